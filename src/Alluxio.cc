@@ -7,13 +7,29 @@
  */
 
 #include "Alluxio.h"
+#include "Deadline.h"
+#include "IoScheduler.h"
+#include "MetadataCache.h"
+#include "OutputCommitter.h"
+#include "StripedFile.h"
+#include "ThreadPool.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <regex>
+#include <list>
+#include <set>
 #include <string>
 #include <string.h>
+#include <fnmatch.h>
 #include <stdlib.h>
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 using namespace alluxio;
 using namespace alluxio::jni;
@@ -26,7 +42,7 @@ using namespace alluxio::jni;
    thread to connect to the master node.
 */
 AlluxioClientContext::AlluxioClientContext()
-    : m_mustDetachInDtor(false), m_mustDeleteLocalRef(false) {
+    : m_mustDetachInDtor(false), m_mustDeleteGlobalRef(false) {
   attach();
 }
 
@@ -34,9 +50,9 @@ AlluxioClientContext::AlluxioClientContext()
    Destructor.
 */
 AlluxioClientContext::~AlluxioClientContext() {
-    if (m_mustDeleteLocalRef) {
-        m_env.deleteLocalRef(m_baseFileSystem);
-        m_mustDeleteLocalRef = false;
+    if (m_mustDeleteGlobalRef) {
+        getEnv().deleteGlobalRef(m_baseFileSystem);
+        m_mustDeleteGlobalRef = false;
     }
     if (m_mustDetachInDtor) {
         m_env.DetachCurrentThread();
@@ -111,12 +127,39 @@ void AlluxioClientContext::attach() {
     m_mustDetachInDtor = true;
   }
 
-  // Get a pointer to the alluxio java object for use in subsequent Java calls.
+  // Get a pointer to the alluxio java object for use in subsequent Java calls,
+  // from whichever thread makes them.
   jvalue ret;
   m_env.callStaticMethod(&ret, "alluxio/client/file/BaseFileSystem", "get",
                          "()Lalluxio/client/file/BaseFileSystem;");
-  m_baseFileSystem = ret.l;
-  m_mustDeleteLocalRef = true;
+  m_baseFileSystem = m_env.newGlobalRef(ret.l);
+  m_env.deleteLocalRef(ret.l);
+  m_mustDeleteGlobalRef = true;
+}
+
+static std::mutex s_sharedContextLock;
+static std::atomic<AlluxioClientContext *> s_sharedContext(NULL);
+static std::atomic<AlluxioFileSystem *> s_sharedFileSystem(NULL);
+
+/**
+   The context of the process.
+
+   Created on first use, under a lock, and never destroyed: its global
+   reference stays valid until the process exits.  Later calls only load the
+   pointer.  The thread making the first call stays attached to the JVM.
+*/
+AlluxioClientContext &AlluxioClientContext::shared() {
+  AlluxioClientContext *context = s_sharedContext.load(std::memory_order_acquire);
+  if (context != NULL) {
+    return *context;
+  }
+  std::lock_guard<std::mutex> guard(s_sharedContextLock);
+  context = s_sharedContext.load(std::memory_order_relaxed);
+  if (context == NULL) {
+    context = new AlluxioClientContext();
+    s_sharedContext.store(context, std::memory_order_release);
+  }
+  return *context;
 }
 
 jAlluxioCreateFileOptions AlluxioCreateFileOptions::getCreateFileOptions()
@@ -136,12 +179,13 @@ void AlluxioCreateFileOptions::setWriteType(WriteType writeType)
 {
     jobject jWriteType;
     jvalue  ret;
+    Env env = getEnv();
 
     // Get the enum value for the specified write type
-    jWriteType = enumObjWriteType(m_env, writeType);
+    jWriteType = enumObjWriteType(env, writeType);
     
     // Call the method to set the write type
-    m_env.callMethod(&ret, m_obj, "setWriteType", 
+    env.callMethod(&ret, m_obj, "setWriteType", 
             "(Lalluxio/client/WriteType;)Lalluxio/client/file/options/CreateFileOptions;",
             jWriteType);
 }
@@ -163,12 +207,13 @@ void AlluxioOpenFileOptions::setReadType(ReadType readType)
 {
     jobject jReadType;
     jvalue  ret;
+    Env env = getEnv();
 
     // Get the enum value for the specified write type
-    jReadType = enumObjReadType(m_env, readType);
+    jReadType = enumObjReadType(env, readType);
     
     // Call the method to set the write type
-    m_env.callMethod(&ret, m_obj, "setReadType", 
+    env.callMethod(&ret, m_obj, "setReadType", 
             "(Lalluxio/client/ReadType;)Lalluxio/client/file/options/OpenFileOptions;",
             jReadType);
 }
@@ -184,14 +229,366 @@ jByteBuffer ByteBuffer::allocate(int capacity)
   return new ByteBuffer(env, ret.l);
 }
 
+//////////////////////////////////////////
+// AsyncQueue
+//////////////////////////////////////////
+
+/**
+   The async calls of one stream, run one after the other.  Each call runs
+   on its own pool once the IoScheduler admits it; the next one is only
+   queued once the previous one is over, so no pool thread ever waits for
+   another.
+*/
+class alluxio::AsyncQueue : public std::enable_shared_from_this<AsyncQueue> {
+  public:
+    AsyncQueue() : m_running(false) {}
+
+    void submit(ThreadPool &pool, const IoRequest &request, std::function<void()> call)
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_calls.push_back(Call(&pool, request, call));
+      if (m_running) {
+        return;
+      }
+      m_running = true;
+      guard.unlock();
+
+      std::shared_ptr<AsyncQueue> self = shared_from_this();
+      IoScheduler::post(pool, request, [self] { self->runFront(); });
+    }
+
+  private:
+    struct Call {
+        Call(ThreadPool *pool, const IoRequest &request, const std::function<void()> &call)
+            : pool(pool), request(request), call(call) {}
+
+        ThreadPool *pool;
+        IoRequest request;
+        std::function<void()> call;
+    };
+
+    void runFront()
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      std::function<void()> call = m_calls.front().call;
+      m_calls.pop_front();
+      guard.unlock();
+
+      try {
+        call();
+      } catch (...) {
+        // A failing ready callback must not stall the calls behind it
+      }
+
+      guard.lock();
+      if (m_calls.empty()) {
+        m_running = false;
+        return;
+      }
+      ThreadPool *next = m_calls.front().pool;
+      IoRequest request = m_calls.front().request;
+      guard.unlock();
+
+      std::shared_ptr<AsyncQueue> self = shared_from_this();
+      IoScheduler::post(*next, request, [self] { self->runFront(); });
+    }
+
+    std::mutex m_lock;
+    std::deque<Call> m_calls;
+    /// Whether a call is queued on a pool or running
+    bool m_running;
+};
+
+namespace {
+
+/**
+   The lock of a stream for one call.  Throws TimeoutException for a stream
+   left unusable by a call given up on, without waiting behind that call.
+*/
+class StreamGuard {
+  public:
+    explicit StreamGuard(StreamLock &lock) : m_lock(lock)
+    {
+      checkUsable();
+      m_lock.mutex.lock();
+      if (m_lock.abandoned) {
+        m_lock.mutex.unlock();
+        checkUsable();
+      }
+    }
+
+    ~StreamGuard() { m_lock.mutex.unlock(); }
+
+  private:
+    StreamGuard(StreamGuard const &);
+    void operator=(StreamGuard const &);
+
+    void checkUsable()
+    {
+      if (m_lock.abandoned) {
+        throw TimeoutException("stream unusable: a call on it was given up on at its deadline");
+      }
+    }
+
+    StreamLock &m_lock;
+};
+
+/**
+   Queue call(env, stream), moving bytes bytes, on pool behind the other
+   async calls of a stream.
+
+   The call gets its own global reference to the stream and shares its
+   lock, so the wrapper may be deleted before the call runs.  Its outcome
+   goes to the future, then onReady, if any, is called.
+*/
+template <typename R>
+std::future<R> submitStreamCall(std::shared_ptr<AsyncQueue> &queue,
+                                const std::shared_ptr<StreamLock> &lock,
+                                ThreadPool &pool, jobject obj, int64_t bytes,
+                                std::function<R(Env &, jobject)> call,
+                                const ReadyCallback &onReady)
+{
+  if (!queue) {
+    queue = std::make_shared<AsyncQueue>();
+  }
+  Env env;
+  jobject stream = env.newGlobalRef(obj);
+
+  std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(
+      [stream, lock, call]() {
+    struct Release {
+      Env env;
+      jobject stream;
+      ~Release() { env.deleteGlobalRef(stream); }
+    } release = { Env(), stream };
+    StreamGuard guard(*lock);
+    return call(release.env, stream);
+  }));
+  std::future<R> result = task->get_future();
+  try {
+    queue->submit(pool, IoRequest(bytes), [task, onReady] {
+      (*task)();
+      if (onReady) {
+        onReady();
+      }
+    });
+  } catch (...) {
+    env.deleteGlobalRef(stream);
+    throw;
+  }
+  return result;
+}
+
+int readStream(Env &env, jobject stream, void *buff, int length)
+{
+  jvalue ret;
+  jbyteArray jBuf = env.newByteArray(length);
+  try {
+    env.callMethod(&ret, stream, "read", "([B)I", jBuf);
+  } catch (const NativeException &) {
+    env->DeleteLocalRef(jBuf);
+    throw;
+  }
+  if (ret.i > 0) {
+    env->GetByteArrayRegion(jBuf, 0, ret.i, (jbyte*) buff);
+  }
+  env->DeleteLocalRef(jBuf);
+  return ret.i;
+}
+
+int positionedReadStream(Env &env, jobject stream, long pos, void *buff, int length)
+{
+  jvalue ret;
+  jbyteArray jBuf = env.newByteArray(length);
+  try {
+    env.callMethod(&ret, stream, "positionedRead", "(J[BII)I", (jlong) pos, jBuf,
+                   (jint) 0, (jint) length);
+  } catch (const NativeException &) {
+    env->DeleteLocalRef(jBuf);
+    throw;
+  }
+  if (ret.i > 0) {
+    env->GetByteArrayRegion(jBuf, 0, ret.i, (jbyte*) buff);
+  }
+  env->DeleteLocalRef(jBuf);
+  return ret.i;
+}
+
+void writeStream(Env &env, jobject stream, const void *buff, int length)
+{
+  jbyteArray jBuf = env.newByteArray(length);
+  env->SetByteArrayRegion(jBuf, 0, length, (jbyte*) buff);
+  try {
+    env.callMethod(NULL, stream, "write", "([B)V", jBuf);
+  } catch (const NativeException &) {
+    env->DeleteLocalRef(jBuf);
+    throw;
+  }
+  env->DeleteLocalRef(jBuf);
+}
+
+/// Result of a call run within a deadline, set on the thread running it
+template <typename R>
+struct Outcome {
+    void set(const std::function<R()> &call) { value.reset(new R(call())); }
+    R take() { return std::move(*value); }
+
+    std::unique_ptr<R> value;
+};
+
+template <>
+struct Outcome<void> {
+    void set(const std::function<void()> &call) { call(); }
+    void take() {}
+};
+
+/// Release what a call given up on returned once it did
+template <typename R>
+void discard(Outcome<R> &) {}
+
+void discard(Outcome<jFileInStream> &outcome)
+{
+  if (outcome.value) {
+    std::unique_ptr<InStream> stream(*outcome.value);
+    stream->close();
+  }
+}
+
+void discard(Outcome<jFileOutStream> &outcome)
+{
+  if (outcome.value) {
+    std::unique_ptr<OutStream> stream(*outcome.value);
+    stream->cancel();
+  }
+}
+
+void discard(Outcome<jDirectoryIterator> &outcome)
+{
+  if (outcome.value) {
+    delete *outcome.value;
+  }
+}
+
+/**
+   Run call(fs) within scope, where fs is a file system of the thread
+   running it over client, with cache.
+*/
+template <typename R>
+R callWithin(DeadlineScope &scope, AlluxioClientContext &client,
+             const std::shared_ptr<MetadataCache> &cache,
+             const std::function<R(AlluxioFileSystem &)> &call)
+{
+  AlluxioClientContext *context = &client;
+  std::shared_ptr<Outcome<R> > outcome = std::make_shared<Outcome<R> >();
+  scope.run([context, cache, call, outcome] {
+    AlluxioFileSystem fs(*context);
+    fs.setMetadataCache(cache);
+    outcome->set([&fs, &call] { return call(fs); });
+  }, [outcome] { discard(*outcome); });
+  return outcome->take();
+}
+
+/**
+   Invalidates cached metadata when a mutation returns, whether it succeeded
+   or not: a failed recursive delete may still have removed part of a tree.
+   The close of a stream writing a file counts as one, as its length and
+   completeness change.
+*/
+class InvalidateOnExit {
+  public:
+    InvalidateOnExit(MetadataCache *cache, const char *path, bool tree)
+        : m_cache(cache), m_path(path), m_tree(tree) {}
+
+    ~InvalidateOnExit() {
+      if (m_cache == NULL) {
+        return;
+      }
+      if (m_tree) {
+        m_cache->invalidateTree(m_path);
+      } else {
+        m_cache->invalidate(m_path);
+      }
+    }
+
+  private:
+    MetadataCache *m_cache;
+    const char *m_path;
+    bool m_tree;
+};
+
+/// Global reference of its own to an object, for calls that outlive its wrapper
+struct GlobalRef {
+    explicit GlobalRef(jobject ref) : obj(Env().newGlobalRef(ref)) {}
+    ~GlobalRef() { Env().deleteGlobalRef(obj); }
+
+    jobject obj;
+};
+
+/**
+   Run call(env, stream) within scope.  Given up on, the stream is marked
+   unusable at once, and closeMethod called on it once call returns.
+*/
+void runStreamWithin(DeadlineScope &scope, jobject obj, const std::shared_ptr<StreamLock> &lock,
+                     const char *closeMethod, const std::function<void(Env &, jobject)> &call)
+{
+  std::shared_ptr<GlobalRef> stream = std::make_shared<GlobalRef>(obj);
+  std::shared_ptr<StreamLock> streamLock = lock;
+  scope.run([stream, call] {
+    Env env;
+    call(env, stream->obj);
+  }, [stream, streamLock, closeMethod] {
+    std::lock_guard<std::mutex> guard(streamLock->mutex);
+    try {
+      Env().callMethod(NULL, stream->obj, closeMethod, "()V");
+    } catch (NativeException &e) {
+      e.discard();
+    }
+  }, [streamLock] { streamLock->abandoned = true; });
+}
+
+} // namespace
+
+template <typename R>
+R InStream::callWithin(DeadlineScope &scope, const std::function<R(InStream &)> &call)
+{
+  std::shared_ptr<StreamLock> lock = m_lock;
+  std::shared_ptr<Outcome<R> > outcome = std::make_shared<Outcome<R> >();
+  runStreamWithin(scope, m_obj, m_lock, "close", [lock, call, outcome](Env &env, jobject stream) {
+    InStream copy(env, env->NewLocalRef(stream));
+    copy.m_lock = lock;
+    outcome->set([&copy, &call] { return call(copy); });
+  });
+  return outcome->take();
+}
+
+template <typename R>
+R OutStream::callWithin(DeadlineScope &scope, const std::function<R(OutStream &)> &call)
+{
+  std::shared_ptr<StreamLock> lock = m_lock;
+  std::shared_ptr<Outcome<R> > outcome = std::make_shared<Outcome<R> >();
+  runStreamWithin(scope, m_obj, m_lock, "cancel", [lock, call, outcome](Env &env, jobject stream) {
+    OutStream copy(env, env->NewLocalRef(stream));
+    copy.m_lock = lock;
+    outcome->set([&copy, &call] { return call(copy); });
+  });
+  return outcome->take();
+}
+
 //////////////////////////////////////////
 //InStream
 //////////////////////////////////////////
 
 int InStream::read()
 {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    return callWithin<int>(*deadline, [](InStream &stream) { return stream.read(); });
+  }
+
   jvalue ret;
-  m_env.callMethod(&ret, m_obj, "read", "()I");
+  IoAdmission admission(1);
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(&ret, m_obj, "read", "()I");
   return ret.i;
 }
 
@@ -206,6 +603,30 @@ int InStream::read(void *buff, int length, int off, int maxLen,
    jvalue ret;
    int rdSz;
 
+   DeadlineScope *deadline = DeadlineScope::current();
+   if (deadline != NULL) {
+      // Read into a buffer of the call, as buff may be gone once it returns
+      std::chrono::time_point<std::chrono::system_clock> started =
+         std::chrono::system_clock::now();
+      std::shared_ptr<std::vector<char> > data =
+         std::make_shared<std::vector<char> >(std::max(length, 0));
+      rdSz = callWithin<int>(*deadline, [data, length, off, maxLen](InStream &stream) {
+         return stream.read(data->data(), length, off, maxLen);
+      });
+      if (rdSz > 0) {
+         memcpy(buff, data->data(), rdSz);
+      }
+      if (measureTime)
+      {
+         *pReadTimeCounter += std::chrono::system_clock::now() - started;
+      }
+      return rdSz;
+   }
+
+   Env env = getEnv();
+   IoAdmission admission(off < 0 || maxLen <= 0 ? length : maxLen);
+   StreamGuard guard(*m_lock);
+
    std::chrono::duration<double> duration = std::chrono::duration<double>::zero();
    std::chrono::time_point<std::chrono::system_clock> startTime, stopTime;
 
@@ -216,7 +637,7 @@ int InStream::read(void *buff, int length, int off, int maxLen,
          startTime = std::chrono::system_clock::now();
       }
 
-      jBuf = m_env.newByteArray(length);
+      jBuf = env.newByteArray(length);
 
       if (measureTime)
       {
@@ -232,7 +653,7 @@ int InStream::read(void *buff, int length, int off, int maxLen,
             startTime = std::chrono::system_clock::now();
          }
 
-         m_env.callMethod(&ret, m_obj, "read", "([B)I", jBuf);
+         env.callMethod(&ret, m_obj, "read", "([B)I", jBuf);
 
          if (measureTime)
          {
@@ -246,7 +667,7 @@ int InStream::read(void *buff, int length, int off, int maxLen,
             startTime = std::chrono::system_clock::now();
          }
 
-         m_env.callMethod(&ret, m_obj, "read", "([BII)I", jBuf, off, maxLen);
+         env.callMethod(&ret, m_obj, "read", "([BII)I", jBuf, off, maxLen);
 
          if (measureTime)
          {
@@ -260,7 +681,7 @@ int InStream::read(void *buff, int length, int off, int maxLen,
       }
    } catch (NativeException) {
       if (jBuf != NULL) {
-         m_env->DeleteLocalRef(jBuf);
+         env->DeleteLocalRef(jBuf);
       }
       throw;
    }
@@ -270,11 +691,11 @@ int InStream::read(void *buff, int length, int off, int maxLen,
       {
          startTime = std::chrono::system_clock::now();
       }
-      m_env->GetByteArrayRegion(jBuf, 0, rdSz, (jbyte*) buff);
+      env->GetByteArrayRegion(jBuf, 0, rdSz, (jbyte*) buff);
       // TODO: It's much more efficient to get direct access to the buffer,
       // but doing so requires the caller to create the java buffer.
       // Create a read method that allows for this option.
-      // buff = m_env->GetDirectBufferAddress(jBuf);
+      // buff = env->GetDirectBufferAddress(jBuf);
       if (measureTime)
       {
          stopTime = std::chrono::system_clock::now();
@@ -282,7 +703,7 @@ int InStream::read(void *buff, int length, int off, int maxLen,
          *pBufferCopyTimeCounter += duration;
       }
    }
-   m_env->DeleteLocalRef(jBuf);
+   env->DeleteLocalRef(jBuf);
    return rdSz;
 }
 
@@ -293,28 +714,116 @@ int InStream::read(void *buff, int length)
 
 void InStream::close()
 {
-  m_env.callMethod(NULL, m_obj, "close", "()V");
+  if (m_lock->abandoned) {
+    // Closed once the call given up on returns
+    return;
+  }
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    callWithin<void>(*deadline, [](InStream &stream) { stream.close(); });
+    return;
+  }
+
+  IoAdmission admission(0);
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(NULL, m_obj, "close", "()V");
 }
 
 void InStream::seek(long pos)
 {
-  m_env.callMethod(NULL, m_obj, "seek", "(J)V", (jlong) pos);
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    callWithin<void>(*deadline, [pos](InStream &stream) { stream.seek(pos); });
+    return;
+  }
+
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(NULL, m_obj, "seek", "(J)V", (jlong) pos);
 }
 
 long InStream::skip(long n)
 {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    return callWithin<long>(*deadline, [n](InStream &stream) { return stream.skip(n); });
+  }
+
   jvalue ret;
-  m_env.callMethod(&ret, m_obj, "skip", "(J)J", (jlong) n);
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(&ret, m_obj, "skip", "(J)J", (jlong) n);
   return ret.j;
 }
 
+/**
+   Read at an absolute position of the stream.  The stream position is left
+   unchanged, so no seek is needed before or after.
+
+   @param[in] pos Position in the stream to read from
+   @param[out] buff Buffer to fill
+   @param[in] length Maximum number of bytes to read
+   @return Number of bytes read, or -1 at end of stream
+*/
+int InStream::positionedRead(long pos, void *buff, int length)
+{
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::shared_ptr<std::vector<char> > data =
+        std::make_shared<std::vector<char> >(std::max(length, 0));
+    int read = callWithin<int>(*deadline, [pos, data, length](InStream &stream) {
+      return stream.positionedRead(pos, data->data(), length);
+    });
+    if (read > 0) {
+      memcpy(buff, data->data(), read);
+    }
+    return read;
+  }
+
+  Env env = getEnv();
+  IoAdmission admission(length);
+  StreamGuard guard(*m_lock);
+  return positionedReadStream(env, m_obj, pos, buff, length);
+}
+
+std::future<int> InStream::readAsync(void *buff, int length, ReadyCallback onReady)
+{
+  return submitStreamCall<int>(m_async, m_lock, ThreadPool::shared(), m_obj, length,
+                               [buff, length](Env &env, jobject stream) {
+    return readStream(env, stream, buff, length);
+  }, onReady);
+}
+
+std::future<int> InStream::positionedReadAsync(long pos, void *buff, int length,
+                                               ReadyCallback onReady)
+{
+  return submitStreamCall<int>(m_async, m_lock, ThreadPool::shared(), m_obj, length,
+                               [pos, buff, length](Env &env, jobject stream) {
+    return positionedReadStream(env, stream, pos, buff, length);
+  }, onReady);
+}
+
+std::future<void> InStream::closeAsync(ReadyCallback onReady)
+{
+  return submitStreamCall<void>(m_async, m_lock, ThreadPool::shared(), m_obj, 0,
+                                [](Env &env, jobject stream) {
+    env.callMethod(NULL, stream, "close", "()V");
+  }, onReady);
+}
+
 //////////////////////////////////////////
 // OutStream
 //////////////////////////////////////////
 
 void OutStream::write(int byte) 
 {
-  m_env.callMethod(NULL, m_obj, "write", "(I)V", (jint) byte);
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    callWithin<void>(*deadline, [byte](OutStream &stream) { stream.write(byte); });
+    return;
+  }
+
+  IoAdmission admission(1);
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(NULL, m_obj, "write", "(I)V", (jint) byte);
 }
 
 void OutStream::write(const void *buff, int length)
@@ -328,35 +837,207 @@ void OutStream::write(const void *buff, int length,
   jthrowable exception;
   jbyteArray jBuf;
 
-  jBuf = m_env.newByteArray(length);
-  m_env->SetByteArrayRegion(jBuf, 0, length, (jbyte*) buff);
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    // Written from a copy, as buff may be gone before the call returns
+    std::shared_ptr<std::vector<char> > data = std::make_shared<std::vector<char> >(
+        (const char *) buff, (const char *) buff + std::max(length, 0));
+    callWithin<void>(*deadline, [data, length, off, maxLen](OutStream &stream) {
+      stream.write(data->data(), length, off, maxLen);
+    });
+    return;
+  }
+
+  Env env = getEnv();
+  IoAdmission admission(off < 0 || maxLen <= 0 ? length : maxLen);
+  StreamGuard guard(*m_lock);
+
+  jBuf = env.newByteArray(length);
+  env->SetByteArrayRegion(jBuf, 0, length, (jbyte*) buff);
 
   std::unique_ptr<char[]> jbuff(new char[length * sizeof(char)]);
-  m_env->GetByteArrayRegion(jBuf, 0, length, (jbyte*) jbuff.get());
+  env->GetByteArrayRegion(jBuf, 0, length, (jbyte*) jbuff.get());
   // printf("byte array in write: %s\n", jbuff);
 
   if (off < 0 || maxLen <= 0 || length == maxLen)
-    m_env.callMethod(NULL, m_obj, "write", "([B)V", jBuf);
+    env.callMethod(NULL, m_obj, "write", "([B)V", jBuf);
   else
-    m_env.callMethod(NULL, m_obj, "write", "([BII)V", jBuf, (jint) off, (jint) maxLen);
-  m_env->DeleteLocalRef(jBuf);
+    env.callMethod(NULL, m_obj, "write", "([BII)V", jBuf, (jint) off, (jint) maxLen);
+  env->DeleteLocalRef(jBuf);
 }
 
 // Call the templates
 void OutStream::close()
 {
-  m_env.callMethod(NULL, m_obj, "close", "()V");
+  InvalidateOnExit invalidate(m_cache.get(), m_path.c_str(), false);
+  if (m_lock->abandoned) {
+    // Cancelled once the call given up on returns
+    return;
+  }
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    callWithin<void>(*deadline, [](OutStream &stream) { stream.close(); });
+    return;
+  }
+
+  IoAdmission admission(0);
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(NULL, m_obj, "close", "()V");
 }
 
 //TODO: These methods are not yet tested yet.  Use with care
 void OutStream::cancel() 
 {
-  m_env.callMethod(NULL, m_obj, "cancel", "()V");
+  InvalidateOnExit invalidate(m_cache.get(), m_path.c_str(), false);
+  if (m_lock->abandoned) {
+    return;
+  }
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    callWithin<void>(*deadline, [](OutStream &stream) { stream.cancel(); });
+    return;
+  }
+
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(NULL, m_obj, "cancel", "()V");
 }
 
 void OutStream::flush()
 {
-  m_env.callMethod(NULL, m_obj, "flush", "()V");
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    callWithin<void>(*deadline, [](OutStream &stream) { stream.flush(); });
+    return;
+  }
+
+  IoAdmission admission(0);
+  StreamGuard guard(*m_lock);
+  getEnv().callMethod(NULL, m_obj, "flush", "()V");
+}
+
+#define ASYNC_CLOSE_MAX_OUTSTANDING  64
+
+/**
+   Process-wide state behind OutStream::closeAsync() and flushAsync(): the
+   count of calls in flight.  The calls run on ThreadPool::shared().
+*/
+namespace {
+class AsyncCloser {
+  public:
+    static AsyncCloser &instance() {
+      // Never destroyed: calls still running on the shared pool during
+      // static destruction release it when they finish
+      static AsyncCloser *closer = new AsyncCloser();
+      return *closer;
+    }
+
+    void acquire()
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_changed.wait(guard, [this] { return m_outstanding < m_maxOutstanding; });
+      m_outstanding++;
+    }
+
+    void release()
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_outstanding--;
+      m_changed.notify_all();
+    }
+
+    void setMaxOutstanding(int maxOutstanding)
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_maxOutstanding = maxOutstanding > 0 ? maxOutstanding : 1;
+      m_changed.notify_all();
+    }
+
+    void awaitIdle()
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_changed.wait(guard, [this] { return m_outstanding == 0; });
+    }
+
+  private:
+    AsyncCloser() : m_outstanding(0), m_maxOutstanding(ASYNC_CLOSE_MAX_OUTSTANDING) {}
+
+    int m_outstanding;
+    int m_maxOutstanding;
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+};
+} // namespace
+
+/**
+   Run a no-argument void method of the stream on ThreadPool::shared().
+
+   It runs after the async calls issued before it on this stream, and counts
+   against the cap on async closes until it is over, even if it fails before
+   reaching the JVM, such as on a stream given up on at a deadline.  If it
+   completes the file, the cached metadata of the file is invalidated before
+   the future is ready.
+*/
+std::future<void> OutStream::submitAsync(const char *methodName, bool completes,
+                                         const ReadyCallback &onReady)
+{
+  AsyncCloser &closer = AsyncCloser::instance();
+  closer.acquire();
+
+  std::shared_ptr<MetadataCache> cache;
+  if (completes) {
+    cache = m_cache;
+  }
+  std::string path = m_path;
+  try {
+    return submitStreamCall<void>(m_async, m_lock, ThreadPool::shared(), m_obj, 0,
+                                  [methodName, cache, path](Env &env, jobject stream) {
+      InvalidateOnExit invalidate(cache.get(), path.c_str(), false);
+      env.callMethod(NULL, stream, methodName, "()V");
+    }, [onReady] {
+      AsyncCloser::instance().release();
+      if (onReady) {
+        onReady();
+      }
+    });
+  } catch (...) {
+    closer.release();
+    throw;
+  }
+}
+
+/**
+   Close the stream on a background thread.
+
+   With CACHE_THROUGH or THROUGH, close() blocks until the data is persisted
+   to the under file system; this returns immediately instead so the caller
+   can move on to the next file.  Errors are reported through the future.
+*/
+std::future<void> OutStream::closeAsync(ReadyCallback onReady)
+{
+  return submitAsync("close", true, onReady);
+}
+
+std::future<void> OutStream::flushAsync(ReadyCallback onReady)
+{
+  return submitAsync("flush", false, onReady);
+}
+
+std::future<void> OutStream::writeAsync(const void *buff, int length, ReadyCallback onReady)
+{
+  return submitStreamCall<void>(m_async, m_lock, ThreadPool::shared(), m_obj, length,
+                                [buff, length](Env &env, jobject stream) {
+    writeStream(env, stream, buff, length);
+  }, onReady);
+}
+
+void OutStream::setMaxOutstandingCloses(int maxOutstanding)
+{
+  AsyncCloser::instance().setMaxOutstanding(maxOutstanding);
+}
+
+void OutStream::awaitAsyncCloses()
+{
+  AsyncCloser::instance().awaitIdle();
 }
 
 //////////////////////////////////////////
@@ -393,52 +1074,223 @@ jAlluxioURI AlluxioURI::newURI(const char *scheme, const char *authority, const
   return new AlluxioURI(env, retObj);
 }
 
-jobject enumObjReadType(Env& env, ReadType readType)
+//////////////////////////////////////////
+// AlluxioURICache
+//////////////////////////////////////////
+
+#define URI_CACHE_SHARDS 16
+
+namespace {
+
+/// Path looked up without copying it; points into the entry once cached
+struct PathKey {
+  const char *data;
+  size_t length;
+  size_t hash;
+};
+
+struct PathKeyHash {
+  size_t operator()(const PathKey &key) const { return key.hash; }
+};
+
+struct PathKeyEqual {
+  bool operator()(const PathKey &a, const PathKey &b) const
+  {
+    return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+  }
+};
+
+PathKey pathKey(const char *path, size_t length)
 {
-  const char *valueName;
-  switch (readType) {
-    case NO_CACHE: 
-          valueName = "NO_CACHE";
-          break;
-    case CACHE:
-          valueName = "CACHE";
-          break;
-    case CACHE_PROMOTE:
-          valueName = "CACHE_PROMOTE";
-          break;
-    default:
-          throw std::runtime_error("invalid readType");
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char) path[i]) * 1099511628211ULL;
   }
-  return env.getEnumObject(TREADT_CLS, valueName, "Lalluxio/client/ReadType;");
+  PathKey key = { path, length, (size_t) hash };
+  return key;
 }
 
-jobject enumObjWriteType(Env& env, WriteType writeType)
+struct URIEntry {
+  std::string path;
+  SharedURI uri;
+};
+
+/// Deleted with the environment of the thread dropping the last copy
+void deleteURI(jobject uri)
 {
-  const char *valueName;
-  switch (writeType) {
-    case ASYNC_THROUGH: 
-          valueName = "ASYNC_THROUGH";
-          break;
-    case CACHE_THROUGH:
-          valueName = "CACHE_THROUGH";
-          break;
-    case MUST_CACHE:
-          valueName = "MUST_CACHE";
-          break;
-    case THROUGH:
-          valueName = "THROUGH";
-          break;
-    default:
-          throw std::runtime_error("invalid writeType");
-  }
-  return env.getEnumObject(TWRITET_CLS, valueName, "Lalluxio/client/WriteType;");
+  Env().deleteGlobalRef(uri);
 }
 
-//////////////////////////////////////////
-// AlluxioFileSystem
-//////////////////////////////////////////
+} // namespace
 
-/**
+struct AlluxioURICache::Shard {
+  Shard() : hits(0), misses(0), evictions(0) {}
+
+  std::mutex lock;
+  /// Most recently used first
+  std::list<URIEntry> entries;
+  std::unordered_map<PathKey, std::list<URIEntry>::iterator, PathKeyHash,
+                     PathKeyEqual> index;
+  int64_t hits;
+  int64_t misses;
+  int64_t evictions;
+};
+
+AlluxioURICache &AlluxioURICache::instance()
+{
+  // Never destroyed: the JVM may be gone by the time statics are
+  static AlluxioURICache *cache = new AlluxioURICache();
+  return *cache;
+}
+
+AlluxioURICache::AlluxioURICache()
+    : m_capacityPerShard(DEFAULT_URI_CACHE_CAPACITY / URI_CACHE_SHARDS)
+{
+  for (int i = 0; i < URI_CACHE_SHARDS; i++) {
+    m_shards.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+}
+
+AlluxioURICache::~AlluxioURICache() {}
+
+SharedURI AlluxioURICache::get(Env env, const char *path)
+{
+  PathKey key = pathKey(path, strlen(path));
+  Shard &s = *m_shards[key.hash % m_shards.size()];
+  {
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+      s.hits++;
+      s.entries.splice(s.entries.begin(), s.entries, it->second);
+      return it->second->uri;
+    }
+    s.misses++;
+  }
+
+  // Built outside the lock; a racing miss on the same path just loses
+  jstring jPath = env.newStringUTF(path, "path");
+  jobject local;
+  try {
+    local = env.newObject("alluxio/AlluxioURI", "(Ljava/lang/String;)V", jPath);
+  } catch (...) {
+    env->DeleteLocalRef(jPath);
+    throw;
+  }
+  env->DeleteLocalRef(jPath);
+  jobject global = env->NewGlobalRef(local);
+  env->DeleteLocalRef(local);
+  SharedURI uri(global, deleteURI);
+
+  size_t capacity = m_capacityPerShard;
+  if (capacity == 0) {
+    return uri;
+  }
+  std::lock_guard<std::mutex> guard(s.lock);
+  if (s.index.find(key) != s.index.end()) {
+    return uri;
+  }
+  s.entries.push_front(URIEntry());
+  s.entries.front().path.assign(path, key.length);
+  s.entries.front().uri = uri;
+  key.data = s.entries.front().path.data();
+  s.index[key] = s.entries.begin();
+  while (s.entries.size() > capacity) {
+    const std::string &last = s.entries.back().path;
+    s.index.erase(pathKey(last.data(), last.size()));
+    s.entries.pop_back();
+    s.evictions++;
+  }
+  return uri;
+}
+
+void AlluxioURICache::setCapacity(size_t capacity)
+{
+  m_capacityPerShard = capacity == 0 ? 0 :
+      std::max((size_t) 1, capacity / m_shards.size());
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    Shard &s = *m_shards[i];
+    std::lock_guard<std::mutex> guard(s.lock);
+    while (s.entries.size() > m_capacityPerShard) {
+      const std::string &last = s.entries.back().path;
+      s.index.erase(pathKey(last.data(), last.size()));
+      s.entries.pop_back();
+      s.evictions++;
+    }
+  }
+}
+
+AlluxioURICacheStats AlluxioURICache::stats() const
+{
+  AlluxioURICacheStats stats;
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    Shard &s = *m_shards[i];
+    std::lock_guard<std::mutex> guard(s.lock);
+    stats.hits += s.hits;
+    stats.misses += s.misses;
+    stats.evictions += s.evictions;
+    stats.entries += s.entries.size();
+  }
+  return stats;
+}
+
+void AlluxioURICache::clear()
+{
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    Shard &s = *m_shards[i];
+    std::lock_guard<std::mutex> guard(s.lock);
+    s.index.clear();
+    s.entries.clear();
+  }
+}
+
+jobject enumObjReadType(Env& env, ReadType readType)
+{
+  const char *valueName;
+  switch (readType) {
+    case NO_CACHE: 
+          valueName = "NO_CACHE";
+          break;
+    case CACHE:
+          valueName = "CACHE";
+          break;
+    case CACHE_PROMOTE:
+          valueName = "CACHE_PROMOTE";
+          break;
+    default:
+          throw std::runtime_error("invalid readType");
+  }
+  return env.getEnumObject(TREADT_CLS, valueName, "Lalluxio/client/ReadType;");
+}
+
+jobject enumObjWriteType(Env& env, WriteType writeType)
+{
+  const char *valueName;
+  switch (writeType) {
+    case ASYNC_THROUGH: 
+          valueName = "ASYNC_THROUGH";
+          break;
+    case CACHE_THROUGH:
+          valueName = "CACHE_THROUGH";
+          break;
+    case MUST_CACHE:
+          valueName = "MUST_CACHE";
+          break;
+    case THROUGH:
+          valueName = "THROUGH";
+          break;
+    default:
+          throw std::runtime_error("invalid writeType");
+  }
+  return env.getEnumObject(TWRITET_CLS, valueName, "Lalluxio/client/WriteType;");
+}
+
+//////////////////////////////////////////
+// AlluxioFileSystem
+//////////////////////////////////////////
+
+/**
   Constructor
 
   @param[in] clientContext Context that has either connected to alluxio, or
@@ -447,22 +1299,81 @@ jobject enumObjWriteType(Env& env, WriteType writeType)
 AlluxioFileSystem::AlluxioFileSystem(AlluxioClientContext &clientContext)
     : mClient(clientContext) {}
 
+/**
+  File system over the shared context, created on first use and never
+  destroyed.
+*/
+AlluxioFileSystem &AlluxioFileSystem::shared() {
+  AlluxioFileSystem *fs = s_sharedFileSystem.load(std::memory_order_acquire);
+  if (fs != NULL) {
+    return *fs;
+  }
+  AlluxioClientContext &context = AlluxioClientContext::shared();
+  std::lock_guard<std::mutex> guard(s_sharedContextLock);
+  fs = s_sharedFileSystem.load(std::memory_order_relaxed);
+  if (fs == NULL) {
+    fs = new AlluxioFileSystem(context);
+    s_sharedFileSystem.store(fs, std::memory_order_release);
+  }
+  return *fs;
+}
+
+/**
+  Check whether a path exists.
+
+  A striped file only appears under its path once its writer has committed
+  the manifest, so this is also true exactly for complete striped files.
+
+  @param[in] path Path to check
+*/
 bool AlluxioFileSystem::exists(const char *path) {
   jvalue ret;
+  uint64_t generation = 0;
+
+  if (mCache) {
+    MetadataCache::Existence cached = mCache->exists(path);
+    if (cached != MetadataCache::UNKNOWN) {
+      return cached == MetadataCache::EXISTS;
+    }
+    generation = mCache->generation();
+  }
 
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    return callWithin<bool>(*deadline, mClient, mCache, [p](AlluxioFileSystem &fs) {
+      return fs.exists(p.c_str());
+    });
+  }
+
+  IoAdmission admission(0);
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
 
   mClient.getEnv().callMethod(&ret, mClient.getJObj(), "exists",
-                              "(Lalluxio/AlluxioURI;)Z", uri->getJObj());
+                              "(Lalluxio/AlluxioURI;)Z", uri.get());
 
+  if (mCache) {
+    mCache->putExists(path, ret.z, generation);
+  }
   return ret.z;
 }
 
 void AlluxioFileSystem::createDirectory(const char *path) {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    callWithin<void>(*deadline, mClient, mCache, [p](AlluxioFileSystem &fs) {
+      fs.createDirectory(p.c_str());
+    });
+    return;
+  }
+
   jvalue ret;
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
+  InvalidateOnExit invalidate(mCache.get(), path, false);
+  IoAdmission admission(0);
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
   mClient.getEnv().callMethod(&ret, mClient.getJObj(), "createDirectory",
-                              "(Lalluxio/AlluxioURI;)V", uri->getJObj());
+                              "(Lalluxio/AlluxioURI;)V", uri.get());
   return;
 }
 
@@ -475,13 +1386,24 @@ void AlluxioFileSystem::createDirectory(const char *path) {
              deleted as well
 */
 void AlluxioFileSystem::deletePath(const char *path, bool recursive) {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    callWithin<void>(*deadline, mClient, mCache, [p, recursive](AlluxioFileSystem &fs) {
+      fs.deletePath(p.c_str(), recursive);
+    });
+    return;
+  }
+
   jvalue ret;
+  InvalidateOnExit invalidate(mCache.get(), path, true);
+  IoAdmission admission(0);
 
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
 
   if (!recursive) {
     mClient.getEnv().callMethod(&ret, mClient.getJObj(), "delete",
-                                "(Lalluxio/AlluxioURI;)V", uri->getJObj());
+                                "(Lalluxio/AlluxioURI;)V", uri.get());
   } else {
     jvalue deleteOptionsDefaults;
     jvalue deleteOptionsSetRecursive;
@@ -498,15 +1420,33 @@ void AlluxioFileSystem::deletePath(const char *path, bool recursive) {
     mClient.getEnv().callMethod(
         &ret, mClient.getJObj(), "delete",
         "(Lalluxio/AlluxioURI;Lalluxio/client/file/options/DeleteOptions;)V",
-        uri->getJObj(), (jobject)deleteOptionsSetRecursive.l);
+        uri.get(), (jobject)deleteOptionsSetRecursive.l);
   }
 }
 
 jFileInStream AlluxioFileSystem::openFile(const char *path,
                                           AlluxioOpenFileOptions *options) {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    std::shared_ptr<GlobalRef> opts;
+    if (options != NULL) {
+      opts = std::make_shared<GlobalRef>(options->getOptions());
+    }
+    return callWithin<jFileInStream>(*deadline, mClient, mCache, [p, opts](AlluxioFileSystem &fs) {
+      if (!opts) {
+        return fs.openFile(p.c_str());
+      }
+      Env env;
+      AlluxioOpenFileOptions copy(env, env->NewLocalRef(opts->obj));
+      return fs.openFile(p.c_str(), &copy);
+    });
+  }
+
   jvalue ret;
+  IoAdmission admission(0);
 
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
 
   jFileInStream fileInStream = NULL;
 
@@ -514,13 +1454,13 @@ jFileInStream AlluxioFileSystem::openFile(const char *path,
     mClient.getEnv().callMethod(
         &ret, mClient.getJObj(), "openFile",
         "(Lalluxio/AlluxioURI;)Lalluxio/client/file/FileInStream;",
-        uri->getJObj());
+        uri.get());
   } else {
     mClient.getEnv().callMethod(&ret, mClient.getJObj(), "openFile",
                                 "(Lalluxio/AlluxioURI;Lalluxio/client/file/"
                                 "options/OpenFileOptions;)Lalluxio/client/file/"
                                 "FileInStream;",
-                                uri->getJObj(), options->getOptions());
+                                uri.get(), options->getOptions());
   }
 
   // FIXME: Change to shared_ptr?
@@ -530,35 +1470,70 @@ jFileInStream AlluxioFileSystem::openFile(const char *path,
 jFileOutStream
 AlluxioFileSystem::createFile(const char *path,
                               AlluxioCreateFileOptions *options) {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    std::shared_ptr<GlobalRef> opts;
+    if (options != NULL) {
+      opts = std::make_shared<GlobalRef>(options->getOptions());
+    }
+    return callWithin<jFileOutStream>(*deadline, mClient, mCache, [p, opts](AlluxioFileSystem &fs) {
+      if (!opts) {
+        return fs.createFile(p.c_str());
+      }
+      Env env;
+      AlluxioCreateFileOptions copy(env, env->NewLocalRef(opts->obj));
+      return fs.createFile(p.c_str(), &copy);
+    });
+  }
+
   jvalue ret;
+  InvalidateOnExit invalidate(mCache.get(), path, false);
+  IoAdmission admission(0);
 
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
 
   if (options == NULL) {
     mClient.getEnv().callMethod(
         &ret, mClient.getJObj(), "createFile",
         "(Lalluxio/AlluxioURI;)Lalluxio/client/file/FileOutStream;",
-        uri->getJObj());
+        uri.get());
   } else {
     mClient.getEnv().callMethod(&ret, mClient.getJObj(), "createFile",
                                 "(Lalluxio/AlluxioURI;Lalluxio/client/file/"
                                 "options/CreateFileOptions;)Lalluxio/client/"
                                 "file/FileOutStream;",
-                                uri->getJObj(), options->getOptions());
+                                uri.get(), options->getOptions());
   }
 
-  return (new FileOutStream(mClient.getEnv(), ret.l));
+  FileOutStream *out = new FileOutStream(mClient.getEnv(), ret.l);
+  out->m_cache = mCache;
+  out->m_path = path;
+  return out;
 }
 
 void AlluxioFileSystem::renameFile(const char *origPath, const char *newPath) {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string from(origPath);
+    std::string to(newPath);
+    callWithin<void>(*deadline, mClient, mCache, [from, to](AlluxioFileSystem &fs) {
+      fs.renameFile(from.c_str(), to.c_str());
+    });
+    return;
+  }
+
   jvalue ret;
+  InvalidateOnExit invalidateOrig(mCache.get(), origPath, true);
+  InvalidateOnExit invalidateNew(mCache.get(), newPath, true);
+  IoAdmission admission(0);
 
-  std::unique_ptr<AlluxioURI> origURI(AlluxioURI::newURI(origPath));
-  std::unique_ptr<AlluxioURI> newURI(AlluxioURI::newURI(newPath));
+  SharedURI origURI = AlluxioURICache::instance().get(mClient.getEnv(), origPath);
+  SharedURI newURI = AlluxioURICache::instance().get(mClient.getEnv(), newPath);
 
   mClient.getEnv().callMethod(&ret, mClient.getJObj(), "rename",
                               "(Lalluxio/AlluxioURI;Lalluxio/AlluxioURI;)V",
-                              origURI->getJObj(), newURI->getJObj());
+                              origURI.get(), newURI.get());
 }
 
 // FIXME: We should be able to query the open file options and not require them
@@ -652,81 +1627,1116 @@ void AlluxioFileSystem::completeAppend(const char *path,
   free(appendPath);
 }
 
+/**
+  Return the length of a file in bytes.
+
+  For a striped file (see StripedFile.h) this is the logical length recorded
+  in its manifest rather than the size of the directory holding the parts.
+
+  @param[in] path Path of the file
+*/
 long int AlluxioFileSystem::fileSize(const char *path) {
+  FileStatus status = getStatus(path);
+
+  if (status.isFolder) {
+    StripedFileManifest manifest;
+    if (StripedFileManifest::readIfStriped(*this, path, manifest)) {
+      return manifest.length;
+    }
+  }
+
+  return status.length;
+}
+
+namespace {
+
+/**
+   Method IDs of URIStatus and List, looked up once per process.  Method IDs
+   are valid on every thread for as long as their class is loaded, and the
+   class cache holds a global reference to both classes.
+*/
+struct StatusMethods {
+  StatusMethods(Env env) {
+    jclass status = env.findClassAndCache(URI_STATUS_CLS);
+    getPath = lookup(env, status, "getPath", "()Ljava/lang/String;");
+    getLength = lookup(env, status, "getLength", "()J");
+    isFolder = lookup(env, status, "isFolder", "()Z");
+    getBlockSizeBytes = lookup(env, status, "getBlockSizeBytes", "()J");
+    getLastModificationTimeMs = lookup(env, status, "getLastModificationTimeMs", "()J");
+    getInMemoryPercentage = lookup(env, status, "getInMemoryPercentage", "()I");
+    isPersisted = lookup(env, status, "isPersisted", "()Z");
+    isPinned = lookup(env, status, "isPinned", "()Z");
+    getOwner = lookup(env, status, "getOwner", "()Ljava/lang/String;");
+    getMode = lookup(env, status, "getMode", "()I");
+
+    jclass list = env.findClassAndCache(JLIST_CLS);
+    listSize = lookup(env, list, "size", "()I");
+    listGet = lookup(env, list, "get", "(I)Ljava/lang/Object;");
+  }
+
+  static const StatusMethods &get(Env env) {
+    // Initialized once; a failed lookup is retried on the next call
+    static const StatusMethods methods(env);
+    return methods;
+  }
+
+  static jmethodID lookup(Env &env, jclass cls, const char *name, const char *sig) {
+    jmethodID mid = env.getMethodId(cls, name, sig);
+    if (mid == NULL) {
+      env.checkExceptionAndClear();
+      throw MethodNotFoundException(URI_STATUS_CLS, name);
+    }
+    return mid;
+  }
+
+  jmethodID getPath;
+  jmethodID getLength;
+  jmethodID isFolder;
+  jmethodID getBlockSizeBytes;
+  jmethodID getLastModificationTimeMs;
+  jmethodID getInMemoryPercentage;
+  jmethodID isPersisted;
+  jmethodID isPinned;
+  jmethodID getOwner;
+  jmethodID getMode;
+  jmethodID listSize;
+  jmethodID listGet;
+};
+
+std::string callStringMethod(Env &env, jobject obj, jmethodID mid)
+{
+  jstring str = (jstring) env->CallObjectMethod(obj, mid);
+  env.checkExceptionAndClear();
+  std::string out;
+  if (str != NULL) {
+    env.jstringToString(str, out);
+    env->DeleteLocalRef(str);
+  }
+  return out;
+}
+
+void toFileStatus(Env &env, const StatusMethods &m, jobject status, FileStatus &out)
+{
+  out.path = callStringMethod(env, status, m.getPath);
+  out.length = env->CallLongMethod(status, m.getLength);
+  out.isFolder = env->CallBooleanMethod(status, m.isFolder);
+  out.blockSizeBytes = env->CallLongMethod(status, m.getBlockSizeBytes);
+  out.lastModificationTimeMs = env->CallLongMethod(status, m.getLastModificationTimeMs);
+  out.inMemoryPercentage = env->CallIntMethod(status, m.getInMemoryPercentage);
+  out.persisted = env->CallBooleanMethod(status, m.isPersisted);
+  out.pinned = env->CallBooleanMethod(status, m.isPinned);
+  out.mode = env->CallIntMethod(status, m.getMode);
+  // Getters of primitive fields cannot throw; one check covers them all
+  env.checkExceptionAndClear();
+  out.owner = callStringMethod(env, status, m.getOwner);
+}
+
+StringRef callStringMethod(Env &env, jobject obj, jmethodID mid, StringArena &arena)
+{
+  jstring str = (jstring) env->CallObjectMethod(obj, mid);
+  env.checkExceptionAndClear();
+  StringRef out;
+  if (str != NULL) {
+    env.getStringUTF(str, arena, out);
+    env->DeleteLocalRef(str);
+  }
+  return out;
+}
+
+/// toFileStatus() with the strings copied into arena
+void toFileStatus(Env &env, const StatusMethods &m, jobject status, StringArena &arena,
+                  FileStatusRef &out)
+{
+  out.path = callStringMethod(env, status, m.getPath, arena);
+  out.length = env->CallLongMethod(status, m.getLength);
+  out.isFolder = env->CallBooleanMethod(status, m.isFolder);
+  out.blockSizeBytes = env->CallLongMethod(status, m.getBlockSizeBytes);
+  out.lastModificationTimeMs = env->CallLongMethod(status, m.getLastModificationTimeMs);
+  out.inMemoryPercentage = env->CallIntMethod(status, m.getInMemoryPercentage);
+  out.persisted = env->CallBooleanMethod(status, m.isPersisted);
+  out.pinned = env->CallBooleanMethod(status, m.isPinned);
+  out.mode = env->CallIntMethod(status, m.getMode);
+  env.checkExceptionAndClear();
+  out.owner = callStringMethod(env, status, m.getOwner, arena);
+}
+
+/**
+   The packed listing helper of src/java/liballuxio/NativeListing.java, if
+   its jar is on the class path.
+*/
+struct NativeListingMethod {
+  NativeListingMethod(Env env)
+      : cls(NULL), listStatus(NULL), listStatusFiltered(NULL), encode(NULL),
+        listingFlags(NULL) {
+    try {
+      cls = env.findClassAndCache(NATIVE_LISTING_CLS);
+    } catch (ClassNotFoundException &e) {
+      // Not installed: listings fall back to JNI calls per entry
+      e.discard();
+      return;
+    }
+    listStatus = env.getStaticMethodId(cls, "listStatus",
+        "(Lalluxio/client/file/FileSystem;Lalluxio/AlluxioURI;)[B");
+    listStatusFiltered = env.getStaticMethodId(cls, "listStatusFiltered",
+        "(Lalluxio/client/file/FileSystem;Lalluxio/AlluxioURI;I"
+        "Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;JJJJZIZI)[B");
+    encode = env.getStaticMethodId(cls, "encode", "(Ljava/util/List;II)[B");
+    listingFlags = env.getStaticMethodId(cls, "listingFlags", "(Ljava/util/List;)I");
+    if (listStatus == NULL || listStatusFiltered == NULL || encode == NULL ||
+        listingFlags == NULL) {
+      env->ExceptionClear();
+      listStatus = NULL;
+      listStatusFiltered = NULL;
+      encode = NULL;
+      listingFlags = NULL;
+    }
+  }
+
+  static const NativeListingMethod &get(Env env) {
+    static const NativeListingMethod method(env);
+    return method;
+  }
+
+  jclass cls;
+  jmethodID listStatus;
+  jmethodID listStatusFiltered;
+  jmethodID encode;
+  jmethodID listingFlags;
+};
+
+/// Listing flag of NativeListing: the listed directory holds a commit manifest
+const int32_t LISTING_HAS_MANIFEST = 1;
+
+/// Largest packed listing buffer a thread keeps between listings
+const size_t PACKED_BUFFER_KEEP = 4 * 1024 * 1024;
+
+/**
+   Reads the big-endian fields written by NativeListing.listStatus().
+*/
+class PackedListingReader {
+  public:
+    PackedListingReader(const char *data, size_t size)
+        : m_pos(data), m_end(data + size) {}
+
+    int32_t readInt() { return (int32_t) readBits(4); }
+    int64_t readLong() { return (int64_t) readBits(8); }
+    uint8_t readByte() { return (uint8_t) readBits(1); }
+
+    void readString(std::string &out) {
+      int32_t length = readInt();
+      need(length);
+      out.assign(m_pos, length);
+      m_pos += length;
+    }
+
+    /// Points into the packed data instead of copying
+    void readString(StringRef &out) {
+      int32_t length = readInt();
+      need(length);
+      out = StringRef(m_pos, length);
+      m_pos += length;
+    }
+
+  private:
+    void need(int64_t n) {
+      if (n < 0 || n > m_end - m_pos) {
+        throw std::runtime_error("Malformed packed listing from " NATIVE_LISTING_CLS);
+      }
+    }
+
+    uint64_t readBits(int n) {
+      need(n);
+      uint64_t v = 0;
+      for (int i = 0; i < n; i++) {
+        v = (v << 8) | (unsigned char) m_pos[i];
+      }
+      m_pos += n;
+      return v;
+    }
+
+    const char *m_pos;
+    const char *m_end;
+};
+
+/**
+   Decode a packed listing into FileStatus or FileStatusRef entries.  Entries
+   already in out are reused, so strings that fit keep their buffer.
+*/
+template <typename Status>
+int32_t decodeListing(const char *data, size_t size, std::vector<Status> &out)
+{
+  PackedListingReader in(data, size);
+  if (in.readInt() != NATIVE_LISTING_VERSION) {
+    throw std::runtime_error("Unsupported packed listing version from " NATIVE_LISTING_CLS);
+  }
+  int32_t count = in.readInt();
+  if (count < 0) {
+    throw std::runtime_error("Malformed packed listing from " NATIVE_LISTING_CLS);
+  }
+  int32_t listingFlags = in.readInt();
+
+  out.resize(count);
+  for (int32_t i = 0; i < count; i++) {
+    Status &status = out[i];
+    uint8_t flags = in.readByte();
+    status.isFolder = (flags & 1) != 0;
+    status.persisted = (flags & 2) != 0;
+    status.pinned = (flags & 4) != 0;
+    status.length = in.readLong();
+    status.blockSizeBytes = in.readLong();
+    status.lastModificationTimeMs = in.readLong();
+    status.inMemoryPercentage = in.readInt();
+    status.mode = in.readInt();
+    in.readString(status.path);
+    in.readString(status.owner);
+  }
+  return listingFlags;
+}
+
+/**
+   Copy a packed listing out of Java and decode it.
+
+   @return The listing flags
+*/
+int32_t decodePacked(Env &env, jbyteArray packed, std::vector<FileStatus> &out)
+{
+  // Reused by every listing of the thread; strings are copied out of it
+  static thread_local std::vector<char> buffer;
+  buffer.resize(env->GetArrayLength(packed));
+  env->GetByteArrayRegion(packed, 0, buffer.size(), (jbyte *) buffer.data());
+  env->DeleteLocalRef(packed);
+  int32_t flags = decodeListing(buffer.data(), buffer.size(), out);
+  if (buffer.capacity() > PACKED_BUFFER_KEEP) {
+    std::vector<char>().swap(buffer);
+  }
+  return flags;
+}
+
+/**
+   Copy a packed listing into arena and decode it; the strings of the
+   entries point into the copy.
+*/
+int32_t decodePacked(Env &env, jbyteArray packed, StringArena &arena,
+                     std::vector<FileStatusRef> &out)
+{
+  size_t size = env->GetArrayLength(packed);
+  char *data = arena.allocate(size);
+  env->GetByteArrayRegion(packed, 0, size, (jbyte *) data);
+  env->DeleteLocalRef(packed);
+  return decodeListing(data, size, out);
+}
+
+/**
+   List with the packed helper: one call into Java, one copy out of it.
+*/
+void listStatusPacked(Env &env, const NativeListingMethod &native, jobject fs,
+                      jobject uri, std::vector<FileStatus> &out)
+{
+  jbyteArray packed = (jbyteArray) env->CallStaticObjectMethod(native.cls,
+                                                               native.listStatus,
+                                                               fs, uri);
+  env.checkExceptionAndClear();
+  decodePacked(env, packed, out);
+}
+
+/**
+   List with the filter evaluated by the packed helper: only matching entries
+   are serialized and copied out of Java.
+
+   @return The listing flags
+*/
+int32_t listStatusFilteredPacked(Env &env, const NativeListingMethod &native,
+                                 jobject fs, jobject uri, const ListStatusFilter &filter,
+                                 std::vector<FileStatus> &out)
+{
+  JNIStringBase glob(env, env.newStringUTF(filter.nameGlob.c_str(), "nameGlob"));
+  JNIStringBase suffix(env, env.newStringUTF(filter.nameSuffix.c_str(), "nameSuffix"));
+  JNIStringBase regex(env, env.newStringUTF(filter.nameRegex.c_str(), "nameRegex"));
+  jbyteArray packed = (jbyteArray) env->CallStaticObjectMethod(
+      native.cls, native.listStatusFiltered, fs, uri, (jint) filter.type,
+      glob.getJString(), suffix.getJString(), regex.getJString(),
+      (jlong) filter.minLength, (jlong) filter.maxLength,
+      (jlong) filter.minModificationTimeMs, (jlong) filter.maxModificationTimeMs,
+      (jboolean) filter.inMemoryOnly, (jint) filter.sortBy,
+      (jboolean) filter.descending, (jint) filter.limit);
+  env.checkExceptionAndClear();
+  return decodePacked(env, packed, out);
+}
+
+std::string baseName(const std::string &path)
+{
+  std::string::size_type slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool matchesFilter(const ListStatusFilter &filter, const std::regex *nameRegex,
+                   const FileStatus &status)
+{
+  if ((filter.type == ListStatusFilter::FILES_ONLY && status.isFolder) ||
+      (filter.type == ListStatusFilter::DIRECTORIES_ONLY && !status.isFolder) ||
+      (filter.minLength >= 0 && status.length < filter.minLength) ||
+      (filter.maxLength >= 0 && status.length > filter.maxLength) ||
+      (filter.minModificationTimeMs >= 0 &&
+       status.lastModificationTimeMs < filter.minModificationTimeMs) ||
+      (filter.maxModificationTimeMs >= 0 &&
+       status.lastModificationTimeMs > filter.maxModificationTimeMs) ||
+      (filter.inMemoryOnly && status.inMemoryPercentage < 100)) {
+    return false;
+  }
+
+  std::string name = baseName(status.path);
+  const std::string &suffix = filter.nameSuffix;
+  if (name.size() < suffix.size() ||
+      name.compare(name.size() - suffix.size(), std::string::npos, suffix) != 0) {
+    return false;
+  }
+  if (!filter.nameGlob.empty() &&
+      fnmatch(filter.nameGlob.c_str(), name.c_str(), 0) != 0) {
+    return false;
+  }
+  return nameRegex == NULL || std::regex_match(name, *nameRegex);
+}
+
+/**
+   Convert entries [from, from + count) of a Java List<URIStatus>, with the
+   packed helper if available and JNI calls per field otherwise.
+*/
+void statusRange(Env &env, jobject list, jint from, jint count,
+                 std::vector<FileStatus> &out)
+{
+  const NativeListingMethod &native = NativeListingMethod::get(env);
+  if (native.encode != NULL) {
+    jbyteArray packed = (jbyteArray) env->CallStaticObjectMethod(native.cls, native.encode,
+                                                                 list, from, count);
+    env.checkExceptionAndClear();
+    decodePacked(env, packed, out);
+    return;
+  }
+
+  const StatusMethods &methods = StatusMethods::get(env);
+  out.resize(count);
+  for (jint i = 0; i < count; i++) {
+    jobject status = env->CallObjectMethod(list, methods.listGet, from + i);
+    env.checkExceptionAndClear();
+    try {
+      toFileStatus(env, methods, status, out[i]);
+    } catch (const NativeException &) {
+      env->DeleteLocalRef(status);
+      throw;
+    }
+    // Keep the local reference table small on huge directories
+    env->DeleteLocalRef(status);
+  }
+}
+
+jint listSize(Env &env, jobject list)
+{
+  jint size = env->CallIntMethod(list, StatusMethods::get(env).listSize);
+  env.checkExceptionAndClear();
+  return size;
+}
+
+/**
+   List with JNI calls per entry and per field.
+*/
+void listStatusPerEntry(Env &env, jobject fs, jobject uri, std::vector<FileStatus> &out)
+{
+  jvalue retList;
+  env.callMethod(&retList, fs, "listStatus",
+                 "(Lalluxio/AlluxioURI;)Ljava/util/List;", uri);
+  try {
+    statusRange(env, retList.l, 0, listSize(env, retList.l), out);
+  } catch (...) {
+    env->DeleteLocalRef(retList.l);
+    throw;
+  }
+  env->DeleteLocalRef(retList.l);
+}
+
+/**
+   List with JNI calls per entry and per field, copying the strings into
+   arena.
+*/
+void listStatusPerEntry(Env &env, jobject fs, jobject uri, StringArena &arena,
+                        std::vector<FileStatusRef> &out)
+{
+  jvalue retList;
+  env.callMethod(&retList, fs, "listStatus",
+                 "(Lalluxio/AlluxioURI;)Ljava/util/List;", uri);
+  const StatusMethods &methods = StatusMethods::get(env);
+  try {
+    jint count = listSize(env, retList.l);
+    out.resize(count);
+    for (jint i = 0; i < count; i++) {
+      jobject status = env->CallObjectMethod(retList.l, methods.listGet, i);
+      env.checkExceptionAndClear();
+      try {
+        toFileStatus(env, methods, status, arena, out[i]);
+      } catch (const NativeException &) {
+        env->DeleteLocalRef(status);
+        throw;
+      }
+      env->DeleteLocalRef(status);
+    }
+  } catch (...) {
+    env->DeleteLocalRef(retList.l);
+    throw;
+  }
+  env->DeleteLocalRef(retList.l);
+}
+
+void copyStatus(const FileStatus &in, StringArena &arena, FileStatusRef &out)
+{
+  out.path = arena.copy(in.path);
+  out.length = in.length;
+  out.isFolder = in.isFolder;
+  out.blockSizeBytes = in.blockSizeBytes;
+  out.lastModificationTimeMs = in.lastModificationTimeMs;
+  out.inMemoryPercentage = in.inMemoryPercentage;
+  out.persisted = in.persisted;
+  out.pinned = in.pinned;
+  out.owner = arena.copy(in.owner);
+  out.mode = in.mode;
+}
+
+/// Whether an entry listed in dir is the manifest of a committed job
+bool isManifest(const char *entry, size_t length, const char *dir)
+{
+  static const std::string suffix = "/" COMMIT_MANIFEST_NAME;
+  size_t dirLength = strlen(dir);
+  // Listing a file returns the file itself
+  if (length == dirLength && memcmp(entry, dir, length) == 0) {
+    return false;
+  }
+  return length > suffix.size() &&
+      memcmp(entry + length - suffix.size(), suffix.data(), suffix.size()) == 0;
+}
+
+} // namespace
+
+/**
+   Get the status of a file or directory in one call to the master, or from
+   the metadata cache if one is set and knows the path.
+
+   @param[in] path Path of the file or directory
+   @return Its status
+*/
+FileStatus AlluxioFileSystem::getStatus(const char *path) {
+  Env env = mClient.getEnv();
+  const StatusMethods &methods = StatusMethods::get(env);
   jvalue retGetStatus;
-  jvalue retGetSize;
+  FileStatus status;
+  uint64_t generation = 0;
 
-  // FIXME: where are we cleaning up ret* memory?  Is there a huge memory leak
-  // going on here?  Also, this whole file doesn't appear to be exception safe.
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
+  if (mCache) {
+    if (mCache->getStatus(path, status)) {
+      return status;
+    }
+    generation = mCache->generation();
+  }
+
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    return callWithin<FileStatus>(*deadline, mClient, mCache, [p](AlluxioFileSystem &fs) {
+      return fs.getStatus(p.c_str());
+    });
+  }
 
-  mClient.getEnv().callMethod(
-      &retGetStatus, mClient.getJObj(), "getStatus",
-      "(Lalluxio/AlluxioURI;)Lalluxio/client/file/URIStatus;", uri->getJObj());
+  IoAdmission admission(0);
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
+  env.callMethod(&retGetStatus, mClient.getJObj(), "getStatus",
+                 "(Lalluxio/AlluxioURI;)Lalluxio/client/file/URIStatus;", uri.get());
+
+  try {
+    toFileStatus(env, methods, retGetStatus.l, status);
+  } catch (const NativeException &) {
+    env->DeleteLocalRef(retGetStatus.l);
+    throw;
+  }
+  env->DeleteLocalRef(retGetStatus.l);
+
+  if (mCache) {
+    mCache->putStatus(path, status, generation);
+  }
+  return status;
+}
+
+/**
+   Get the status of every entry of a directory in one call to the master.
 
-  mClient.getEnv().callMethod(&retGetSize, retGetStatus.l, "getLength", "()J");
+   With the liballuxio jar on the class path the whole listing crosses JNI
+   as one packed byte array; otherwise each field of each entry is fetched
+   with its own JNI call.
+
+   If path is the output directory of a committed job (see OutputCommitter.h),
+   only the outputs listed in its manifest are returned.
+
+   With a metadata cache set, the listing and the status of each entry are
+   cached.
+
+   @param[in] path Directory to list; listing a file returns its own status
+   @return Status of each entry
+*/
+std::vector<FileStatus> AlluxioFileSystem::listStatus(const char *path) {
+  Env env = mClient.getEnv();
+  const NativeListingMethod &native = NativeListingMethod::get(env);
+  std::vector<FileStatus> statuses;
+  uint64_t generation = 0;
+
+  if (mCache) {
+    if (mCache->getListing(path, statuses)) {
+      return statuses;
+    }
+    generation = mCache->generation();
+  }
+
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    return callWithin<std::vector<FileStatus> >(*deadline, mClient, mCache,
+                                                [p](AlluxioFileSystem &fs) {
+      return fs.listStatus(p.c_str());
+    });
+  }
+
+  IoAdmission admission(0);
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
+  if (native.listStatus != NULL) {
+    listStatusPacked(env, native, mClient.getJObj(), uri.get(), statuses);
+  } else {
+    listStatusPerEntry(env, mClient.getJObj(), uri.get(), statuses);
+  }
+
+  bool committedOutput = false;
+  for (size_t i = 0; i < statuses.size() && !committedOutput; i++) {
+    committedOutput = isManifest(statuses[i].path.data(), statuses[i].path.size(), path);
+  }
+
+  // Output of a committed job: hide what is not in its manifest
+  if (committedOutput) {
+    std::vector<std::string> paths;
+    paths.reserve(statuses.size());
+    for (size_t i = 0; i < statuses.size(); i++) {
+      paths.push_back(statuses[i].path);
+    }
+    paths = JobCommitter::filterCommitted(*this, path, paths);
+    std::set<std::string> visible(paths.begin(), paths.end());
+    statuses.erase(std::remove_if(statuses.begin(), statuses.end(),
+                                  [&visible](const FileStatus &status) {
+                                    return visible.count(status.path) == 0;
+                                  }),
+                   statuses.end());
+  }
+
+  if (mCache) {
+    mCache->putListing(path, statuses, generation);
+  }
+  return statuses;
+}
+
+/**
+   List a directory like listStatus(path), into a listing whose buffers are
+   reused from call to call.
+
+   With the liballuxio jar on the class path the packed listing is copied
+   into the arena of the listing once and the entries point into it;
+   otherwise each string is copied into the arena straight from Java.  The
+   output of a committed job, and every listing while a metadata cache or
+   a DeadlineScope is set, go through listStatus(path) and are copied in.
+
+   @param[in] path Directory to list; listing a file returns its own status
+   @param[out] out Status of each entry, valid until out is reused
+*/
+void AlluxioFileSystem::listStatus(const char *path, StatusListing &out) {
+  Env env = mClient.getEnv();
+  const NativeListingMethod &native = NativeListingMethod::get(env);
+  out.clear();
+
+  if (!mCache && DeadlineScope::current() == NULL) {
+    IoAdmission admission(0);
+    SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
+    bool committedOutput = false;
+    if (native.listStatus != NULL) {
+      jbyteArray packed = (jbyteArray) env->CallStaticObjectMethod(
+          native.cls, native.listStatus, mClient.getJObj(), uri.get());
+      env.checkExceptionAndClear();
+      int32_t flags = decodePacked(env, packed, out.m_arena, out.m_entries);
+      committedOutput = (flags & LISTING_HAS_MANIFEST) != 0;
+    } else {
+      listStatusPerEntry(env, mClient.getJObj(), uri.get(), out.m_arena, out.m_entries);
+      for (size_t i = 0; i < out.size() && !committedOutput; i++) {
+        committedOutput = isManifest(out[i].path.data, out[i].path.length, path);
+      }
+    }
+    if (!committedOutput) {
+      return;
+    }
+    out.clear();
+  }
+
+  std::vector<FileStatus> statuses = listStatus(path);
+  out.m_entries.resize(statuses.size());
+  for (size_t i = 0; i < statuses.size(); i++) {
+    copyStatus(statuses[i], out.m_arena, out.m_entries[i]);
+  }
+}
+
+/**
+   Get the status of a file or directory like getStatus(path), with its
+   strings copied into arena.
+
+   @param[in] path Path of the file or directory
+   @param[in] arena Holds the strings of the status until reset
+*/
+FileStatusRef AlluxioFileSystem::getStatus(const char *path, StringArena &arena) {
+  FileStatusRef status;
+  if (mCache || DeadlineScope::current() != NULL) {
+    copyStatus(getStatus(path), arena, status);
+    return status;
+  }
+
+  Env env = mClient.getEnv();
+  const StatusMethods &methods = StatusMethods::get(env);
+  jvalue retGetStatus;
+  IoAdmission admission(0);
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
+  env.callMethod(&retGetStatus, mClient.getJObj(), "getStatus",
+                 "(Lalluxio/AlluxioURI;)Lalluxio/client/file/URIStatus;", uri.get());
+  try {
+    toFileStatus(env, methods, retGetStatus.l, arena, status);
+  } catch (const NativeException &) {
+    env->DeleteLocalRef(retGetStatus.l);
+    throw;
+  }
+  env->DeleteLocalRef(retGetStatus.l);
+  return status;
+}
+
+/**
+   Get the status of the entries of a directory that pass a filter, sorted
+   and limited as the filter asks.
+
+   With the liballuxio jar on the class path the filter, sort and limit run
+   in the JVM and only the entries returned cross JNI; otherwise the whole
+   listing is converted and filtered here.  As with listStatus(path), only
+   committed entries are considered for the output of a committed job.
+
+   @param[in] path Directory to list
+   @param[in] filter Entries to return and their order
+   @return Status of each matching entry
+*/
+std::vector<FileStatus> AlluxioFileSystem::listStatus(const char *path,
+                                                      const ListStatusFilter &filter) {
+  Env env = mClient.getEnv();
+  const NativeListingMethod &native = NativeListingMethod::get(env);
+  std::vector<FileStatus> statuses;
+
+  if (mCache && mCache->getListing(path, statuses)) {
+    filter.apply(statuses);
+    return statuses;
+  }
+
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    return callWithin<std::vector<FileStatus> >(*deadline, mClient, mCache,
+                                                [p, filter](AlluxioFileSystem &fs) {
+      return fs.listStatus(p.c_str(), filter);
+    });
+  }
+
+  if (native.listStatusFiltered != NULL) {
+    IoAdmission admission(0);
+    SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
+    int32_t flags = listStatusFilteredPacked(env, native, mClient.getJObj(),
+                                             uri.get(), filter, statuses);
+    if ((flags & LISTING_HAS_MANIFEST) == 0) {
+      return statuses;
+    }
+    // Output of a committed job: uncommitted entries may have taken the
+    // place of committed ones in a limited result, filter after hiding them
+  }
 
-  return retGetSize.j;
+  statuses = listStatus(path);
+  filter.apply(statuses);
+  return statuses;
+}
+
+/**
+   Open a directory for streaming its entries.
+
+   The master is asked for the listing once; entries are then converted
+   from Java batchSize at a time as the iterator advances.  Like listStatus(),
+   only committed entries are returned for the output of a committed job.
+
+   @param[in] path Directory to list
+   @param[in] batchSize Number of entries converted per batch
+   @return Iterator over the entries; delete it to release the listing
+*/
+jDirectoryIterator AlluxioFileSystem::openDirectory(const char *path, int batchSize) {
+  DeadlineScope *deadline = DeadlineScope::current();
+  if (deadline != NULL) {
+    std::string p(path);
+    return callWithin<jDirectoryIterator>(*deadline, mClient, mCache,
+                                          [p, batchSize](AlluxioFileSystem &fs) {
+      return fs.openDirectory(p.c_str(), batchSize);
+    });
+  }
+
+  Env env = mClient.getEnv();
+  const NativeListingMethod &native = NativeListingMethod::get(env);
+  jvalue retList;
+  IoAdmission admission(0);
+  SharedURI uri = AlluxioURICache::instance().get(mClient.getEnv(), path);
+  env.callMethod(&retList, mClient.getJObj(), "listStatus",
+                 "(Lalluxio/AlluxioURI;)Ljava/util/List;", uri.get());
+
+  std::unique_ptr<std::vector<std::string> > committed;
+  try {
+    bool hasManifest;
+    if (native.listingFlags != NULL) {
+      jint flags = env->CallStaticIntMethod(native.cls, native.listingFlags, retList.l);
+      env.checkExceptionAndClear();
+      hasManifest = (flags & LISTING_HAS_MANIFEST) != 0;
+    } else {
+      hasManifest = exists(JobCommitter::manifestPath(path).c_str());
+    }
+    std::vector<std::string> files;
+    if (hasManifest && JobCommitter::readCommitted(*this, path, files)) {
+      committed.reset(new std::vector<std::string>());
+      committed->swap(files);
+    }
+  } catch (...) {
+    env->DeleteLocalRef(retList.l);
+    throw;
+  }
+  return new DirectoryIterator(env, retList.l, batchSize, committed.release());
 }
 
 /**
    Return a list of files in the given path.
 
+   If path is the output directory of a committed job (see OutputCommitter.h),
+   only the outputs listed in its manifest are returned.
+
    @param[in] path Path to list files/dirs from
    @param[in] filter Type of filter to apply to list call
    @return Vector of strings.  Each entry is a file in the path.
 */
 std::vector<std::string> AlluxioFileSystem::listPath(const char *path,
                                                      ListPathFilter filter) {
+  ListStatusFilter statusFilter;
+  switch (filter) {
+  case ListPathFilter::NONE:
+    break;
+
+  case ListPathFilter::DIRECTORIES_ONLY:
+    statusFilter.type = ListStatusFilter::DIRECTORIES_ONLY;
+    break;
+
+  default:
+    std::ostringstream errMsg;
+    errMsg << "Unknown listPath() filter " << int(filter);
+    throw std::runtime_error(errMsg.str());
+  }
+
   std::vector<std::string> files;
+  std::vector<FileStatus> statuses = filter == ListPathFilter::NONE ?
+      listStatus(path) : listStatus(path, statusFilter);
 
-  jvalue retList;
-  std::unique_ptr<AlluxioURI> uri(AlluxioURI::newURI(path));
-  mClient.getEnv().callMethod(&retList, mClient.getJObj(), "listStatus",
-                              "(Lalluxio/AlluxioURI;)Ljava/util/List;", uri->getJObj());
-
-  // List<URIStatus>.size()
-  jvalue retGetSize;
-  mClient.getEnv().callMethod(&retGetSize, retList.l, "size", "()I");
-
-  files.reserve(retGetSize.i);
-  for(int i = 0; i < retGetSize.i; i++) {
-    jvalue uriObj;
-    mClient.getEnv().callMethod(&uriObj, retList.l, "get",
-                                "(I)Ljava/lang/Object;", (jint)i);
-
-    jvalue uriString;
-    mClient.getEnv().callMethod(&uriString, uriObj.l, "toString",
-            "()Ljava/lang/String;", uriObj.l);
-    std::string rawObjStr;
-    mClient.getEnv().jstringToString(static_cast<jstring>(uriString.l), rawObjStr);
-
-    // Parse out just the file name from the raw string
-    const static std::string PATH_MARKER_START = "path=";
-    const static std::string PATH_MARKER_END = ", ";
-    std::string pathStr = rawObjStr.substr(rawObjStr.find(PATH_MARKER_START) + PATH_MARKER_START.size());
-    pathStr = pathStr.substr(0, pathStr.find(PATH_MARKER_END));
-
-    switch (filter) {
-    case ListPathFilter::NONE:
-      files.push_back(pathStr);
-      break;
-
-    case ListPathFilter::DIRECTORIES_ONLY:
-      if (rawObjStr.find("folder=true") != std::string::npos) {
-        files.push_back(pathStr);
+  files.reserve(statuses.size());
+  for (size_t i = 0; i < statuses.size(); i++) {
+    files.push_back(statuses[i].path);
+  }
+
+  return files;
+}
+
+
+namespace {
+
+/**
+   Queue operation(fs) on ThreadPool::shared() once the IoScheduler admits
+   it, where fs is the file system of the worker sharing the metadata cache
+   of this one.  onReady, if any,
+   is called once the future is ready.
+*/
+template <typename F>
+std::future<decltype(std::declval<F &>()(std::declval<AlluxioFileSystem &>()))>
+submitWithCache(const std::shared_ptr<MetadataCache> &cache, const ReadyCallback &onReady,
+                F operation)
+{
+  typedef decltype(std::declval<F &>()(std::declval<AlluxioFileSystem &>())) R;
+  std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(
+      [cache, operation]() -> R {
+    AlluxioFileSystem fs(ThreadPool::currentFileSystem());
+    fs.setMetadataCache(cache);
+    return operation(fs);
+  }));
+  std::future<R> result = task->get_future();
+  IoScheduler::post(ThreadPool::shared(), IoRequest(), [task, onReady] {
+    (*task)();
+    if (onReady) {
+      onReady();
+    }
+  });
+  return result;
+}
+
+} // namespace
+
+std::future<bool> AlluxioFileSystem::existsAsync(const char *path, ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p](AlluxioFileSystem &fs) {
+    return fs.exists(p.c_str());
+  });
+}
+
+std::future<void> AlluxioFileSystem::createDirectoryAsync(const char *path,
+                                                          ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p](AlluxioFileSystem &fs) {
+    fs.createDirectory(p.c_str());
+  });
+}
+
+std::future<void> AlluxioFileSystem::deletePathAsync(const char *path, bool recursive,
+                                                     ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p, recursive](AlluxioFileSystem &fs) {
+    fs.deletePath(p.c_str(), recursive);
+  });
+}
+
+std::future<void> AlluxioFileSystem::renameFileAsync(const char *origPath,
+                                                     const char *newPath,
+                                                     ReadyCallback onReady) {
+  std::string from(origPath);
+  std::string to(newPath);
+  return submitWithCache(mCache, onReady, [from, to](AlluxioFileSystem &fs) {
+    fs.renameFile(from.c_str(), to.c_str());
+  });
+}
+
+std::future<FileStatus> AlluxioFileSystem::getStatusAsync(const char *path,
+                                                          ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p](AlluxioFileSystem &fs) {
+    return fs.getStatus(p.c_str());
+  });
+}
+
+std::future<std::vector<FileStatus> >
+AlluxioFileSystem::listStatusAsync(const char *path, ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p](AlluxioFileSystem &fs) {
+    return fs.listStatus(p.c_str());
+  });
+}
+
+std::future<jFileInStream> AlluxioFileSystem::openFileAsync(const char *path,
+                                                            AlluxioOpenFileOptions *options,
+                                                            ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p, options](AlluxioFileSystem &fs) {
+    return fs.openFile(p.c_str(), options);
+  });
+}
+
+std::future<jFileOutStream> AlluxioFileSystem::createFileAsync(const char *path,
+                                                               AlluxioCreateFileOptions *options,
+                                                               ReadyCallback onReady) {
+  std::string p(path);
+  return submitWithCache(mCache, onReady, [p, options](AlluxioFileSystem &fs) {
+    return fs.createFile(p.c_str(), options);
+  });
+}
+
+//////////////////////////////////////////
+// FileStatusRef
+//////////////////////////////////////////
+
+FileStatus FileStatusRef::toStatus() const
+{
+  FileStatus status;
+  status.path = path.str();
+  status.length = length;
+  status.isFolder = isFolder;
+  status.blockSizeBytes = blockSizeBytes;
+  status.lastModificationTimeMs = lastModificationTimeMs;
+  status.inMemoryPercentage = inMemoryPercentage;
+  status.persisted = persisted;
+  status.pinned = pinned;
+  status.owner = owner.str();
+  status.mode = mode;
+  return status;
+}
+
+//////////////////////////////////////////
+// ListStatusFilter
+//////////////////////////////////////////
+
+struct ListStatusFilter::CompiledRegex {
+    explicit CompiledRegex(const std::string &pattern) : pattern(pattern), regex(pattern) {}
+
+    std::string pattern;
+    std::regex regex;
+};
+
+/**
+   nameRegex compiled, once for as long as it is not changed; NULL if it is
+   empty.  Filters matched from several threads at once may each compile
+   it, and keep either.
+*/
+std::shared_ptr<const ListStatusFilter::CompiledRegex> ListStatusFilter::compiledRegex() const
+{
+  if (nameRegex.empty()) {
+    return std::shared_ptr<const CompiledRegex>();
+  }
+  std::shared_ptr<const CompiledRegex> compiled = std::atomic_load(&m_compiled);
+  if (!compiled || compiled->pattern != nameRegex) {
+    compiled = std::make_shared<const CompiledRegex>(nameRegex);
+    std::atomic_store(&m_compiled, compiled);
+  }
+  return compiled;
+}
+
+bool ListStatusFilter::matches(const FileStatus &status) const
+{
+  std::shared_ptr<const CompiledRegex> re = compiledRegex();
+  return matchesFilter(*this, re ? &re->regex : NULL, status);
+}
+
+void ListStatusFilter::apply(std::vector<FileStatus> &statuses) const
+{
+  std::shared_ptr<const CompiledRegex> compiled = compiledRegex();
+  const std::regex *re = compiled ? &compiled->regex : NULL;
+  statuses.erase(std::remove_if(statuses.begin(), statuses.end(),
+                                [this, re](const FileStatus &status) {
+                                  return !matchesFilter(*this, re, status);
+                                }),
+                 statuses.end());
+
+  size_t keep = limit > 0 ? std::min(statuses.size(), (size_t) limit) : statuses.size();
+  if (sortBy != UNSORTED) {
+    SortKey key = sortBy;
+    bool desc = descending;
+    auto before = [key, desc](const FileStatus &a, const FileStatus &b) {
+      int cmp = 0;
+      switch (key) {
+      case BY_LENGTH:
+        cmp = a.length < b.length ? -1 : (a.length > b.length ? 1 : 0);
+        break;
+      case BY_MODIFICATION_TIME:
+        cmp = a.lastModificationTimeMs < b.lastModificationTimeMs ? -1 :
+            (a.lastModificationTimeMs > b.lastModificationTimeMs ? 1 : 0);
+        break;
+      default:
+        cmp = baseName(a.path).compare(baseName(b.path));
+        break;
       }
-      break;
+      if (desc) {
+        cmp = -cmp;
+      }
+      return cmp != 0 ? cmp < 0 : a.path < b.path;
+    };
+    std::partial_sort(statuses.begin(), statuses.begin() + keep, statuses.end(), before);
+  }
+  statuses.resize(keep);
+}
 
-    default:
-      std::ostringstream errMsg;
-      errMsg << "Unknown listPath() filter " << int(filter);
-      throw std::runtime_error(errMsg.str());
+
+//////////////////////////////////////////
+// DirectoryIterator
+//////////////////////////////////////////
+
+DirectoryIterator::DirectoryIterator(Env env, jobject list, int batchSize,
+                                     std::vector<std::string> *committed)
+    : JNIObjBase(env, list), m_fetched(0),
+      m_batchSize(batchSize > 0 ? batchSize : DEFAULT_DIRECTORY_BATCH_SIZE),
+      m_index(0), m_started(false), m_done(false), m_committed(committed) {
+  Env current = getEnv();
+  m_size = listSize(current, m_obj);
+
+  if (m_committed) {
+    // Subdirectories holding committed files stay visible, as in listStatus()
+    std::vector<std::string> parents;
+    for (size_t i = 0; i < m_committed->size(); i++) {
+      const std::string &file = (*m_committed)[i];
+      std::string::size_type slash = file.rfind('/');
+      while (slash != std::string::npos && slash > 0) {
+        parents.push_back(file.substr(0, slash));
+        slash = file.rfind('/', slash - 1);
+      }
     }
+    m_committed->insert(m_committed->end(), parents.begin(), parents.end());
+    std::sort(m_committed->begin(), m_committed->end());
   }
+}
 
-  return files;
+/**
+   Convert the next batch of entries from the Java listing.
+
+   @return false if every entry was already converted
+*/
+bool DirectoryIterator::fetch()
+{
+  if (m_fetched >= m_size) {
+    return false;
+  }
+  int count = std::min(m_batchSize, m_size - m_fetched);
+  Env env = getEnv();
+  statusRange(env, m_obj, m_fetched, count, m_batch);
+  m_fetched += count;
+  return true;
+}
+
+/**
+   Move to the next visible entry.
+
+   @return false at the end of the directory
+*/
+bool DirectoryIterator::advance()
+{
+  if (m_done) {
+    return false;
+  }
+  for (;;) {
+    if (m_started) {
+      m_index++;
+    }
+    m_started = true;
+    while (m_index >= m_batch.size()) {
+      if (!fetch()) {
+        m_batch.clear();
+        m_done = true;
+        return false;
+      }
+      m_index = 0;
+    }
+    if (!m_committed || std::binary_search(m_committed->begin(), m_committed->end(),
+                                           m_batch[m_index].path)) {
+      return true;
+    }
+  }
 }
 
+bool DirectoryIterator::next(FileStatus &out)
+{
+  if (!advance()) {
+    return false;
+  }
+  out = current();
+  return true;
+}
+
+DirectoryIterator::iterator DirectoryIterator::begin()
+{
+  if (!m_started && !advance()) {
+    return end();
+  }
+  return m_done ? end() : iterator(this);
+}
 
 /* vim: set ts=4 sw=4 : */
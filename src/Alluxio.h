@@ -13,12 +13,24 @@
 #include<stdint.h>
 #include<chrono>
 #include<functional>
+#include <atomic>
+#include <iterator>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "JNIHelper.h"
+#include "StringArena.h"
 
 #define BBUF_CLS                    "java/nio/ByteBuffer"
+#define URI_STATUS_CLS              "alluxio/client/file/URIStatus"
+#define JLIST_CLS                   "java/util/List"
+#define NATIVE_LISTING_CLS          "liballuxio/NativeListing"
+#define NATIVE_LISTING_VERSION      2
+
+/// Paths whose AlluxioURI is kept by AlluxioURICache
+#define DEFAULT_URI_CACHE_CAPACITY  8192
 
 #define TREADT_CLS                  "alluxio/client/ReadType"
 #define TWRITET_CLS                 "alluxio/client/WriteType"
@@ -63,6 +75,9 @@ class AlluxioOpenFileOptions;
 class AlluxioURI;
 class ClientContext;
 class Configuration;
+class MetadataCache;
+class AsyncQueue;
+class DeadlineScope;
 
 class ByteBuffer;
 class InStream;
@@ -84,40 +99,50 @@ typedef OutStream* jOutStream;
 typedef FileOutStream* jFileOutStream;
 typedef FileInStream*  jFileInStream;
 
+/// Called on the pool thread once the future of an async call is ready, for
+/// event loops and coroutines that cannot wait on it.  Must not block or throw.
+typedef std::function<void()> ReadyCallback;
+
 
+/*
+   Handles hold a global reference only, valid on every thread, and look up
+   the environment of the calling thread on each call (see
+   JNIHelper::getEnv()).  They can thus be created on one thread and used or
+   deleted on another.
+*/
 class JNIStringBase {
   public:
-    JNIStringBase(jni::Env env, jstring localString): m_env(env) { 
+    JNIStringBase(jni::Env env, jstring localString) { 
       m_string = reinterpret_cast<jstring>(env->NewGlobalRef(localString));
       // this means after the constructor, the localObj will be destroyed
       env->DeleteLocalRef(localString);
     }
 
-    ~JNIStringBase() { m_env->DeleteGlobalRef(m_string); }
+    ~JNIStringBase() { getEnv()->DeleteGlobalRef(m_string); }
 
     jstring getJString() { return m_string; }
-    jni::Env& getEnv() { return m_env; }
+    /// Environment of the calling thread
+    jni::Env getEnv() const { return jni::Env(); }
 
   protected:
-    jni::Env m_env;
     jstring m_string; // the underlying jstring
 };
 
 class JNIObjBase {
   public:
-    JNIObjBase(jni::Env env, jobject localObj): m_env(env) {
+    JNIObjBase(jni::Env env, jobject localObj) {
       m_obj = env->NewGlobalRef(localObj);
       // this means after the constructor, the localObj will be destroyed
       env->DeleteLocalRef(localObj);
     }
 
-    ~JNIObjBase() { m_env->DeleteGlobalRef(m_obj); }
+    ~JNIObjBase() { getEnv()->DeleteGlobalRef(m_obj); }
 
     jobject getJObj() { return m_obj; }
-    jni::Env& getEnv() { return m_env; }
+    /// Environment of the calling thread
+    jni::Env getEnv() const { return jni::Env(); }
 
   protected:
-    jni::Env m_env;
     jobject m_obj; // the underlying jobject
 };
 
@@ -130,12 +155,24 @@ class AlluxioClientContext
                 const char *accessKey, const char *secretKey);
         static void setAlluxioStringConstant(jni::Env &env, const char *key, const char *value);
 
+        /**
+           The context of the process, created on first use and never
+           destroyed.  After the first call this is a single atomic load: no
+           lock and no JNI call, from any thread.
+        */
+        static AlluxioClientContext &shared();
+
+        /// Global reference, usable from any thread
         jobject getJObj() { return m_baseFileSystem; }
-        jni::Env &getEnv() { return m_env; }
+        /// Environment of the calling thread, not of the one that attached
+        jni::Env getEnv() { return jni::Env(); }
 
     private:
+        AlluxioClientContext(AlluxioClientContext const &);
+        void operator=(AlluxioClientContext const &);
+
         bool m_mustDetachInDtor;
-        bool m_mustDeleteLocalRef;
+        bool m_mustDeleteGlobalRef;
         jni::Env m_env;
         /// Pointer to Java object that has all APIs for Alluxio file system.
         jobject m_baseFileSystem;
@@ -154,6 +191,7 @@ class AlluxioCreateFileOptions : public JNIObjBase
        }
 
    private:
+       friend class AlluxioFileSystem;
        AlluxioCreateFileOptions(jni::Env env, jobject createFileOptions) :
            JNIObjBase(env, createFileOptions) {}
 };
@@ -175,10 +213,86 @@ class AlluxioOpenFileOptions : public JNIObjBase
         }
 
     private:
+        friend class AlluxioFileSystem;
         AlluxioOpenFileOptions(jni::Env env, jobject openFileOptions) :
             JNIObjBase(env, openFileOptions) {}
 };
 
+/**
+   Status of a file or directory, as returned by the master.
+*/
+struct FileStatus {
+    FileStatus()
+        : length(0), isFolder(false), blockSizeBytes(0),
+          lastModificationTimeMs(0), inMemoryPercentage(0), persisted(false),
+          pinned(false), mode(0) {}
+
+    std::string path;
+    int64_t length;
+    bool isFolder;
+    int64_t blockSizeBytes;
+    int64_t lastModificationTimeMs;
+    int inMemoryPercentage;
+    bool persisted;
+    bool pinned;
+    std::string owner;
+    int mode;
+};
+
+/**
+   FileStatus whose strings point into a StringArena instead of owning them.
+*/
+struct FileStatusRef {
+    FileStatusRef()
+        : length(0), isFolder(false), blockSizeBytes(0),
+          lastModificationTimeMs(0), inMemoryPercentage(0), persisted(false),
+          pinned(false), mode(0) {}
+
+    /// Copy of the status that owns its strings
+    FileStatus toStatus() const;
+
+    StringRef path;
+    int64_t length;
+    bool isFolder;
+    int64_t blockSizeBytes;
+    int64_t lastModificationTimeMs;
+    int inMemoryPercentage;
+    bool persisted;
+    bool pinned;
+    StringRef owner;
+    int mode;
+};
+
+/**
+   Result of AlluxioFileSystem::listStatus(path, StatusListing &).  Entries
+   and their strings live in buffers that the next listing into the same
+   StatusListing reuses, so once they have grown to the size of the
+   directories listed, listing allocates nothing per entry.  Entries are
+   valid until the next listing or clear().
+*/
+class StatusListing {
+  public:
+    typedef std::vector<FileStatusRef>::const_iterator const_iterator;
+
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+    const FileStatusRef &operator[](size_t i) const { return m_entries[i]; }
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+
+    void clear()
+    {
+      m_entries.clear();
+      m_arena.reset();
+    }
+
+  private:
+    friend class AlluxioFileSystem;
+
+    std::vector<FileStatusRef> m_entries;
+    StringArena m_arena;
+};
+
 /// Enum to control what is filtered in the listPath call
 enum class ListPathFilter {
     /// No filtering in listPath().  Return everything under given path.
@@ -187,12 +301,155 @@ enum class ListPathFilter {
     DIRECTORIES_ONLY
 };
 
+/**
+   Which entries of a directory listStatus() returns, and in which order.
+   With the liballuxio jar on the class path the filter is evaluated in the
+   JVM, so only matching entries cross JNI.
+
+   Name patterns apply to the last component of the path; empty patterns
+   and bounds of -1 do not constrain.  Bounds are inclusive.
+
+       ListStatusFilter newest;
+       newest.type = ListStatusFilter::FILES_ONLY;
+       newest.sortBy = ListStatusFilter::BY_MODIFICATION_TIME;
+       newest.descending = true;
+       newest.limit = 100;
+*/
+struct ListStatusFilter {
+    // Values shared with src/java/liballuxio/NativeListing.java
+    enum EntryType { ALL = 0, FILES_ONLY = 1, DIRECTORIES_ONLY = 2 };
+    enum SortKey { UNSORTED = 0, BY_NAME = 1, BY_LENGTH = 2, BY_MODIFICATION_TIME = 3 };
+
+    ListStatusFilter()
+        : type(ALL), minLength(-1), maxLength(-1), minModificationTimeMs(-1),
+          maxModificationTimeMs(-1), inMemoryOnly(false), sortBy(UNSORTED),
+          descending(false), limit(0) {}
+
+    EntryType type;
+    /// fnmatch(3) pattern: *, ? and [...]
+    std::string nameGlob;
+    std::string nameSuffix;
+    /// Regular expression the whole name must match
+    std::string nameRegex;
+    int64_t minLength;
+    int64_t maxLength;
+    int64_t minModificationTimeMs;
+    int64_t maxModificationTimeMs;
+    /// Only entries fully in Alluxio memory
+    bool inMemoryOnly;
+
+    /// Ties are broken by path, ascending
+    SortKey sortBy;
+    bool descending;
+    /// Keep the first limit entries after sorting; 0 keeps all
+    int limit;
+
+    bool matches(const FileStatus &status) const;
+    /// Filter, sort and limit a listing in place
+    void apply(std::vector<FileStatus> &statuses) const;
+
+  private:
+    struct CompiledRegex;
+
+    std::shared_ptr<const CompiledRegex> compiledRegex() const;
+
+    /// nameRegex as last compiled, shared by copies of the filter
+    mutable std::shared_ptr<const CompiledRegex> m_compiled;
+};
+
+/// Entries fetched from Java per batch by DirectoryIterator
+#define DEFAULT_DIRECTORY_BATCH_SIZE 1024
+
+/**
+   Streams the entries of a directory, converting them from Java a batch at a
+   time.  Memory is bounded by the batch size, the first entries are available
+   before the rest are converted, and entries never reached (after a break)
+   are never converted.  Works with range-for:
+
+       std::unique_ptr<DirectoryIterator> dir(fs.openDirectory("/data"));
+       for (const FileStatus &status : *dir) { ... }
+
+   Single pass: use either range-for or next(), once.
+*/
+class DirectoryIterator : public JNIObjBase {
+  public:
+    class iterator {
+      public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef FileStatus value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const FileStatus *pointer;
+        typedef const FileStatus &reference;
+
+        iterator() : m_dir(NULL) {}
+
+        const FileStatus &operator*() const { return m_dir->current(); }
+        const FileStatus *operator->() const { return &m_dir->current(); }
+        iterator &operator++() {
+          if (!m_dir->advance()) {
+            m_dir = NULL;
+          }
+          return *this;
+        }
+        bool operator==(const iterator &other) const { return m_dir == other.m_dir; }
+        bool operator!=(const iterator &other) const { return m_dir != other.m_dir; }
+
+      private:
+        friend class DirectoryIterator;
+        explicit iterator(DirectoryIterator *dir) : m_dir(dir) {}
+
+        DirectoryIterator *m_dir;
+    };
+
+    /// Fetch the next entry; false once the directory is exhausted
+    bool next(FileStatus &out);
+
+    iterator begin();
+    iterator end() { return iterator(); }
+
+  private:
+    friend class AlluxioFileSystem;
+    DirectoryIterator(jni::Env env, jobject list, int batchSize,
+                      std::vector<std::string> *committed);
+    DirectoryIterator(DirectoryIterator const &);
+    void operator=(DirectoryIterator const &);
+
+    const FileStatus &current() const { return m_batch[m_index]; }
+    bool advance();
+    bool fetch();
+
+    int m_size;
+    int m_fetched;
+    int m_batchSize;
+    std::vector<FileStatus> m_batch;
+    size_t m_index;
+    bool m_started;
+    bool m_done;
+    /// Sorted committed paths when listing the output of a committed job
+    std::unique_ptr<std::vector<std::string> > m_committed;
+};
+
+typedef DirectoryIterator* jDirectoryIterator;
+
 /**
    Abstraction layer to alluxio file system. 
+
+   Within a DeadlineScope (see Deadline.h) each blocking call runs on a
+   thread of its own over the same client context, which must outlive the
+   calls given up on.
 */
 class AlluxioFileSystem {
     public:
         AlluxioFileSystem(AlluxioClientContext& clientContext);
+
+        /**
+           File system over AlluxioClientContext::shared(), for any thread;
+           like it, free to obtain after the first call.  It has no metadata
+           cache and must not be given one: wrap the shared context in an
+           AlluxioFileSystem of your own for that, which costs no JNI call.
+        */
+        static AlluxioFileSystem &shared();
+
         bool exists(const char *path);
         long int fileSize(const char *path);
         void createDirectory(const char *path);
@@ -204,9 +461,46 @@ class AlluxioFileSystem {
         void completeAppend(const char *path, jFileOutStream fileOutStream);
         void renameFile(const char *origPath, const char *newPath);
         std::vector<std::string> listPath(const char * path, ListPathFilter filter);
+        FileStatus getStatus(const char *path);
+        std::vector<FileStatus> listStatus(const char *path);
+        std::vector<FileStatus> listStatus(const char *path,
+                                           const ListStatusFilter &filter);
+        /// listStatus(path) into a listing reused from call to call
+        void listStatus(const char *path, StatusListing &out);
+        /// getStatus(path) with its strings copied into arena
+        FileStatusRef getStatus(const char *path, StringArena &arena);
+        jDirectoryIterator openDirectory(const char *path,
+                                         int batchSize = DEFAULT_DIRECTORY_BATCH_SIZE);
+
+        // Asynchronous counterparts, run on ThreadPool::shared() with the
+        // metadata cache of this file system; options must outlive the future.
+        std::future<bool> existsAsync(const char *path,
+                                      ReadyCallback onReady = ReadyCallback());
+        std::future<void> createDirectoryAsync(const char *path,
+                                               ReadyCallback onReady = ReadyCallback());
+        std::future<void> deletePathAsync(const char *path, bool recursive = false,
+                                          ReadyCallback onReady = ReadyCallback());
+        std::future<void> renameFileAsync(const char *origPath, const char *newPath,
+                                          ReadyCallback onReady = ReadyCallback());
+        std::future<FileStatus> getStatusAsync(const char *path,
+                                               ReadyCallback onReady = ReadyCallback());
+        std::future<std::vector<FileStatus> > listStatusAsync(
+            const char *path, ReadyCallback onReady = ReadyCallback());
+        std::future<jFileInStream> openFileAsync(const char *path,
+                                                 AlluxioOpenFileOptions *options = nullptr,
+                                                 ReadyCallback onReady = ReadyCallback());
+        std::future<jFileOutStream> createFileAsync(const char *path,
+                                                    AlluxioCreateFileOptions *options = nullptr,
+                                                    ReadyCallback onReady = ReadyCallback());
+
+        /// Answer exists(), fileSize(), getStatus(), listStatus() and listPath()
+        /// from cache when possible (see MetadataCache.h); NULL to stop caching
+        void setMetadataCache(std::shared_ptr<MetadataCache> cache) { mCache = cache; }
+        const std::shared_ptr<MetadataCache> &metadataCache() const { return mCache; }
 
     private:
         AlluxioClientContext& mClient;
+        std::shared_ptr<MetadataCache> mCache;
 };
 
 class AlluxioByteBuffer : public JNIObjBase {
@@ -225,9 +519,30 @@ class ByteBuffer : public JNIObjBase {
     static jByteBuffer allocate(int capacity);
 };
 
+/**
+   Lock of a stream, shared with its async calls and with its calls given
+   up on at their deadline (see Deadline.h).
+*/
+struct StreamLock {
+    StreamLock() : abandoned(false) {}
+
+    std::mutex mutex;
+    /// Set once a call on the stream was given up on: the stream is unusable
+    std::atomic<bool> abandoned;
+};
+
+/*
+   Streams may be handed from thread to thread and used from several at
+   once: every call, synchronous or async, holds the lock of the stream
+   while it is in the JVM, so concurrent calls take turns.  Calls that
+   depend on the position (read, seek, skip, write) need ordering from the
+   caller; positionedRead does not.  Within a DeadlineScope the blocking
+   calls are bounded (see Deadline.h).
+*/
 class InStream : public JNIObjBase {
   public:
-    InStream(jni::Env env, jobject istream): JNIObjBase(env, istream){}
+    InStream(jni::Env env, jobject istream)
+        : JNIObjBase(env, istream), m_lock(std::make_shared<StreamLock>()) {}
   
     void close();
     int read();
@@ -239,7 +554,29 @@ class InStream : public JNIObjBase {
           std::chrono::duration<double>* pBufferCopyTimeCounter);
     void seek(long pos);
     long skip(long n);
-  
+    int positionedRead(long pos, void *buff, int length);
+
+    // Read on a background attached thread of ThreadPool::shared().  Async
+    // calls on one stream run in the order they were issued; buff must stay
+    // valid until the future is ready.  The stream object may be deleted at
+    // once.
+    std::future<int> readAsync(void *buff, int length,
+                               ReadyCallback onReady = ReadyCallback());
+    std::future<int> positionedReadAsync(long pos, void *buff, int length,
+                                         ReadyCallback onReady = ReadyCallback());
+    std::future<void> closeAsync(ReadyCallback onReady = ReadyCallback());
+
+    /// Whether a call given up on left the stream unusable (see Deadline.h)
+    bool abandoned() const { return m_lock->abandoned; }
+
+  private:
+    /// Run call on a copy of the stream within scope; closes it if given up on
+    template <typename R>
+    R callWithin(DeadlineScope &scope, const std::function<R(InStream &)> &call);
+
+    /// Held during every JVM call on the stream, including async ones
+    std::shared_ptr<StreamLock> m_lock;
+    std::shared_ptr<AsyncQueue> m_async;
 };
 
 class FileInStream : public InStream 
@@ -263,7 +600,8 @@ class RemoteBlockInStream : public BlockInStream {
 
 class OutStream : public JNIObjBase {
   public:
-    OutStream(jni::Env env, jobject ostream): JNIObjBase(env, ostream){}
+    OutStream(jni::Env env, jobject ostream)
+        : JNIObjBase(env, ostream), m_lock(std::make_shared<StreamLock>()) {}
 
     void cancel();
     void close();
@@ -272,6 +610,39 @@ class OutStream : public JNIObjBase {
     void write(const void *buff, int length);
     void write(const void *buff, int length, int off, int maxLen);
 
+    // Close/flush on a thread of ThreadPool::shared().  Async operations on
+    // one stream run in the order they were issued; the stream object itself
+    // may be deleted as soon as closeAsync() returns.
+    std::future<void> closeAsync(ReadyCallback onReady = ReadyCallback());
+    std::future<void> flushAsync(ReadyCallback onReady = ReadyCallback());
+    // Write on a thread of ThreadPool::shared(), in order with the other
+    // async calls; buff must stay valid until the future is ready.
+    std::future<void> writeAsync(const void *buff, int length,
+                                 ReadyCallback onReady = ReadyCallback());
+
+    // Cap on async closes/flushes in flight process-wide; closeAsync() and
+    // flushAsync() block while the cap is reached.
+    static void setMaxOutstandingCloses(int maxOutstanding);
+    // Barrier: wait until every async close/flush issued so far has finished
+    static void awaitAsyncCloses();
+
+  private:
+    friend class AlluxioFileSystem;
+
+    /// completes: the file is complete once methodName returns
+    std::future<void> submitAsync(const char *methodName, bool completes,
+                                  const ReadyCallback &onReady);
+    /// Run call on a copy of the stream within scope; cancels it if given up on
+    template <typename R>
+    R callWithin(DeadlineScope &scope, const std::function<R(OutStream &)> &call);
+
+    /// Held during every JVM call on the stream, including async ones
+    std::shared_ptr<StreamLock> m_lock;
+    std::shared_ptr<AsyncQueue> m_async;
+    /// Cache of the file system that created the file, and its path: the
+    /// entries cached while it was written go once it is closed or cancelled
+    std::shared_ptr<MetadataCache> m_cache;
+    std::string m_path;
 };
 
 class FileOutStream : public OutStream 
@@ -297,6 +668,56 @@ class AlluxioURI : public JNIObjBase {
     AlluxioURI(jni::Env env, jobject uri): JNIObjBase(env, uri){}
 };
 
+/// Global reference to a Java AlluxioURI, deleted with its last copy
+typedef std::shared_ptr<_jobject> SharedURI;
+
+struct AlluxioURICacheStats {
+    AlluxioURICacheStats() : hits(0), misses(0), evictions(0), entries(0) {}
+
+    int64_t hits;
+    int64_t misses;
+    int64_t evictions;
+    int64_t entries;
+};
+
+/**
+   Process-wide cache of Java AlluxioURI objects by path string, so that
+   AlluxioFileSystem calls on hot paths neither allocate nor cross into
+   the JVM to build their URI.  Java URIs are immutable, so one object is
+   shared by all threads.  The least recently used paths of a shard are
+   evicted beyond the capacity; a URI in use stays valid until its last
+   SharedURI is gone.
+*/
+class AlluxioURICache {
+  public:
+    static AlluxioURICache &instance();
+
+    /**
+       AlluxioURI of path, built on a miss
+
+       @param[in] env JNI environment of the calling thread
+       @param[in] path Path as passed to AlluxioFileSystem
+    */
+    SharedURI get(jni::Env env, const char *path);
+
+    /// Most paths kept, DEFAULT_URI_CACHE_CAPACITY by default; 0 disables
+    /// the cache
+    void setCapacity(size_t capacity);
+    AlluxioURICacheStats stats() const;
+    void clear();
+
+  private:
+    struct Shard;
+
+    AlluxioURICache();
+    ~AlluxioURICache();
+    AlluxioURICache(AlluxioURICache const &);
+    void operator=(AlluxioURICache const &);
+
+    std::vector<std::unique_ptr<Shard> > m_shards;
+    std::atomic<size_t> m_capacityPerShard;
+};
+
 
 
 } // namespace alluxio
@@ -7,18 +7,44 @@
  */
 
 #include "Alluxio.h"
+#include "BatchOperations.h"
+#include "CompletionQueue.h"
+#include "IoScheduler.h"
+#include "ConcurrencyLimit.h"
+#include "Deadline.h"
+#include "HedgedRead.h"
+#include "LocalStaging.h"
+#include "MetadataCache.h"
+#include "NamespaceSnapshot.h"
+#include "NamespaceWalker.h"
+#include "OutputCommitter.h"
+#include "PackFile.h"
+#include "StripedFile.h"
+#include "ThreadPool.h"
 #include "Util.h"
+#if defined(__cpp_impl_coroutine)
+#include "Coroutine.h"
+#endif
 
+#include <dirent.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 //FIXME: This is using a mix of C and C++ IO right now.  Convert to all
 // C++
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <ctime>
 #include <iomanip>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
+#include <mutex>
+#include <sstream>
 #include <thread>
 #include "JNIHelper.h"
 
@@ -31,8 +57,16 @@ const char *filePath;
 
 const char *gFileToCreate = "/hello.txt";
 const char *gDirToCreate = "/alluxiotest";
+const char *gStripedFileToCreate = "/alluxiotest/striped.bin";
+const char *gStagedFileToCreate = "/alluxiotest/staged.txt";
+const char *gJobOutputDir = "/alluxiotest/job-output";
+const char *gPackDirToCreate = "/alluxiotest/pack";
+const char *gCachedFileToCreate = "/alluxiotest/cached.txt";
 const char *gPathSeparatorString = "/";
 const char gPathSeparatorChar = '/';
+// Threads of ThreadPool::shared(), sized before any test starts it
+const int gSharedPoolThreads = 4;
+bool gSharedPoolSized = false;
 
 // FIXME: Change to allow keys to be entered via a config file
 const char *awsAccessKey = "-----ACCESS-KEY-----";
@@ -82,6 +116,18 @@ void testDirectoryExists(jAlluxioFileSystem client, const char *path)
   std::cout << "SUCCESS - Alluxio dir " << path << " exists" << std::endl;
 }
 
+void testGetStatus(jAlluxioFileSystem client, const char *path)
+{
+  std::cout << std::endl << "TEST - GET STATUS: ";
+  FileStatus status = client->getStatus(path);
+  if (status.path != path || !status.isFolder) {
+    std::cout << "FAILURE - status of " << path << " is not a directory" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Alluxio dir " << path << " is a directory owned by "
+      << status.owner << std::endl;
+}
+
 void testGetFileSize(jAlluxioFileSystem client, const char *path)
 {
   std::cout << std::endl << "TEST - GET FILE SIZE: ";
@@ -207,9 +253,9 @@ jFileOutStream testCreateFile(jAlluxioFileSystem client, const char *path)
 }
 
 void testReadLargeFile(jAlluxioFileSystem client, jFileInStream fileInStream, 
-      const char* path, char* inputBuffer, int bufferSize)
+      const char* path, char* inputBuffer, int bufferSize, std::ostream &out = std::cout)
 {
-  std::cout << std::endl << "TEST - READ LARGE FILE: ";
+  out << std::endl << "TEST - READ LARGE FILE: ";
   std::chrono::duration<double> duration = std::chrono::duration<double>::zero();
   std::chrono::duration<double> elapsedTime = std::chrono::duration<double>::zero();
   std::chrono::duration<double> bufferCreationTime = std::chrono::duration<double>::zero();
@@ -227,17 +273,17 @@ void testReadLargeFile(jAlluxioFileSystem client, jFileInStream fileInStream,
   fileInStream = client->openFile(path, openOptions);
   stopTime = std::chrono::system_clock::now();
   duration = stopTime - startTime;
-  std::cout << "Opened file " << path << " from Alluxio in " << duration.count() 
+  out << "Opened file " << path << " from Alluxio in " << duration.count() 
      << " seconds" << std::endl;
 
   if (fileInStream == NULL) 
   {
-     std::cout << "failed to open alluxio file " << path << std::endl;
+     out << "failed to open alluxio file " << path << std::endl;
      goto exit;
   }
   else
   {
-      std::cout << "successfully opened file: " << path << " for reading" << std::endl;
+      out << "successfully opened file: " << path << " for reading" << std::endl;
   }
 
   elapsedTime = std::chrono::duration<double>::zero();
@@ -252,24 +298,25 @@ void testReadLargeFile(jAlluxioFileSystem client, jFileInStream fileInStream,
      elapsedTime += stopTime - startTime;
   }
 
-  std::cout << bufferCreationTime.count() 
+  out << bufferCreationTime.count() 
      << " seconds creating buffers" << std::endl << alluxioReadTime.count() << 
      " seconds reading buffers" << std::endl << bufferCopyTime.count() << 
      " seconds gaining access to buffers"<< std::endl;
 
   fileInStream->close();
 
-  std::cout << "Read complete" << std::endl;
-  std::cout << "Spent " << elapsedTime.count() << " seconds reading from Alluxio" << std::endl;
+  out << "Read complete" << std::endl;
+  out << "Spent " << elapsedTime.count() << " seconds reading from Alluxio" << std::endl;
   delete (fileInStream); 
 
 exit:
   return;
 }
 
-void testCopyFile(jAlluxioFileSystem client, const char *inPath, const char *alluxioPath)
+void testCopyFile(jAlluxioFileSystem client, const char *inPath, const char *alluxioPath,
+                  std::ostream &out = std::cout)
 {
-  std::cout << std::endl << "TEST - COPY FILE: ";
+  out << std::endl << "TEST - COPY FILE: ";
   const char *fileNameInInpath;
   jFileOutStream targetOutStream;
   jFileInStream  fileInStream;
@@ -285,10 +332,8 @@ void testCopyFile(jAlluxioFileSystem client, const char *inPath, const char *all
   std::chrono::duration<double> elapsedTimeWriting = std::chrono::duration<double>::zero();
   std::chrono::time_point<std::chrono::system_clock> startTime, stopTime;
 
-  std::cout.precision(15);
-
-  AlluxioClientContext localContext;
-  AlluxioFileSystem afs(localContext);
+  // Shared by every copying thread; no context per thread
+  AlluxioFileSystem &afs = AlluxioFileSystem::shared();
 
   createOptions = AlluxioCreateFileOptions::getCreateFileOptions();
 
@@ -300,7 +345,7 @@ void testCopyFile(jAlluxioFileSystem client, const char *inPath, const char *all
   inputFile.open(inPath, std::ios::in | std::ios::binary);
   stopTime = std::chrono::system_clock::now();
   duration = stopTime - startTime;
-  std::cout << "Opened file " << inPath << " on disk in " << duration.count() 
+  out << "Opened file " << inPath << " on disk in " << duration.count() 
      << " seconds" << std::endl;
 
   // FIXME: Change to std::vector
@@ -341,15 +386,15 @@ void testCopyFile(jAlluxioFileSystem client, const char *inPath, const char *all
   stopTime = std::chrono::system_clock::now();
   elapsedTimeWriting += stopTime - startTime;
 
-  std::cout << "File copy complete" << std::endl;
-  std::cout << "Spent " << elapsedTimeReading.count() 
+  out << "File copy complete" << std::endl;
+  out << "Spent " << elapsedTimeReading.count() 
      << " seconds reading from disk" << std::endl;
-  std::cout << "Spent " << elapsedTimeWriting.count() 
+  out << "Spent " << elapsedTimeWriting.count() 
      << " seconds writing to Alluxio" << std::endl;
   delete(targetOutStream);
 
   // Now do the reading from Alluxio
-  testReadLargeFile(&afs, fileInStream, alluxioPath, inputBuffer, bufferSize);
+  testReadLargeFile(&afs, fileInStream, alluxioPath, inputBuffer, bufferSize, out);
 
   free(inputBuffer);
 
@@ -403,6 +448,1265 @@ void testReadFile(jFileInStream fileInStream)
   std::cout << "SUCCESS - Content of the created file:" << buf << std::endl;
 }
 
+void testStripedFile(jAlluxioFileSystem client, const char *path)
+{
+  std::cout << std::endl << "TEST - STRIPED FILE: ";
+  const int fileSize = 100000;
+  StripedFileOptions options;
+  options.numParts = 3;
+  options.stripeSize = 4096;
+
+  std::vector<char> content(fileSize);
+  for (int i = 0; i < fileSize; i++) {
+    content[i] = (char) (i % 251);
+  }
+
+  StripedFileWriter writer(*client, path, options);
+  writer.write(content.data(), fileSize / 2);
+  writer.write(content.data() + fileSize / 2, fileSize - fileSize / 2);
+  writer.close();
+
+  if (client->fileSize(path) != fileSize) {
+    std::cout << "FAILURE - fileSize of striped file is " << client->fileSize(path)
+        << ", expected " << fileSize << std::endl;
+    return;
+  }
+
+  std::vector<char> readBack(fileSize);
+  StripedFileInStream reader(*client, path);
+  int rdSz = reader.read(readBack.data(), fileSize);
+  reader.close();
+
+  if (rdSz != fileSize || readBack != content) {
+    std::cout << "FAILURE - striped file content does not match" << std::endl;
+    return;
+  }
+
+  // Ordinary directories holding a file or a directory of the manifest's
+  // name keep their own size
+  std::string plainFile = std::string(path) + ".plain";
+  std::string plainDir = std::string(path) + ".nested";
+  client->createDirectory(plainFile.c_str());
+  client->createDirectory(plainDir.c_str());
+  client->createDirectory((plainDir + "/_manifest").c_str());
+  char notManifest[] = "not a striped file manifest\n";
+  FileOutStream *other = client->createFile((plainFile + "/_manifest").c_str());
+  other->write(notManifest, strlen(notManifest));
+  other->close();
+  delete other;
+  bool plainSized =
+      client->fileSize(plainFile.c_str()) == client->getStatus(plainFile.c_str()).length &&
+      client->fileSize(plainDir.c_str()) == client->getStatus(plainDir.c_str()).length;
+  client->deletePath(plainFile.c_str(), true);
+  client->deletePath(plainDir.c_str(), true);
+
+  if (!plainSized) {
+    std::cout << "FAILURE - fileSize of a directory holding an unrelated _manifest "
+        << "is not its own length" << std::endl;
+  } else {
+    std::cout << "SUCCESS - Wrote and read back " << fileSize << " bytes over "
+        << options.numParts << " parts of " << path << std::endl;
+  }
+}
+
+void testAsyncClose(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - ASYNC CLOSE: ";
+  const int numFiles = 4;
+  char content[] = "hello, alluxio!!";
+  std::vector<std::future<void> > closes;
+  std::vector<std::string> paths;
+  std::unique_ptr<AlluxioCreateFileOptions> options(
+      AlluxioCreateFileOptions::getCreateFileOptions());
+
+  options->setWriteType(CACHE_THROUGH);
+
+  // Each file is handed off for closing and the next one is written at once
+  for (int i = 0; i < numFiles; i++) {
+    paths.push_back(std::string(dir) + "/async." + std::to_string(i));
+    std::unique_ptr<FileOutStream> out(client->createFile(paths.back().c_str(),
+                                                          options.get()));
+    out->write(content, strlen(content));
+    closes.push_back(out->closeAsync());
+  }
+
+  OutStream::awaitAsyncCloses();
+
+  for (int i = 0; i < numFiles; i++) {
+    closes[i].get();
+    if (client->fileSize(paths[i].c_str()) != (long int) strlen(content)) {
+      std::cout << "FAILURE - " << paths[i] << " is incomplete after async close"
+          << std::endl;
+      return;
+    }
+  }
+  std::cout << "SUCCESS - Closed " << numFiles << " files in the background" << std::endl;
+}
+
+/// Remove a local directory and the files in it
+void removeLocalDir(const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (d != NULL) {
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+        unlink((std::string(dir) + "/" + entry->d_name).c_str());
+      }
+    }
+    closedir(d);
+  }
+  rmdir(dir);
+}
+
+void testLocalStaging(jAlluxioFileSystem client, const char *path)
+{
+  std::cout << std::endl << "TEST - LOCAL STAGING: ";
+  char stagingDir[] = "/tmp/alluxiotest-staging.XXXXXX";
+  char content[] = "hello, alluxio!!";
+
+  if (mkdtemp(stagingDir) == NULL) {
+    std::cout << "FAILURE - could not create local staging directory" << std::endl;
+    return;
+  }
+
+  bool uploaded;
+  try {
+    LocalStagingOptions options;
+    options.stagingDir = stagingDir;
+    LocalStaging staging(options);
+
+    // Two files staged for the path: the one closed last is uploaded last
+    char again[] = "hello again, alluxio!!";
+    std::unique_ptr<StagedOutStream> out(staging.createFile(path));
+    out->write(content, strlen(content));
+    std::unique_ptr<StagedOutStream> first(staging.createFile(path));
+    first->write(again, strlen(again));
+    first->close();
+    out->close();
+
+    staging.awaitUpload(path);
+    uploaded = client->fileSize(path) == (long int) strlen(content);
+  } catch (...) {
+    removeLocalDir(stagingDir);
+    throw;
+  }
+  // The staging is gone with its streams: nothing writes there any more
+  removeLocalDir(stagingDir);
+
+  if (!uploaded) {
+    std::cout << "FAILURE - " << path << " was not uploaded completely" << std::endl;
+  } else {
+    std::cout << "SUCCESS - Staged " << path << " in " << stagingDir
+        << " and uploaded it" << std::endl;
+  }
+}
+
+void testOutputCommitter(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - OUTPUT COMMITTER: ";
+  const int numTasks = 2;
+  char content[] = "hello, alluxio!!";
+  JobCommitter job(*client, dir, "job-1");
+  job.setupJob();
+
+  // An attempt that fails after writing: its output must never be listed
+  TaskCommitter failed(*client, dir, "job-1", 0, 0);
+  std::unique_ptr<FileOutStream> out(failed.createOutput("data"));
+  out->write(content, strlen(content));
+  out->close();
+
+  for (int i = 0; i < numTasks; i++) {
+    TaskCommitter task(*client, dir, "job-1", i, 1);
+    out.reset(task.createOutput("data"));
+    out->write(content, strlen(content));
+    out->close();
+    task.commitTask();
+  }
+  job.commitJob();
+
+  std::vector<std::string> listed = client->listPath(dir, ListPathFilter::NONE);
+  std::vector<std::string> committed = JobCommitter::listCommitted(*client, dir);
+  std::sort(listed.begin(), listed.end());
+  std::sort(committed.begin(), committed.end());
+
+  // A _MANIFEST file of another kind hides nothing
+  std::string plain = std::string(dir) + "/plain";
+  client->createDirectory(plain.c_str());
+  out.reset(client->createFile((plain + "/" COMMIT_MANIFEST_NAME).c_str()));
+  out->write(content, strlen(content));
+  out->close();
+  out.reset(client->createFile((plain + "/data").c_str()));
+  out->close();
+  size_t plainListed = client->listPath(plain.c_str(), ListPathFilter::NONE).size();
+  std::unique_ptr<DirectoryIterator> entries(client->openDirectory(plain.c_str()));
+  size_t plainIterated = 0;
+  for (DirectoryIterator::iterator it = entries->begin(); it != entries->end(); ++it) {
+    plainIterated++;
+  }
+  entries.reset();
+  bool plainCommitted = JobCommitter::isCommitted(*client, plain.c_str());
+  client->deletePath(plain.c_str(), true);
+
+  if (!JobCommitter::isCommitted(*client, dir) || (int) listed.size() != numTasks ||
+      committed != listed || plainCommitted ||
+      plainListed != 2 || plainIterated != 2) {
+    std::cout << "FAILURE - ls of " << dir << " found " << listed.size()
+        << " committed outputs, expected " << numTasks << "; " << plainListed << " and "
+        << plainIterated << " entries listed in " << plain << ", expected 2" << std::endl;
+  } else {
+    std::cout << "SUCCESS - Committed " << numTasks << " task outputs to " << dir
+        << std::endl;
+  }
+}
+
+void testPackFile(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - PACK FILE: ";
+  const int numMembers = 200;
+  PackWriterOptions options;
+  options.maxPackSize = 256 * 1024;
+
+  // Members of 1-5 KB, written out of name order
+  PackWriter writer(*client, dir, options);
+  for (int i = numMembers - 1; i >= 0; i--) {
+    std::string content((i % 5 + 1) * 1024, (char) ('a' + i % 26));
+    writer.add("object-" + std::to_string(i), content.data(), content.size());
+  }
+  writer.close();
+
+  PackReader reader(*client, dir);
+  std::vector<char> data;
+  for (int i = 0; i < numMembers; i++) {
+    reader.readMember("object-" + std::to_string(i), data);
+    std::string content((i % 5 + 1) * 1024, (char) ('a' + i % 26));
+    if (std::string(data.begin(), data.end()) != content) {
+      std::cout << "FAILURE - content of member object-" << i << " does not match"
+          << std::endl;
+      return;
+    }
+  }
+  if (reader.numMembers() != numMembers || reader.contains("object-missing")) {
+    std::cout << "FAILURE - pack index has " << reader.numMembers()
+        << " members, expected " << numMembers << std::endl;
+    return;
+  }
+
+  int numFiles = client->listPath(dir, ListPathFilter::NONE).size();
+  std::cout << "SUCCESS - Read back " << numMembers << " members stored in "
+      << numFiles << " files under " << dir << std::endl;
+}
+
+void testDirectoryIterator(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - DIRECTORY ITERATOR: ";
+  const int batchSize = 2;
+  std::vector<std::string> expected = client->listPath(dir, ListPathFilter::NONE);
+  std::vector<std::string> streamed;
+
+  std::unique_ptr<DirectoryIterator> entries(client->openDirectory(dir, batchSize));
+  for (const FileStatus &status : *entries) {
+    streamed.push_back(status.path);
+  }
+
+  if (streamed != expected) {
+    std::cout << "FAILURE - streamed " << streamed.size() << " entries of " << dir
+        << ", ls found " << expected.size() << std::endl;
+  } else {
+    std::cout << "SUCCESS - Streamed " << streamed.size() << " entries of " << dir
+        << " in batches of " << batchSize << std::endl;
+  }
+}
+
+void testFilteredListing(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - FILTERED LISTING: ";
+  ListStatusFilter filter;
+  filter.type = ListStatusFilter::FILES_ONLY;
+  filter.nameGlob = "async.*";
+  filter.sortBy = ListStatusFilter::BY_NAME;
+  filter.descending = true;
+  filter.limit = 2;
+
+  std::vector<FileStatus> top = client->listStatus(dir, filter);
+  std::vector<FileStatus> expected = client->listStatus(dir);
+  filter.apply(expected);
+
+  bool same = top.size() == expected.size() && top.size() == (size_t) filter.limit;
+  for (size_t i = 0; same && i < top.size(); i++) {
+    same = top[i].path == expected[i].path;
+  }
+  if (!same) {
+    std::cout << "FAILURE - filtered listing of " << dir << " returned " << top.size()
+        << " entries, expected " << expected.size() << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Last " << top.size() << " async files of " << dir << " are "
+      << top[0].path << " and " << top[1].path << std::endl;
+}
+
+void testNamespaceWalk(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - NAMESPACE WALK: ";
+  WalkOptions options;
+  options.numThreads = 4;
+
+  // Same totals, listing one directory at a time on this thread
+  WalkSummary expected;
+  std::vector<std::string> pending(1, dir);
+  while (!pending.empty()) {
+    std::vector<FileStatus> entries = client->listStatus(pending.back().c_str());
+    pending.pop_back();
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i].isFolder) {
+        expected.directories++;
+        pending.push_back(entries[i].path);
+      } else {
+        expected.files++;
+        expected.bytes += entries[i].length;
+      }
+    }
+  }
+
+  WalkSummary summary = count(*client, dir, options);
+  WalkSummary usage = du(*client, dir, options);
+  options.filter.nameGlob = "async.*";
+  std::vector<std::string> found = find(*client, dir, options);
+
+  if (summary.directories != expected.directories || summary.files != expected.files ||
+      summary.bytes != expected.bytes || usage.files != expected.files ||
+      usage.bytes != expected.bytes || found.size() != 4) {
+    std::cout << "FAILURE - walk of " << dir << " found " << summary.directories
+        << " directories and " << summary.files << " files, expected "
+        << expected.directories << " and " << expected.files << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Walked " << summary.directories << " directories and "
+      << summary.files << " files (" << summary.bytes << " bytes) under " << dir
+      << " on " << options.numThreads << " threads" << std::endl;
+}
+
+void testMetadataCache(jAlluxioFileSystem client, const char *path)
+{
+  std::cout << std::endl << "TEST - METADATA CACHE: ";
+  std::shared_ptr<MetadataCache> cache(new MetadataCache());
+  char content[] = "hello, alluxio!!";
+  bool ok = true;
+
+  client->setMetadataCache(cache);
+  try {
+    // Missing, then remembered as missing
+    ok = !client->exists(path) && !client->exists(path);
+
+    // Creating and deleting through the client must not leave stale entries
+    std::unique_ptr<FileOutStream> out(client->createFile(path));
+    out->write(content, strlen(content));
+    // Looked up while incomplete: the close drops what was cached then
+    client->fileSize(path);
+    out->close();
+    ok = ok && client->exists(path);
+    for (int i = 0; i < 3; i++) {
+      ok = ok && client->fileSize(path) == (long int) strlen(content);
+    }
+    client->deletePath(path);
+    ok = ok && !client->exists(path);
+
+    // Same for a close in the background, once its future is ready
+    out.reset(client->createFile(path));
+    out->write(content, strlen(content));
+    client->fileSize(path);
+    out->closeAsync().get();
+    ok = ok && client->fileSize(path) == (long int) strlen(content);
+    client->deletePath(path);
+  } catch (...) {
+    client->setMetadataCache(nullptr);
+    throw;
+  }
+  client->setMetadataCache(nullptr);
+
+  MetadataCacheStats stats = cache->stats();
+  int64_t lookups = stats.hits + stats.negativeHits + stats.misses;
+  if (!ok) {
+    std::cout << "FAILURE - cached metadata of " << path << " went stale" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << stats.hits + stats.negativeHits << " of " << lookups
+      << " lookups of " << path << " answered from cache" << std::endl;
+}
+
+void testURICache(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - URI CACHE: ";
+  std::string path = std::string(dir) + "/uricache";
+  AlluxioURICache &cache = AlluxioURICache::instance();
+
+  AlluxioURICacheStats before = cache.stats();
+  const int lookups = 4;
+  for (int i = 0; i < lookups; i++) {
+    client->exists(path.c_str());
+  }
+  AlluxioURICacheStats after = cache.stats();
+
+  // Shrinking evicts down to the new capacity
+  const int64_t capacity = 16;
+  cache.setCapacity(capacity);
+  int64_t entries = cache.stats().entries;
+  cache.setCapacity(DEFAULT_URI_CACHE_CAPACITY);
+
+  int64_t hits = after.hits - before.hits;
+  if (after.misses - before.misses != 1 || hits != lookups - 1 ||
+      entries > capacity) {
+    std::cout << "FAILURE - " << hits << " of " << lookups << " lookups of " << path
+        << " reused a cached URI" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << hits << " of " << lookups << " lookups of " << path
+      << " reused a cached URI" << std::endl;
+}
+
+void testStatusListing(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - STATUS LISTING: ";
+  std::vector<FileStatus> expected = client->listStatus(dir);
+
+  // The second listing reuses the buffers of the first
+  StatusListing listing;
+  const int rounds = 2;
+  for (int round = 0; round < rounds; round++) {
+    client->listStatus(dir, listing);
+    bool same = listing.size() == expected.size();
+    for (size_t i = 0; i < listing.size() && same; i++) {
+      same = listing[i].path == expected[i].path &&
+          listing[i].length == expected[i].length &&
+          listing[i].isFolder == expected[i].isFolder &&
+          listing[i].owner == expected[i].owner;
+    }
+    if (!same) {
+      std::cout << "FAILURE - listing " << round + 1 << " of " << dir
+          << " does not match listStatus()" << std::endl;
+      return;
+    }
+  }
+
+  StringArena arena;
+  FileStatusRef status = client->getStatus(dir, arena);
+  if (status.path != std::string(dir) || !status.isFolder) {
+    std::cout << "FAILURE - status of " << dir << " is " << status.path.str() << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Listed " << listing.size() << " entries of " << dir << " "
+      << rounds << " times into one StatusListing" << std::endl;
+}
+
+void testSharedPool(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - SHARED POOL: ";
+  if (!gSharedPoolSized || ThreadPool::shared().size() != gSharedPoolThreads) {
+    std::cout << "FAILURE - the shared pool was started before it was sized, with "
+        << ThreadPool::shared().size() << " threads" << std::endl;
+    return;
+  }
+  std::vector<FileStatus> entries = client->listStatus(dir);
+
+  // A thread that never attaches to the JVM itself
+  int found = 0;
+  std::string error;
+  std::thread caller([&entries, &found, &error] {
+    std::vector<std::future<bool> > results;
+    for (size_t i = 0; i < entries.size(); i++) {
+      std::string path = entries[i].path;
+      results.push_back(ThreadPool::shared().submitOperation(
+          [path](AlluxioFileSystem &fs) { return fs.exists(path.c_str()); }));
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+      try {
+        found += results[i].get() ? 1 : 0;
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+    }
+  });
+  caller.join();
+
+  // Library features run on the shared pool unless given another
+  ThreadPool own(2);
+  WalkOptions options;
+  options.pool = &own;
+  WalkSummary summary = count(*client, dir);
+  WalkSummary expected = count(*client, dir, options);
+
+  if (!error.empty() || found != (int) entries.size() ||
+      summary.files != expected.files || summary.directories != expected.directories) {
+    std::cout << "FAILURE - " << found << " of " << entries.size() << " entries of " << dir
+        << " found from an unattached thread " << error << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << found << " operations from an unattached thread ran on "
+      << ThreadPool::shared().size() << " shared threads" << std::endl;
+}
+
+void testAsyncOperations(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - ASYNC OPERATIONS: ";
+  std::string path = std::string(dir) + "/future.txt";
+  const char first[] = "written ";
+  const char second[] = "asynchronously";
+  std::string expected = std::string(first) + second;
+
+  // Both writes are queued before either runs; they land in order
+  std::unique_ptr<FileOutStream> out(client->createFileAsync(path.c_str()).get());
+  std::future<void> wrote1 = out->writeAsync(first, strlen(first));
+  std::future<void> wrote2 = out->writeAsync(second, strlen(second));
+  out->closeAsync().get();
+  wrote1.get();
+  wrote2.get();
+  out.reset();
+  FileStatus status = client->getStatusAsync(path.c_str()).get();
+
+  std::vector<char> head(expected.size());
+  std::vector<char> tail(strlen(second));
+  std::unique_ptr<FileInStream> in(client->openFileAsync(path.c_str()).get());
+  std::future<int> readHead = in->readAsync(head.data(), (int) head.size());
+  std::future<int> readTail = in->positionedReadAsync(strlen(first), tail.data(),
+                                                      (int) tail.size());
+  bool ok = status.length == (int64_t) expected.size() &&
+      readHead.get() == (int) head.size() && readTail.get() == (int) tail.size() &&
+      std::string(head.begin(), head.end()) == expected &&
+      std::string(tail.begin(), tail.end()) == second;
+  in->close();
+  in.reset();
+  client->deletePathAsync(path.c_str()).get();
+  ok = ok && !client->existsAsync(path.c_str()).get();
+
+  // Every status call of a listing in flight at once
+  std::vector<FileStatus> entries = client->listStatusAsync(dir).get();
+  std::vector<std::future<FileStatus> > statuses;
+  for (size_t i = 0; i < entries.size(); i++) {
+    statuses.push_back(client->getStatusAsync(entries[i].path.c_str()));
+  }
+  for (size_t i = 0; i < statuses.size(); i++) {
+    ok = ok && statuses[i].get().length == entries[i].length;
+  }
+
+  if (!ok) {
+    std::cout << "FAILURE - async write, read or delete of " << path
+        << " did not match" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << statuses.size() << " status calls in flight at once, "
+      << "and an async write, read and delete of " << path << std::endl;
+}
+
+#if defined(__cpp_impl_coroutine)
+/// Coroutine that starts at once and frees itself when done
+struct DetachedCoroutine {
+  struct promise_type {
+    DetachedCoroutine get_return_object() { return DetachedCoroutine(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+/// Executor resuming coroutines on the one thread calling run()
+class RunLoop {
+  public:
+    coro::Executor executor()
+    {
+      return [this](std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_ready.push_back(handle);
+        m_changed.notify_one();
+      };
+    }
+
+    void run(const int &remaining)
+    {
+      while (remaining > 0) {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_changed.wait(guard, [this] { return !m_ready.empty(); });
+        std::coroutine_handle<> handle = m_ready.front();
+        m_ready.pop_front();
+        guard.unlock();
+        handle.resume();
+      }
+    }
+
+  private:
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::deque<std::coroutine_handle<> > m_ready;
+};
+
+DetachedCoroutine writeCoroutine(AlluxioFileSystem &fs, std::string path, std::string data,
+                                 coro::Executor post, int &remaining, bool &ok)
+{
+  try {
+    std::unique_ptr<FileOutStream> out(co_await coro::createFile(fs, path.c_str(), post));
+    co_await coro::write(*out, data.data(), (int) data.size(), post);
+    co_await coro::close(*out, post);
+  } catch (jni::NativeException &e) {
+    e.discard();
+    ok = false;
+  }
+  remaining--;
+}
+
+DetachedCoroutine readCoroutine(AlluxioFileSystem &fs, std::string path, long pos,
+                                char *buff, int length, coro::Executor post,
+                                int &remaining, bool &ok)
+{
+  try {
+    std::unique_ptr<FileInStream> in(co_await coro::openFile(fs, path.c_str(), post));
+    int n = co_await coro::positionedRead(*in, pos, buff, length, post);
+    co_await coro::close(*in, post);
+    ok = ok && n == length;
+  } catch (jni::NativeException &e) {
+    e.discard();
+    ok = false;
+  }
+  remaining--;
+}
+
+void testCoroutines(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - COROUTINES: ";
+  const int readers = 64;
+  const int sliceSize = 16;
+  std::string path = std::string(dir) + "/coroutine.txt";
+  std::string data;
+  for (int i = 0; i < readers; i++) {
+    char slice[sliceSize + 1];
+    snprintf(slice, sizeof(slice), "slice %09d\n", i);
+    data += slice;
+  }
+
+  RunLoop loop;
+  bool ok = true;
+  int remaining = 1;
+  writeCoroutine(*client, path, data, loop.executor(), remaining, ok);
+  loop.run(remaining);
+
+  // Every read is in flight before the first one completes
+  std::vector<char> read(data.size());
+  remaining = readers;
+  for (int i = 0; i < readers; i++) {
+    readCoroutine(*client, path, (long) i * sliceSize, &read[i * sliceSize], sliceSize,
+                  loop.executor(), remaining, ok);
+  }
+  loop.run(remaining);
+  client->deletePath(path.c_str());
+
+  if (!ok || std::string(read.begin(), read.end()) != data) {
+    std::cout << "FAILURE - coroutine reads of " << path << " did not match" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << readers << " coroutines read " << path
+      << " on 1 executor thread" << std::endl;
+}
+#endif
+
+/// Wait on the descriptor of cq, like an event loop, until count completions arrived
+bool awaitCompletions(CompletionQueue &cq, size_t count, std::vector<Completion> &out)
+{
+  out.clear();
+  while (out.size() < count) {
+    struct pollfd ready = { cq.fd(), POLLIN, 0 };
+    if (poll(&ready, 1, 10000) <= 0) {
+      std::cout << "FAILURE - " << out.size() << " of " << count
+          << " completions arrived within 10 seconds" << std::endl;
+      return false;
+    }
+    cq.drain(out);
+  }
+  for (size_t i = 0; i < out.size(); i++) {
+    if (!out[i].ok) {
+      std::cout << "FAILURE - operation " << out[i].tag << ": " << out[i].error << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void testCompletionQueue(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - COMPLETION QUEUE: ";
+  std::string path = std::string(dir) + "/completion.txt";
+  const char data[] = "completed through an event loop";
+  const int slices = 4;
+  const int sliceSize = (sizeof(data) - 1) / slices;
+  CompletionQueue cq;
+  std::vector<Completion> done;
+  size_t total = 0;
+
+  cq.createFile(*client, path.c_str(), 1);
+  if (!awaitCompletions(cq, 1, done)) {
+    return;
+  }
+  std::unique_ptr<FileOutStream> out(done[0].outStream);
+  cq.write(*out, data, sizeof(data) - 1, 2);
+  cq.close(*out, 3);
+  total += done.size();
+  if (!awaitCompletions(cq, 2, done)) {
+    return;
+  }
+  out.reset();
+
+  // A stat of every entry of the directory and an open, all in flight
+  std::vector<FileStatus> entries = client->listStatus(dir);
+  cq.openFile(*client, path.c_str(), 4);
+  for (size_t i = 0; i < entries.size(); i++) {
+    cq.getStatus(*client, entries[i].path.c_str(), 100 + i);
+  }
+  total += done.size();
+  if (!awaitCompletions(cq, entries.size() + 1, done)) {
+    return;
+  }
+  bool ok = true;
+  std::unique_ptr<FileInStream> in;
+  for (size_t i = 0; i < done.size(); i++) {
+    if (done[i].tag == 4) {
+      in.reset(done[i].inStream);
+    } else {
+      ok = ok && done[i].status.length == entries[done[i].tag - 100].length;
+    }
+  }
+
+  char read[sizeof(data)] = { 0 };
+  for (int i = 0; i < slices; i++) {
+    cq.positionedRead(*in, i * sliceSize, read + i * sliceSize, sliceSize, 200 + i);
+  }
+  cq.close(*in, 5);
+  total += done.size();
+  if (!awaitCompletions(cq, slices + 1, done)) {
+    return;
+  }
+  in.reset();
+
+  // Only once the reads and the close are over
+  cq.deletePath(*client, path.c_str(), false, 6);
+  total += done.size();
+  if (!awaitCompletions(cq, 1, done)) {
+    return;
+  }
+  total += done.size();
+
+  if (!ok || strncmp(read, data, slices * sliceSize) != 0 || cq.pending() != 0) {
+    std::cout << "FAILURE - completions of " << path << " did not match" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << total << " completions for " << path << " and the entries of "
+      << dir << " drained from one descriptor" << std::endl;
+}
+
+void testSharedHandles(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - SHARED HANDLES: ";
+  const int tasks = 8;
+  const int sliceSize = 16;
+  std::string path = std::string(dir) + "/handles.txt";
+  std::string data;
+  for (int i = 0; i < tasks; i++) {
+    char slice[sliceSize + 1];
+    snprintf(slice, sizeof(slice), "handle %08d\n", i);
+    data += slice;
+  }
+
+  // Created here, written and closed on a pool thread
+  FileOutStream *out = client->createFile(path.c_str());
+  ThreadPool::shared().submit([out, &data] {
+    out->write(data.data(), (int) data.size());
+    out->close();
+    delete out;
+  }).get();
+
+  // One stream and one file system, used by every task at once
+  std::unique_ptr<FileInStream> in(client->openFile(path.c_str()));
+  std::vector<char> read(data.size());
+  std::vector<std::future<int> > reads;
+  for (int i = 0; i < tasks; i++) {
+    FileInStream *stream = in.get();
+    char *buff = &read[i * sliceSize];
+    reads.push_back(ThreadPool::shared().submit([stream, buff, i] {
+      return stream->positionedRead((long) i * sliceSize, buff, sliceSize);
+    }));
+  }
+  std::future<long> length = ThreadPool::shared().submit([client, &path] {
+    return client->fileSize(path.c_str());
+  });
+  bool ok = length.get() == (long) data.size();
+  for (int i = 0; i < tasks; i++) {
+    ok = reads[i].get() == sliceSize && ok;
+  }
+  in->close();
+  client->deletePath(path.c_str());
+
+  if (!ok || std::string(read.begin(), read.end()) != data) {
+    std::cout << "FAILURE - " << path << " read from pool threads did not match" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << tasks << " pool tasks read one stream of " << path
+      << " opened on the main thread" << std::endl;
+}
+
+void testSharedFileSystem(const char *dir)
+{
+  std::cout << std::endl << "TEST - SHARED FILE SYSTEM: ";
+  const int numThreads = 8;
+  std::vector<AlluxioFileSystem *> seen(numThreads);
+  std::vector<int> found(numThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; i++) {
+    threads.push_back(std::thread([i, dir, &seen, &found] {
+      try {
+        seen[i] = &AlluxioFileSystem::shared();
+        found[i] = seen[i]->exists(dir) ? 1 : 0;
+      } catch (jni::NativeException &e) {
+        e.discard();
+      }
+      jni::Env().DetachCurrentThread();
+    }));
+  }
+  for (int i = 0; i < numThreads; i++) {
+    threads[i].join();
+  }
+  AlluxioClientContext *poolContext = ThreadPool::shared().submit([] {
+    return ThreadPool::currentContext();
+  }).get();
+
+  bool ok = poolContext == &AlluxioClientContext::shared();
+  for (int i = 0; i < numThreads; i++) {
+    ok = ok && seen[i] == &AlluxioFileSystem::shared() && found[i] == 1;
+  }
+  if (!ok) {
+    std::cout << "FAILURE - threads did not share one file system finding " << dir << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << numThreads << " threads found " << dir
+      << " through one shared file system" << std::endl;
+}
+
+void testIoScheduler(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - IO SCHEDULER: ";
+  const int numStreams = 4;
+  const int readsPerStream = 4;
+  const int sliceSize = 1024;
+  const int interactiveCalls = 8;
+  std::string path = std::string(dir) + "/scheduler.txt";
+  std::string data;
+  for (int i = 0; i < numStreams * readsPerStream; i++) {
+    data += std::string(sliceSize - 1, (char) ('a' + i)) + "\n";
+  }
+  FileOutStream *out = client->createFile(path.c_str());
+  out->write(data.data(), (int) data.size());
+  out->close();
+  delete out;
+
+  // Bulk reads: 2 at a time, 64 KB/s after a 4 KB burst
+  IoScheduler scheduler;
+  IoLimits batch;
+  batch.maxInFlight = 2;
+  batch.bytesPerSecond = 64 * 1024;
+  batch.burstBytes = 4 * 1024;
+  scheduler.setLimits(IoClass::BATCH, batch);
+  IoScheduler::install(&scheduler);
+
+  std::vector<std::unique_ptr<FileInStream> > streams;
+  for (int s = 0; s < numStreams; s++) {
+    streams.push_back(std::unique_ptr<FileInStream>(client->openFile(path.c_str())));
+  }
+  std::vector<char> read(data.size());
+  std::vector<std::future<int> > reads;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  {
+    IoScope scope(IoClass::BATCH, "bulk-copy");
+    for (int s = 0; s < numStreams; s++) {
+      for (int r = 0; r < readsPerStream; r++) {
+        long pos = (long) (s * readsPerStream + r) * sliceSize;
+        reads.push_back(streams[s]->positionedReadAsync(pos, &read[pos], sliceSize));
+      }
+    }
+  }
+
+  // Serving calls meanwhile are not held back by the batch limits
+  bool ok = true;
+  for (int i = 0; i < interactiveCalls; i++) {
+    ok = client->getStatus(path.c_str()).length == (long) data.size() && ok;
+  }
+  for (size_t i = 0; i < reads.size(); i++) {
+    ok = reads[i].get() == sliceSize && ok;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  for (int s = 0; s < numStreams; s++) {
+    streams[s]->close();
+  }
+  IoScheduler::install(NULL);
+  IoClassStats bulk = scheduler.stats(IoClass::BATCH);
+  IoClassStats serving = scheduler.stats(IoClass::INTERACTIVE);
+  client->deletePath(path.c_str());
+
+  // 12 KB past the burst at 64 KB/s take at least 0.1875 seconds
+  if (!ok || std::string(read.begin(), read.end()) != data ||
+      bulk.admitted != (int64_t) reads.size() || bulk.peakInFlight > batch.maxInFlight ||
+      bulk.waited == 0 || elapsed.count() < 0.15 ||
+      serving.admitted < interactiveCalls || serving.waited != 0) {
+    std::cout << "FAILURE - " << bulk.admitted << " batch reads of " << path << ", "
+        << bulk.peakInFlight << " at most at a time in " << elapsed.count() << " seconds, "
+        << serving.waited << " interactive calls waited" << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << bulk.admitted << " batch reads of " << path << " ran at most "
+      << batch.maxInFlight << " at a time under the byte rate, " << interactiveCalls
+      << " interactive calls never waited" << std::endl;
+}
+
+void testNamespaceSnapshot(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - NAMESPACE SNAPSHOT: ";
+  char snapshotFile[] = "/tmp/alluxiotest-snapshot.XXXXXX";
+  int fd = mkstemp(snapshotFile);
+  if (fd < 0) {
+    std::cout << "FAILURE - could not create local snapshot file" << std::endl;
+    return;
+  }
+  close(fd);
+
+  std::string added = std::string(dir) + "/snapshot.txt";
+  std::string replaced = std::string(dir) + "/snapshot.dir";
+  bool ok;
+  int relisted;
+  int64_t size;
+  try {
+    client->createDirectory(replaced.c_str());
+    NamespaceSnapshot::create(*client, dir, snapshotFile, 4);
+    NamespaceSnapshot snapshot(snapshotFile);
+    WalkSummary summary = count(*client, dir);
+    ok = snapshot.size() == summary.directories + summary.files + 1 &&
+        snapshot.listStatus(dir).size() == client->listStatus(dir).size() &&
+        !snapshot.exists(added.c_str());
+
+    // Only the directory that changed is listed again
+    std::unique_ptr<FileOutStream> out(client->createFile(added.c_str()));
+    out->write(dir, strlen(dir));
+    out->close();
+    relisted = snapshot.refresh(*client, 4);
+    ok = ok && snapshot.fileSize(added.c_str()) == (int64_t) strlen(dir);
+    size = snapshot.size();
+    client->deletePath(added.c_str());
+
+    // A directory replaced by a file is listed once, as the file
+    client->deletePath(replaced.c_str(), true);
+    out.reset(client->createFile(replaced.c_str()));
+    out->close();
+    snapshot.refresh(*client, 4);
+    std::vector<FileStatus> listing = snapshot.listStatus(dir);
+    int seen = 0;
+    for (size_t i = 0; i < listing.size(); i++) {
+      if (listing[i].path == replaced) {
+        seen++;
+        ok = ok && !listing[i].isFolder;
+      }
+    }
+    ok = ok && seen == 1 && listing.size() == client->listStatus(dir).size();
+    client->deletePath(replaced.c_str());
+  } catch (...) {
+    unlink(snapshotFile);
+    throw;
+  }
+  unlink(snapshotFile);
+
+  if (!ok || relisted != 1) {
+    std::cout << "FAILURE - snapshot of " << dir << " does not match the namespace"
+        << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Snapshot of " << size << " entries under " << dir
+      << " refreshed by re-listing " << relisted << " directory" << std::endl;
+}
+
+void testBatchOperations(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - BATCH OPERATIONS: ";
+  std::string base = std::string(dir) + "/batch";
+  BatchOptions options;
+  options.numThreads = 4;
+
+  // Parents are created first, whatever the order given
+  std::vector<std::string> dirs;
+  dirs.push_back(base + "/a/x");
+  dirs.push_back(base + "/a/y");
+  dirs.push_back(base + "/b");
+  std::vector<BatchResult> created = mkdirsMany(*client, dirs, options);
+
+  std::vector<std::string> checked(dirs);
+  checked.push_back(base + "/missing");
+  std::vector<BatchResult> found = existsMany(*client, checked, options);
+
+  // The second rename lands in the directory the first one makes
+  std::vector<std::pair<std::string, std::string> > renames;
+  renames.push_back(std::make_pair(base + "/b", base + "/c"));
+  renames.push_back(std::make_pair(base + "/a/x", base + "/c/x"));
+  std::vector<BatchResult> renamed = renameMany(*client, renames, options);
+
+  // Children go first, so no delete needs to be recursive
+  std::vector<std::string> deleted;
+  deleted.push_back(base);
+  deleted.push_back(base + "/a");
+  deleted.push_back(base + "/a/y");
+  deleted.push_back(base + "/c");
+  deleted.push_back(base + "/c/x");
+  std::vector<BatchResult> removed = deleteMany(*client, deleted, false, options);
+
+  std::vector<BatchResult> all;
+  all.insert(all.end(), created.begin(), created.end());
+  all.insert(all.end(), found.begin(), found.end());
+  all.insert(all.end(), renamed.begin(), renamed.end());
+  all.insert(all.end(), removed.begin(), removed.end());
+  for (size_t i = 0; i < all.size(); i++) {
+    if (!all[i].ok) {
+      std::cout << "FAILURE - " << all[i].error << std::endl;
+      return;
+    }
+  }
+  if (!found[0].exists || !found[1].exists || !found[2].exists || found[3].exists ||
+      client->exists(base.c_str())) {
+    std::cout << "FAILURE - batch results do not match " << base << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Created " << created.size() << ", renamed " << renamed.size()
+      << " and deleted " << removed.size() << " paths under " << base << " on "
+      << options.numThreads << " threads" << std::endl;
+}
+
+void testAdaptiveConcurrency(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - ADAPTIVE CONCURRENCY: ";
+  ConcurrencyLimitOptions limits;
+  limits.algorithm = LimitAlgorithm::AIMD;
+  limits.initialLimit = 2;
+  limits.maxLimit = 16;
+  limits.windowSize = 8;
+  ConcurrencyLimiter limiter(limits);
+
+  BatchOptions options;
+  options.numThreads = 16;
+  options.limiter = &limiter;
+  std::vector<std::string> paths;
+  for (int i = 0; i < 64; i++) {
+    paths.push_back(std::string(dir) + "/adaptive-" + std::to_string(i));
+  }
+  paths[0] = dir;
+  std::vector<BatchResult> found = existsMany(*client, paths, options);
+  for (size_t i = 0; i < found.size(); i++) {
+    if (!found[i].ok) {
+      std::cout << "FAILURE - " << found[i].error << std::endl;
+      return;
+    }
+  }
+  if (!found[0].exists || found[1].exists) {
+    std::cout << "FAILURE - exists results do not match " << dir << std::endl;
+    return;
+  }
+
+  ConcurrencyLimitStats stats = limiter.stats();
+  std::vector<LimitDecision> decisions = limiter.decisions();
+  int highest = limits.initialLimit;
+  for (size_t i = 0; i < decisions.size(); i++) {
+    if (decisions[i].limit < limits.minLimit || decisions[i].limit > limits.maxLimit) {
+      std::cout << "FAILURE - limit moved to " << decisions[i].limit << std::endl;
+      return;
+    }
+    highest = std::max(highest, decisions[i].limit);
+  }
+  if (decisions.size() != paths.size() / limits.windowSize ||
+      stats.completed != (int64_t) paths.size() || stats.inFlight != 0 ||
+      stats.peakInFlight > highest) {
+    std::cout << "FAILURE - " << decisions.size() << " decisions, " << stats.completed
+        << " completions, peak " << stats.peakInFlight << " over a limit of "
+        << highest << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << decisions.size() << " decisions over " << paths.size()
+      << " exists calls on " << dir << " kept the limit between " << limits.minLimit
+      << " and " << limits.maxLimit << std::endl;
+}
+
+void testDeadlines(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - DEADLINES: ";
+  std::string path = std::string(dir) + "/deadline.txt";
+  std::string data = "bounded by a deadline\n";
+  FileOutStream *out = client->createFile(path.c_str());
+  out->write(data.data(), (int) data.size());
+  out->close();
+  delete out;
+
+  // Calls that finish in time return as usual
+  std::unique_ptr<FileInStream> in;
+  std::vector<char> read(data.size());
+  bool ok;
+  {
+    DeadlineScope deadline(std::chrono::seconds(10));
+    ok = client->getStatus(path.c_str()).length == (long) data.size();
+    in.reset(client->openFile(path.c_str()));
+    ok = in->positionedRead(0, read.data(), (int) read.size()) == (int) data.size() && ok;
+  }
+
+  // Created before admission is held; cancelled once its write is given up on
+  std::string heldPath = path + ".held";
+  std::unique_ptr<FileOutStream> held(client->createFile(heldPath.c_str()));
+
+  // Hold the only batch slot, so that batch calls hang in admission
+  IoScheduler scheduler;
+  IoLimits batch;
+  batch.maxInFlight = 1;
+  scheduler.setLimits(IoClass::BATCH, batch);
+  IoScheduler::install(&scheduler);
+  IoScope scope(IoClass::BATCH);
+  std::unique_ptr<IoAdmission> slot(new IoAdmission(0));
+
+  const std::chrono::milliseconds timeout(100);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool timedOut = false;
+  try {
+    DeadlineScope deadline(timeout);
+    in->positionedRead(0, read.data(), (int) read.size());
+  } catch (const TimeoutException &) {
+    timedOut = true;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  // The stream is given up on with the call, even without a deadline
+  bool refused = false;
+  try {
+    in->read();
+  } catch (const TimeoutException &) {
+    refused = true;
+  }
+  in->close();
+
+  bool writeTimedOut = false;
+  try {
+    DeadlineScope deadline(timeout);
+    held->write(data.data(), (int) data.size());
+  } catch (const TimeoutException &) {
+    writeTimedOut = true;
+  }
+
+  CancellationToken token;
+  std::thread canceller([token]() mutable {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    token.cancel();
+  });
+  bool cancelled = false;
+  try {
+    DeadlineScope deadline(token);
+    client->exists(path.c_str());
+  } catch (const CancelledException &) {
+    cancelled = true;
+  }
+  canceller.join();
+
+  // The abandoned calls finish once admitted; the scheduler waits for them
+  slot.reset();
+  IoScheduler::install(NULL);
+  client->deletePath(path.c_str());
+
+  // A background close of the stream given up on fails, and is not left
+  // outstanding
+  std::future<void> close = held->closeAsync();
+  std::shared_ptr<std::promise<void> > idle = std::make_shared<std::promise<void> >();
+  std::future<void> closesDone = idle->get_future();
+  std::thread([idle] {
+    OutStream::awaitAsyncCloses();
+    idle->set_value();
+  }).detach();
+  bool drained = closesDone.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+  bool closeRefused = false;
+  try {
+    close.get();
+  } catch (const TimeoutException &) {
+    closeRefused = true;
+  }
+
+  if (!ok || std::string(read.begin(), read.end()) != data || !timedOut || !refused ||
+      !cancelled || !writeTimedOut || !closeRefused || !drained ||
+      elapsed.count() < 0.1 || elapsed.count() > 2) {
+    std::cout << "FAILURE - deadline of " << path << " gave up after " << elapsed.count()
+        << " seconds, stream " << (refused ? "refused" : "accepted")
+        << " later calls, cancel " << (cancelled ? "worked" : "did not work")
+        << ", background close of a held write " << (closeRefused ? "refused" : "accepted")
+        << (drained ? "" : " and left outstanding") << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - Read " << path << " within a deadline, gave up on a held read after "
+      << timeout.count() << " ms and on a cancelled call, the stream refused later calls"
+      << " and a background close of a held write was not left outstanding" << std::endl;
+}
+
+void testHedgedReads(jAlluxioFileSystem client, const char *dir)
+{
+  std::cout << std::endl << "TEST - HEDGED READS: ";
+  std::string path = std::string(dir) + "/hedged.txt";
+  std::string data;
+  for (int i = 0; data.size() < 64 * 1024; i++) {
+    data += "hedged block " + std::to_string(i) + "\n";
+  }
+  FileOutStream *out = client->createFile(path.c_str());
+  out->write(data.data(), (int) data.size());
+  out->close();
+  delete out;
+
+  // A delay every read exceeds: the budget alone decides what is hedged
+  const int numReads = 200;
+  const int readSize = 512;
+  HedgedReadOptions options;
+  options.delayMs = 0.001;
+  HedgedInStream fixed(*client, path.c_str(), options);
+  bool matched = true;
+  std::vector<char> buff(readSize);
+  for (int i = 0; i < numReads; i++) {
+    int64_t pos = (i * 4099) % (data.size() - readSize);
+    int read = fixed.positionedRead(pos, buff.data(), readSize);
+    matched = matched && read == readSize &&
+        std::string(buff.data(), read) == data.substr(pos, readSize);
+  }
+  fixed.close();
+  HedgedReadStats stats = fixed.stats();
+  double budget = options.budgetBurst + options.budgetRatio * numReads;
+
+  // The delay then comes from the latency of the reads
+  HedgedReadOptions learned;
+  learned.minDelayMs = 0;
+  HedgedInStream p95(*client, path.c_str(), learned);
+  for (int i = 0; i < numReads; i++) {
+    int64_t pos = (i * 7919) % (data.size() - readSize);
+    int read = p95.positionedRead(pos, buff.data(), readSize);
+    matched = matched && read == readSize &&
+        std::string(buff.data(), read) == data.substr(pos, readSize);
+  }
+  p95.close();
+  HedgedReadStats learnedStats = p95.stats();
+  client->deletePath(path.c_str());
+
+  if (!matched || stats.reads != numReads || stats.hedged <= 0 || stats.hedged > budget ||
+      stats.reopened != stats.cancelled ||
+      stats.hedgeWins > stats.hedged || stats.cancelled > stats.hedged ||
+      learnedStats.delayMs <= 0 || learnedStats.hedged > learned.budgetBurst +
+      learned.budgetRatio * numReads) {
+    std::cout << "FAILURE - " << (matched ? "" : "wrong data, ") << stats.hedged
+        << " hedges for a budget of " << budget << ", " << stats.overBudget << " over budget, "
+        << stats.reopened << " of " << stats.cancelled << " cancelled streams reopened, "
+        << learnedStats.hedged << " hedges after a delay of " << learnedStats.delayMs << " ms"
+        << std::endl;
+    return;
+  }
+  std::cout << "SUCCESS - " << 2 * numReads << " hedged reads of " << path
+      << " returned the right data, with hedges kept within budget" << std::endl;
+}
+
 void testDeleteFile(jAlluxioFileSystem client, const char *path, bool recursive)
 {
   std::cout << std::endl << "TEST - DELETE FILE: ";
@@ -414,6 +1718,8 @@ void testDeleteFile(jAlluxioFileSystem client, const char *path, bool recursive)
 int main(int argc, char*argv[])
 {
   program_name = argv[0];
+  // Set once: copies run on several threads
+  std::cout.precision(15);
   if (argc < 3 || argc > 4) {
     usage();
     exit(1);
@@ -432,6 +1738,7 @@ int main(int argc, char*argv[])
 
   try {
       AlluxioClientContext::connect(host, port, awsAccessKey, awsSecretKey);
+      gSharedPoolSized = ThreadPool::configureShared(gSharedPoolThreads);
       AlluxioClientContext acc;
       AlluxioFileSystem stackFS(acc);
       jAlluxioFileSystem client = &stackFS;
@@ -477,23 +1784,119 @@ int main(int argc, char*argv[])
       // Test directory shows up in ls
       testLsCommand(client, gDirToCreate, ListPathFilter::DIRECTORIES_ONLY);
 
+      // Read all the status fields of the directory in one call
+      testGetStatus(client, gDirToCreate);
+
+      // Write and read back a file striped over several parts
+      testStripedFile(client, gStripedFileToCreate);
+
+      // Close several CACHE_THROUGH files without waiting on each one
+      testAsyncClose(client, gDirToCreate);
+
+      // Write through a local staging directory and wait for the upload
+      testLocalStaging(client, gStagedFileToCreate);
+
+      // Commit task outputs through a job manifest instead of renames
+      testOutputCommitter(client, gJobOutputDir);
+
+      // Store many small objects in a few pack files behind one index
+      testPackFile(client, gPackDirToCreate);
+
+      // Walk the test directory a few entries at a time
+      testDirectoryIterator(client, gDirToCreate);
+
+      // Let the JVM filter, sort and cut a listing before it crosses JNI
+      testFilteredListing(client, gDirToCreate);
+
+      // Count and search the test directory tree on several threads
+      testNamespaceWalk(client, gDirToCreate);
+
+      // Repeated lookups of one path served from the metadata cache
+      testMetadataCache(client, gCachedFileToCreate);
+
+      // Save the test directory tree locally and catch up with a change
+      testNamespaceSnapshot(client, gDirToCreate);
+
+      // Repeated calls on a path share one Java URI
+      testURICache(client, gDirToCreate);
+
+      // List into reused buffers instead of a string per entry
+      testStatusListing(client, gDirToCreate);
+
+      // Submit operations from a thread that is not attached to the JVM
+      testSharedPool(client, gDirToCreate);
+
+      // Write, read, stat and delete through futures
+      testAsyncOperations(client, gDirToCreate);
+
+#if defined(__cpp_impl_coroutine)
+      // Many reads in flight from coroutines on one thread
+      testCoroutines(client, gDirToCreate);
+#endif
+
+      // Operations driven from a poll loop
+      testCompletionQueue(client, gDirToCreate);
+
+      // Streams and file systems used from threads that did not create them
+      testSharedHandles(client, gDirToCreate);
+
+      // Share one file system between threads that never attached
+      testSharedFileSystem(gDirToCreate);
+
+      // Hold bulk reads to their limits while serving calls go through
+      testIoScheduler(client, gDirToCreate);
+
+      // Prepare and clean up a small tree in batches
+      testBatchOperations(client, gDirToCreate);
+
+      // Let the observed latency pick how many batch calls run at once
+      testAdaptiveConcurrency(client, gDirToCreate);
+
+      // Give up on calls at their deadline or when cancelled
+      testDeadlines(client, gDirToCreate);
+
+      // Hedge slow positional reads on a second stream
+      testHedgedReads(client, gDirToCreate);
+
       if (file != NULL)
       {
           std::string alluxioFile = inputFileToAlluxioPath(file);
 
-          // FIXME: Make number of threads a command line option
-          const int numThreads = 1;
+          // Files copied; how many copies run at once is up to the shared
+          // limiter of the class, which starts above this and adjusts to
+          // the latency of the copies
+          const int numCopies = 4;
+          IoClass copyClass = IoScope::currentClass();
+          // Each copy prints its output in one piece once it is done
+          std::mutex outputLock;
           std::vector<std::thread> threads;
           std::vector<std::string> fileNames;
+          for (int i=0; i<numCopies; i++)
+          {
+              fileNames.push_back(std::string(alluxioFile + "." + std::to_string(i)));
+          }
 
           // Copy a variable number of files to Alluxio (in parallel)
-          for (int i=0; i<numThreads; i++)
+          for (int i=0; i<numCopies; i++)
           {
-              fileNames.push_back(std::string(alluxioFile + "." + std::to_string(i)));
-              threads.push_back(std::thread(testCopyFile, client, file, fileNames.back().c_str()));
+              const char *copyName = fileNames[i].c_str();
+              threads.push_back(std::thread([client, file, copyName, copyClass,
+                                             &outputLock] {
+                  std::ostringstream output;
+                  output.precision(std::cout.precision());
+                  {
+                      ConcurrencyPermit permit(ConcurrencyLimiter::shared(copyClass));
+                      testCopyFile(client, file, copyName, output);
+                  }
+                  {
+                      std::lock_guard<std::mutex> guard(outputLock);
+                      std::cout << output.str();
+                  }
+                  jni::Env().DetachCurrentThread();
+              }));
           }
 
-          for (int j=0; j<numThreads; j++)
+          for (int j=0; j<numCopies; j++)
           {
               threads.back().join();
               threads.pop_back();
@@ -0,0 +1,381 @@
+/**
+ * Batched metadata operations
+ *
+ */
+
+#include "BatchOperations.h"
+#include "ConcurrencyLimit.h"
+#include "IoScheduler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+namespace {
+
+/// Alluxio ignores trailing slashes; so do batches
+std::string normalize(const std::string &path)
+{
+  std::string::size_type end = path.find_last_not_of('/');
+  return end == std::string::npos ? std::string("/") : path.substr(0, end + 1);
+}
+
+/// Ancestors of a normalized path, nearest first, "/" last
+std::vector<std::string> ancestors(const std::string &path)
+{
+  std::vector<std::string> result;
+  std::string::size_type slash = path.rfind('/');
+  while (slash != std::string::npos && path != "/") {
+    result.push_back(path.substr(0, slash > 0 ? slash : 1));
+    if (slash == 0) {
+      break;
+    }
+    slash = path.rfind('/', slash - 1);
+  }
+  return result;
+}
+
+typedef std::function<void(AlluxioFileSystem &fs, size_t item,
+                           BatchResult &result)> Operation;
+
+/**
+   Items of a batch and the order between them.  Each item runs on the pool
+   once the items it waits for are done, and the limiter, if any, has a
+   permit for it.
+*/
+class Batch {
+  public:
+    /**
+       @param[in] fs File system of the calling thread
+       @param[in] operation Runs one item; throws if it fails
+       @param[in] skipAfterFailure Whether an item is skipped when one it
+                  waits for failed
+    */
+    Batch(AlluxioFileSystem &fs, const Operation &operation, bool skipAfterFailure)
+        : m_cache(fs.metadataCache()), m_operation(operation),
+          m_skipAfterFailure(skipAfterFailure), m_ioClass(IoScope::currentClass()),
+          m_tenant(IoScope::currentTenant()), m_outstanding(0), m_executor(NULL),
+          m_limiter(NULL) {}
+
+    size_t add()
+    {
+      m_items.push_back(Item());
+      return m_items.size() - 1;
+    }
+
+    /// Run then only once first is done
+    void order(size_t first, size_t then)
+    {
+      m_items[first].next.push_back(then);
+      m_items[then].waiting++;
+    }
+
+    std::vector<BatchResult> run(const BatchOptions &options)
+    {
+      m_results.assign(m_items.size(), BatchResult());
+      if (m_items.empty()) {
+        return m_results;
+      }
+
+      // Waits, once the batch is done, for its tasks still finishing
+      BoundedExecutor executor(options.pool != NULL ? *options.pool : ThreadPool::shared(),
+                               std::min(options.numThreads, (int) m_items.size()));
+      m_executor = &executor;
+      if (options.adaptive) {
+        m_limiter = options.limiter != NULL ? options.limiter :
+                                              &ConcurrencyLimiter::shared(m_ioClass);
+      }
+      m_outstanding = m_items.size();
+      for (size_t i = 0; i < m_items.size(); i++) {
+        if (m_items[i].waiting == 0) {
+          start(i);
+        }
+      }
+
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_idle.wait(guard, [this] { return m_outstanding == 0; });
+      return m_results;
+    }
+
+  private:
+    struct Item {
+        Item() : waiting(0), blocked(false) {}
+
+        /// Items not done yet that this one waits for
+        int waiting;
+        /// Whether one of them failed
+        bool blocked;
+        std::vector<size_t> next;
+    };
+
+    void start(size_t i)
+    {
+      if (m_limiter == NULL) {
+        m_executor->execute([this, i] { perform(i); });
+        return;
+      }
+      m_limiter->acquireAsync([this, i] {
+        m_executor->execute([this, i] { perform(i); });
+      });
+    }
+
+    void perform(size_t i)
+    {
+      BatchResult &result = m_results[i];
+      ConcurrencyLimiter::Clock::time_point started = ConcurrencyLimiter::Clock::now();
+      try {
+        AlluxioClientContext *context = ThreadPool::currentContext();
+        if (context == NULL) {
+          throw std::runtime_error("batch thread is not attached to the JVM");
+        }
+        IoScope scope(m_ioClass, m_tenant);
+        AlluxioFileSystem fs(*context);
+        fs.setMetadataCache(m_cache);
+        m_operation(fs, i, result);
+        result.ok = true;
+      } catch (NativeException &e) {
+        result.error = e.what();
+        e.discard();
+      } catch (const std::exception &e) {
+        result.error = e.what();
+      }
+      // Failed items were still answered by the master: only latency counts
+      if (m_limiter != NULL) {
+        m_limiter->release(ConcurrencyLimiter::Clock::now() - started);
+      }
+      done(i);
+    }
+
+    /// Release the items waiting for i; skipped ones are done at once
+    void done(size_t i)
+    {
+      std::vector<size_t> finished(1, i);
+      std::vector<size_t> ready;
+      std::unique_lock<std::mutex> guard(m_lock);
+      while (!finished.empty()) {
+        size_t f = finished.back();
+        finished.pop_back();
+        for (size_t n = 0; n < m_items[f].next.size(); n++) {
+          Item &next = m_items[m_items[f].next[n]];
+          if (!m_results[f].ok && m_skipAfterFailure) {
+            next.blocked = true;
+          }
+          if (--next.waiting > 0) {
+            continue;
+          }
+          if (next.blocked) {
+            m_results[m_items[f].next[n]].error =
+                "skipped: an operation it depends on failed";
+            finished.push_back(m_items[f].next[n]);
+          } else {
+            ready.push_back(m_items[f].next[n]);
+          }
+        }
+        m_outstanding--;
+      }
+      if (m_outstanding == 0) {
+        m_idle.notify_all();
+      }
+      guard.unlock();
+
+      for (size_t r = 0; r < ready.size(); r++) {
+        start(ready[r]);
+      }
+    }
+
+    std::shared_ptr<MetadataCache> m_cache;
+    Operation m_operation;
+    bool m_skipAfterFailure;
+    IoClass m_ioClass;
+    std::string m_tenant;
+    std::vector<Item> m_items;
+    std::vector<BatchResult> m_results;
+    std::mutex m_lock;
+    std::condition_variable m_idle;
+    size_t m_outstanding;
+    BoundedExecutor *m_executor;
+    ConcurrencyLimiter *m_limiter;
+};
+
+} // namespace
+
+std::vector<BatchResult> alluxio::existsMany(AlluxioFileSystem &fs,
+                                             const std::vector<std::string> &paths,
+                                             const BatchOptions &options)
+{
+  Batch batch(fs, [&paths](AlluxioFileSystem &fs, size_t i, BatchResult &result) {
+    result.exists = fs.exists(paths[i].c_str());
+  }, false);
+  for (size_t i = 0; i < paths.size(); i++) {
+    batch.add();
+  }
+  return batch.run(options);
+}
+
+std::vector<BatchResult> alluxio::mkdirsMany(AlluxioFileSystem &fs,
+                                             const std::vector<std::string> &paths,
+                                             const BatchOptions &options)
+{
+  std::vector<std::string> dirs;
+  Batch batch(fs, [&dirs](AlluxioFileSystem &fs, size_t i, BatchResult &) {
+    try {
+      fs.createDirectory(dirs[i].c_str());
+    } catch (NativeException &e) {
+      // Fine if it is there already, as a directory
+      bool isFolder = false;
+      try {
+        isFolder = fs.getStatus(dirs[i].c_str()).isFolder;
+      } catch (NativeException &statError) {
+        statError.discard();
+      }
+      if (!isFolder) {
+        throw;
+      }
+      e.discard();
+    }
+  }, true);
+
+  // One item per directory, waiting for its parent; "/" always exists
+  std::unordered_map<std::string, size_t> items;
+  std::vector<long> itemOfPath(paths.size(), -1);
+  for (size_t p = 0; p < paths.size(); p++) {
+    std::string path = normalize(paths[p]);
+    std::vector<std::string> missing;
+    if (items.find(path) == items.end() && path != "/") {
+      missing.push_back(path);
+      std::vector<std::string> up = ancestors(path);
+      for (size_t a = 0; a < up.size() && up[a] != "/" &&
+                         items.find(up[a]) == items.end(); a++) {
+        missing.push_back(up[a]);
+      }
+    }
+
+    // Outermost first, so that parents have their item already
+    for (size_t m = missing.size(); m-- > 0;) {
+      size_t item = batch.add();
+      dirs.push_back(missing[m]);
+      items[missing[m]] = item;
+      std::vector<std::string> up = ancestors(missing[m]);
+      if (!up.empty() && up[0] != "/") {
+        batch.order(items[up[0]], item);
+      }
+    }
+    if (path != "/") {
+      itemOfPath[p] = (long) items[path];
+    }
+  }
+
+  std::vector<BatchResult> created = batch.run(options);
+  std::vector<BatchResult> results(paths.size());
+  for (size_t p = 0; p < paths.size(); p++) {
+    if (itemOfPath[p] >= 0) {
+      results[p] = created[itemOfPath[p]];
+    } else {
+      results[p].ok = true;
+    }
+  }
+  return results;
+}
+
+std::vector<BatchResult> alluxio::deleteMany(AlluxioFileSystem &fs,
+                                             const std::vector<std::string> &paths,
+                                             bool recursive,
+                                             const BatchOptions &options)
+{
+  std::vector<std::string> unique;
+  Batch batch(fs, [&unique, recursive](AlluxioFileSystem &fs, size_t i, BatchResult &) {
+    fs.deletePath(unique[i].c_str(), recursive);
+  }, false);
+
+  // Repeated paths are deleted once
+  std::unordered_map<std::string, size_t> items;
+  std::vector<size_t> itemOfPath(paths.size());
+  for (size_t p = 0; p < paths.size(); p++) {
+    std::string path = normalize(paths[p]);
+    std::unordered_map<std::string, size_t>::iterator it = items.find(path);
+    if (it == items.end()) {
+      it = items.insert(std::make_pair(path, batch.add())).first;
+      unique.push_back(path);
+    }
+    itemOfPath[p] = it->second;
+  }
+
+  // Each path waits for the paths of the batch right below it
+  for (size_t i = 0; i < unique.size(); i++) {
+    std::vector<std::string> up = ancestors(unique[i]);
+    for (size_t a = 0; a < up.size(); a++) {
+      std::unordered_map<std::string, size_t>::iterator it = items.find(up[a]);
+      if (it != items.end()) {
+        batch.order(i, it->second);
+        break;
+      }
+    }
+  }
+
+  std::vector<BatchResult> deleted = batch.run(options);
+  std::vector<BatchResult> results(paths.size());
+  for (size_t p = 0; p < paths.size(); p++) {
+    results[p] = deleted[itemOfPath[p]];
+  }
+  return results;
+}
+
+std::vector<BatchResult> alluxio::renameMany(
+    AlluxioFileSystem &fs,
+    const std::vector<std::pair<std::string, std::string> > &renames,
+    const BatchOptions &options)
+{
+  Batch batch(fs, [&renames](AlluxioFileSystem &fs, size_t i, BatchResult &) {
+    fs.renameFile(renames[i].first.c_str(), renames[i].second.c_str());
+  }, false);
+
+  // Earlier renames by path they touch, and by ancestor of those paths
+  std::unordered_map<std::string, std::vector<size_t> > at;
+  std::unordered_map<std::string, std::vector<size_t> > below;
+  for (size_t i = 0; i < renames.size(); i++) {
+    batch.add();
+    std::string touched[2] = { normalize(renames[i].first),
+                               normalize(renames[i].second) };
+
+    std::unordered_set<size_t> earlier;
+    for (int t = 0; t < 2; t++) {
+      std::vector<std::string> keys = ancestors(touched[t]);
+      keys.push_back(touched[t]);
+      for (size_t k = 0; k < keys.size(); k++) {
+        std::unordered_map<std::string, std::vector<size_t> >::iterator it = at.find(keys[k]);
+        if (it != at.end()) {
+          earlier.insert(it->second.begin(), it->second.end());
+        }
+      }
+      std::unordered_map<std::string, std::vector<size_t> >::iterator it =
+          below.find(touched[t]);
+      if (it != below.end()) {
+        earlier.insert(it->second.begin(), it->second.end());
+      }
+    }
+    for (std::unordered_set<size_t>::iterator e = earlier.begin(); e != earlier.end(); ++e) {
+      batch.order(*e, i);
+    }
+
+    for (int t = 0; t < 2; t++) {
+      at[touched[t]].push_back(i);
+      std::vector<std::string> up = ancestors(touched[t]);
+      for (size_t a = 0; a < up.size(); a++) {
+        below[up[a]].push_back(i);
+      }
+    }
+  }
+
+  return batch.run(options);
+}
+
+/* vim: set ts=4 sw=4 : */
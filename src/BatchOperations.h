@@ -0,0 +1,107 @@
+/**
+ * Batched metadata operations
+ *
+ * existsMany(), mkdirsMany(), deleteMany() and renameMany() run the
+ * operations of a batch concurrently on ThreadPool::shared() instead of one
+ * master round trip after the other, while keeping the order the namespace
+ * needs: parents are created before their children, children are deleted
+ * before their parents, and renames touching the same subtree run in the
+ * order they were given.
+ *
+ * Every item gets its own result; a failed item does not stop the others.
+ * Items run with the IoScope class and tenant of the calling thread.
+ *
+ */
+
+#ifndef __BATCH_OPERATIONS_H_
+#define __BATCH_OPERATIONS_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+class ConcurrencyLimiter;
+class ThreadPool;
+
+struct BatchOptions {
+    BatchOptions() : numThreads(8), pool(NULL), adaptive(true), limiter(NULL) {}
+
+    /// Operations running at once, at most
+    int numThreads;
+    /// Pool running the operations; NULL for ThreadPool::shared().  Do not
+    /// run a batch from a task of the same pool.
+    ThreadPool *pool;
+    /// Let a limiter choose how many operations run at once, up to
+    /// numThreads; false to always run numThreads at once
+    bool adaptive;
+    /// Limiter of an adaptive batch; NULL for ConcurrencyLimiter::shared()
+    /// of the IoScope class of the calling thread
+    ConcurrencyLimiter *limiter;
+};
+
+/**
+   Outcome of one item of a batch.
+*/
+struct BatchResult {
+    BatchResult() : ok(false), exists(false) {}
+
+    /// False if the operation failed or was skipped; error then says why
+    bool ok;
+    /// existsMany(): whether the path exists
+    bool exists;
+    std::string error;
+};
+
+/**
+   Check whether each path exists.
+
+   @param[in] fs File system of the calling thread; its metadata cache, if
+              any, is shared by the operations
+   @param[in] paths Paths to check
+   @param[in] options Concurrency
+   @return One result per path, in the same order
+*/
+std::vector<BatchResult> existsMany(AlluxioFileSystem &fs,
+                                    const std::vector<std::string> &paths,
+                                    const BatchOptions &options = BatchOptions());
+
+/**
+   Create directories and their missing ancestors, like mkdir -p.  An
+   ancestor shared by several paths is created once, before its children;
+   directories that already exist are not an error.  A path fails if it or
+   one of its ancestors could not be created.
+*/
+std::vector<BatchResult> mkdirsMany(AlluxioFileSystem &fs,
+                                    const std::vector<std::string> &paths,
+                                    const BatchOptions &options = BatchOptions());
+
+/**
+   Delete paths, those below another path of the batch first.  Without
+   recursive, a directory is only deleted if the batch empties it.
+*/
+std::vector<BatchResult> deleteMany(AlluxioFileSystem &fs,
+                                    const std::vector<std::string> &paths,
+                                    bool recursive = false,
+                                    const BatchOptions &options = BatchOptions());
+
+/**
+   Rename each source to its destination.  Renames with a path equal to,
+   above or below a path of an earlier rename wait for it; the others run
+   concurrently.
+
+   @param[in] renames Pairs of source and destination paths
+*/
+std::vector<BatchResult> renameMany(
+    AlluxioFileSystem &fs,
+    const std::vector<std::pair<std::string, std::string> > &renames,
+    const BatchOptions &options = BatchOptions());
+
+} // namespace alluxio
+
+#endif /* __BATCH_OPERATIONS_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,303 @@
+/**
+ * Completion queue for event loops
+ *
+ */
+
+#include "CompletionQueue.h"
+#include "ThreadPool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <atomic>
+#include <stdexcept>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+struct CompletionQueue::Operation {
+    explicit Operation(uint64_t tag) : arrivals(0) { completion.tag = tag; }
+
+    Completion completion;
+    /// Moves the result of the call into completion; throws its error
+    std::function<void(Completion &)> collect;
+    /// The call returning its future and the call being over; the second
+    /// of the two completes the operation
+    std::atomic<int> arrivals;
+};
+
+namespace {
+
+std::runtime_error systemError(const std::string &what)
+{
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+} // namespace
+
+/**
+   On Linux the descriptor is an eventfd; elsewhere, the read end of a pipe.
+*/
+CompletionQueue::CompletionQueue() : m_inFlight(0)
+{
+#ifdef __linux__
+  m_readFd = m_writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_readFd < 0) {
+    throw systemError("Could not create completion eventfd");
+  }
+#else
+  int fds[2];
+  if (pipe(fds) != 0) {
+    throw systemError("Could not create completion pipe");
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  m_readFd = fds[0];
+  m_writeFd = fds[1];
+#endif
+}
+
+CompletionQueue::~CompletionQueue()
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  m_idle.wait(guard, [this] { return m_inFlight == 0; });
+  for (size_t i = 0; i < m_done.size(); i++) {
+    delete m_done[i].inStream;
+    delete m_done[i].outStream;
+  }
+  guard.unlock();
+
+  ::close(m_readFd);
+  if (m_writeFd != m_readFd) {
+    ::close(m_writeFd);
+  }
+}
+
+size_t CompletionQueue::drain(std::vector<Completion> &out)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (m_done.empty()) {
+    return 0;
+  }
+
+  // Rearm under the lock, so that the next completion signals again
+  char buff[64];
+  while (::read(m_readFd, buff, sizeof(buff)) > 0 || errno == EINTR) {
+  }
+
+  size_t count = m_done.size();
+  for (size_t i = 0; i < count; i++) {
+    out.push_back(std::move(m_done[i]));
+  }
+  m_done.clear();
+  return count;
+}
+
+size_t CompletionQueue::pending() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  return m_inFlight + m_done.size();
+}
+
+template <typename R>
+void CompletionQueue::submit(uint64_t tag,
+                             const std::function<std::future<R>(ReadyCallback)> &start,
+                             const std::function<void(std::future<R> &, Completion &)> &store)
+{
+  std::shared_ptr<Operation> operation(new Operation(tag));
+  std::shared_ptr<std::future<R> > future(new std::future<R>());
+  operation->collect = [future, store](Completion &completion) {
+    store(*future, completion);
+  };
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_inFlight++;
+  }
+  try {
+    *future = start([this, operation] { arrive(operation, true); });
+  } catch (...) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_inFlight--;
+    m_idle.notify_all();
+    throw;
+  }
+  arrive(operation, false);
+}
+
+/**
+   Complete the operation once both its call has returned the future and
+   the future is ready.  Results are always collected on a pool thread, so
+   that Java exceptions are released by the thread that caught them.
+*/
+void CompletionQueue::arrive(const std::shared_ptr<Operation> &operation, bool onPool)
+{
+  if (++operation->arrivals < 2) {
+    return;
+  }
+  if (onPool) {
+    complete(operation);
+  } else {
+    ThreadPool::shared().execute([this, operation] { complete(operation); });
+  }
+}
+
+void CompletionQueue::complete(const std::shared_ptr<Operation> &operation)
+{
+  Completion &completion = operation->completion;
+  try {
+    operation->collect(completion);
+    completion.ok = true;
+  } catch (NativeException &e) {
+    completion.error = e.what();
+    e.discard();
+  } catch (const std::exception &e) {
+    completion.error = e.what();
+  }
+
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (m_done.empty()) {
+#ifdef __linux__
+    uint64_t one = 1;
+#else
+    char one = 1;
+#endif
+    while (::write(m_writeFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+  }
+  m_done.push_back(std::move(completion));
+  if (--m_inFlight == 0) {
+    m_idle.notify_all();
+  }
+}
+
+//////////////////////////////////////////
+// Operations
+//////////////////////////////////////////
+
+void CompletionQueue::openFile(AlluxioFileSystem &fs, const char *path, uint64_t tag,
+                               AlluxioOpenFileOptions *options)
+{
+  std::string p(path);
+  submit<jFileInStream>(tag, [&fs, p, options](ReadyCallback onReady) {
+    return fs.openFileAsync(p.c_str(), options, onReady);
+  }, [](std::future<jFileInStream> &result, Completion &completion) {
+    completion.inStream = result.get();
+  });
+}
+
+void CompletionQueue::createFile(AlluxioFileSystem &fs, const char *path, uint64_t tag,
+                                 AlluxioCreateFileOptions *options)
+{
+  std::string p(path);
+  submit<jFileOutStream>(tag, [&fs, p, options](ReadyCallback onReady) {
+    return fs.createFileAsync(p.c_str(), options, onReady);
+  }, [](std::future<jFileOutStream> &result, Completion &completion) {
+    completion.outStream = result.get();
+  });
+}
+
+void CompletionQueue::getStatus(AlluxioFileSystem &fs, const char *path, uint64_t tag)
+{
+  std::string p(path);
+  submit<FileStatus>(tag, [&fs, p](ReadyCallback onReady) {
+    return fs.getStatusAsync(p.c_str(), onReady);
+  }, [](std::future<FileStatus> &result, Completion &completion) {
+    completion.status = result.get();
+  });
+}
+
+void CompletionQueue::exists(AlluxioFileSystem &fs, const char *path, uint64_t tag)
+{
+  std::string p(path);
+  submit<bool>(tag, [&fs, p](ReadyCallback onReady) {
+    return fs.existsAsync(p.c_str(), onReady);
+  }, [](std::future<bool> &result, Completion &completion) {
+    completion.exists = result.get();
+  });
+}
+
+namespace {
+
+void storeVoid(std::future<void> &result, Completion &)
+{
+  result.get();
+}
+
+void storeBytes(std::future<int> &result, Completion &completion)
+{
+  completion.bytes = result.get();
+}
+
+} // namespace
+
+void CompletionQueue::deletePath(AlluxioFileSystem &fs, const char *path, bool recursive,
+                                 uint64_t tag)
+{
+  std::string p(path);
+  submit<void>(tag, [&fs, p, recursive](ReadyCallback onReady) {
+    return fs.deletePathAsync(p.c_str(), recursive, onReady);
+  }, storeVoid);
+}
+
+void CompletionQueue::renameFile(AlluxioFileSystem &fs, const char *origPath,
+                                 const char *newPath, uint64_t tag)
+{
+  std::string from(origPath);
+  std::string to(newPath);
+  submit<void>(tag, [&fs, from, to](ReadyCallback onReady) {
+    return fs.renameFileAsync(from.c_str(), to.c_str(), onReady);
+  }, storeVoid);
+}
+
+void CompletionQueue::read(InStream &in, void *buff, int length, uint64_t tag)
+{
+  submit<int>(tag, [&in, buff, length](ReadyCallback onReady) {
+    return in.readAsync(buff, length, onReady);
+  }, storeBytes);
+}
+
+void CompletionQueue::positionedRead(InStream &in, long pos, void *buff, int length,
+                                     uint64_t tag)
+{
+  submit<int>(tag, [&in, pos, buff, length](ReadyCallback onReady) {
+    return in.positionedReadAsync(pos, buff, length, onReady);
+  }, storeBytes);
+}
+
+void CompletionQueue::close(InStream &in, uint64_t tag)
+{
+  submit<void>(tag, [&in](ReadyCallback onReady) {
+    return in.closeAsync(onReady);
+  }, storeVoid);
+}
+
+void CompletionQueue::write(OutStream &out, const void *buff, int length, uint64_t tag)
+{
+  submit<void>(tag, [&out, buff, length](ReadyCallback onReady) {
+    return out.writeAsync(buff, length, onReady);
+  }, storeVoid);
+}
+
+void CompletionQueue::flush(OutStream &out, uint64_t tag)
+{
+  submit<void>(tag, [&out](ReadyCallback onReady) {
+    return out.flushAsync(onReady);
+  }, storeVoid);
+}
+
+void CompletionQueue::close(OutStream &out, uint64_t tag)
+{
+  submit<void>(tag, [&out](ReadyCallback onReady) {
+    return out.closeAsync(onReady);
+  }, storeVoid);
+}
+
+/* vim: set ts=4 sw=4 : */
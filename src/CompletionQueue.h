@@ -0,0 +1,126 @@
+/**
+ * Completion queue for event loops
+ *
+ * A CompletionQueue takes Alluxio operations from a loop thread that must
+ * not block in the JVM, runs them on ThreadPool::shared() and keeps their
+ * outcomes until the loop asks for them.  fd() becomes readable when
+ * completions are waiting, so it can be registered with epoll or poll like
+ * a socket; drain() then takes every waiting completion at once and rearms
+ * the descriptor.  The descriptor is signalled once per batch, not once per
+ * completion.
+ *
+ * The rules of the async calls of Alluxio.h apply: buffers and streams stay
+ * valid until their completion is drained, and streams are not used
+ * synchronously meanwhile.
+ *
+ */
+
+#ifndef __COMPLETION_QUEUE_H_
+#define __COMPLETION_QUEUE_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+/**
+   Outcome of one operation of a CompletionQueue.
+*/
+struct Completion {
+    Completion() : tag(0), ok(false), bytes(0), exists(false),
+                   inStream(NULL), outStream(NULL) {}
+
+    /// Tag the operation was submitted with
+    uint64_t tag;
+    /// False if the operation failed; error then says why
+    bool ok;
+    std::string error;
+    /// read(), positionedRead(): bytes read, or -1 at end of stream
+    int bytes;
+    /// exists(): whether the path exists
+    bool exists;
+    /// getStatus(): status of the path
+    FileStatus status;
+    /// openFile(), createFile(): the new stream, to be deleted by the caller
+    jFileInStream inStream;
+    jFileOutStream outStream;
+};
+
+class CompletionQueue {
+  public:
+    CompletionQueue();
+    /// Waits for the operations in flight; streams never drained are deleted
+    ~CompletionQueue();
+
+    /// Readable while completions are waiting to be drained
+    int fd() const { return m_readFd; }
+
+    /**
+       Append the waiting completions to out, in the order they completed,
+       and rearm fd().  Never blocks.
+
+       @return Number of completions appended
+    */
+    size_t drain(std::vector<Completion> &out);
+    /// Operations submitted whose completion has not been drained yet
+    size_t pending() const;
+
+    // Operations.  Each one eventually gives exactly one completion with
+    // its tag; only a failure to queue it is thrown.
+    void openFile(AlluxioFileSystem &fs, const char *path, uint64_t tag,
+                  AlluxioOpenFileOptions *options = nullptr);
+    void createFile(AlluxioFileSystem &fs, const char *path, uint64_t tag,
+                    AlluxioCreateFileOptions *options = nullptr);
+    void getStatus(AlluxioFileSystem &fs, const char *path, uint64_t tag);
+    void exists(AlluxioFileSystem &fs, const char *path, uint64_t tag);
+    void deletePath(AlluxioFileSystem &fs, const char *path, bool recursive, uint64_t tag);
+    void renameFile(AlluxioFileSystem &fs, const char *origPath, const char *newPath,
+                    uint64_t tag);
+
+    void read(InStream &in, void *buff, int length, uint64_t tag);
+    void positionedRead(InStream &in, long pos, void *buff, int length, uint64_t tag);
+    void close(InStream &in, uint64_t tag);
+    void write(OutStream &out, const void *buff, int length, uint64_t tag);
+    void flush(OutStream &out, uint64_t tag);
+    void close(OutStream &out, uint64_t tag);
+
+  private:
+    CompletionQueue(CompletionQueue const &);
+    void operator=(CompletionQueue const &);
+
+    struct Operation;
+
+    /**
+       Issue start(onReady), an async call of Alluxio.h; once it is over,
+       store() moves its result into the completion.
+    */
+    template <typename R>
+    void submit(uint64_t tag, const std::function<std::future<R>(ReadyCallback)> &start,
+                const std::function<void(std::future<R> &, Completion &)> &store);
+    void arrive(const std::shared_ptr<Operation> &operation, bool onPool);
+    void complete(const std::shared_ptr<Operation> &operation);
+
+    int m_readFd;
+    int m_writeFd;
+    mutable std::mutex m_lock;
+    std::condition_variable m_idle;
+    /// Completions waiting to be drained; fd() is readable iff not empty
+    std::vector<Completion> m_done;
+    /// Operations submitted and not completed yet
+    size_t m_inFlight;
+};
+
+} // namespace alluxio
+
+#endif /* __COMPLETION_QUEUE_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,237 @@
+/**
+ * Adaptive limit on concurrent operations
+ *
+ */
+
+#include "ConcurrencyLimit.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+using namespace alluxio;
+
+/// Weight of a new gradient target in the limit
+#define GRADIENT_SMOOTHING 0.2
+/// Share of the gap closed per window when latency stays above the baseline,
+/// so that the baseline follows a lasting change of the cluster
+#define BASELINE_DRIFT 0.05
+
+ConcurrencyLimiter::ConcurrencyLimiter(const ConcurrencyLimitOptions &options)
+    : m_options(options), m_limit(0), m_inFlight(0), m_peakInFlight(0), m_baseline(0),
+      m_created(Clock::now()), m_samples(0), m_latencySum(0), m_failure(false),
+      m_windowPeak(0), m_windowStart(m_created)
+{
+  m_options.minLimit = std::max(1, m_options.minLimit);
+  m_options.maxLimit = std::max(m_options.minLimit, m_options.maxLimit);
+  m_options.windowSize = std::max(1, m_options.windowSize);
+  m_limit = std::min(std::max(options.initialLimit, m_options.minLimit), m_options.maxLimit);
+}
+
+void ConcurrencyLimiter::configure(const ConcurrencyLimitOptions &options)
+{
+  std::vector<std::function<void()> > granted;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_options = options;
+    m_options.minLimit = std::max(1, m_options.minLimit);
+    m_options.maxLimit = std::max(m_options.minLimit, m_options.maxLimit);
+    m_options.windowSize = std::max(1, m_options.windowSize);
+    m_limit = std::min(std::max(m_limit, (double) m_options.minLimit),
+                       (double) m_options.maxLimit);
+    grantWaiters(granted);
+  }
+  for (size_t i = 0; i < granted.size(); i++) {
+    granted[i]();
+  }
+}
+
+void ConcurrencyLimiter::acquire()
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  if (m_waiters.empty() && m_inFlight < (int) m_limit) {
+    take();
+    return;
+  }
+  Waiter waiter;
+  m_waiters.push_back(&waiter);
+  m_granted.wait(guard, [&waiter] { return waiter.granted; });
+}
+
+void ConcurrencyLimiter::acquireAsync(std::function<void()> granted)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (!m_waiters.empty() || m_inFlight >= (int) m_limit) {
+      Waiter *waiter = new Waiter();
+      waiter->onGranted = granted;
+      m_waiters.push_back(waiter);
+      return;
+    }
+    take();
+  }
+  granted();
+}
+
+void ConcurrencyLimiter::release(Clock::duration latency, bool ok)
+{
+  std::vector<std::function<void()> > granted;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    Clock::time_point now = Clock::now();
+    m_inFlight--;
+    m_stats.completed++;
+    if (!ok) {
+      m_stats.failed++;
+      m_failure = true;
+    }
+    m_samples++;
+    m_latencySum += std::chrono::duration<double>(latency).count();
+    if (m_samples >= m_options.windowSize || !ok) {
+      decide(now);
+    }
+    grantWaiters(granted);
+  }
+  for (size_t i = 0; i < granted.size(); i++) {
+    granted[i]();
+  }
+}
+
+int ConcurrencyLimiter::limit() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  return (int) m_limit;
+}
+
+ConcurrencyLimitStats ConcurrencyLimiter::stats() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  ConcurrencyLimitStats stats = m_stats;
+  stats.limit = (int) m_limit;
+  stats.inFlight = m_inFlight;
+  stats.waiting = (int) m_waiters.size();
+  stats.peakInFlight = m_peakInFlight;
+  return stats;
+}
+
+std::vector<LimitDecision> ConcurrencyLimiter::decisions() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  return std::vector<LimitDecision>(m_decisions.begin(), m_decisions.end());
+}
+
+ConcurrencyLimiter &ConcurrencyLimiter::shared(IoClass ioClass)
+{
+  // Never destroyed, like the other process-wide objects of the library
+  static ConcurrencyLimiter *limiters[IO_CLASS_COUNT] = {
+    new ConcurrencyLimiter(), new ConcurrencyLimiter(), new ConcurrencyLimiter()
+  };
+  return *limiters[(int) ioClass];
+}
+
+/// Count a permit as taken; with the lock held
+void ConcurrencyLimiter::take()
+{
+  m_inFlight++;
+  m_windowPeak = std::max(m_windowPeak, m_inFlight);
+  m_peakInFlight = std::max(m_peakInFlight, m_inFlight);
+}
+
+/**
+   Move the limit after a window of completions, or at once after a failure,
+   and start the next window.
+*/
+void ConcurrencyLimiter::decide(Clock::time_point now)
+{
+  LimitDecision decision;
+  decision.atSeconds = std::chrono::duration<double>(now - m_created).count();
+  decision.previousLimit = (int) m_limit;
+
+  double latency = m_samples > 0 ? m_latencySum / m_samples : 0;
+  double elapsed = std::chrono::duration<double>(now - m_windowStart).count();
+  if (m_baseline <= 0 || latency < m_baseline) {
+    m_baseline = latency;
+  }
+  // In use: the window reached the limit, so more permits might have helped
+  bool inUse = m_windowPeak >= (int) m_limit;
+  double limit = m_limit;
+
+  if (m_failure) {
+    limit *= m_options.backoffRatio;
+  } else if (m_options.algorithm == LimitAlgorithm::AIMD) {
+    if (latency > m_options.tolerance * m_baseline) {
+      limit *= m_options.backoffRatio;
+    } else if (inUse) {
+      limit += 1;
+    }
+  } else {
+    double gradient = latency > 0 ? m_options.tolerance * m_baseline / latency : 1;
+    gradient = std::max(0.5, std::min(1.0, gradient));
+    // Room for a queue of sqrt(limit) on top of what latency allows
+    double target = limit * gradient + sqrt(limit);
+    if (!inUse && target > limit) {
+      target = limit;
+    }
+    limit = limit * (1 - GRADIENT_SMOOTHING) + target * GRADIENT_SMOOTHING;
+  }
+
+  m_limit = std::min(std::max(limit, (double) m_options.minLimit),
+                     (double) m_options.maxLimit);
+  decision.limit = (int) m_limit;
+  if (m_failure) {
+    decision.reason = "failure";
+  } else if (decision.limit < decision.previousLimit) {
+    decision.reason = "latency";
+  } else if (decision.limit > decision.previousLimit) {
+    decision.reason = "grow";
+  } else {
+    decision.reason = inUse ? "steady" : "idle";
+  }
+  if (decision.limit > decision.previousLimit) {
+    m_stats.increases++;
+  } else if (decision.limit < decision.previousLimit) {
+    m_stats.decreases++;
+  }
+  decision.latencyMs = latency * 1000;
+  decision.baselineMs = m_baseline * 1000;
+  decision.throughput = elapsed > 0 ? m_samples / elapsed : 0;
+  m_decisions.push_back(decision);
+  if (m_decisions.size() > CONCURRENCY_LIMIT_HISTORY) {
+    m_decisions.pop_front();
+  }
+
+  if (latency > m_baseline) {
+    m_baseline += (latency - m_baseline) * BASELINE_DRIFT;
+  }
+  m_samples = 0;
+  m_latencySum = 0;
+  m_failure = false;
+  m_windowPeak = m_inFlight;
+  m_windowStart = now;
+}
+
+/**
+   Hand free permits to waiters, in order.  Blocking waiters are woken;
+   callbacks of async ones go to granted, to be called without the lock.
+*/
+void ConcurrencyLimiter::grantWaiters(std::vector<std::function<void()> > &granted)
+{
+  bool woken = false;
+  while (!m_waiters.empty() && m_inFlight < (int) m_limit) {
+    Waiter *waiter = m_waiters.front();
+    m_waiters.pop_front();
+    take();
+    if (waiter->onGranted) {
+      granted.push_back(waiter->onGranted);
+      delete waiter;
+    } else {
+      waiter->granted = true;
+      woken = true;
+    }
+  }
+  if (woken) {
+    m_granted.notify_all();
+  }
+}
+
+/* vim: set ts=4 sw=4 : */
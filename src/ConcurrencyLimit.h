@@ -0,0 +1,206 @@
+/**
+ * Adaptive limit on concurrent operations
+ *
+ * A ConcurrencyLimiter lets a number of operations run at once and moves
+ * that number with what it observes, so that bulk work neither leaves the
+ * cluster idle nor queues up at the master.  Every windowSize completions
+ * it compares their mean latency with the lowest latency seen lately: with
+ * AIMD it adds one when the limit was in use and latency held, and backs
+ * off by a ratio when latency grew; the gradient algorithm scales the limit
+ * by how much latency grew, leaving some room for queueing.  Operations
+ * reported as failed, such as timeouts, always back off.
+ *
+ * The parallel APIs (BatchOperations.h, NamespaceWalker.h, the parts of
+ * StripedFile.h and the stat batches of NamespaceSnapshot::refresh()) run
+ * their items under the shared limiter of the IoClass of the calling thread,
+ * unless told otherwise; their thread count is then only an upper bound.
+ * Left out are the calls that add no fan-out of their own: single async
+ * calls (Alluxio.h, CompletionQueue.h), bounded by IoScheduler.h; hedges
+ * (HedgedRead.h), capped by their budget; uploads of LocalStaging.h and
+ * async closes, capped by their own settings.  Do not wait for such an API
+ * while holding a permit of the same limiter.
+ *
+ */
+
+#ifndef __CONCURRENCY_LIMIT_H_
+#define __CONCURRENCY_LIMIT_H_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <vector>
+
+#include "IoScheduler.h"
+
+/// Decisions kept by a ConcurrencyLimiter for decisions()
+#define CONCURRENCY_LIMIT_HISTORY 64
+
+namespace alluxio {
+
+enum class LimitAlgorithm {
+    /// Additive increase, multiplicative decrease
+    AIMD,
+    /// Scale by the ratio of baseline to observed latency
+    GRADIENT
+};
+
+struct ConcurrencyLimitOptions {
+    ConcurrencyLimitOptions()
+        : algorithm(LimitAlgorithm::GRADIENT), initialLimit(8), minLimit(1),
+          maxLimit(128), windowSize(16), tolerance(1.5), backoffRatio(0.9) {}
+
+    LimitAlgorithm algorithm;
+    int initialLimit;
+    int minLimit;
+    int maxLimit;
+    /// Completions per decision
+    int windowSize;
+    /// Latency over the baseline taken as normal, as a ratio
+    double tolerance;
+    /// Limit kept on a decrease by AIMD, or after a failure
+    double backoffRatio;
+};
+
+/**
+   One adjustment of the limit, or a window where it was kept.
+*/
+struct LimitDecision {
+    LimitDecision()
+        : atSeconds(0), previousLimit(0), limit(0), latencyMs(0), baselineMs(0),
+          throughput(0), reason("") {}
+
+    /// Since the limiter was created
+    double atSeconds;
+    int previousLimit;
+    int limit;
+    /// Mean latency of the window, and the baseline it was compared with
+    double latencyMs;
+    double baselineMs;
+    /// Completions per second over the window
+    double throughput;
+    /// "grow", "latency", "failure", "idle" (limit not in use) or "steady"
+    const char *reason;
+};
+
+struct ConcurrencyLimitStats {
+    ConcurrencyLimitStats()
+        : limit(0), inFlight(0), waiting(0), peakInFlight(0), completed(0),
+          failed(0), increases(0), decreases(0) {}
+
+    int limit;
+    int inFlight;
+    int waiting;
+    int peakInFlight;
+    int64_t completed;
+    int64_t failed;
+    int64_t increases;
+    int64_t decreases;
+};
+
+class ConcurrencyLimiter {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit ConcurrencyLimiter(const ConcurrencyLimitOptions &options =
+                                ConcurrencyLimitOptions());
+
+    /// Change the options; the limit is kept, within the new bounds
+    void configure(const ConcurrencyLimitOptions &options);
+
+    /// Wait for a permit
+    void acquire();
+    /**
+       Call granted with a permit: at once if one is free, else from the
+       release() that frees one.  Waiters are served in order.  granted
+       must not block.
+    */
+    void acquireAsync(std::function<void()> granted);
+    /// Return a permit, with the latency of the operation that held it
+    void release(Clock::duration latency, bool ok = true);
+
+    int limit() const;
+    ConcurrencyLimitStats stats() const;
+    /// Most recent decisions, oldest first
+    std::vector<LimitDecision> decisions() const;
+
+    /// The limiter of a class for the process, created on first use
+    static ConcurrencyLimiter &shared(IoClass ioClass);
+
+  private:
+    ConcurrencyLimiter(ConcurrencyLimiter const &);
+    void operator=(ConcurrencyLimiter const &);
+
+    struct Waiter {
+        Waiter() : granted(false) {}
+
+        bool granted;
+        /// Async waiters: called once granted
+        std::function<void()> onGranted;
+    };
+
+    void take();
+    void decide(Clock::time_point now);
+    void grantWaiters(std::vector<std::function<void()> > &granted);
+
+    ConcurrencyLimitOptions m_options;
+    /// Limit with its fraction, smoothed by the gradient algorithm
+    double m_limit;
+    int m_inFlight;
+    int m_peakInFlight;
+    double m_baseline;
+    Clock::time_point m_created;
+
+    // Current window
+    int m_samples;
+    double m_latencySum;
+    bool m_failure;
+    int m_windowPeak;
+    Clock::time_point m_windowStart;
+
+    ConcurrencyLimitStats m_stats;
+    std::deque<LimitDecision> m_decisions;
+    std::list<Waiter *> m_waiters;
+    mutable std::mutex m_lock;
+    std::condition_variable m_granted;
+};
+
+/**
+   A permit of a limiter for as long as it lives, released with the time it
+   was held.
+*/
+class ConcurrencyPermit {
+  public:
+    explicit ConcurrencyPermit(ConcurrencyLimiter &limiter)
+        : m_limiter(limiter), m_ok(true)
+    {
+      m_limiter.acquire();
+      m_start = ConcurrencyLimiter::Clock::now();
+    }
+
+    ~ConcurrencyPermit()
+    {
+      m_limiter.release(ConcurrencyLimiter::Clock::now() - m_start, m_ok);
+    }
+
+    /// Report the operation as failed, so that the limit backs off
+    void failed() { m_ok = false; }
+
+  private:
+    ConcurrencyPermit(ConcurrencyPermit const &);
+    void operator=(ConcurrencyPermit const &);
+
+    ConcurrencyLimiter &m_limiter;
+    ConcurrencyLimiter::Clock::time_point m_start;
+    bool m_ok;
+};
+
+} // namespace alluxio
+
+#endif /* __CONCURRENCY_LIMIT_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,226 @@
+/**
+ * C++20 coroutine awaitables for Alluxio operations
+ *
+ * co_await on one of the functions below suspends the coroutine while the
+ * JNI call runs on ThreadPool::shared(), then resumes it through the
+ * executor given, so that the threads of a coroutine scheduler never block
+ * in the JVM.  Thousands of operations can be in flight from a handful of
+ * threads:
+ *
+ *     std::unique_ptr<FileInStream> in(co_await coro::openFile(fs, path, post));
+ *     int n = co_await coro::read(*in, buff, sizeof(buff), post);
+ *     co_await coro::close(*in, post);
+ *
+ * The awaitables are built on the ReadyCallback variants of the async calls
+ * of Alluxio.h, so the library itself stays C++11; only this header needs a
+ * C++20 compiler, and it is only installed when configure finds one.
+ *
+ * Handles work from any thread, so a coroutine may resume on another
+ * thread of its scheduler than the one that opened its stream.  Buffers
+ * stay valid until the co_await is over.
+ *
+ */
+
+#ifndef __COROUTINE_H_
+#define __COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "Coroutine.h needs C++20 coroutines; see CXX20_FLAGS in configure"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+namespace coro {
+
+/**
+   Resumes a coroutine on the caller's side, typically by queueing the
+   handle on the run queue of its scheduler.  Without one, the coroutine
+   resumes on the pool thread that ran the call and must not block there.
+*/
+typedef std::function<void(std::coroutine_handle<>)> Executor;
+
+/**
+   Awaitable for one async call.  start() issues the call with the callback
+   to run once its future is ready; the coroutine is resumed by whichever of
+   await_suspend() and that callback comes last.
+*/
+template <typename R>
+class Awaitable {
+  public:
+    typedef std::function<std::future<R>(ReadyCallback)> Start;
+
+    Awaitable(Start start, Executor executor)
+        : m_start(std::move(start)), m_executor(std::move(executor)), m_arrived(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+      m_handle = handle;
+      m_future = m_start([this] { arrive(); });
+      // Already done: carry on without suspending
+      return !m_arrived.exchange(true);
+    }
+
+    R await_resume() { return m_future.get(); }
+
+  private:
+    void arrive()
+    {
+      if (!m_arrived.exchange(true)) {
+        return;
+      }
+      // The coroutine, and this awaitable with it, may be gone once resumed
+      std::coroutine_handle<> handle = m_handle;
+      Executor executor = m_executor;
+      if (executor) {
+        executor(handle);
+      } else {
+        handle.resume();
+      }
+    }
+
+    Start m_start;
+    Executor m_executor;
+    std::coroutine_handle<> m_handle;
+    std::future<R> m_future;
+    std::atomic<bool> m_arrived;
+};
+
+//////////////////////////////////////////
+// File system
+//////////////////////////////////////////
+
+/// Options, if any, must outlive the co_await
+inline Awaitable<jFileInStream> openFile(AlluxioFileSystem &fs, const char *path,
+                                         AlluxioOpenFileOptions *options = nullptr,
+                                         Executor executor = Executor())
+{
+  std::string p(path);
+  return Awaitable<jFileInStream>([&fs, p, options](ReadyCallback onReady) {
+    return fs.openFileAsync(p.c_str(), options, onReady);
+  }, executor);
+}
+
+inline Awaitable<jFileInStream> openFile(AlluxioFileSystem &fs, const char *path,
+                                         Executor executor)
+{
+  return openFile(fs, path, nullptr, executor);
+}
+
+inline Awaitable<jFileOutStream> createFile(AlluxioFileSystem &fs, const char *path,
+                                            AlluxioCreateFileOptions *options = nullptr,
+                                            Executor executor = Executor())
+{
+  std::string p(path);
+  return Awaitable<jFileOutStream>([&fs, p, options](ReadyCallback onReady) {
+    return fs.createFileAsync(p.c_str(), options, onReady);
+  }, executor);
+}
+
+inline Awaitable<jFileOutStream> createFile(AlluxioFileSystem &fs, const char *path,
+                                            Executor executor)
+{
+  return createFile(fs, path, nullptr, executor);
+}
+
+inline Awaitable<FileStatus> getStatus(AlluxioFileSystem &fs, const char *path,
+                                       Executor executor = Executor())
+{
+  std::string p(path);
+  return Awaitable<FileStatus>([&fs, p](ReadyCallback onReady) {
+    return fs.getStatusAsync(p.c_str(), onReady);
+  }, executor);
+}
+
+inline Awaitable<std::vector<FileStatus> > listStatus(AlluxioFileSystem &fs, const char *path,
+                                                      Executor executor = Executor())
+{
+  std::string p(path);
+  return Awaitable<std::vector<FileStatus> >([&fs, p](ReadyCallback onReady) {
+    return fs.listStatusAsync(p.c_str(), onReady);
+  }, executor);
+}
+
+inline Awaitable<bool> exists(AlluxioFileSystem &fs, const char *path,
+                              Executor executor = Executor())
+{
+  std::string p(path);
+  return Awaitable<bool>([&fs, p](ReadyCallback onReady) {
+    return fs.existsAsync(p.c_str(), onReady);
+  }, executor);
+}
+
+inline Awaitable<void> deletePath(AlluxioFileSystem &fs, const char *path,
+                                  bool recursive = false, Executor executor = Executor())
+{
+  std::string p(path);
+  return Awaitable<void>([&fs, p, recursive](ReadyCallback onReady) {
+    return fs.deletePathAsync(p.c_str(), recursive, onReady);
+  }, executor);
+}
+
+//////////////////////////////////////////
+// Streams
+//////////////////////////////////////////
+
+inline Awaitable<int> read(InStream &in, void *buff, int length,
+                           Executor executor = Executor())
+{
+  return Awaitable<int>([&in, buff, length](ReadyCallback onReady) {
+    return in.readAsync(buff, length, onReady);
+  }, executor);
+}
+
+inline Awaitable<int> positionedRead(InStream &in, long pos, void *buff, int length,
+                                     Executor executor = Executor())
+{
+  return Awaitable<int>([&in, pos, buff, length](ReadyCallback onReady) {
+    return in.positionedReadAsync(pos, buff, length, onReady);
+  }, executor);
+}
+
+inline Awaitable<void> close(InStream &in, Executor executor = Executor())
+{
+  return Awaitable<void>([&in](ReadyCallback onReady) {
+    return in.closeAsync(onReady);
+  }, executor);
+}
+
+inline Awaitable<void> write(OutStream &out, const void *buff, int length,
+                             Executor executor = Executor())
+{
+  return Awaitable<void>([&out, buff, length](ReadyCallback onReady) {
+    return out.writeAsync(buff, length, onReady);
+  }, executor);
+}
+
+inline Awaitable<void> flush(OutStream &out, Executor executor = Executor())
+{
+  return Awaitable<void>([&out](ReadyCallback onReady) {
+    return out.flushAsync(onReady);
+  }, executor);
+}
+
+inline Awaitable<void> close(OutStream &out, Executor executor = Executor())
+{
+  return Awaitable<void>([&out](ReadyCallback onReady) {
+    return out.closeAsync(onReady);
+  }, executor);
+}
+
+} // namespace coro
+} // namespace alluxio
+
+#endif /* __COROUTINE_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,370 @@
+/**
+ * Deadlines and cancellation of blocking Alluxio calls
+ *
+ */
+
+#include "Deadline.h"
+#include "IoScheduler.h"
+#include "JNIHelper.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <thread>
+#include <vector>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+static thread_local DeadlineScope *t_scope = NULL;
+
+namespace {
+
+/// A call handed to a deadline thread, shared with the caller waiting for it
+struct Task {
+    enum State { QUEUED, RUNNING, DONE, ABANDONED };
+
+    Task()
+        : state(QUEUED), cancelled(false), interrupted(false), thread(NULL),
+          ioClass(IoClass::INTERACTIVE) {}
+
+    std::mutex lock;
+    std::condition_variable changed;
+    State state;
+    /// Set by a token of the scope of the caller
+    bool cancelled;
+    bool interrupted;
+    /// Java thread running the call, while RUNNING
+    jobject thread;
+
+    std::function<void()> call;
+    std::function<void()> cleanup;
+    std::exception_ptr error;
+    IoClass ioClass;
+    std::string tenant;
+};
+
+/**
+   Threads running the calls made within a deadline, started as calls come
+   and never waited for: a thread stuck in an abandoned call is simply not
+   given another one until it returns.
+*/
+class Runner {
+  public:
+    static Runner &instance()
+    {
+      // Never destroyed: its threads may outlive main()
+      static Runner *runner = new Runner();
+      return *runner;
+    }
+
+    void submit(const std::shared_ptr<Task> &task)
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_tasks.push_back(task);
+      if ((int) m_tasks.size() > m_idle && m_threads < DEADLINE_MAX_THREADS) {
+        m_threads++;
+        std::thread(&Runner::work, this).detach();
+      } else {
+        m_ready.notify_one();
+      }
+    }
+
+  private:
+    Runner() : m_threads(0), m_idle(0) {}
+
+    void work()
+    {
+      jobject self = NULL;
+      try {
+        Env env;
+        jvalue ret;
+        env.callStaticMethod(&ret, "java/lang/Thread", "currentThread",
+                             "()Ljava/lang/Thread;");
+        self = env.newGlobalRef(ret.l);
+        env->DeleteLocalRef(ret.l);
+      } catch (NativeException &e) {
+        // Calls of this thread are abandoned without an interrupt
+        e.discard();
+      }
+
+      std::unique_lock<std::mutex> guard(m_lock);
+      while (true) {
+        if (m_tasks.empty()) {
+          m_idle++;
+          bool woken = m_ready.wait_for(guard,
+                                        std::chrono::seconds(DEADLINE_THREAD_IDLE_SECONDS),
+                                        [this] { return !m_tasks.empty(); });
+          m_idle--;
+          if (!woken) {
+            break;
+          }
+        }
+        std::shared_ptr<Task> task = m_tasks.front();
+        m_tasks.pop_front();
+        guard.unlock();
+        execute(*task, self);
+        guard.lock();
+      }
+      m_threads--;
+      guard.unlock();
+
+      if (self != NULL) {
+        Env().deleteGlobalRef(self);
+      }
+      Env().DetachCurrentThread();
+    }
+
+    static void execute(Task &task, jobject self)
+    {
+      bool started;
+      {
+        std::lock_guard<std::mutex> guard(task.lock);
+        started = task.state == Task::QUEUED;
+        if (started) {
+          task.state = Task::RUNNING;
+          task.thread = self;
+        }
+      }
+      if (started) {
+        try {
+          IoScope scope(task.ioClass, task.tenant);
+          task.call();
+        } catch (...) {
+          task.error = std::current_exception();
+        }
+      }
+
+      bool abandoned;
+      bool interrupted;
+      {
+        std::lock_guard<std::mutex> guard(task.lock);
+        task.thread = NULL;
+        abandoned = task.state == Task::ABANDONED;
+        interrupted = task.interrupted;
+        if (!abandoned) {
+          task.state = Task::DONE;
+          task.changed.notify_all();
+        }
+      }
+      if (interrupted) {
+        // Not to fail the next call of this thread
+        try {
+          jvalue ret;
+          Env().callStaticMethod(&ret, "java/lang/Thread", "interrupted", "()Z");
+        } catch (NativeException &e) {
+          e.discard();
+        }
+      }
+      if (abandoned && task.cleanup) {
+        try {
+          task.cleanup();
+        } catch (...) {
+          // Nobody is left to report it to
+        }
+      }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_ready;
+    std::deque<std::shared_ptr<Task> > m_tasks;
+    int m_threads;
+    int m_idle;
+};
+
+} // namespace
+
+//////////////////////////////////////////
+// CancellationToken
+//////////////////////////////////////////
+
+CancellationToken::CancellationToken() : m_state(std::make_shared<State>()) {}
+
+void CancellationToken::cancel()
+{
+  std::vector<std::function<void()> > waiters;
+  {
+    std::lock_guard<std::mutex> guard(m_state->lock);
+    if (m_state->cancelled) {
+      return;
+    }
+    m_state->cancelled = true;
+    // Copied: the waiters remove themselves from the list
+    waiters.assign(m_state->waiters.begin(), m_state->waiters.end());
+  }
+  for (size_t i = 0; i < waiters.size(); i++) {
+    waiters[i]();
+  }
+}
+
+bool CancellationToken::cancelled() const
+{
+  std::lock_guard<std::mutex> guard(m_state->lock);
+  return m_state->cancelled;
+}
+
+//////////////////////////////////////////
+// DeadlineScope
+//////////////////////////////////////////
+
+DeadlineScope::DeadlineScope(Clock::duration timeout)
+{
+  enter(Clock::now() + timeout);
+}
+
+DeadlineScope::DeadlineScope(Clock::duration timeout, const CancellationToken &token)
+    : m_token(token.m_state)
+{
+  enter(Clock::now() + timeout);
+}
+
+DeadlineScope::DeadlineScope(const CancellationToken &token) : m_token(token.m_state)
+{
+  enter(Clock::time_point::max());
+}
+
+DeadlineScope::~DeadlineScope()
+{
+  t_scope = m_previous;
+}
+
+void DeadlineScope::enter(Clock::time_point expiresAt)
+{
+  m_previous = t_scope;
+  m_expiresAt = expiresAt;
+  if (m_previous != NULL && m_previous->m_expiresAt < m_expiresAt) {
+    m_expiresAt = m_previous->m_expiresAt;
+  }
+  t_scope = this;
+}
+
+DeadlineScope *DeadlineScope::current()
+{
+  return t_scope;
+}
+
+bool DeadlineScope::cancelled() const
+{
+  for (const DeadlineScope *scope = this; scope != NULL; scope = scope->m_previous) {
+    if (scope->m_token) {
+      std::lock_guard<std::mutex> guard(scope->m_token->lock);
+      if (scope->m_token->cancelled) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void DeadlineScope::check() const
+{
+  if (cancelled() || Clock::now() >= m_expiresAt) {
+    giveUp();
+  }
+}
+
+void DeadlineScope::giveUp() const
+{
+  if (cancelled()) {
+    throw CancelledException("call cancelled");
+  }
+  throw TimeoutException("deadline expired before the call returned");
+}
+
+DeadlineScope::Subscription::Subscription(const DeadlineScope &scope,
+                                          const std::function<void()> &onCancel)
+{
+  bool cancelled = false;
+  for (const DeadlineScope *s = &scope; s != NULL && !cancelled; s = s->m_previous) {
+    if (!s->m_token) {
+      continue;
+    }
+    std::lock_guard<std::mutex> guard(s->m_token->lock);
+    if (s->m_token->cancelled) {
+      cancelled = true;
+    } else {
+      m_waiters.push_back(std::make_pair(s->m_token, s->m_token->waiters.insert(
+          s->m_token->waiters.end(), onCancel)));
+    }
+  }
+  if (cancelled) {
+    onCancel();
+  }
+}
+
+DeadlineScope::Subscription::~Subscription()
+{
+  for (size_t i = 0; i < m_waiters.size(); i++) {
+    std::lock_guard<std::mutex> guard(m_waiters[i].first->lock);
+    m_waiters[i].first->waiters.erase(m_waiters[i].second);
+  }
+}
+
+void DeadlineScope::run(const std::function<void()> &call,
+                        const std::function<void()> &cleanup,
+                        const std::function<void()> &onAbandon) const
+{
+  check();
+
+  std::shared_ptr<Task> task = std::make_shared<Task>();
+  task->call = call;
+  task->cleanup = cleanup;
+  task->ioClass = IoScope::currentClass();
+  task->tenant = IoScope::currentTenant();
+
+  // Tokens in effect wake the wait below once cancelled
+  std::weak_ptr<Task> weak = task;
+  Subscription subscription(*this, [weak] {
+    std::shared_ptr<Task> task = weak.lock();
+    if (task) {
+      std::lock_guard<std::mutex> guard(task->lock);
+      task->cancelled = true;
+      task->changed.notify_all();
+    }
+  });
+  {
+    // Cancelled since check(): nothing is started
+    std::lock_guard<std::mutex> guard(task->lock);
+    if (task->cancelled) {
+      giveUp();
+    }
+  }
+
+  Runner::instance().submit(task);
+
+  std::unique_lock<std::mutex> guard(task->lock);
+  while (task->state != Task::DONE && !task->cancelled) {
+    if (m_expiresAt == Clock::time_point::max()) {
+      task->changed.wait(guard);
+    } else if (task->changed.wait_until(guard, m_expiresAt) == std::cv_status::timeout) {
+      break;
+    }
+  }
+  if (task->state == Task::DONE) {
+    guard.unlock();
+    if (task->error) {
+      std::rethrow_exception(task->error);
+    }
+    return;
+  }
+
+  // Given up on: the call finishes on its own, cleanup follows it
+  bool running = task->state == Task::RUNNING;
+  task->state = Task::ABANDONED;
+  if (onAbandon) {
+    onAbandon();
+  }
+  if (running && task->thread != NULL) {
+    // Under the lock of the task, so that its thread is still on this call
+    try {
+      Env().callMethod(NULL, task->thread, "interrupt", "()V");
+      task->interrupted = true;
+    } catch (NativeException &e) {
+      e.discard();
+    }
+  }
+  guard.unlock();
+  giveUp();
+}
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,165 @@
+/**
+ * Deadlines and cancellation of blocking Alluxio calls
+ *
+ * A call into the JVM can block for minutes when a worker hangs or the
+ * master fails over.  Within a DeadlineScope, the blocking calls of
+ * Alluxio.h made by the thread run on a thread of their own while the
+ * caller waits for them at most until the deadline, or until a token of the
+ * scope is cancelled; it then gets a TimeoutException or a
+ * CancelledException.  The Java thread running the call is interrupted and
+ * the call abandoned: whatever it returns later, such as an opened stream,
+ * is closed and dropped.
+ *
+ * A stream whose call was abandoned is unusable from then on: its other
+ * calls, async ones included, throw TimeoutException, and close() and
+ * cancel() do nothing.  Once the abandoned call returns, an InStream is
+ * closed and an OutStream cancelled, so a half written file is never
+ * completed.
+ *
+ *     CancellationToken token;          // cancel() from another thread
+ *     try {
+ *       DeadlineScope deadline(std::chrono::milliseconds(200), token);
+ *       read = stream->positionedRead(pos, buff, length);
+ *     } catch (const TimeoutException &e) {
+ *       // stream is unusable, delete it and open the file again
+ *     }
+ *
+ * Scopes nest: the earliest deadline and every token in effect apply.
+ * Calls made outside any scope run on the calling thread, as before, and
+ * async calls are not bounded: wait for their futures with a timeout.
+ *
+ */
+
+#ifndef __DEADLINE_H_
+#define __DEADLINE_H_
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Threads running calls within a deadline at once; further calls queue
+#define DEADLINE_MAX_THREADS 64
+/// Idle time after which such a thread detaches and exits
+#define DEADLINE_THREAD_IDLE_SECONDS 30
+
+namespace alluxio {
+
+/// A call given up on at its deadline, or made on a stream left unusable by one
+class TimeoutException : public std::runtime_error {
+  public:
+    explicit TimeoutException(const std::string &what) : std::runtime_error(what) {}
+};
+
+/// A call given up on because a token of its scope was cancelled
+class CancelledException : public std::runtime_error {
+  public:
+    explicit CancelledException(const std::string &what) : std::runtime_error(what) {}
+};
+
+/**
+   Cancels the calls made within the scopes it was given to.  Copies share
+   one state, so a copy can be cancelled from another thread.
+*/
+class CancellationToken {
+  public:
+    CancellationToken();
+
+    /// Give up on the calls waiting under the token, and on those to come
+    void cancel();
+    bool cancelled() const;
+
+  private:
+    friend class DeadlineScope;
+
+    struct State {
+        State() : cancelled(false) {}
+
+        std::mutex lock;
+        bool cancelled;
+        /// Called once on cancel(), to wake the calls waiting
+        std::list<std::function<void()> > waiters;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+/**
+   Deadline and tokens of the blocking calls of the calling thread for as
+   long as it lives.
+*/
+class DeadlineScope {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit DeadlineScope(Clock::duration timeout);
+    DeadlineScope(Clock::duration timeout, const CancellationToken &token);
+    /// Cancellation only, without a time limit
+    explicit DeadlineScope(const CancellationToken &token);
+    ~DeadlineScope();
+
+    /// Innermost scope of the calling thread, or NULL
+    static DeadlineScope *current();
+
+    /// Earliest deadline in effect; Clock::time_point::max() for none
+    Clock::time_point expiresAt() const { return m_expiresAt; }
+    /// Whether a token in effect was cancelled
+    bool cancelled() const;
+    /// Throw if the deadline has passed or a token was cancelled
+    void check() const;
+
+    /**
+       Calls onCancel once a token in effect is cancelled, at once if one
+       already is, for as long as it lives.  onCancel runs on the thread
+       cancelling and must not block.
+    */
+    class Subscription {
+      public:
+        Subscription(const DeadlineScope &scope, const std::function<void()> &onCancel);
+        ~Subscription();
+
+      private:
+        Subscription(Subscription const &);
+        void operator=(Subscription const &);
+
+        typedef std::list<std::function<void()> >::iterator Waiter;
+        std::vector<std::pair<std::shared_ptr<CancellationToken::State>, Waiter> > m_waiters;
+    };
+
+    /**
+       Run call on a thread attached to the JVM, with the IoScope of the
+       calling thread, and wait for it within this scope.  Exceptions of
+       call are thrown here.
+
+       If the wait ends first, onAbandon is called here, the Java thread
+       running call is interrupted and TimeoutException or
+       CancelledException thrown; cleanup is called on the other thread
+       once call returns, or instead of call if it had not started.
+       Nothing is started if the scope has already expired.
+    */
+    void run(const std::function<void()> &call, const std::function<void()> &cleanup,
+             const std::function<void()> &onAbandon = std::function<void()>()) const;
+
+  private:
+    DeadlineScope(DeadlineScope const &);
+    void operator=(DeadlineScope const &);
+
+    void enter(Clock::time_point expiresAt);
+    /// Throw for a wait that ended before its call did
+    void giveUp() const;
+
+    Clock::time_point m_expiresAt;
+    std::shared_ptr<CancellationToken::State> m_token;
+    DeadlineScope *m_previous;
+};
+
+} // namespace alluxio
+
+#endif /* __DEADLINE_H_ */
+
+/* vim: set ts=4 sw=4 : */
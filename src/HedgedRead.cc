@@ -0,0 +1,348 @@
+/**
+ * Hedged positional reads
+ *
+ */
+
+#include "HedgedRead.h"
+#include "Deadline.h"
+#include "IoScheduler.h"
+#include "JNIHelper.h"
+#include "ThreadPool.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+/**
+   One positionedRead(), shared by its caller and the reads on the pool:
+   leg 0 is the read, leg 1 its hedge.
+*/
+struct HedgedInStream::Read {
+    Read(int64_t pos, int length)
+        : pos(pos), length(length), ioClass(IoScope::currentClass()),
+          tenant(IoScope::currentTenant()), start(Clock::now()),
+          legs(0), failed(0), winner(-1), result(0), cancelled(false) {}
+
+    int64_t pos;
+    int length;
+    IoClass ioClass;
+    std::string tenant;
+    /// When leg 0 was sent
+    Clock::time_point start;
+    /// Each leg reads into its own buffer, the winner is copied out
+    std::vector<char> data[2];
+    CancellationToken tokens[2];
+
+    std::mutex lock;
+    std::condition_variable changed;
+    int legs;
+    int failed;
+    int winner;
+    int result;
+    /// Set by a token of the scope of the caller
+    bool cancelled;
+    /// First failure of a leg
+    std::exception_ptr error;
+};
+
+HedgedInStream::HedgedInStream(AlluxioFileSystem &fs, const char *path,
+                               const HedgedReadOptions &options)
+    : m_fs(fs), m_path(path), m_options(options),
+      m_pool(options.pool != NULL ? *options.pool : ThreadPool::shared()), m_next(0),
+      m_legs(0), m_closed(false), m_budget(options.budgetBurst), m_sampled(0),
+      m_delay(options.delayMs / 1000)
+{
+  m_options.numStreams = std::max(1, m_options.numStreams);
+  m_slots.resize(m_options.numStreams);
+  for (size_t i = 0; i < m_slots.size(); i++) {
+    m_slots[i].stream.reset(fs.openFile(path));
+  }
+}
+
+HedgedInStream::~HedgedInStream()
+{
+  try {
+    close();
+  } catch (...) {
+    // Nowhere to report it from a destructor
+  }
+}
+
+int HedgedInStream::positionedRead(int64_t pos, void *buff, int length)
+{
+  DeadlineScope *scope = DeadlineScope::current();
+  Clock::time_point deadline = scope != NULL ? scope->expiresAt() : Clock::time_point::max();
+  if (scope != NULL) {
+    scope->check();
+  }
+  std::shared_ptr<Read> read = std::make_shared<Read>(pos, length);
+  Clock::duration delay = Clock::duration::zero();
+  int slot;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_closed) {
+      throw std::runtime_error("read on a closed HedgedInStream of " + m_path);
+    }
+    slot = pickStream(-1);
+    if (slot < 0) {
+      throw std::runtime_error("no stream left open on " + m_path);
+    }
+    m_stats.reads++;
+    m_budget = std::min(m_budget + m_options.budgetRatio, m_options.budgetBurst);
+    if (m_delay > 0 && m_slots.size() > 1) {
+      delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_delay));
+    }
+    startLeg(read, 0, slot);
+  }
+
+  // A token of the scope cancelled wakes the waits below
+  std::unique_ptr<DeadlineScope::Subscription> subscription;
+  if (scope != NULL) {
+    subscription.reset(new DeadlineScope::Subscription(*scope, [read] {
+      std::lock_guard<std::mutex> guard(read->lock);
+      read->cancelled = true;
+      read->changed.notify_all();
+    }));
+  }
+  std::unique_lock<std::mutex> guard(read->lock);
+  std::function<bool()> answered = [&read] {
+    return read->winner >= 0 || read->failed == read->legs || read->cancelled;
+  };
+  if (delay > Clock::duration::zero() &&
+      !read->changed.wait_until(guard, std::min(read->start + delay, deadline), answered) &&
+      Clock::now() < deadline) {
+    std::lock_guard<std::mutex> streams(m_lock);
+    int other = pickStream(slot);
+    if (other >= 0 && m_budget >= 1) {
+      m_budget -= 1;
+      m_stats.hedged++;
+      startLeg(read, 1, other);
+    } else if (other >= 0) {
+      m_stats.overBudget++;
+    }
+  }
+  if (deadline == Clock::time_point::max()) {
+    read->changed.wait(guard, answered);
+  } else {
+    read->changed.wait_until(guard, deadline, answered);
+  }
+  int winner = read->winner;
+  int result = read->result;
+  int legs = read->legs;
+  bool failed = read->failed == legs;
+  std::exception_ptr error = read->error;
+  guard.unlock();
+  subscription.reset();
+
+  // The legs not used are given up on, and the streams they left unusable opened again
+  for (int leg = 0; leg < legs; leg++) {
+    if (leg != winner) {
+      read->tokens[leg].cancel();
+    }
+  }
+  if (winner < 0) {
+    if (failed) {
+      std::rethrow_exception(error);
+    }
+    scope->check();
+    throw TimeoutException("deadline expired before the call returned");
+  }
+
+  // Written by the winner before it was named, and not touched since
+  if (result > 0) {
+    memcpy(buff, read->data[winner].data(), result);
+  }
+  std::lock_guard<std::mutex> streams(m_lock);
+  if (winner == 1) {
+    m_stats.hedgeWins++;
+  }
+  return result;
+}
+
+void HedgedInStream::close()
+{
+  std::vector<std::shared_ptr<InStream> > streams;
+  {
+    std::unique_lock<std::mutex> guard(m_lock);
+    m_closed = true;
+    m_idle.wait(guard, [this] { return m_legs == 0; });
+    for (size_t i = 0; i < m_slots.size(); i++) {
+      streams.push_back(m_slots[i].stream);
+      m_slots[i].stream.reset();
+    }
+  }
+  for (size_t i = 0; i < streams.size(); i++) {
+    if (streams[i]) {
+      streams[i]->close();
+    }
+  }
+}
+
+HedgedReadStats HedgedInStream::stats() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  HedgedReadStats stats = m_stats;
+  stats.delayMs = m_delay * 1000;
+  return stats;
+}
+
+/**
+   Least busy open stream other than other, in turn among equals; -1 for
+   none.  With the lock held.
+*/
+int HedgedInStream::pickStream(int other)
+{
+  int count = (int) m_slots.size();
+  int best = -1;
+  for (int i = 0; i < count; i++) {
+    int slot = (m_next + i) % count;
+    const Slot &s = m_slots[slot];
+    if (slot != other && s.stream && !s.reopening &&
+        (best < 0 || s.busy < m_slots[best].busy)) {
+      best = slot;
+    }
+  }
+  if (best >= 0 && other < 0) {
+    m_next = (best + 1) % count;
+  }
+  return best;
+}
+
+/// Run a leg of read on a stream, on the pool; with the lock held
+void HedgedInStream::startLeg(const std::shared_ptr<Read> &read, int leg, int slot)
+{
+  std::shared_ptr<InStream> stream = m_slots[slot].stream;
+  m_slots[slot].busy++;
+  m_legs++;
+  read->data[leg].resize(read->length);
+  read->legs++;
+  m_pool.execute([this, read, leg, slot, stream] { runLeg(read, leg, slot, stream); });
+}
+
+void HedgedInStream::runLeg(const std::shared_ptr<Read> &read, int leg, int slot,
+                            const std::shared_ptr<InStream> &stream)
+{
+  bool started;
+  {
+    // A hedge still queued when the read was answered is not sent
+    std::lock_guard<std::mutex> guard(read->lock);
+    started = read->winner < 0;
+  }
+  int result = 0;
+  bool cancelled = false;
+  std::exception_ptr error;
+  std::shared_ptr<InStream> current = stream;
+  while (started) {
+    try {
+      IoScope io(read->ioClass, read->tenant);
+      DeadlineScope scope(read->tokens[leg]);
+      result = current->positionedRead((long) read->pos, read->data[leg].data(), read->length);
+    } catch (const CancelledException &) {
+      cancelled = true;
+    } catch (const TimeoutException &) {
+      // Left unusable by a read cancelled on the same stream
+      if (current->abandoned()) {
+        current = reopen(slot, current);
+        if (current) {
+          continue;
+        }
+      }
+      error = std::current_exception();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    break;
+  }
+  {
+    std::lock_guard<std::mutex> guard(read->lock);
+    if (started && !cancelled && !error && read->winner < 0) {
+      read->winner = leg;
+      read->result = result;
+    } else if (error) {
+      read->failed++;
+      if (!read->error) {
+        read->error = error;
+      }
+    }
+    read->changed.notify_all();
+  }
+
+  // Cancelled before it was sent, the read left the stream as it was
+  if (cancelled && current->abandoned()) {
+    reopen(slot, current);
+  }
+  std::lock_guard<std::mutex> guard(m_lock);
+  m_slots[slot].busy--;
+  if (leg == 0 && started && !error) {
+    // Only a bound for a read given up on, but one past the delay
+    recordLatency(std::chrono::duration<double>(Clock::now() - read->start).count());
+  }
+  if (--m_legs == 0) {
+    m_idle.notify_all();
+  }
+}
+
+/**
+   Open the stream of a slot again in place of one left unusable by a
+   cancelled read, unless another read already did.  Returns the stream now
+   in the slot, NULL if it could not be opened.  The first read to find the
+   stream unusable counts it as cancelled.
+*/
+std::shared_ptr<InStream> HedgedInStream::reopen(int slot,
+                                                 const std::shared_ptr<InStream> &stream)
+{
+  Slot &s = m_slots[slot];
+  {
+    std::unique_lock<std::mutex> guard(m_lock);
+    if (s.reopening || s.stream != stream) {
+      m_reopened.wait(guard, [&s] { return !s.reopening; });
+      return s.stream;
+    }
+    s.reopening = true;
+    m_stats.cancelled++;
+  }
+  std::shared_ptr<InStream> fresh;
+  try {
+    fresh.reset(m_fs.openFile(m_path.c_str()));
+  } catch (NativeException &e) {
+    // Reads go to the other streams from now on
+    e.discard();
+  }
+  std::lock_guard<std::mutex> guard(m_lock);
+  s.stream = fresh;
+  s.reopening = false;
+  if (fresh) {
+    m_stats.reopened++;
+  }
+  m_reopened.notify_all();
+  return fresh;
+}
+
+/**
+   Keep the latency of a read and now and then take the delay from them
+   again; with the lock held.
+*/
+void HedgedInStream::recordLatency(double seconds)
+{
+  if (m_latencies.size() < HEDGE_LATENCY_SAMPLES) {
+    m_latencies.push_back(seconds);
+  } else {
+    m_latencies[m_sampled % HEDGE_LATENCY_SAMPLES] = seconds;
+  }
+  m_sampled++;
+  if (m_options.delayMs > 0 || (int) m_latencies.size() < m_options.minSamples ||
+      m_sampled % HEDGE_DELAY_REFRESH != 0) {
+    return;
+  }
+  std::vector<double> sorted(m_latencies);
+  size_t rank = std::min(sorted.size() - 1, (size_t) (m_options.percentile * sorted.size()));
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  m_delay = std::max(sorted[rank], m_options.minDelayMs / 1000);
+}
+
+/* vim: set ts=4 sw=4 : */
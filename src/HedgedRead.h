@@ -0,0 +1,160 @@
+/**
+ * Hedged positional reads
+ *
+ * Read latency at the far tail comes from the odd slow worker response
+ * rather than from a lack of throughput.  A HedgedInStream keeps several
+ * streams open on one file; when a positionedRead() has not returned after
+ * a delay, the same range is read on another stream and whichever read
+ * returns first is used.  The other one is cancelled (see Deadline.h): its
+ * Java thread is interrupted, and its stream is closed and opened again.
+ * Streams opened separately may be served by other workers, depending on
+ * where the blocks are cached.
+ *
+ * The delay is fixed, or a percentile of the latency of recent reads so
+ * that only the slowest reads are hedged.  A budget caps hedges at a share
+ * of reads, so that a cluster that is slow all over is not sent twice the
+ * load.
+ *
+ *     HedgedReadOptions options;
+ *     options.percentile = 0.95;        // hedge reads slower than the p95
+ *     HedgedInStream in(fs, "/data/index", options);
+ *     in.positionedRead(pos, buff, length);
+ *
+ */
+
+#ifndef __HEDGED_READ_H_
+#define __HEDGED_READ_H_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Alluxio.h"
+
+/// Recent read latencies a derived delay is computed from
+#define HEDGE_LATENCY_SAMPLES 256
+/// Reads between two computations of a derived delay
+#define HEDGE_DELAY_REFRESH 16
+
+namespace alluxio {
+
+class ThreadPool;
+
+struct HedgedReadOptions {
+    HedgedReadOptions()
+        : numStreams(2), delayMs(0), percentile(0.95), minDelayMs(1), minSamples(32),
+          budgetRatio(0.05), budgetBurst(10), pool(NULL) {}
+
+    /// Streams opened on the file; a hedge goes to another than the read
+    int numStreams;
+    /// Fixed delay before a read is hedged; 0 to use percentile
+    double delayMs;
+    /// Percentile of the latencies of recent reads, before any hedge, used
+    /// as the delay
+    double percentile;
+    /// Lower bound of a delay taken from percentile
+    double minDelayMs;
+    /// Reads timed before percentile is trusted; none are hedged before
+    int minSamples;
+    /// Hedges allowed per read, on average
+    double budgetRatio;
+    /// Hedges allowed in a row, once the budget has built up
+    double budgetBurst;
+    /// Pool running the reads; NULL for ThreadPool::shared().  Do not read
+    /// from a task of the same pool.
+    ThreadPool *pool;
+};
+
+struct HedgedReadStats {
+    HedgedReadStats()
+        : reads(0), hedged(0), hedgeWins(0), overBudget(0), cancelled(0),
+          reopened(0), delayMs(0) {}
+
+    int64_t reads;
+    /// Reads that sent a hedge, and those the hedge answered first
+    int64_t hedged;
+    int64_t hedgeWins;
+    /// Reads slow enough to hedge, but not hedged for lack of budget
+    int64_t overBudget;
+    /// Streams left unusable by a read cancelled before it returned
+    int64_t cancelled;
+    /// Of those, the streams opened again
+    int64_t reopened;
+    /// Current delay; 0 while no read is hedged yet
+    double delayMs;
+};
+
+/**
+   Positional reads of one file, hedged over several streams.  Reads may
+   be made from several threads at once.  Within a DeadlineScope, the wait
+   for a read is bounded by the deadline of the scope and ends once one of
+   its tokens is cancelled.
+*/
+class HedgedInStream {
+  public:
+    /// fs must outlive the stream
+    HedgedInStream(AlluxioFileSystem &fs, const char *path,
+                   const HedgedReadOptions &options = HedgedReadOptions());
+    ~HedgedInStream();
+
+    int positionedRead(int64_t pos, void *buff, int length);
+    /// Wait for the reads still running, then close the streams
+    void close();
+
+    HedgedReadStats stats() const;
+
+  private:
+    HedgedInStream(HedgedInStream const &);
+    void operator=(HedgedInStream const &);
+
+    typedef std::chrono::steady_clock Clock;
+    struct Read;
+
+    struct Slot {
+        Slot() : busy(0), reopening(false) {}
+
+        /// NULL if it could not be opened again
+        std::shared_ptr<InStream> stream;
+        /// Reads running on the stream
+        int busy;
+        bool reopening;
+    };
+
+    int pickStream(int other);
+    void startLeg(const std::shared_ptr<Read> &read, int leg, int slot);
+    void runLeg(const std::shared_ptr<Read> &read, int leg, int slot,
+                const std::shared_ptr<InStream> &stream);
+    std::shared_ptr<InStream> reopen(int slot, const std::shared_ptr<InStream> &stream);
+    void recordLatency(double seconds);
+
+    AlluxioFileSystem &m_fs;
+    std::string m_path;
+    HedgedReadOptions m_options;
+    ThreadPool &m_pool;
+
+    std::vector<Slot> m_slots;
+    int m_next;
+    /// Reads running on the pool, waited for by close()
+    int m_legs;
+    bool m_closed;
+    double m_budget;
+    std::vector<double> m_latencies;
+    size_t m_sampled;
+    /// Delay in seconds; 0 for none
+    double m_delay;
+    HedgedReadStats m_stats;
+    mutable std::mutex m_lock;
+    std::condition_variable m_idle;
+    std::condition_variable m_reopened;
+};
+
+} // namespace alluxio
+
+#endif /* __HEDGED_READ_H_ */
+
+/* vim: set ts=4 sw=4 : */
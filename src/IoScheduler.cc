@@ -0,0 +1,466 @@
+/**
+ * Admission control for Alluxio operations
+ *
+ */
+
+#include "IoScheduler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+using namespace alluxio;
+
+static thread_local IoClass t_class = IoClass::INTERACTIVE;
+static thread_local std::string t_tenant;
+/// Depth of admitted operations on the calling thread
+static thread_local int t_admitted = 0;
+
+static std::atomic<IoScheduler *> s_installed(NULL);
+/// Threads that may have loaded s_installed and not yet entered it
+static std::atomic<int> s_entering(0);
+
+namespace {
+
+/// Calls made inside it are part of an operation admitted already
+struct Admitted {
+    Admitted() { t_admitted++; }
+    ~Admitted() { t_admitted--; }
+};
+
+} // namespace
+
+//////////////////////////////////////////
+// IoScope
+//////////////////////////////////////////
+
+IoScope::IoScope(IoClass ioClass, const std::string &tenant)
+    : m_previousClass(t_class), m_previousTenant(t_tenant)
+{
+  t_class = ioClass;
+  t_tenant = tenant;
+}
+
+IoScope::~IoScope()
+{
+  t_class = m_previousClass;
+  t_tenant = m_previousTenant;
+}
+
+IoClass IoScope::currentClass()
+{
+  return t_class;
+}
+
+const std::string &IoScope::currentTenant()
+{
+  return t_tenant;
+}
+
+IoRequest::IoRequest(int64_t bytes) : ioClass(t_class), tenant(t_tenant), bytes(bytes) {}
+
+//////////////////////////////////////////
+// IoScheduler
+//////////////////////////////////////////
+
+void IoScheduler::TokenBucket::configure(const IoLimits &limits, Clock::time_point now)
+{
+  rate = (double) limits.bytesPerSecond;
+  burst = limits.burstBytes > 0 ? (double) limits.burstBytes : rate;
+  tokens = burst;
+  last = now;
+}
+
+void IoScheduler::TokenBucket::refill(Clock::time_point now)
+{
+  if (rate <= 0) {
+    return;
+  }
+  std::chrono::duration<double> elapsed = now - last;
+  tokens = std::min(burst, tokens + elapsed.count() * rate);
+  last = now;
+}
+
+/// When the debt is paid back, with one byte to spare
+IoScheduler::Clock::time_point IoScheduler::TokenBucket::readyAt() const
+{
+  if (ready()) {
+    return last;
+  }
+  std::chrono::duration<double> wait((1 - tokens) / rate);
+  return last + std::chrono::duration_cast<Clock::duration>(wait);
+}
+
+IoScheduler::IoScheduler(int maxInFlight)
+    : m_maxInFlight(std::max(0, maxInFlight)), m_inFlight(0), m_posted(0), m_users(0),
+      m_stop(false), m_wakeAt(Clock::time_point::max())
+{
+  m_timer = std::thread(&IoScheduler::runTimer, this);
+}
+
+IoScheduler::~IoScheduler()
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  m_granted.wait(guard, [this] {
+    for (int i = 0; i < IO_CLASS_COUNT; i++) {
+      if (!m_classes[i].waiting.empty()) {
+        return false;
+      }
+    }
+    return m_inFlight == 0 && m_users == 0;
+  });
+  m_stop = true;
+  m_timerChanged.notify_one();
+  guard.unlock();
+  m_timer.join();
+}
+
+void IoScheduler::setLimits(IoClass ioClass, const IoLimits &limits)
+{
+  std::list<Request *> started;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    Class &c = m_classes[(int) ioClass];
+    c.limits = limits;
+    c.bucket.configure(limits, Clock::now());
+    pump(started);
+  }
+  runStarted(started);
+}
+
+void IoScheduler::setTenantLimits(const std::string &tenant, const IoLimits &limits)
+{
+  std::list<Request *> started;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_tenants[tenant].configure(limits, Clock::now());
+    pump(started);
+  }
+  runStarted(started);
+}
+
+IoClassStats IoScheduler::stats(IoClass ioClass) const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  const Class &c = m_classes[(int) ioClass];
+  IoClassStats stats = c.stats;
+  stats.inFlight = c.inFlight;
+  stats.queued = (int64_t) c.waiting.size();
+  return stats;
+}
+
+void IoScheduler::install(IoScheduler *scheduler)
+{
+  s_installed.store(scheduler);
+  // Grace period: a thread that loaded the scheduler replaced has entered it
+  // by now, and its destructor waits for it
+  while (s_entering > 0) {
+    std::this_thread::yield();
+  }
+}
+
+IoScheduler *IoScheduler::installed()
+{
+  return s_installed.load(std::memory_order_acquire);
+}
+
+/// The scheduler installed, kept from destruction until leave(); or NULL
+IoScheduler *IoScheduler::enter()
+{
+  s_entering++;
+  IoScheduler *scheduler = s_installed.load();
+  if (scheduler != NULL) {
+    scheduler->m_users++;
+  }
+  s_entering--;
+  return scheduler;
+}
+
+void IoScheduler::leave()
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (--m_users == 0) {
+    // For the destructor
+    m_granted.notify_all();
+  }
+}
+
+void IoScheduler::post(ThreadPool &pool, const IoRequest &request,
+                       std::function<void()> task)
+{
+  IoScheduler *scheduler = enter();
+  if (scheduler == NULL) {
+    pool.execute(task);
+    return;
+  }
+
+  ThreadPool *target = &pool;
+  Request *r = new Request();
+  r->ioClass = request.ioClass;
+  r->bytes = request.bytes;
+  r->capped = true;
+  r->onPool = false;
+  r->posted = true;
+  r->start = [scheduler, target, request, task] {
+    try {
+      target->execute([scheduler, request, task] {
+        struct Finish {
+          IoScheduler *scheduler;
+          IoClass ioClass;
+          ~Finish() { scheduler->release(ioClass); }
+        } finish = { scheduler, request.ioClass };
+        scheduler->startPosted(request.ioClass);
+        IoScope scope(request.ioClass, request.tenant);
+        Admitted admitted;
+        task();
+      });
+    } catch (...) {
+      scheduler->startPosted(request.ioClass);
+      scheduler->release(request.ioClass);
+    }
+  };
+  // Queued or in flight from now on, which the destructor waits for
+  scheduler->dispatch(r, request.tenant);
+  scheduler->leave();
+}
+
+void IoScheduler::admit(const IoRequest &request)
+{
+  Request r;
+  r.ioClass = request.ioClass;
+  r.bytes = request.bytes;
+  // Calls within an admitted operation are part of it
+  r.capped = t_admitted == 0;
+  r.onPool = ThreadPool::currentContext() != NULL;
+  r.posted = false;
+
+  std::list<Request *> started;
+  std::unique_lock<std::mutex> guard(m_lock);
+  enqueue(&r, request.tenant);
+  pump(started);
+  if (!started.empty()) {
+    guard.unlock();
+    runStarted(started);
+    guard.lock();
+  }
+  m_granted.wait(guard, [&r] { return r.granted; });
+}
+
+void IoScheduler::release(IoClass ioClass)
+{
+  std::list<Request *> started;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_inFlight--;
+    m_classes[(int) ioClass].inFlight--;
+    pump(started);
+    if (m_inFlight == 0) {
+      // For the destructor
+      m_granted.notify_all();
+    }
+  }
+  runStarted(started);
+}
+
+void IoScheduler::dispatch(const IoRequest &request, std::function<void()> start)
+{
+  Request *r = new Request();
+  r->ioClass = request.ioClass;
+  r->bytes = request.bytes;
+  r->capped = true;
+  r->onPool = false;
+  r->posted = false;
+  r->start = start;
+  dispatch(r, request.tenant);
+}
+
+void IoScheduler::dispatch(Request *request, const std::string &tenant)
+{
+  std::list<Request *> started;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    enqueue(request, tenant);
+    pump(started);
+  }
+  runStarted(started);
+}
+
+/// A task of post() started on its pool: its slot is no longer lent out
+void IoScheduler::startPosted(IoClass ioClass)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  m_posted--;
+  m_classes[(int) ioClass].posted--;
+}
+
+void IoScheduler::enqueue(Request *request, const std::string &tenant)
+{
+  std::unordered_map<std::string, TokenBucket>::iterator it = m_tenants.find(tenant);
+  request->tenant = it == m_tenants.end() ? NULL : &it->second;
+  request->granted = false;
+  request->waited = false;
+  request->queuedAt = Clock::now();
+  m_classes[(int) request->ioClass].waiting.push_back(request);
+}
+
+/**
+   Grant every queued request that may start, most urgent class first and in
+   order within a class, and set the timer for those waiting on tokens.
+
+   @param[out] started Granted async requests, to be run without the lock
+*/
+void IoScheduler::pump(std::list<Request *> &started)
+{
+  Clock::time_point now = Clock::now();
+  Clock::time_point wakeAt = Clock::time_point::max();
+  bool grantedSync = false;
+
+  for (int i = 0; i < IO_CLASS_COUNT; i++) {
+    Class &c = m_classes[i];
+    c.bucket.refill(now);
+    std::list<Request *>::iterator it = c.waiting.begin();
+    while (it != c.waiting.end()) {
+      Request *r = *it;
+      // A pool thread must not wait for the slot of a task queued behind it
+      int inFlight = r->onPool ? m_inFlight - m_posted : m_inFlight;
+      int classInFlight = r->onPool ? c.inFlight - c.posted : c.inFlight;
+      bool full = (m_maxInFlight > 0 && inFlight >= m_maxInFlight) ||
+                  (c.limits.maxInFlight > 0 && classInFlight >= c.limits.maxInFlight);
+      if (r->capped && full) {
+        // Woken up by the next release()
+        r->waited = true;
+        ++it;
+        continue;
+      }
+      if (r->bytes > 0) {
+        if (r->tenant != NULL) {
+          r->tenant->refill(now);
+        }
+        if (!c.bucket.ready() || (r->tenant != NULL && !r->tenant->ready())) {
+          Clock::time_point readyAt = c.bucket.readyAt();
+          if (r->tenant != NULL) {
+            readyAt = std::max(readyAt, r->tenant->readyAt());
+          }
+          wakeAt = std::min(wakeAt, readyAt);
+          r->waited = true;
+          ++it;
+          continue;
+        }
+      }
+
+      it = c.waiting.erase(it);
+      grant(c, r, now);
+      if (r->start) {
+        started.push_back(r);
+      } else {
+        grantedSync = true;
+      }
+    }
+  }
+
+  if (grantedSync) {
+    m_granted.notify_all();
+  }
+  if (wakeAt != m_wakeAt) {
+    m_wakeAt = wakeAt;
+    m_timerChanged.notify_one();
+  }
+}
+
+/// Start request now, taking its slot and its bytes
+void IoScheduler::grant(Class &c, Request *request, Clock::time_point now)
+{
+  m_inFlight++;
+  c.inFlight++;
+  if (request->posted) {
+    m_posted++;
+    c.posted++;
+  }
+  if (request->bytes > 0) {
+    if (c.bucket.rate > 0) {
+      c.bucket.tokens -= (double) request->bytes;
+    }
+    if (request->tenant != NULL && request->tenant->rate > 0) {
+      request->tenant->tokens -= (double) request->bytes;
+    }
+  }
+
+  c.stats.peakInFlight = std::max(c.stats.peakInFlight, (int64_t) c.inFlight);
+  c.stats.admitted++;
+  c.stats.bytes += request->bytes;
+  if (request->waited) {
+    std::chrono::duration<double> waited = now - request->queuedAt;
+    c.stats.waited++;
+    c.stats.waitSeconds += waited.count();
+  }
+  request->granted = true;
+}
+
+void IoScheduler::runStarted(std::list<Request *> &started)
+{
+  for (std::list<Request *>::iterator it = started.begin(); it != started.end(); ++it) {
+    std::function<void()> start;
+    start.swap((*it)->start);
+    delete *it;
+    start();
+  }
+  started.clear();
+}
+
+/// Pump again once the requests waiting on tokens may go
+void IoScheduler::runTimer()
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  while (!m_stop) {
+    if (m_wakeAt == Clock::time_point::max()) {
+      m_timerChanged.wait(guard);
+      continue;
+    }
+    if (m_timerChanged.wait_until(guard, m_wakeAt) == std::cv_status::timeout) {
+      std::list<Request *> started;
+      m_wakeAt = Clock::time_point::max();
+      pump(started);
+      guard.unlock();
+      runStarted(started);
+      guard.lock();
+    }
+  }
+}
+
+//////////////////////////////////////////
+// IoAdmission
+//////////////////////////////////////////
+
+IoAdmission::IoAdmission(int64_t bytes) : m_scheduler(NULL), m_class(IoClass::INTERACTIVE)
+{
+  if (t_admitted > 0) {
+    return;
+  }
+  IoScheduler *scheduler = IoScheduler::enter();
+  if (scheduler == NULL) {
+    return;
+  }
+  IoRequest request(bytes);
+  try {
+    scheduler->admit(request);
+  } catch (...) {
+    scheduler->leave();
+    throw;
+  }
+  // In flight from now on, which the destructor waits for
+  scheduler->leave();
+  m_scheduler = scheduler;
+  m_class = request.ioClass;
+  t_admitted++;
+}
+
+IoAdmission::~IoAdmission()
+{
+  if (m_scheduler != NULL) {
+    t_admitted--;
+    m_scheduler->release(m_class);
+  }
+}
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,253 @@
+/**
+ * Admission control for Alluxio operations
+ *
+ * An IoScheduler decides when the JNI calls of liballuxio may start, so
+ * that bulk work sharing a process with latency sensitive work cannot take
+ * every call slot or all of the bandwidth.  Each operation belongs to a
+ * class (interactive, batch, background) and optionally to a tenant, both
+ * set for the calling thread with an IoScope.  A scheduler can cap the
+ * operations in flight per class and over all classes, and limit the bytes
+ * read and written per second per class and per tenant, with token buckets.
+ * Operations that must wait are queued and started in class order, first
+ * come first served within a class.
+ *
+ * Once installed, the scheduler admits the reads, writes and metadata calls
+ * of Alluxio.h, synchronous or not.  Async calls wait for admission in its
+ * queue without holding a pool thread.  With no scheduler installed, the
+ * only cost is a few atomic operations per call.
+ *
+ */
+
+#ifndef __IO_SCHEDULER_H_
+#define __IO_SCHEDULER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace alluxio {
+
+class ThreadPool;
+
+/// Classes of operations, most urgent first
+enum class IoClass {
+    INTERACTIVE,
+    BATCH,
+    BACKGROUND
+};
+
+#define IO_CLASS_COUNT 3
+
+/**
+   Limits of a class, or of a tenant for the byte rate.  0 means no limit.
+*/
+struct IoLimits {
+    IoLimits() : maxInFlight(0), bytesPerSecond(0), burstBytes(0) {}
+
+    /// Operations of the class running at once
+    int maxInFlight;
+    /// Sustained bytes read and written per second
+    int64_t bytesPerSecond;
+    /// Bytes that may go at once after a quiet period; 0 for one second worth
+    int64_t burstBytes;
+};
+
+struct IoClassStats {
+    IoClassStats()
+        : inFlight(0), queued(0), peakInFlight(0), admitted(0), waited(0),
+          bytes(0), waitSeconds(0) {}
+
+    int64_t inFlight;
+    int64_t queued;
+    /// Most operations of the class ever in flight at once
+    int64_t peakInFlight;
+    int64_t admitted;
+    /// Operations admitted after waiting in the queue
+    int64_t waited;
+    int64_t bytes;
+    /// Time spent waiting in the queue, over all operations
+    double waitSeconds;
+};
+
+/**
+   Class and tenant of the operations of the calling thread for as long as
+   it lives; async calls keep those in effect when they were made.  Threads
+   start out INTERACTIVE without a tenant.
+*/
+class IoScope {
+  public:
+    IoScope(IoClass ioClass, const std::string &tenant = std::string());
+    ~IoScope();
+
+    static IoClass currentClass();
+    static const std::string &currentTenant();
+
+  private:
+    IoScope(IoScope const &);
+    void operator=(IoScope const &);
+
+    IoClass m_previousClass;
+    std::string m_previousTenant;
+};
+
+/// An operation to admit: the class and tenant of the calling thread
+struct IoRequest {
+    explicit IoRequest(int64_t bytes = 0);
+
+    IoClass ioClass;
+    std::string tenant;
+    int64_t bytes;
+};
+
+class IoScheduler {
+  public:
+    /// @param[in] maxInFlight Operations of all classes running at once
+    explicit IoScheduler(int maxInFlight = 0);
+    /// Waits for the operations it queued or admitted; uninstall it first
+    ~IoScheduler();
+
+    void setLimits(IoClass ioClass, const IoLimits &limits);
+    /// Byte rate of a tenant over all classes; maxInFlight is ignored
+    void setTenantLimits(const std::string &tenant, const IoLimits &limits);
+    IoClassStats stats(IoClass ioClass) const;
+
+    /**
+       Make this the scheduler of the process, or remove it with NULL.
+       Operations already admitted finish under the scheduler that admitted
+       them.  Returns once no thread can be about to queue an operation on
+       the scheduler replaced, which may then be destroyed.
+    */
+    static void install(IoScheduler *scheduler);
+    /// The scheduler installed; only valid for as long as it stays installed
+    static IoScheduler *installed();
+
+    /**
+       Run task on pool once the installed scheduler admits request; at once
+       with none installed.  The task runs with the class and tenant of the
+       request, and the calls it makes are not admitted again.  pool must
+       outlive the tasks queued for it.
+    */
+    static void post(ThreadPool &pool, const IoRequest &request,
+                     std::function<void()> task);
+
+    /// Wait until request may start; see IoAdmission
+    void admit(const IoRequest &request);
+    /// End an operation admitted by admit() or dispatch()
+    void release(IoClass ioClass);
+    /// Call start once request may start, on this thread or another
+    void dispatch(const IoRequest &request, std::function<void()> start);
+
+  private:
+    friend class IoAdmission;
+
+    IoScheduler(IoScheduler const &);
+    void operator=(IoScheduler const &);
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct TokenBucket {
+        TokenBucket() : rate(0), burst(0), tokens(0) {}
+
+        void configure(const IoLimits &limits, Clock::time_point now);
+        void refill(Clock::time_point now);
+        /// Operations moving bytes wait while the bucket is in debt
+        bool ready() const { return rate <= 0 || tokens > 0; }
+        Clock::time_point readyAt() const;
+
+        double rate;
+        double burst;
+        double tokens;
+        Clock::time_point last;
+    };
+
+    struct Request {
+        IoClass ioClass;
+        int64_t bytes;
+        TokenBucket *tenant;
+        /// Held back by the caps on operations in flight
+        bool capped;
+        /// Made from a ThreadPool thread
+        bool onPool;
+        /// Run by post(): holds its slot while queued on a pool
+        bool posted;
+        bool granted;
+        /// Passed over by pump() at least once
+        bool waited;
+        Clock::time_point queuedAt;
+        /// Async requests: called once granted
+        std::function<void()> start;
+    };
+
+    struct Class {
+        Class() : inFlight(0), posted(0) {}
+
+        IoLimits limits;
+        TokenBucket bucket;
+        std::list<Request *> waiting;
+        int inFlight;
+        /// Of inFlight, tasks of post() not started on their pool yet
+        int posted;
+        IoClassStats stats;
+    };
+
+    static IoScheduler *enter();
+    void leave();
+    void dispatch(Request *request, const std::string &tenant);
+    void startPosted(IoClass ioClass);
+    void enqueue(Request *request, const std::string &tenant);
+    void pump(std::list<Request *> &started);
+    void grant(Class &c, Request *request, Clock::time_point now);
+    static void runStarted(std::list<Request *> &started);
+    void runTimer();
+
+    int m_maxInFlight;
+    int m_inFlight;
+    int m_posted;
+    /// Threads between enter() and leave()
+    std::atomic<int> m_users;
+    Class m_classes[IO_CLASS_COUNT];
+    std::unordered_map<std::string, TokenBucket> m_tenants;
+    bool m_stop;
+    /// When the timer pumps again for requests waiting on tokens
+    Clock::time_point m_wakeAt;
+    mutable std::mutex m_lock;
+    std::condition_variable m_granted;
+    std::condition_variable m_timerChanged;
+    std::thread m_timer;
+};
+
+/**
+   Admission of one operation of the calling thread by the installed
+   scheduler, held until destroyed.  Does nothing with no scheduler
+   installed, or within an operation already admitted.
+
+   On a ThreadPool thread, the slots held by async calls still queued on a
+   pool do not count against the in-flight caps, as those calls may need
+   that thread to start.
+*/
+class IoAdmission {
+  public:
+    explicit IoAdmission(int64_t bytes);
+    ~IoAdmission();
+
+  private:
+    IoAdmission(IoAdmission const &);
+    void operator=(IoAdmission const &);
+
+    IoScheduler *m_scheduler;
+    IoClass m_class;
+};
+
+} // namespace alluxio
+
+#endif /* __IO_SCHEDULER_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -297,24 +297,49 @@ void Env::deleteGlobalRef(jobject obj)
   m_env->DeleteGlobalRef(obj);
 }
 
+/**
+ * Append a jstring to cStr.  GetStringUTFRegion copies straight into the
+ * string, where GetStringUTFChars may make a copy of its own first.
+ */
 bool Env::jstringToString(jstring str, std::string& cStr)
 {
   if (str == NULL) {
     return false;
   }
-  const char* buf;
-  buf = m_env->GetStringUTFChars(str, NULL);
-  if (buf != NULL) {
-    cStr += buf;
-    m_env->ReleaseStringUTFChars(str, buf); 
-  } else {
+  jsize chars = m_env->GetStringLength(str);
+  jsize bytes = m_env->GetStringUTFLength(str);
+  size_t start = cStr.size();
+  // Room for the NUL the JVM writes after the region
+  cStr.resize(start + bytes + 1);
+  m_env->GetStringUTFRegion(str, 0, chars, &cStr[start]);
+  cStr.resize(start + bytes);
+  if (m_env->ExceptionCheck()) {
     // something wrong happened
     m_env->ExceptionClear();
+    cStr.resize(start);
     return false;
   }
   return true;
 }
 
+bool Env::getStringUTF(jstring str, StringArena& arena, StringRef& out)
+{
+  if (str == NULL) {
+    return false;
+  }
+  jsize chars = m_env->GetStringLength(str);
+  jsize bytes = m_env->GetStringUTFLength(str);
+  char *buf = arena.allocate(bytes + 1);
+  m_env->GetStringUTFRegion(str, 0, chars, buf);
+  if (m_env->ExceptionCheck()) {
+    m_env->ExceptionClear();
+    return false;
+  }
+  buf[bytes] = '\0';
+  out = StringRef(buf, bytes);
+  return true;
+}
+
 bool Env::getClassName(jclass cls, jobject instance, std::string& nameStr)
 {
   try {
@@ -637,6 +662,12 @@ JNIEnv* JNIHelper::getEnv()
   JavaVM* vmBuf[JVM_BUF_LEN];
   jsize vms;
 
+  // Fast path: the calling thread is attached already
+  JavaVM *known = m_jvm.load(std::memory_order_acquire);
+  if (known != NULL && known->GetEnv((void **) &env, JNI_VERSION_1_6) == JNI_OK) {
+    return env;
+  }
+
   m_env_lock.lock(); // ensure thread-safe JNIEnv acquisition
 
   jint ok = JNI_GetCreatedJavaVMs(vmBuf, JVM_BUF_LEN, &vms);
@@ -674,6 +705,10 @@ JNIEnv* JNIHelper::getEnv()
     classpathString.append(":");
     classpathString.append(CLASSPATH_SLF4J_JAR);
 
+    // For liballuxio's own Java helpers
+    classpathString.append(":");
+    classpathString.append(CLASSPATH_LIBALLUXIO_JAR);
+
     options[0].optionString = const_cast<char *>(classpathString.c_str());
 
     JavaVMInitArgs args;
@@ -687,6 +722,7 @@ JNIEnv* JNIHelper::getEnv()
       m_env_lock.unlock();
       throw std::runtime_error("JNI_CreateJavaVM call failed");
     }
+    m_jvm.store(jvm, std::memory_order_release);
   } else {
     // there are JVM created already, re-use
     JavaVM* jvm = vmBuf[0];
@@ -695,6 +731,7 @@ JNIEnv* JNIHelper::getEnv()
       m_env_lock.unlock();
       throw std::runtime_error("AttachCurrentThread call failed");
     }
+    m_jvm.store(jvm, std::memory_order_release);
   }
 
   m_env_lock.unlock(); // end of critical section
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <sstream>
+#include <atomic>
 #include <memory>
 #include <mutex>
 
@@ -22,6 +23,8 @@
 #include <stdexcept>
 #include <map>
 
+#include "StringArena.h"
+
 #define CTORNAME "<init>"
 
 #define JTHROWABLE_CLS "java/lang/Throwable"
@@ -40,6 +43,12 @@
 // Jackson JARs are required if you plan to configure an S3 underfs
 #define CLASSPATH_JACKSON_JARS "$HOME/jackson/jackson-annotations-2.8.1.jar:$HOME/jackson/jackson-core-2.8.1.jar:$HOME/jackson/jackson-databind-2.8.1.jar"
 
+// Java helpers of liballuxio itself (src/java), installed under $(datadir)/liballuxio.  They
+// are optional: the calls that use them fall back to plain JNI when the classes are missing.
+#ifndef CLASSPATH_LIBALLUXIO_JAR
+#define CLASSPATH_LIBALLUXIO_JAR "$HOME/liballuxio/dist/share/liballuxio/liballuxio.jar"
+#endif
+
 #define JVM_BUF_LEN   1 
 #define MAX_CLS_SIG 256
 #define MAX_EXCEPT_MSG_LEN 256
@@ -240,6 +249,7 @@ public:
   Env();
   Env(JNIEnv *env): m_env(env) {}
   Env(Env const & copy): m_env(copy.m_env) {}
+  Env &operator=(Env const &other) { m_env = other.m_env; return *this; }
 
   // make it be able to cast to JNIEnv* 
   operator JNIEnv *() const { return m_env; }
@@ -286,6 +296,8 @@ public:
 
   bool getClassName(jclass cls, jobject instance, std::string& nameStr);
   bool jstringToString(jstring str, std::string& cStr);
+  // copy a jstring's modified UTF-8 into an arena, without a JVM-side copy
+  bool getStringUTF(jstring str, StringArena& arena, StringRef& out);
   bool throwableToString(jthrowable except, std::string& exceptStr);
 
   /** Exception related methods **/
@@ -488,16 +500,24 @@ public:
   }
   ~JNIHelper() {}
 
+  /**
+   * Env of the calling thread, attaching it to the JVM (created on first
+   * use) if needed.  Once the JVM is known, an attached thread gets its env
+   * through JavaVM::GetEnv without locking, so handles can afford to look
+   * it up on every call.
+   */
   JNIEnv* getEnv();
   void printThrowableStackTrace(JNIEnv *env, jthrowable exce);
   bool getThrowableStackTrace(JNIEnv *env, jthrowable exce, std::string &out);
 
 private:
-  JNIHelper() {}
+  JNIHelper() : m_jvm(NULL) {}
   JNIHelper(JNIHelper const &);
   void operator=(JNIHelper const &);
 
   Mutex m_env_lock;
+  /// The JVM, once created or found
+  std::atomic<JavaVM *> m_jvm;
 }; // class JNIHelper
 
 }} // namespace Tachyon::JNI
@@ -0,0 +1,519 @@
+/**
+ * Local staging of writes with asynchronous upload
+ *
+ */
+
+#include "LocalStaging.h"
+#include "ThreadPool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace alluxio;
+
+#define STAGING_JOURNAL_NAME    "journal"
+#define STAGING_FILE_SUFFIX     ".stage"
+#define JOURNAL_STAGED          "staged"
+#define JOURNAL_UPLOADED        "uploaded"
+/// Journal size from which it is rewritten with the pending records only
+#define STAGING_JOURNAL_COMPACT_BYTES (1 << 20)
+
+static std::runtime_error systemError(const std::string &what, const std::string &file)
+{
+  return std::runtime_error(what + " " + file + ": " + strerror(errno));
+}
+
+static void writeFully(int fd, const char *data, size_t length, const std::string &file)
+{
+  while (length > 0) {
+    ssize_t n = ::write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw systemError("Could not write", file);
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+//////////////////////////////////////////
+// StagedOutStream
+//////////////////////////////////////////
+
+StagedOutStream::StagedOutStream(LocalStaging &staging, const std::string &path,
+                                 const std::string &id, int fd)
+    : m_staging(staging), m_path(path), m_id(id), m_fd(fd) {}
+
+StagedOutStream::~StagedOutStream()
+{
+  if (m_fd >= 0) {
+    cancel();
+  }
+}
+
+void StagedOutStream::write(const void *buff, int length)
+{
+  if (m_fd < 0) {
+    throw std::runtime_error("write to a closed staged stream");
+  }
+  writeFully(m_fd, static_cast<const char *>(buff), length,
+             m_staging.stagedFile(m_id));
+}
+
+/**
+   Close the staged file.
+
+   The data is synced to local disk and journaled before this returns, so the
+   upload survives a crash of this process from here on.
+*/
+void StagedOutStream::close()
+{
+  if (m_fd < 0) {
+    return;
+  }
+  std::string file = m_staging.stagedFile(m_id);
+  int fd = m_fd;
+  m_fd = -1;
+  if (fsync(fd) != 0) {
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    throw systemError("Could not sync", file);
+  }
+  if (::close(fd) != 0) {
+    throw systemError("Could not close", file);
+  }
+
+  m_staging.journalStaged(m_id, m_path);
+  m_staging.enqueue(m_id, m_path);
+}
+
+void StagedOutStream::cancel()
+{
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  unlink(m_staging.stagedFile(m_id).c_str());
+}
+
+//////////////////////////////////////////
+// LocalStaging
+//////////////////////////////////////////
+
+/**
+   Constructor
+
+   Opens (or creates) the staging directory and queues the uploads a previous
+   process left unfinished.
+
+   @param[in] options Staging options; stagingDir is required
+*/
+LocalStaging::LocalStaging(const LocalStagingOptions &options)
+    : m_options(options), m_journalFd(-1), m_journalBytes(0), m_nextId(0), m_pending(0),
+      m_stopping(false), m_uploader(ThreadPool::shared(), options.maxConcurrentUploads) {
+  if (m_options.stagingDir.empty()) {
+    throw std::runtime_error("LocalStaging needs a staging directory");
+  }
+  if (mkdir(m_options.stagingDir.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw systemError("Could not create staging directory", m_options.stagingDir);
+  }
+
+  recover();
+}
+
+LocalStaging::~LocalStaging()
+{
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stopping = true;
+  }
+  // Uploads not started yet give up at once
+  m_uploader.await();
+  if (m_journalFd >= 0) {
+    ::close(m_journalFd);
+  }
+}
+
+std::string LocalStaging::stagedFile(const std::string &id) const
+{
+  return m_options.stagingDir + "/" + id + STAGING_FILE_SUFFIX;
+}
+
+std::string LocalStaging::journalFile() const
+{
+  return m_options.stagingDir + "/" STAGING_JOURNAL_NAME;
+}
+
+/// Append a record to the journal; with the journal lock held
+void LocalStaging::appendJournal(const std::string &record)
+{
+  std::string line = record + "\n";
+  writeFully(m_journalFd, line.data(), line.size(), journalFile());
+  m_journalBytes += line.size();
+  if (fsync(m_journalFd) != 0) {
+    throw systemError("Could not sync", journalFile());
+  }
+}
+
+void LocalStaging::journalStaged(const std::string &id, const std::string &path)
+{
+  std::lock_guard<std::mutex> guard(m_journalLock);
+  appendJournal(std::string(JOURNAL_STAGED " ") + id + " " + path);
+  m_journaled.push_back(std::make_pair(id, path));
+}
+
+/**
+   Record an upload as done, and compact the journal once it is large.
+   Without the record, the next LocalStaging finds the staged file gone and
+   drops it, so a failure here loses nothing.
+*/
+void LocalStaging::journalUploaded(const std::string &id)
+{
+  std::lock_guard<std::mutex> guard(m_journalLock);
+  for (std::list<std::pair<std::string, std::string> >::iterator it = m_journaled.begin();
+       it != m_journaled.end(); ++it) {
+    if (it->first == id) {
+      m_journaled.erase(it);
+      break;
+    }
+  }
+  appendJournal(std::string(JOURNAL_UPLOADED " ") + id);
+  if (m_journalBytes >= STAGING_JOURNAL_COMPACT_BYTES) {
+    std::string compacted;
+    for (std::list<std::pair<std::string, std::string> >::iterator it = m_journaled.begin();
+         it != m_journaled.end(); ++it) {
+      compacted += std::string(JOURNAL_STAGED " ") + it->first + " " + it->second + "\n";
+    }
+    rewriteJournal(compacted);
+  }
+}
+
+/**
+   Replace the journal with content, atomically, and append to the new one
+   from then on.
+*/
+void LocalStaging::rewriteJournal(const std::string &content)
+{
+  std::string tmpFile = journalFile() + ".tmp";
+  int fd = open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw systemError("Could not create", tmpFile);
+  }
+  try {
+    writeFully(fd, content.data(), content.size(), tmpFile);
+    if (fsync(fd) != 0) {
+      throw systemError("Could not sync", tmpFile);
+    }
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+  if (rename(tmpFile.c_str(), journalFile().c_str()) != 0) {
+    throw systemError("Could not replace", journalFile());
+  }
+
+  fd = open(journalFile().c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    throw systemError("Could not open", journalFile());
+  }
+  if (m_journalFd >= 0) {
+    ::close(m_journalFd);
+  }
+  m_journalFd = fd;
+  m_journalBytes = content.size();
+}
+
+/**
+   Replay the journal: staged files without an "uploaded" record are queued
+   again, staged files that were never closed are removed, and the journal is
+   rewritten to hold only the pending records.
+*/
+void LocalStaging::recover()
+{
+  std::map<std::string, std::string> pending;
+  std::vector<std::string> order;
+  std::ifstream journal(journalFile().c_str());
+  std::string line;
+  while (std::getline(journal, line)) {
+    std::istringstream ss(line);
+    std::string kind, id, path;
+    if (!(ss >> kind >> id)) {
+      continue; // torn last record
+    }
+    if (kind == JOURNAL_STAGED && ss.get() == ' ' && std::getline(ss, path)) {
+      if (pending.find(id) == pending.end()) {
+        order.push_back(id);
+      }
+      pending[id] = path;
+    } else if (kind == JOURNAL_UPLOADED) {
+      pending.erase(id);
+    }
+  }
+  journal.close();
+
+  // Remove files that were being written when the previous process stopped
+  DIR *dir = opendir(m_options.stagingDir.c_str());
+  if (dir != NULL) {
+    const std::string suffix = STAGING_FILE_SUFFIX;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      std::string name = entry->d_name;
+      if (name.size() <= suffix.size() ||
+          name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        continue;
+      }
+      std::string id = name.substr(0, name.size() - suffix.size());
+      if (pending.find(id) == pending.end()) {
+        unlink(stagedFile(id).c_str());
+      }
+    }
+    closedir(dir);
+  }
+
+  std::string compacted;
+  for (size_t i = 0; i < order.size(); i++) {
+    std::map<std::string, std::string>::iterator it = pending.find(order[i]);
+    if (it == pending.end()) {
+      continue;
+    }
+    if (access(stagedFile(it->first).c_str(), F_OK) != 0) {
+      pending.erase(it);
+      continue;
+    }
+    compacted += std::string(JOURNAL_STAGED " ") + it->first + " " + it->second + "\n";
+    m_journaled.push_back(*it);
+  }
+  rewriteJournal(compacted);
+
+  for (size_t i = 0; i < order.size(); i++) {
+    std::map<std::string, std::string>::iterator it = pending.find(order[i]);
+    if (it != pending.end()) {
+      enqueue(it->first, it->second);
+    }
+  }
+}
+
+/**
+   Start a staged file.
+
+   @param[in] path Alluxio path the data is uploaded to; an existing file
+              there is replaced by the upload
+   @return Stream writing to the local staging directory
+*/
+jStagedOutStream LocalStaging::createFile(const char *path)
+{
+  std::ostringstream id;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    id << getpid() << "-" << time(NULL) << "-" << m_nextId++;
+  }
+
+  std::string file = stagedFile(id.str());
+  int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw systemError("Could not create", file);
+  }
+  return new StagedOutStream(*this, path, id.str(), fd);
+}
+
+void LocalStaging::enqueue(const std::string &id, const std::string &path)
+{
+  std::shared_ptr<Upload> job(new Upload());
+  job->id = id;
+  job->path = path;
+  bool start;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    std::list<std::shared_ptr<Upload> > &jobs = m_uploads[path];
+    // A new file for the path supersedes the failed uploads of earlier ones
+    for (std::list<std::shared_ptr<Upload> >::iterator it = jobs.begin(); it != jobs.end();) {
+      it = (*it)->done ? jobs.erase(it) : ++it;
+    }
+    jobs.push_back(job);
+    // Otherwise started once the uploads of the path before it are over
+    start = jobs.size() == 1;
+    m_pending++;
+  }
+  if (start) {
+    m_uploader.execute([this, job] { upload(job); });
+  }
+}
+
+/**
+   Copy one staged file to Alluxio, on a pool thread.
+
+   On failure the staged file and its journal record are kept, so the upload
+   is retried by the next LocalStaging on this directory.
+*/
+void LocalStaging::upload(std::shared_ptr<Upload> job)
+{
+  std::string error;
+  bool uploaded = false;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_stopping) {
+      error = "staging shut down before the upload started";
+    }
+  }
+
+  if (error.empty()) {
+    std::string file = stagedFile(job->id);
+    std::unique_ptr<FileOutStream> out;
+    int fd = -1;
+    try {
+      AlluxioClientContext *context = ThreadPool::currentContext();
+      if (context == NULL) {
+        throw std::runtime_error("upload thread is not attached to the JVM");
+      }
+      AlluxioFileSystem fs(*context);
+
+      fd = open(file.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw systemError("Could not open", file);
+      }
+
+      // Left over from an upload interrupted by a crash
+      if (fs.exists(job->path.c_str())) {
+        fs.deletePath(job->path.c_str());
+      }
+
+      std::unique_ptr<AlluxioCreateFileOptions> createOptions;
+      if (m_options.setWriteType) {
+        createOptions.reset(AlluxioCreateFileOptions::getCreateFileOptions());
+        createOptions->setWriteType(m_options.writeType);
+      }
+      out.reset(fs.createFile(job->path.c_str(), createOptions.get()));
+
+      std::vector<char> buffer(m_options.uploadBufferSize > 0 ?
+                               m_options.uploadBufferSize : 1 << 20);
+      for (;;) {
+        ssize_t n = ::read(fd, buffer.data(), buffer.size());
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw systemError("Could not read", file);
+        }
+        if (n == 0) {
+          break;
+        }
+        out->write(buffer.data(), n);
+      }
+      out->close();
+      out.reset();
+      ::close(fd);
+      fd = -1;
+
+      uploaded = true;
+      try {
+        journalUploaded(job->id);
+      } catch (const std::exception &e) {
+        // Uploaded all the same; a new LocalStaging drops the record
+        fprintf(stderr, "LocalStaging: could not journal the upload of %s: %s\n",
+                job->path.c_str(), e.what());
+      }
+      unlink(file.c_str());
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    if (out) {
+      try {
+        out->cancel();
+      } catch (...) {
+        // The upload already failed; keep that error
+      }
+    }
+  }
+
+  std::shared_ptr<Upload> next;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    job->done = true;
+    m_pending--;
+    std::list<std::shared_ptr<Upload> > &jobs = m_uploads[job->path];
+    if (!uploaded) {
+      job->error = error;
+    } else {
+      // Only failures are remembered; awaitUpload() of an unknown path returns
+      jobs.remove(job);
+    }
+    for (std::list<std::shared_ptr<Upload> >::iterator it = jobs.begin(); it != jobs.end();
+         ++it) {
+      if ((*it)->done) {
+        continue;
+      }
+      if (!m_stopping) {
+        next = *it;
+        break;
+      }
+      (*it)->done = true;
+      (*it)->error = "staging shut down before the upload started";
+      m_pending--;
+    }
+    if (jobs.empty()) {
+      m_uploads.erase(job->path);
+    }
+    m_changed.notify_all();
+  }
+  if (next) {
+    m_uploader.execute([this, next] { upload(next); });
+  }
+}
+
+void LocalStaging::awaitUpload(const char *path)
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  std::map<std::string, std::list<std::shared_ptr<Upload> > >::iterator it =
+      m_uploads.find(path);
+  if (it == m_uploads.end()) {
+    return;
+  }
+  std::vector<std::shared_ptr<Upload> > jobs(it->second.begin(), it->second.end());
+  m_changed.wait(guard, [&jobs] {
+    for (size_t i = 0; i < jobs.size(); i++) {
+      if (!jobs[i]->done) {
+        return false;
+      }
+    }
+    return true;
+  });
+  for (size_t i = 0; i < jobs.size(); i++) {
+    if (!jobs[i]->error.empty()) {
+      throw std::runtime_error("Upload of " + jobs[i]->path + " failed: " + jobs[i]->error);
+    }
+  }
+}
+
+void LocalStaging::awaitAll()
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  m_changed.wait(guard, [this] { return m_pending == 0; });
+}
+
+int LocalStaging::pendingUploads()
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  return m_pending;
+}
+
+/* vim: set ts=4 sw=4 : */
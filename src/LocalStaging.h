@@ -0,0 +1,146 @@
+/**
+ * Local staging of writes with asynchronous upload
+ *
+ * Writers append to a file in a local staging directory (ideally on fast
+ * local disk) instead of a FileOutStream, so write latency does not depend on
+ * the Alluxio cluster.  Closing a staged stream hands the file to background
+ * threads that upload it to its Alluxio path.
+ *
+ * A journal in the staging directory records every closed-but-not-uploaded
+ * file.  A LocalStaging created on the same directory after a crash or
+ * restart uploads whatever the previous process left pending.  Files staged
+ * for the same path are uploaded one after the other, in the order they
+ * were closed, so the last one closed is the one left in Alluxio.
+ *
+ */
+
+#ifndef __LOCAL_STAGING_H_
+#define __LOCAL_STAGING_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Alluxio.h"
+#include "ThreadPool.h"
+
+namespace alluxio {
+
+class LocalStaging;
+
+struct LocalStagingOptions {
+    LocalStagingOptions()
+        : maxConcurrentUploads(4), uploadBufferSize(1 << 20),
+          setWriteType(false), writeType(CACHE_THROUGH) {}
+
+    /// Local directory for staged files and the journal; created if missing
+    std::string stagingDir;
+    /// Number of uploads running at once on ThreadPool::shared()
+    int maxConcurrentUploads;
+    /// Bytes per write() while uploading
+    int uploadBufferSize;
+    /// Whether writeType overrides the client default for uploaded files
+    bool setWriteType;
+    WriteType writeType;
+};
+
+/**
+   A file being written to the staging directory.  Not thread-safe; use one
+   stream per writer like a FileOutStream.
+*/
+class StagedOutStream {
+  public:
+    ~StagedOutStream();
+
+    void write(const void *buff, int length);
+    /// Make the data durable locally and queue the upload
+    void close();
+    /// Discard the staged data; nothing is uploaded
+    void cancel();
+
+    const std::string &path() const { return m_path; }
+
+  private:
+    friend class LocalStaging;
+    StagedOutStream(LocalStaging &staging, const std::string &path,
+                    const std::string &id, int fd);
+    StagedOutStream(StagedOutStream const &);
+    void operator=(StagedOutStream const &);
+
+    LocalStaging &m_staging;
+    std::string m_path;
+    std::string m_id;
+    int m_fd;
+};
+
+typedef StagedOutStream* jStagedOutStream;
+
+class LocalStaging {
+  public:
+    LocalStaging(const LocalStagingOptions &options);
+    /// Waits for running uploads; queued ones stay in the journal
+    ~LocalStaging();
+
+    /// Start a staged file that will be uploaded to path once closed
+    jStagedOutStream createFile(const char *path);
+
+    /// Wait until every file staged for path so far is uploaded; throws if
+    /// an upload failed.  Returns at once if nothing is pending for path.
+    void awaitUpload(const char *path);
+    /// Wait until every upload queued so far is over
+    void awaitAll();
+    /// Number of staged files not yet uploaded
+    int pendingUploads();
+
+  private:
+    friend class StagedOutStream;
+
+    struct Upload {
+      Upload() : done(false) {}
+      std::string id;
+      std::string path;
+      bool done;
+      std::string error;
+    };
+
+    LocalStaging(LocalStaging const &);
+    void operator=(LocalStaging const &);
+
+    std::string stagedFile(const std::string &id) const;
+    std::string journalFile() const;
+    void appendJournal(const std::string &record);
+    void journalStaged(const std::string &id, const std::string &path);
+    void journalUploaded(const std::string &id);
+    void rewriteJournal(const std::string &content);
+    void recover();
+    void enqueue(const std::string &id, const std::string &path);
+    void upload(std::shared_ptr<Upload> job);
+
+    LocalStagingOptions m_options;
+    int m_journalFd;
+    /// Size of the journal, to compact it once it grows too large
+    int64_t m_journalBytes;
+    /// Staged files not uploaded yet, (id, path) in journal order
+    std::list<std::pair<std::string, std::string> > m_journaled;
+    uint64_t m_nextId;
+    /// Uploads of each path in order; the first one not done is running.
+    /// Failed ones are kept until the path is staged again.
+    std::map<std::string, std::list<std::shared_ptr<Upload> > > m_uploads;
+    int m_pending;
+    bool m_stopping;
+    std::mutex m_lock;
+    std::mutex m_journalLock;
+    std::condition_variable m_changed;
+    BoundedExecutor m_uploader;
+};
+
+} // namespace alluxio
+
+#endif /* __LOCAL_STAGING_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,297 @@
+/**
+ * Client-side cache of Alluxio metadata
+ *
+ */
+
+#include "MetadataCache.h"
+
+#include <functional>
+
+using namespace alluxio;
+
+namespace {
+
+/// Alluxio ignores trailing slashes; so does the cache
+std::string normalize(const std::string &path)
+{
+  std::string::size_type end = path.find_last_not_of('/');
+  return end == std::string::npos ? std::string("/") : path.substr(0, end + 1);
+}
+
+} // namespace
+
+MetadataCache::MetadataCache(const MetadataCacheOptions &options)
+    : m_options(options), m_generation(0), m_invalidations(0)
+{
+  if (m_options.numShards <= 0) {
+    m_options.numShards = 1;
+  }
+  for (int i = 0; i < m_options.numShards; i++) {
+    m_shards.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+  m_maxEntriesPerShard = m_options.maxEntries > m_options.numShards ?
+      m_options.maxEntries / m_options.numShards : 1;
+}
+
+MetadataCache::Shard &MetadataCache::shard(const std::string &path)
+{
+  return *m_shards[std::hash<std::string>()(path) % m_shards.size()];
+}
+
+bool MetadataCache::getStatus(const std::string &path, FileStatus &out)
+{
+  std::string key = normalize(path);
+  Shard &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto it = s.entries.find(key);
+  if (it == s.entries.end() || !it->second.hasStatus ||
+      it->second.expires <= Clock::now()) {
+    s.misses++;
+    return false;
+  }
+  s.hits++;
+  touch(s, it->second);
+  out = it->second.status;
+  return true;
+}
+
+MetadataCache::Existence MetadataCache::exists(const std::string &path)
+{
+  std::string key = normalize(path);
+  Shard &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto it = s.entries.find(key);
+  if (it != s.entries.end()) {
+    const Entry &entry = it->second;
+    Clock::time_point now = Clock::now();
+    if (entry.missing && entry.expires > now) {
+      s.negativeHits++;
+      touch(s, it->second);
+      return MISSING;
+    }
+    if (((entry.exists || entry.hasStatus) && entry.expires > now) ||
+        (entry.hasListing && entry.listingExpires > now)) {
+      s.hits++;
+      touch(s, it->second);
+      return EXISTS;
+    }
+  }
+  s.misses++;
+  return UNKNOWN;
+}
+
+bool MetadataCache::getListing(const std::string &path, std::vector<FileStatus> &out)
+{
+  std::string key = normalize(path);
+  Shard &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto it = s.entries.find(key);
+  if (it == s.entries.end() || !it->second.hasListing ||
+      it->second.listingExpires <= Clock::now()) {
+    s.misses++;
+    return false;
+  }
+  s.hits++;
+  touch(s, it->second);
+  out = it->second.listing;
+  return true;
+}
+
+/**
+   Find or make room for the entry of path, evicting the least recently used
+   entry of a full shard.  The caller holds the shard lock.
+
+   @return NULL if an invalidation happened since generation was read
+*/
+MetadataCache::Entry *MetadataCache::fill(Shard &s, const std::string &key,
+                                          uint64_t generation)
+{
+  if (generation != m_generation) {
+    return NULL;
+  }
+
+  auto it = s.entries.find(key);
+  if (it != s.entries.end()) {
+    touch(s, it->second);
+    return &it->second;
+  }
+
+  // Expired entries are not looked up again and end up last
+  if (s.entries.size() >= m_maxEntriesPerShard) {
+    erase(s, s.entries.find(s.lru.back()));
+    s.evictions++;
+  }
+  Entry &entry = s.entries[key];
+  s.lru.push_front(key);
+  entry.used = s.lru.begin();
+  return &entry;
+}
+
+/// Mark an entry as the most recently used of its shard; shard locked
+void MetadataCache::touch(Shard &s, Entry &entry)
+{
+  s.lru.splice(s.lru.begin(), s.lru, entry.used);
+}
+
+/// Drop an entry and its place in the LRU order; shard locked
+void MetadataCache::erase(Shard &s, std::unordered_map<std::string, Entry>::iterator it)
+{
+  s.lru.erase(it->second.used);
+  s.entries.erase(it);
+}
+
+void MetadataCache::putStatus(const std::string &path, const FileStatus &status,
+                              uint64_t generation)
+{
+  std::string key = normalize(path);
+  Shard &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  Entry *entry = fill(s, key, generation);
+  if (entry != NULL) {
+    entry->missing = false;
+    entry->exists = true;
+    entry->hasStatus = true;
+    entry->status = status;
+    entry->expires = Clock::now() + std::chrono::milliseconds(m_options.ttlMs);
+  }
+}
+
+void MetadataCache::putExists(const std::string &path, bool exists, uint64_t generation)
+{
+  std::string key = normalize(path);
+  Shard &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  Entry *entry = fill(s, key, generation);
+  if (entry == NULL) {
+    return;
+  }
+  if (exists) {
+    if (entry->missing) {
+      entry->missing = false;
+      entry->hasStatus = false;
+    }
+    entry->exists = true;
+    entry->expires = Clock::now() + std::chrono::milliseconds(m_options.ttlMs);
+  } else {
+    entry->missing = true;
+    entry->exists = false;
+    entry->hasStatus = false;
+    entry->hasListing = false;
+    entry->listing.clear();
+    entry->expires = Clock::now() + std::chrono::milliseconds(m_options.negativeTtlMs);
+  }
+}
+
+void MetadataCache::putListing(const std::string &path,
+                               const std::vector<FileStatus> &listing,
+                               uint64_t generation)
+{
+  std::string key = normalize(path);
+  {
+    Shard &s = shard(key);
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    Entry *entry = fill(s, key, generation);
+    if (entry == NULL) {
+      return;
+    }
+    if (entry->missing) {
+      entry->missing = false;
+      entry->expires = Clock::time_point();
+    }
+    entry->hasListing = true;
+    entry->listing = listing;
+    entry->listingExpires = Clock::now() + std::chrono::milliseconds(m_options.ttlMs);
+  }
+
+  for (size_t i = 0; i < listing.size(); i++) {
+    if (listing[i].path != key) {
+      putStatus(listing[i].path, listing[i], generation);
+    }
+  }
+}
+
+void MetadataCache::erase(const std::string &key)
+{
+  Shard &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.lock);
+  auto it = s.entries.find(key);
+  if (it != s.entries.end()) {
+    erase(s, it);
+  }
+}
+
+void MetadataCache::invalidate(const std::string &path)
+{
+  std::string key = normalize(path);
+  // Before erasing: fills that read the old generation are dropped
+  m_generation++;
+  m_invalidations++;
+
+  erase(key);
+  // Parents list the new entry and change modification time
+  std::string::size_type slash = key.rfind('/');
+  while (slash != std::string::npos && key != "/") {
+    key.resize(slash > 0 ? slash : 1);
+    erase(key);
+    slash = key.rfind('/');
+  }
+}
+
+void MetadataCache::invalidateTree(const std::string &path)
+{
+  std::string key = normalize(path);
+  if (key == "/") {
+    clear();
+    return;
+  }
+
+  invalidate(key);
+  std::string prefix = key + "/";
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    Shard &s = *m_shards[i];
+    std::lock_guard<std::mutex> guard(s.lock);
+    for (auto e = s.entries.begin(); e != s.entries.end();) {
+      if (e->first.compare(0, prefix.size(), prefix) == 0) {
+        s.lru.erase(e->second.used);
+        e = s.entries.erase(e);
+      } else {
+        ++e;
+      }
+    }
+  }
+}
+
+void MetadataCache::clear()
+{
+  m_generation++;
+  m_invalidations++;
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    std::lock_guard<std::mutex> guard(m_shards[i]->lock);
+    m_shards[i]->entries.clear();
+    m_shards[i]->lru.clear();
+  }
+}
+
+MetadataCacheStats MetadataCache::stats() const
+{
+  MetadataCacheStats stats;
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    Shard &s = *m_shards[i];
+    std::lock_guard<std::mutex> guard(s.lock);
+    stats.hits += s.hits;
+    stats.negativeHits += s.negativeHits;
+    stats.misses += s.misses;
+    stats.evictions += s.evictions;
+    stats.entries += s.entries.size();
+  }
+  stats.invalidations = m_invalidations;
+  return stats;
+}
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,149 @@
+/**
+ * Client-side cache of Alluxio metadata
+ *
+ * Remembers what the master said about a path (its status, that it exists,
+ * that it does not, the listing of a directory) for a few seconds, so that
+ * asking again costs a hash lookup instead of a master RPC through JNI.
+ *
+ * Opt-in: attach one to an AlluxioFileSystem with setMetadataCache().  The
+ * same cache can be shared by the AlluxioFileSystem of several threads.
+ * Mutations made through an AlluxioFileSystem using the cache invalidate the
+ * entries they affect; changes made by other clients are seen once entries
+ * expire.
+ *
+ */
+
+#ifndef __METADATA_CACHE_H_
+#define __METADATA_CACHE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+struct MetadataCacheOptions {
+    MetadataCacheOptions()
+        : numShards(16), maxEntries(100000), ttlMs(10000), negativeTtlMs(1000) {}
+
+    /// Independent hash maps with their own lock
+    int numShards;
+    /// Entries kept over all shards before evicting
+    int maxEntries;
+    /// Lifetime of statuses and listings
+    int ttlMs;
+    /// Lifetime of "does not exist" entries
+    int negativeTtlMs;
+};
+
+struct MetadataCacheStats {
+    MetadataCacheStats()
+        : hits(0), negativeHits(0), misses(0), evictions(0), invalidations(0),
+          entries(0) {}
+
+    int64_t hits;
+    /// Lookups answered with "does not exist"
+    int64_t negativeHits;
+    int64_t misses;
+    int64_t evictions;
+    int64_t invalidations;
+    int64_t entries;
+};
+
+/**
+   Sharded map from path to what is known about it.  Thread-safe.
+
+   Fills take the generation() read before the master was asked: a fill
+   racing with an invalidation is dropped rather than caching stale data.
+*/
+class MetadataCache {
+  public:
+    MetadataCache(const MetadataCacheOptions &options = MetadataCacheOptions());
+
+    /// Outcome of a lookup of whether a path exists
+    enum Existence { UNKNOWN, MISSING, EXISTS };
+
+    bool getStatus(const std::string &path, FileStatus &out);
+    Existence exists(const std::string &path);
+    bool getListing(const std::string &path, std::vector<FileStatus> &out);
+
+    uint64_t generation() const { return m_generation; }
+    void putStatus(const std::string &path, const FileStatus &status,
+                   uint64_t generation);
+    void putExists(const std::string &path, bool exists, uint64_t generation);
+    /// Also caches the status of each entry
+    void putListing(const std::string &path, const std::vector<FileStatus> &listing,
+                    uint64_t generation);
+
+    /// Forget path and its ancestors, after a create
+    void invalidate(const std::string &path);
+    /// Forget path, everything below it and its ancestors, after a delete or
+    /// rename
+    void invalidateTree(const std::string &path);
+    void clear();
+
+    MetadataCacheStats stats() const;
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        Entry() : missing(false), exists(false), hasStatus(false), hasListing(false) {}
+
+        bool missing;
+        /// Known to exist, status not fetched
+        bool exists;
+        bool hasStatus;
+        bool hasListing;
+        FileStatus status;
+        std::vector<FileStatus> listing;
+        Clock::time_point expires;
+        Clock::time_point listingExpires;
+        /// Place of the path in Shard::lru
+        std::list<std::string>::iterator used;
+    };
+
+    struct Shard {
+        Shard() : hits(0), negativeHits(0), misses(0), evictions(0) {}
+
+        std::mutex lock;
+        std::unordered_map<std::string, Entry> entries;
+        /// Paths of entries, most recently used first
+        std::list<std::string> lru;
+        int64_t hits;
+        int64_t negativeHits;
+        int64_t misses;
+        int64_t evictions;
+    };
+
+    MetadataCache(MetadataCache const &);
+    void operator=(MetadataCache const &);
+
+    Shard &shard(const std::string &path);
+    /// Entry for path to fill, or NULL if generation is stale; shard locked
+    Entry *fill(Shard &shard, const std::string &path, uint64_t generation);
+    static void touch(Shard &shard, Entry &entry);
+    static void erase(Shard &shard, std::unordered_map<std::string, Entry>::iterator it);
+    void erase(const std::string &path);
+
+    MetadataCacheOptions m_options;
+    std::vector<std::unique_ptr<Shard> > m_shards;
+    size_t m_maxEntriesPerShard;
+    std::atomic<uint64_t> m_generation;
+    std::atomic<int64_t> m_invalidations;
+};
+
+} // namespace alluxio
+
+#endif /* __METADATA_CACHE_H_ */
+
+/* vim: set ts=4 sw=4 : */
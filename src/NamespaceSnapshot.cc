@@ -0,0 +1,520 @@
+/**
+ * Persisted snapshot of an Alluxio namespace subtree
+ *
+ */
+
+#include "NamespaceSnapshot.h"
+#include "ConcurrencyLimit.h"
+#include "NamespaceWalker.h"
+#include "ThreadPool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+#define SNAPSHOT_MAGIC        "ALXSNAP"
+#define SNAPSHOT_VERSION      1
+#define SNAPSHOT_HEADER_SIZE  32
+#define SNAPSHOT_ENTRY_SIZE   40
+#define SNAPSHOT_FOLDER       1
+/// Directories stat'ed per task by refresh()
+#define SNAPSHOT_STAT_BATCH   64
+
+static void putU32(std::string &out, uint32_t v)
+{
+  for (int i = 0; i < 4; i++) {
+    out.push_back((char) (v >> (8 * i)));
+  }
+}
+
+static void putU64(std::string &out, uint64_t v)
+{
+  for (int i = 0; i < 8; i++) {
+    out.push_back((char) (v >> (8 * i)));
+  }
+}
+
+static uint32_t getU32(const char *p)
+{
+  const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+  return (uint32_t) u[0] | ((uint32_t) u[1] << 8) | ((uint32_t) u[2] << 16) |
+         ((uint32_t) u[3] << 24);
+}
+
+static uint64_t getU64(const char *p)
+{
+  return (uint64_t) getU32(p) | ((uint64_t) getU32(p + 4) << 32);
+}
+
+static std::runtime_error systemError(const std::string &what, const std::string &file)
+{
+  return std::runtime_error(what + " " + file + ": " + strerror(errno));
+}
+
+static std::string trimSlash(const char *path)
+{
+  std::string trimmed = path;
+  while (trimmed.size() > 1 && trimmed[trimmed.size() - 1] == '/') {
+    trimmed.erase(trimmed.size() - 1);
+  }
+  return trimmed;
+}
+
+/// Offset of the last component of path; 0 for "/"
+static size_t nameStart(const std::string &path)
+{
+  return path == "/" ? 0 : path.rfind('/') + 1;
+}
+
+/// Length of the parent part of a path whose name starts at start
+static size_t parentLength(size_t start)
+{
+  return start > 1 ? start - 1 : start;
+}
+
+/// Snapshot order: by parent directory, then by name
+static bool snapshotLess(const FileStatus &a, const FileStatus &b)
+{
+  size_t sa = nameStart(a.path);
+  size_t sb = nameStart(b.path);
+  int cmp = a.path.compare(0, parentLength(sa), b.path, 0, parentLength(sb));
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  return a.path.compare(sa, std::string::npos, b.path, sb, std::string::npos) < 0;
+}
+
+/**
+   Constructor
+
+   @param[in] file Local snapshot file
+*/
+NamespaceSnapshot::NamespaceSnapshot(const char *file)
+    : m_file(file), m_data(NULL), m_size(0), m_numEntries(0), m_names(NULL) {
+  map();
+}
+
+NamespaceSnapshot::~NamespaceSnapshot()
+{
+  unmap();
+}
+
+void NamespaceSnapshot::map()
+{
+  int fd = open(m_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw systemError("Could not open snapshot", m_file);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw systemError("Could not stat snapshot", m_file);
+  }
+  m_size = st.st_size;
+  void *data = m_size > 0 ? mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw systemError("Could not map snapshot", m_file);
+  }
+  m_data = static_cast<const char *>(data);
+
+  uint64_t numEntries = 0;
+  uint64_t namesLength = 0;
+  uint32_t rootLength = 0;
+  bool valid = m_size >= SNAPSHOT_HEADER_SIZE &&
+      memcmp(m_data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+      getU32(m_data + 8) == SNAPSHOT_VERSION;
+  if (valid) {
+    rootLength = getU32(m_data + 12);
+    numEntries = getU64(m_data + 16);
+    namesLength = getU64(m_data + 24);
+    valid = numEntries <= (m_size - SNAPSHOT_HEADER_SIZE) / SNAPSHOT_ENTRY_SIZE &&
+        SNAPSHOT_HEADER_SIZE + numEntries * SNAPSHOT_ENTRY_SIZE + namesLength == m_size &&
+        rootLength <= namesLength;
+  }
+  if (!valid) {
+    unmap();
+    throw std::runtime_error("Malformed snapshot " + m_file);
+  }
+
+  m_numEntries = numEntries;
+  m_names = m_data + SNAPSHOT_HEADER_SIZE + numEntries * SNAPSHOT_ENTRY_SIZE;
+  m_root.assign(m_names, rootLength);
+}
+
+void NamespaceSnapshot::unmap()
+{
+  if (m_data != NULL) {
+    munmap(const_cast<char *>(m_data), m_size);
+    m_data = NULL;
+  }
+}
+
+const char *NamespaceSnapshot::entry(uint64_t i) const
+{
+  return m_data + SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_ENTRY_SIZE;
+}
+
+void NamespaceSnapshot::toStatus(uint64_t i, FileStatus &out) const
+{
+  const char *e = entry(i);
+  out = FileStatus();
+  out.path.assign(m_names + getU64(e), getU32(e + 8));
+  out.length = (int64_t) getU64(e + 16);
+  out.lastModificationTimeMs = (int64_t) getU64(e + 24);
+  out.isFolder = (getU32(e + 32) & SNAPSHOT_FOLDER) != 0;
+}
+
+uint64_t NamespaceSnapshot::lowerBound(const std::string &parent,
+                                       const std::string &name) const
+{
+  uint64_t lo = 0;
+  uint64_t hi = m_numEntries;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    const char *e = entry(mid);
+    const char *path = m_names + getU64(e);
+    size_t pathLength = getU32(e + 8);
+    size_t start = getU32(e + 12);
+
+    int cmp = parent.compare(0, std::string::npos, path, parentLength(start));
+    if (cmp == 0) {
+      cmp = name.compare(0, std::string::npos, path + start, pathLength - start);
+    }
+    if (cmp > 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int64_t NamespaceSnapshot::find(const std::string &path) const
+{
+  size_t start = nameStart(path);
+  std::string parent = path.substr(0, parentLength(start));
+  std::string name = path.substr(start);
+  uint64_t i = lowerBound(parent, name);
+  if (i < m_numEntries) {
+    const char *e = entry(i);
+    if (getU32(e + 8) == path.size() &&
+        memcmp(m_names + getU64(e), path.data(), path.size()) == 0) {
+      return (int64_t) i;
+    }
+  }
+  return -1;
+}
+
+bool NamespaceSnapshot::exists(const char *path) const
+{
+  return find(trimSlash(path)) >= 0;
+}
+
+bool NamespaceSnapshot::getStatus(const char *path, FileStatus &out) const
+{
+  int64_t i = find(trimSlash(path));
+  if (i < 0) {
+    return false;
+  }
+  toStatus(i, out);
+  return true;
+}
+
+int64_t NamespaceSnapshot::fileSize(const char *path) const
+{
+  int64_t i = find(trimSlash(path));
+  return i < 0 ? -1 : (int64_t) getU64(entry(i) + 16);
+}
+
+std::vector<FileStatus> NamespaceSnapshot::listStatus(const char *path) const
+{
+  std::string dir = trimSlash(path);
+  std::vector<FileStatus> statuses;
+
+  for (uint64_t i = lowerBound(dir, ""); i < m_numEntries; i++) {
+    const char *e = entry(i);
+    size_t start = getU32(e + 12);
+    if (parentLength(start) != dir.size() ||
+        memcmp(m_names + getU64(e), dir.data(), dir.size()) != 0) {
+      break;
+    }
+    statuses.push_back(FileStatus());
+    toStatus(i, statuses.back());
+  }
+  return statuses;
+}
+
+/**
+   Sort entries and write them as a snapshot of root.  The file is written
+   under a temporary name and renamed into place, so processes mapping the
+   previous version keep a consistent view.
+*/
+void NamespaceSnapshot::write(const char *file, const std::string &root,
+                              std::vector<FileStatus> &entries)
+{
+  std::sort(entries.begin(), entries.end(), snapshotLess);
+
+  std::string names = root;
+  std::string out;
+  out.reserve(SNAPSHOT_HEADER_SIZE + entries.size() * SNAPSHOT_ENTRY_SIZE);
+  out.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  putU32(out, SNAPSHOT_VERSION);
+  putU32(out, root.size());
+  putU64(out, entries.size());
+  putU64(out, 0); // names length, patched below
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    const FileStatus &status = entries[i];
+    putU64(out, names.size());
+    putU32(out, status.path.size());
+    putU32(out, nameStart(status.path));
+    putU64(out, status.length);
+    putU64(out, status.lastModificationTimeMs);
+    putU32(out, status.isFolder ? SNAPSHOT_FOLDER : 0);
+    putU32(out, 0);
+    names += status.path;
+  }
+  std::string namesLength;
+  putU64(namesLength, names.size());
+  out.replace(24, 8, namesLength);
+  out += names;
+
+  std::string tmp = std::string(file) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw systemError("Could not create", tmp);
+  }
+  const char *data = out.data();
+  size_t length = out.size();
+  while (length > 0) {
+    ssize_t n = ::write(fd, data, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      close(fd);
+      unlink(tmp.c_str());
+      throw systemError("Could not write", tmp);
+    }
+    data += n;
+    length -= n;
+  }
+  if (fsync(fd) != 0 || close(fd) != 0) {
+    unlink(tmp.c_str());
+    throw systemError("Could not sync", tmp);
+  }
+  if (rename(tmp.c_str(), file) != 0) {
+    unlink(tmp.c_str());
+    throw systemError("Could not rename snapshot to", file);
+  }
+}
+
+/**
+   Write a snapshot of everything below root.
+
+   @param[in] fs File system of the calling thread
+   @param[in] root Directory to snapshot
+   @param[in] file Local file to write
+   @param[in] numThreads Directories listed at once
+*/
+void NamespaceSnapshot::create(AlluxioFileSystem &fs, const char *root, const char *file,
+                               int numThreads)
+{
+  FileStatus rootStatus = fs.getStatus(root);
+  std::string rootPath = trimSlash(rootStatus.path.c_str());
+  std::vector<FileStatus> entries(1, rootStatus);
+  std::mutex lock;
+
+  WalkOptions options;
+  options.numThreads = numThreads;
+  walk(fs, rootPath.c_str(), [&lock, &entries](const FileStatus &status, int depth) {
+    if (depth > 0) {
+      std::lock_guard<std::mutex> guard(lock);
+      entries.push_back(status);
+    }
+  }, options);
+
+  write(file, rootPath, entries);
+}
+
+namespace {
+
+/// Result of checking a directory of the snapshot against the master
+struct DirCheck {
+  DirCheck() : missing(false) {}
+
+  bool missing;
+  FileStatus status;
+};
+
+std::vector<DirCheck> checkDirectories(const std::vector<std::string> &dirs)
+{
+  AlluxioClientContext *context = ThreadPool::currentContext();
+  if (context == NULL) {
+    throw std::runtime_error("snapshot thread is not attached to the JVM");
+  }
+  AlluxioFileSystem fs(*context);
+
+  std::vector<DirCheck> checks(dirs.size());
+  for (size_t i = 0; i < dirs.size(); i++) {
+    try {
+      checks[i].status = fs.getStatus(dirs[i].c_str());
+    } catch (NativeException &e) {
+      if (fs.exists(dirs[i].c_str())) {
+        throw;
+      }
+      e.discard();
+      checks[i].missing = true;
+    }
+  }
+  return checks;
+}
+
+} // namespace
+
+/**
+   Refresh the snapshot from the master and rewrite its file.
+
+   A directory whose modification time is unchanged is assumed to hold the
+   same entries: Alluxio files are immutable, so a file only changes by
+   being deleted and created again, which touches its directory.
+
+   @param[in] fs File system of the calling thread
+   @param[in] numThreads Batches of directories checked, and directories
+              listed, at once
+   @return Number of directories re-listed
+*/
+int NamespaceSnapshot::refresh(AlluxioFileSystem &fs, int numThreads)
+{
+  FileStatus rootStatus = fs.getStatus(m_root.c_str());
+
+  std::vector<std::string> dirs;
+  std::unordered_map<std::string, int64_t> mtimes;
+  for (uint64_t i = 0; i < m_numEntries; i++) {
+    const char *e = entry(i);
+    if ((getU32(e + 32) & SNAPSHOT_FOLDER) != 0) {
+      std::string path(m_names + getU64(e), getU32(e + 8));
+      mtimes[path] = (int64_t) getU64(e + 24);
+      if (path != m_root) {
+        dirs.push_back(path);
+      }
+    }
+  }
+
+  // Stat every directory, a batch per task
+  std::unordered_map<std::string, FileStatus> changed;
+  std::unordered_set<std::string> missing;
+  if (rootStatus.isFolder && rootStatus.lastModificationTimeMs != mtimes[m_root]) {
+    changed[m_root] = rootStatus;
+  }
+  {
+    size_t numBatches = (dirs.size() + SNAPSHOT_STAT_BATCH - 1) / SNAPSHOT_STAT_BATCH;
+    size_t window = std::max(1, numThreads);
+    std::vector<std::future<std::vector<DirCheck> > > checks;
+    ConcurrencyLimiter &limiter = ConcurrencyLimiter::shared(IoScope::currentClass());
+    std::function<void(size_t)> submit = [&dirs, &checks, &limiter](size_t b) {
+      size_t i = b * SNAPSHOT_STAT_BATCH;
+      std::vector<std::string> batch(dirs.begin() + i,
+          dirs.begin() + std::min(dirs.size(), i + SNAPSHOT_STAT_BATCH));
+      limiter.acquire();
+      ConcurrencyLimiter::Clock::time_point started = ConcurrencyLimiter::Clock::now();
+      checks.push_back(ThreadPool::shared().submit([batch, &limiter, started] {
+        struct Release {
+          ConcurrencyLimiter &limiter;
+          ConcurrencyLimiter::Clock::time_point started;
+          ~Release() { limiter.release(ConcurrencyLimiter::Clock::now() - started); }
+        } release = { limiter, started };
+        return checkDirectories(batch);
+      }));
+    };
+    // Up to numThreads batches in flight, as the shared limiter of the class
+    // allows: the next is sent as each one is read
+    for (size_t i = 0; i < numBatches && i < window; i++) {
+      submit(i);
+    }
+    for (size_t i = 0; i < numBatches; i++) {
+      if (i + window < numBatches) {
+        submit(i + window);
+      }
+      std::vector<DirCheck> results = checks[i].get();
+      for (size_t j = 0; j < results.size(); j++) {
+        const std::string &dir = dirs[i * SNAPSHOT_STAT_BATCH + j];
+        if (results[j].missing || !results[j].status.isFolder) {
+          // A directory replaced by a file goes with its subtree; the
+          // re-listing of its parent, which changed too, adds the file
+          missing.insert(dir);
+        } else if (results[j].status.lastModificationTimeMs != mtimes[dir]) {
+          changed[dir] = results[j].status;
+        }
+      }
+    }
+  }
+
+  // Keep what is not re-listed: entries outside changed directories and
+  // below no removed one
+  std::vector<FileStatus> entries;
+  entries.reserve(m_numEntries);
+  for (uint64_t i = 0; i < m_numEntries; i++) {
+    FileStatus status;
+    toStatus(i, status);
+
+    bool keep = missing.count(status.path) == 0;
+    bool isChild = true;
+    std::string parent = status.path;
+    while (keep && parent.size() > m_root.size()) {
+      parent.resize(parentLength(nameStart(parent)));
+      keep = missing.count(parent) == 0 && !(isChild && changed.count(parent) != 0);
+      isChild = false;
+    }
+    if (!keep) {
+      continue;
+    }
+
+    if (status.path == m_root) {
+      status.length = rootStatus.length;
+      status.lastModificationTimeMs = rootStatus.lastModificationTimeMs;
+    } else if (changed.count(status.path) != 0) {
+      status.lastModificationTimeMs = changed[status.path].lastModificationTimeMs;
+    }
+    entries.push_back(status);
+  }
+
+  // Re-list changed directories; descend only into directories that are new
+  std::vector<std::string> relist;
+  for (std::unordered_map<std::string, FileStatus>::const_iterator it = changed.begin();
+       it != changed.end(); ++it) {
+    relist.push_back(it->first);
+  }
+  std::mutex lock;
+  WalkOptions options;
+  options.numThreads = numThreads;
+  options.descend = [&mtimes](const FileStatus &status) {
+    return mtimes.count(status.path) == 0;
+  };
+  walk(relist, [&lock, &entries](const FileStatus &status, int) {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.push_back(status);
+  }, options);
+
+  write(m_file.c_str(), m_root, entries);
+  unmap();
+  map();
+  return (int) relist.size();
+}
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,104 @@
+/**
+ * Persisted snapshot of an Alluxio namespace subtree
+ *
+ * A snapshot records the path, length, modification time and folder flag
+ * of every entry below a root in a local file.  A process that starts from
+ * a snapshot maps it and answers exists(), fileSize() and listings from it
+ * without a single RPC, then catches up with refresh(), which re-lists only
+ * the directories whose modification time changed.
+ *
+ * File format (all integers little-endian):
+ *
+ *     header   "ALXSNAP\0", u32 version, u32 rootLength, u64 entries,
+ *              u64 namesLength
+ *     entries  u64 pathOffset, u32 pathLength, u32 nameStart, u64 length,
+ *              u64 modificationTimeMs, u32 flags (1 folder), u32 0
+ *     names    concatenated paths, the root first
+ *
+ * Entries are sorted by parent directory, then by name, so the children of
+ * a directory are contiguous and found by binary search in the mapping.
+ *
+ */
+
+#ifndef __NAMESPACE_SNAPSHOT_H_
+#define __NAMESPACE_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+/**
+   A snapshot file mapped read-only.  Lookups are thread-safe; refresh()
+   must not run concurrently with them.
+*/
+class NamespaceSnapshot {
+  public:
+    /// Map a snapshot written by create() or refresh()
+    explicit NamespaceSnapshot(const char *file);
+    ~NamespaceSnapshot();
+
+    /**
+       Walk root, listing numThreads directories at once on
+       ThreadPool::shared(), and write its snapshot to a local file,
+       replacing it atomically if it exists.
+    */
+    static void create(AlluxioFileSystem &fs, const char *root, const char *file,
+                       int numThreads = 8);
+
+    /**
+       Bring the snapshot up to date: stat every directory, re-list those
+       whose modification time changed, walk the new ones, then rewrite and
+       remap the file.  At most numThreads stat batches and listings run at
+       once, fewer if the shared ConcurrencyLimiter of the IoClass of the
+       caller says so.
+
+       @return Number of directories re-listed
+    */
+    int refresh(AlluxioFileSystem &fs, int numThreads = 8);
+
+    const std::string &root() const { return m_root; }
+    /// Number of entries, the root included
+    int64_t size() const { return (int64_t) m_numEntries; }
+
+    /// Paths outside root() are reported missing
+    bool exists(const char *path) const;
+    bool getStatus(const char *path, FileStatus &out) const;
+    /// Length of the entry as listed by the master, or -1 if missing
+    int64_t fileSize(const char *path) const;
+    /// Entries of a directory, in name order
+    std::vector<FileStatus> listStatus(const char *path) const;
+
+  private:
+    NamespaceSnapshot(NamespaceSnapshot const &);
+    void operator=(NamespaceSnapshot const &);
+
+    void map();
+    void unmap();
+    const char *entry(uint64_t i) const;
+    void toStatus(uint64_t i, FileStatus &out) const;
+    /// First entry whose (parent, name) is not less than the given one
+    uint64_t lowerBound(const std::string &parent, const std::string &name) const;
+    /// Index of the entry for path, or -1
+    int64_t find(const std::string &path) const;
+
+    static void write(const char *file, const std::string &root,
+                      std::vector<FileStatus> &entries);
+
+    std::string m_file;
+    std::string m_root;
+    const char *m_data;
+    size_t m_size;
+    uint64_t m_numEntries;
+    const char *m_names;
+};
+
+} // namespace alluxio
+
+#endif /* __NAMESPACE_SNAPSHOT_H_ */
+
+/* vim: set ts=4 sw=4 : */
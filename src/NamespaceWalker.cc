@@ -0,0 +1,232 @@
+/**
+ * Parallel walk of the Alluxio namespace
+ *
+ */
+
+#include "NamespaceWalker.h"
+#include "ConcurrencyLimit.h"
+#include "IoScheduler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace alluxio;
+
+namespace {
+
+/**
+   State of one walk, shared by the tasks listing its directories.
+*/
+class Walk {
+  public:
+    Walk(const WalkVisitor &visitor, const WalkOptions &options)
+        : m_visitor(visitor), m_options(options), m_filter(options.filter),
+          m_ioClass(IoScope::currentClass()), m_tenant(IoScope::currentTenant()),
+          m_limiter(!options.adaptive ? NULL : options.limiter != NULL ? options.limiter :
+                    &ConcurrencyLimiter::shared(m_ioClass)),
+          m_outstanding(0), m_failed(false),
+          m_executor(options.pool != NULL ? *options.pool : ThreadPool::shared(),
+                     options.numThreads) {
+      m_filter.sortBy = ListStatusFilter::UNSORTED;
+      m_filter.limit = 0;
+    }
+
+    /// Queue the listing of dir, whose entries are at depth
+    void queue(const std::string &dir, int depth)
+    {
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_outstanding++;
+      }
+      // From a pool thread this lands on the worker's own deque
+      if (m_limiter == NULL) {
+        m_executor.execute([this, dir, depth] { expand(dir, depth); });
+        return;
+      }
+      m_limiter->acquireAsync([this, dir, depth] {
+        m_executor.execute([this, dir, depth] { expand(dir, depth); });
+      });
+    }
+
+    /// Wait until every queued listing is done; rethrow the first error
+    void wait()
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_idle.wait(guard, [this] { return m_outstanding == 0; });
+      if (m_error) {
+        std::rethrow_exception(m_error);
+      }
+    }
+
+  private:
+    void expand(const std::string &dir, int depth)
+    {
+      // The permit covers the listing only
+      struct Permit {
+        ConcurrencyLimiter *limiter;
+        ConcurrencyLimiter::Clock::time_point started;
+        void release()
+        {
+          if (limiter != NULL) {
+            limiter->release(ConcurrencyLimiter::Clock::now() - started);
+            limiter = NULL;
+          }
+        }
+        ~Permit() { release(); }
+      } permit = { m_limiter, ConcurrencyLimiter::Clock::now() };
+
+      if (!m_failed) {
+        try {
+          AlluxioClientContext *context = ThreadPool::currentContext();
+          if (context == NULL) {
+            throw std::runtime_error("walker thread is not attached to the JVM");
+          }
+          IoScope scope(m_ioClass, m_tenant);
+          AlluxioFileSystem fs(*context);
+          std::vector<FileStatus> entries = fs.listStatus(dir.c_str());
+          permit.release();
+
+          if (m_options.maxDepth < 0 || depth < m_options.maxDepth) {
+            for (size_t i = 0; i < entries.size(); i++) {
+              if (entries[i].isFolder &&
+                  (!m_options.descend || m_options.descend(entries[i]))) {
+                queue(entries[i].path, depth + 1);
+              }
+            }
+          }
+
+          m_filter.apply(entries);
+          for (size_t i = 0; i < entries.size() && !m_failed; i++) {
+            m_visitor(entries[i], depth);
+          }
+        } catch (...) {
+          fail(std::current_exception());
+        }
+      }
+      permit.release();
+
+      std::lock_guard<std::mutex> guard(m_lock);
+      if (--m_outstanding == 0) {
+        m_idle.notify_all();
+      }
+    }
+
+    void fail(std::exception_ptr error)
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      if (!m_error) {
+        m_error = error;
+      }
+      // Queued listings are skipped from now on
+      m_failed = true;
+    }
+
+    const WalkVisitor &m_visitor;
+    const WalkOptions &m_options;
+    ListStatusFilter m_filter;
+    IoClass m_ioClass;
+    std::string m_tenant;
+    ConcurrencyLimiter *m_limiter;
+    std::mutex m_lock;
+    std::condition_variable m_idle;
+    long m_outstanding;
+    std::atomic<bool> m_failed;
+    std::exception_ptr m_error;
+    /// Last, so that the tasks still finishing are waited for before the
+    /// rest is destroyed
+    BoundedExecutor m_executor;
+};
+
+} // namespace
+
+void alluxio::walk(AlluxioFileSystem &fs, const char *root, const WalkVisitor &visitor,
+                   const WalkOptions &options)
+{
+  FileStatus status = fs.getStatus(root);
+  if (!status.isFolder) {
+    if (options.maxDepth != 0 && options.filter.matches(status)) {
+      visitor(status, 0);
+    }
+    return;
+  }
+  walk(std::vector<std::string>(1, status.path), visitor, options);
+}
+
+void alluxio::walk(const std::vector<std::string> &dirs, const WalkVisitor &visitor,
+                   const WalkOptions &options)
+{
+  if (dirs.empty() || options.maxDepth == 0) {
+    return;
+  }
+
+  Walk walk(visitor, options);
+  for (size_t i = 0; i < dirs.size(); i++) {
+    walk.queue(dirs[i], 1);
+  }
+  walk.wait();
+}
+
+WalkSummary alluxio::du(AlluxioFileSystem &fs, const char *root,
+                        const WalkOptions &options)
+{
+  std::atomic<int64_t> files(0);
+  std::atomic<int64_t> bytes(0);
+
+  walk(fs, root, [&files, &bytes](const FileStatus &status, int) {
+    if (!status.isFolder) {
+      files++;
+      bytes += status.length;
+    }
+  }, options);
+
+  WalkSummary summary;
+  summary.files = files;
+  summary.bytes = bytes;
+  return summary;
+}
+
+WalkSummary alluxio::count(AlluxioFileSystem &fs, const char *root,
+                           const WalkOptions &options)
+{
+  std::atomic<int64_t> directories(0);
+  std::atomic<int64_t> files(0);
+  std::atomic<int64_t> bytes(0);
+
+  walk(fs, root, [&directories, &files, &bytes](const FileStatus &status, int) {
+    if (status.isFolder) {
+      directories++;
+    } else {
+      files++;
+      bytes += status.length;
+    }
+  }, options);
+
+  WalkSummary summary;
+  summary.directories = directories;
+  summary.files = files;
+  summary.bytes = bytes;
+  return summary;
+}
+
+std::vector<std::string> alluxio::find(AlluxioFileSystem &fs, const char *root,
+                                       const WalkOptions &options)
+{
+  std::mutex lock;
+  std::vector<std::string> paths;
+
+  walk(fs, root, [&lock, &paths](const FileStatus &status, int) {
+    std::lock_guard<std::mutex> guard(lock);
+    paths.push_back(status.path);
+  }, options);
+
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,108 @@
+/**
+ * Parallel walk of the Alluxio namespace
+ *
+ * walk() lists directories concurrently on ThreadPool::shared() instead of
+ * one listing RPC at a time: each directory listed queues its subdirectories
+ * on the worker that listed it, and idle workers steal them, so a wide or
+ * deep tree keeps numThreads listings running until the master saturates.
+ *
+ * du(), count() and find() are built on walk().  Listings run with the
+ * IoScope class and tenant of the calling thread.
+ *
+ */
+
+#ifndef __NAMESPACE_WALKER_H_
+#define __NAMESPACE_WALKER_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+class ConcurrencyLimiter;
+class ThreadPool;
+
+struct WalkOptions {
+    WalkOptions()
+        : numThreads(8), maxDepth(-1), pool(NULL), adaptive(true), limiter(NULL) {}
+
+    /// Directories listed at once, at most
+    int numThreads;
+    /// Deepest entries visited: 1 for the children of the root only; -1 for
+    /// no limit
+    int maxDepth;
+    /// Pool listing directories; NULL for ThreadPool::shared().  Do not walk
+    /// from a task of the same pool.
+    ThreadPool *pool;
+    /// Let a limiter choose how many directories are listed at once, up to
+    /// numThreads; false to always list numThreads at once
+    bool adaptive;
+    /// Limiter of an adaptive walk; NULL for ConcurrencyLimiter::shared() of
+    /// the IoScope class of the calling thread
+    ConcurrencyLimiter *limiter;
+    /// Entries passed to the visitor; sortBy and limit are ignored.  All
+    /// directories are descended into whether they match or not.
+    ListStatusFilter filter;
+    /// If set, directories for which it returns false are not descended into
+    std::function<bool(const FileStatus &)> descend;
+};
+
+/**
+   Called once per matching entry, with its depth below the root.  Calls
+   come concurrently from the threads of the pool, in no particular order.
+*/
+typedef std::function<void(const FileStatus &status, int depth)> WalkVisitor;
+
+/**
+   Totals of a walk.
+*/
+struct WalkSummary {
+    WalkSummary() : directories(0), files(0), bytes(0) {}
+
+    int64_t directories;
+    int64_t files;
+    int64_t bytes;
+};
+
+/**
+   Visit every entry below root.  The root itself is not visited, unless it
+   is a file.  The first error raised by a listing or by the visitor stops
+   the walk and is rethrown once the listings under way are over.
+
+   @param[in] fs File system of the calling thread, used to stat the root
+   @param[in] root Directory to walk
+   @param[in] visitor Called for each matching entry; must be thread-safe
+   @param[in] options Concurrency, depth limit and filters
+*/
+void walk(AlluxioFileSystem &fs, const char *root, const WalkVisitor &visitor,
+          const WalkOptions &options = WalkOptions());
+
+/**
+   Visit every entry below each of dirs, on one pool.  Entries directly in
+   one of dirs are at depth 1.  Errors are handled as by walk() above.
+*/
+void walk(const std::vector<std::string> &dirs, const WalkVisitor &visitor,
+          const WalkOptions &options = WalkOptions());
+
+/// Number of matching files and their total length
+WalkSummary du(AlluxioFileSystem &fs, const char *root,
+               const WalkOptions &options = WalkOptions());
+
+/// Number of matching directories and files, and the length of the files
+WalkSummary count(AlluxioFileSystem &fs, const char *root,
+                  const WalkOptions &options = WalkOptions());
+
+/// Paths of the matching entries, sorted
+std::vector<std::string> find(AlluxioFileSystem &fs, const char *root,
+                              const WalkOptions &options = WalkOptions());
+
+} // namespace alluxio
+
+#endif /* __NAMESPACE_WALKER_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,442 @@
+/**
+ * Rename-free, manifest-based output committer
+ *
+ */
+
+#include "OutputCommitter.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+using namespace alluxio;
+
+#define COMMIT_MANIFEST_MAGIC    "alluxio-commit-manifest"
+#define COMMIT_MANIFEST_VERSION  1
+#define TASK_MANIFEST_PREFIX     "task-"
+
+static std::string joinPath(const std::string &dir, const std::string &name)
+{
+  if (!dir.empty() && dir[dir.size() - 1] == '/') {
+    return dir + name;
+  }
+  return dir + "/" + name;
+}
+
+static std::string trimSlash(const std::string &dir)
+{
+  if (dir.size() > 1 && dir[dir.size() - 1] == '/') {
+    return dir.substr(0, dir.size() - 1);
+  }
+  return dir;
+}
+
+//////////////////////////////////////////
+// CommitManifest
+//////////////////////////////////////////
+
+std::string CommitManifest::serialize() const
+{
+  std::ostringstream ss;
+  ss << COMMIT_MANIFEST_MAGIC << " " << COMMIT_MANIFEST_VERSION << "\n";
+  ss << "job " << jobId << "\n";
+  ss << "files " << files.size() << "\n";
+  for (size_t i = 0; i < files.size(); i++) {
+    ss << files[i] << "\n";
+  }
+  return ss.str();
+}
+
+/**
+   Parse a serialized manifest.
+
+   @param[in] data Content of a manifest file
+   @param[out] out Parsed manifest
+   @return false if data is not a valid manifest
+*/
+bool CommitManifest::parse(const std::string &data, CommitManifest &out)
+{
+  std::istringstream ss(data);
+  std::string key;
+  int version;
+  size_t numFiles;
+
+  if (!(ss >> key >> version) || key != COMMIT_MANIFEST_MAGIC ||
+      version != COMMIT_MANIFEST_VERSION) {
+    return false;
+  }
+  if (!(ss >> key) || key != "job" || ss.get() != ' ' || !std::getline(ss, out.jobId)) {
+    return false;
+  }
+  if (!(ss >> key >> numFiles) || key != "files" || ss.get() != '\n') {
+    return false;
+  }
+
+  out.files.clear();
+  out.files.reserve(numFiles);
+  std::string file;
+  for (size_t i = 0; i < numFiles; i++) {
+    if (!std::getline(ss, file) || file.empty()) {
+      return false;
+    }
+    out.files.push_back(file);
+  }
+  return true;
+}
+
+/// Whole content of a small file
+static std::string readFile(AlluxioFileSystem &fs, const char *path)
+{
+  std::unique_ptr<FileInStream> in(fs.openFile(path));
+  std::string data;
+  char buf[4096];
+  int rdSz;
+  try {
+    while ((rdSz = in->read(buf, sizeof(buf))) > 0) {
+      data.append(buf, rdSz);
+    }
+  } catch (...) {
+    in->close();
+    throw;
+  }
+  in->close();
+  return data;
+}
+
+bool CommitManifest::read(AlluxioFileSystem &fs, const char *path, CommitManifest &out)
+{
+  if (!fs.exists(path)) {
+    return false;
+  }
+
+  if (!parse(readFile(fs, path), out)) {
+    std::string err = "Malformed commit manifest ";
+    err += path;
+    throw std::runtime_error(err);
+  }
+  return true;
+}
+
+void CommitManifest::write(AlluxioFileSystem &fs, const char *path) const
+{
+  std::string data = serialize();
+  std::unique_ptr<FileOutStream> out(fs.createFile(path));
+  try {
+    out->write(data.data(), data.size());
+    out->close();
+  } catch (...) {
+    try {
+      out->cancel();
+    } catch (...) {
+      // Keep the original error
+    }
+    throw;
+  }
+}
+
+//////////////////////////////////////////
+// TaskCommitter
+//////////////////////////////////////////
+
+/**
+   Constructor
+
+   @param[in] fs File system the task writes to
+   @param[in] outputDir Output directory of the job
+   @param[in] jobId Id of the job, as given to its JobCommitter
+   @param[in] taskId Id of the task, unique within the job
+   @param[in] attempt Attempt number, so that retried or speculative attempts
+              of a task never write to the same paths
+*/
+TaskCommitter::TaskCommitter(AlluxioFileSystem &fs, const char *outputDir,
+                             const std::string &jobId, int taskId, int attempt)
+    : m_fs(fs), m_outputDir(trimSlash(outputDir)), m_taskId(taskId),
+      m_attempt(attempt) {
+  m_manifest.jobId = jobId;
+}
+
+/**
+   Path of an output of this task.
+
+   @param[in] name Output name; may contain directories relative to the
+              output directory, e.g. "date=2016-08-01/data"
+   @return Full path, with the last component made unique to the attempt
+*/
+std::string TaskCommitter::outputPath(const char *name) const
+{
+  std::string relative = name;
+  std::string::size_type slash = relative.rfind('/');
+  std::string subdir = slash == std::string::npos ? "" : relative.substr(0, slash + 1);
+  std::string base = slash == std::string::npos ? relative : relative.substr(slash + 1);
+  if (base.empty()) {
+    throw std::runtime_error(std::string("Invalid output name ") + name);
+  }
+
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "part-%05d-%d-", m_taskId, m_attempt);
+  return joinPath(m_outputDir, subdir + prefix + base);
+}
+
+jFileOutStream TaskCommitter::createOutput(const char *name,
+                                           AlluxioCreateFileOptions *options)
+{
+  std::string path = outputPath(name);
+  jFileOutStream out = m_fs.createFile(path.c_str(), options);
+  m_manifest.files.push_back(path.substr(m_outputDir.size() + 1));
+  return out;
+}
+
+/**
+   Commit the task.
+
+   The outputs are already in place; this only records them.  All streams
+   from createOutput() must be closed first.
+*/
+const CommitManifest &TaskCommitter::commitTask()
+{
+  std::ostringstream name;
+  name << TASK_MANIFEST_PREFIX << m_taskId << "-" << m_attempt;
+  std::string path = joinPath(JobCommitter::taskManifestDir(m_outputDir,
+                                                            m_manifest.jobId),
+                              name.str());
+  m_manifest.write(m_fs, path.c_str());
+  return m_manifest;
+}
+
+void TaskCommitter::abortTask()
+{
+  for (size_t i = 0; i < m_manifest.files.size(); i++) {
+    std::string path = joinPath(m_outputDir, m_manifest.files[i]);
+    try {
+      m_fs.deletePath(path.c_str());
+    } catch (const std::exception &) {
+      // Uncommitted outputs are invisible to readers anyway
+    }
+  }
+  m_manifest.files.clear();
+}
+
+//////////////////////////////////////////
+// JobCommitter
+//////////////////////////////////////////
+
+JobCommitter::JobCommitter(AlluxioFileSystem &fs, const char *outputDir,
+                           const std::string &jobId)
+    : m_fs(fs), m_outputDir(trimSlash(outputDir)), m_jobId(jobId) {
+  if (m_jobId.empty() || m_jobId.find('/') != std::string::npos ||
+      m_jobId.find('\n') != std::string::npos) {
+    throw std::runtime_error("Invalid job id '" + m_jobId + "'");
+  }
+}
+
+std::string JobCommitter::taskManifestDir(const std::string &outputDir,
+                                          const std::string &jobId)
+{
+  return joinPath(joinPath(trimSlash(outputDir), COMMIT_TEMP_DIR_NAME), jobId);
+}
+
+void JobCommitter::setupJob()
+{
+  std::string tempDir = joinPath(m_outputDir, COMMIT_TEMP_DIR_NAME);
+  std::string taskDir = taskManifestDir(m_outputDir, m_jobId);
+  const std::string *dirs[] = { &m_outputDir, &tempDir, &taskDir };
+  for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+    if (!m_fs.exists(dirs[i]->c_str())) {
+      m_fs.createDirectory(dirs[i]->c_str());
+    }
+  }
+}
+
+/**
+   Commit the job.
+
+   Writes the job manifest next to the task manifests, renames it to
+   <dir>/_MANIFEST and drops the task manifests: three metadata operations
+   whatever the number of outputs.  The rename is the commit point:
+   listCommitted() returns none of the outputs before it and all of them
+   after.
+
+   @param[in] taskManifests One manifest per task, as returned by commitTask()
+              of the attempt that won
+*/
+void JobCommitter::commitJob(const std::vector<CommitManifest> &taskManifests)
+{
+  CommitManifest job;
+  job.jobId = m_jobId;
+  for (size_t i = 0; i < taskManifests.size(); i++) {
+    if (taskManifests[i].jobId != m_jobId) {
+      throw std::runtime_error("Manifest of job " + taskManifests[i].jobId +
+                               " committed with job " + m_jobId);
+    }
+    job.files.insert(job.files.end(), taskManifests[i].files.begin(),
+                     taskManifests[i].files.end());
+  }
+  std::sort(job.files.begin(), job.files.end());
+  job.files.erase(std::unique(job.files.begin(), job.files.end()), job.files.end());
+
+  std::string taskDir = taskManifestDir(m_outputDir, m_jobId);
+  std::string staged = joinPath(taskDir, COMMIT_MANIFEST_NAME);
+  std::string published = joinPath(m_outputDir, COMMIT_MANIFEST_NAME);
+  job.write(m_fs, staged.c_str());
+  // Fails if another job already committed to this directory
+  m_fs.renameFile(staged.c_str(), published.c_str());
+  m_fs.deletePath(taskDir.c_str(), true);
+}
+
+/**
+   Commit the job from the task manifests persisted by commitTask().
+
+   Reading them costs one listing plus one read per task; pass the manifests
+   to commitJob(taskManifests) instead when the driver has them at hand.
+*/
+void JobCommitter::commitJob()
+{
+  commitJob(readTaskManifests());
+}
+
+void JobCommitter::abortJob()
+{
+  std::vector<CommitManifest> manifests;
+  try {
+    manifests = readTaskManifests();
+  } catch (const std::exception &) {
+    // Nothing was committed by any task
+  }
+  for (size_t i = 0; i < manifests.size(); i++) {
+    for (size_t j = 0; j < manifests[i].files.size(); j++) {
+      std::string path = joinPath(m_outputDir, manifests[i].files[j]);
+      try {
+        m_fs.deletePath(path.c_str());
+      } catch (const std::exception &) {
+        // Already gone, or never closed by its task
+      }
+    }
+  }
+  std::string taskDir = taskManifestDir(m_outputDir, m_jobId);
+  if (m_fs.exists(taskDir.c_str())) {
+    m_fs.deletePath(taskDir.c_str(), true);
+  }
+}
+
+/**
+   Read the persisted task manifests, keeping the lowest committed attempt of
+   each task.
+*/
+std::vector<CommitManifest> JobCommitter::readTaskManifests()
+{
+  std::string taskDir = taskManifestDir(m_outputDir, m_jobId);
+  std::vector<std::string> entries = m_fs.listPath(taskDir.c_str(), ListPathFilter::NONE);
+
+  // task id -> (attempt, path)
+  std::map<int, std::pair<int, std::string> > chosen;
+  for (size_t i = 0; i < entries.size(); i++) {
+    std::string name = entries[i].substr(entries[i].rfind('/') + 1);
+    int taskId, attempt;
+    char end;
+    if (sscanf(name.c_str(), TASK_MANIFEST_PREFIX "%d-%d%c", &taskId, &attempt, &end) != 2) {
+      continue;
+    }
+    std::map<int, std::pair<int, std::string> >::iterator it = chosen.find(taskId);
+    if (it == chosen.end() || attempt < it->second.first) {
+      chosen[taskId] = std::make_pair(attempt, entries[i]);
+    }
+  }
+
+  std::vector<CommitManifest> manifests(chosen.size());
+  size_t i = 0;
+  for (std::map<int, std::pair<int, std::string> >::iterator it = chosen.begin();
+       it != chosen.end(); ++it, ++i) {
+    if (!CommitManifest::read(m_fs, it->second.second.c_str(), manifests[i])) {
+      throw std::runtime_error("Task manifest " + it->second.second + " disappeared");
+    }
+  }
+  return manifests;
+}
+
+bool JobCommitter::isCommitted(AlluxioFileSystem &fs, const char *dir)
+{
+  std::vector<std::string> files;
+  return fs.exists(manifestPath(dir).c_str()) && readCommitted(fs, dir, files);
+}
+
+std::string JobCommitter::manifestPath(const std::string &dir)
+{
+  return joinPath(trimSlash(dir), COMMIT_MANIFEST_NAME);
+}
+
+/**
+   Committed files of a directory that holds a _MANIFEST file, parsed from
+   it; listings use this once they have seen the file, without asking the
+   master whether it exists.
+
+   @param[in] dir Output directory
+   @param[out] files Full paths of the committed files
+   @return false if the _MANIFEST file of dir is not a commit manifest
+*/
+bool JobCommitter::readCommitted(AlluxioFileSystem &fs, const char *dir,
+                                 std::vector<std::string> &files)
+{
+  CommitManifest manifest;
+  std::string base = trimSlash(dir);
+  if (!CommitManifest::parse(readFile(fs, manifestPath(base).c_str()), manifest)) {
+    return false;
+  }
+  files.clear();
+  files.reserve(manifest.files.size());
+  for (size_t i = 0; i < manifest.files.size(); i++) {
+    files.push_back(joinPath(base, manifest.files[i]));
+  }
+  return true;
+}
+
+/**
+   Committed files of a directory, read from its manifest alone.
+
+   @param[in] dir Output directory
+   @return Full paths of the committed files; empty if dir is not committed
+*/
+std::vector<std::string> JobCommitter::listCommitted(AlluxioFileSystem &fs,
+                                                     const char *dir)
+{
+  std::vector<std::string> files;
+  if (!fs.exists(manifestPath(dir).c_str()) || !readCommitted(fs, dir, files)) {
+    files.clear();
+  }
+  return files;
+}
+
+std::vector<std::string> JobCommitter::filterCommitted(
+    AlluxioFileSystem &fs, const char *dir, const std::vector<std::string> &entries)
+{
+  std::vector<std::string> committed;
+  if (!readCommitted(fs, dir, committed)) {
+    return entries;
+  }
+  std::set<std::string> visible(committed.begin(), committed.end());
+  std::string base = trimSlash(dir);
+  for (size_t i = 0; i < committed.size(); i++) {
+    std::string::size_type slash = committed[i].rfind('/');
+    while (slash != std::string::npos && slash > base.size()) {
+      std::string parent = committed[i].substr(0, slash);
+      if (!visible.insert(parent).second) {
+        break;
+      }
+      slash = parent.rfind('/');
+    }
+  }
+
+  std::vector<std::string> files;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (visible.count(entries[i]) != 0) {
+      files.push_back(entries[i]);
+    }
+  }
+  return files;
+}
+
+/* vim: set ts=4 sw=4 : */
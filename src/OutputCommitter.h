@@ -0,0 +1,124 @@
+/**
+ * Rename-free, manifest-based output committer
+ *
+ * Instead of writing to temporary names and renaming every output into place
+ * (one rename per file at commit time), tasks write straight into the output
+ * directory under names unique to the task attempt and list them in a task
+ * manifest.  Committing the job publishes one job manifest:
+ *
+ *     <dir>/_MANIFEST                        committed outputs of the job
+ *     <dir>/_temporary/<jobId>/task-<t>-<a>  manifest of task t, attempt a
+ *     <dir>/part-<t>-<a>-<name>              output written by task t
+ *
+ * Files in <dir> that are not in _MANIFEST (outputs of failed or
+ * speculative attempts) are ignored by readers: AlluxioFileSystem::listStatus()
+ * and listPath() only return committed entries for a directory that has a
+ * _MANIFEST.  A _MANIFEST file that is not a commit manifest is listed like
+ * any other file.
+ *
+ */
+
+#ifndef __OUTPUT_COMMITTER_H_
+#define __OUTPUT_COMMITTER_H_
+
+#include <string>
+#include <vector>
+
+#include "Alluxio.h"
+
+#define COMMIT_MANIFEST_NAME  "_MANIFEST"
+#define COMMIT_TEMP_DIR_NAME  "_temporary"
+
+namespace alluxio {
+
+/**
+   List of output files, relative to the output directory.  Used both for
+   task manifests and for the job manifest.
+*/
+struct CommitManifest {
+    std::string jobId;
+    std::vector<std::string> files;
+
+    std::string serialize() const;
+    static bool parse(const std::string &data, CommitManifest &out);
+
+    /// Read the manifest file at path; false if it does not exist
+    static bool read(AlluxioFileSystem &fs, const char *path, CommitManifest &out);
+    /// Write the manifest as a new file at path
+    void write(AlluxioFileSystem &fs, const char *path) const;
+};
+
+class TaskCommitter {
+  public:
+    TaskCommitter(AlluxioFileSystem &fs, const char *outputDir,
+                  const std::string &jobId, int taskId, int attempt = 0);
+
+    /// Create an output of this task, directly under the output directory
+    jFileOutStream createOutput(const char *name,
+                                AlluxioCreateFileOptions *options = nullptr);
+    /// Full path createOutput(name) writes to
+    std::string outputPath(const char *name) const;
+
+    /// Persist the task manifest (one file create); the returned manifest can
+    /// also be handed to JobCommitter::commitJob() directly
+    const CommitManifest &commitTask();
+    /// Best-effort removal of the outputs created so far
+    void abortTask();
+
+  private:
+    AlluxioFileSystem &m_fs;
+    std::string m_outputDir;
+    int m_taskId;
+    int m_attempt;
+    CommitManifest m_manifest;
+};
+
+class JobCommitter {
+  public:
+    JobCommitter(AlluxioFileSystem &fs, const char *outputDir,
+                 const std::string &jobId);
+
+    /// Create the output and task manifest directories
+    void setupJob();
+
+    /// Publish the outputs of the given task manifests.  Costs a constant
+    /// number of metadata operations whatever the number of files.
+    void commitJob(const std::vector<CommitManifest> &taskManifests);
+    /// Same, reading the task manifests that tasks persisted in commitTask()
+    void commitJob();
+    /// Remove task manifests and the outputs they list
+    void abortJob();
+
+    /// Whether dir holds the committed output of a job
+    static bool isCommitted(AlluxioFileSystem &fs, const char *dir);
+    /// Full paths of the committed files of dir
+    static std::vector<std::string> listCommitted(AlluxioFileSystem &fs,
+                                                  const char *dir);
+    /// Same, for a dir known to hold a _MANIFEST file; false if that file is
+    /// not a commit manifest
+    static bool readCommitted(AlluxioFileSystem &fs, const char *dir,
+                              std::vector<std::string> &files);
+    static std::string manifestPath(const std::string &dir);
+    /// Keep only the entries of a listing of dir, which holds a _MANIFEST
+    /// file, that are committed: files in the manifest and directories that
+    /// contain some.  If that file is not a commit manifest, all are kept.
+    static std::vector<std::string> filterCommitted(
+        AlluxioFileSystem &fs, const char *dir,
+        const std::vector<std::string> &entries);
+
+    static std::string taskManifestDir(const std::string &outputDir,
+                                       const std::string &jobId);
+
+  private:
+    std::vector<CommitManifest> readTaskManifests();
+
+    AlluxioFileSystem &m_fs;
+    std::string m_outputDir;
+    std::string m_jobId;
+};
+
+} // namespace alluxio
+
+#endif /* __OUTPUT_COMMITTER_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,484 @@
+/**
+ * Pack files: many small logical files stored in a few large Alluxio files
+ *
+ */
+
+#include "PackFile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace alluxio;
+
+#define PACK_INDEX_NAME     "_index"
+#define PACK_INDEX_MAGIC    "ALXPACK"
+#define PACK_INDEX_VERSION  1
+#define PACK_HEADER_SIZE    32
+#define PACK_ENTRY_SIZE     32
+/// Largest read asked of a pack at once, as Java allocates a buffer of it
+#define PACK_READ_CHUNK     (4 << 20)
+
+static void putU32(std::string &out, uint32_t v)
+{
+  for (int i = 0; i < 4; i++) {
+    out.push_back((char) (v >> (8 * i)));
+  }
+}
+
+static void putU64(std::string &out, uint64_t v)
+{
+  for (int i = 0; i < 8; i++) {
+    out.push_back((char) (v >> (8 * i)));
+  }
+}
+
+static uint32_t getU32(const char *p)
+{
+  const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+  return (uint32_t) u[0] | ((uint32_t) u[1] << 8) | ((uint32_t) u[2] << 16) |
+         ((uint32_t) u[3] << 24);
+}
+
+static uint64_t getU64(const char *p)
+{
+  return (uint64_t) getU32(p) | ((uint64_t) getU32(p + 4) << 32);
+}
+
+namespace {
+
+struct Crc32Table {
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      entries[i] = c;
+    }
+  }
+  uint32_t entries[256];
+};
+
+} // namespace
+
+/// CRC-32 (IEEE), chainable: crc32(crc32(0, a), b) == crc32(0, a + b)
+static uint32_t crc32(uint32_t crc, const void *data, size_t length)
+{
+  static const Crc32Table table;
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static std::string trimSlash(const char *dir)
+{
+  std::string path = dir;
+  if (path.size() > 1 && path[path.size() - 1] == '/') {
+    path.erase(path.size() - 1);
+  }
+  return path;
+}
+
+//////////////////////////////////////////
+// PackWriter
+//////////////////////////////////////////
+
+/**
+   Constructor
+
+   @param[in] fs File system to write to
+   @param[in] dir Directory of the pack
+   @param[in] options Pack options
+*/
+PackWriter::PackWriter(AlluxioFileSystem &fs, const char *dir,
+                       const PackWriterOptions &options)
+    : m_fs(fs), m_dir(trimSlash(dir)), m_options(options), m_numPacks(0),
+      m_packOffset(0), m_closed(false) {
+  if (!m_fs.exists(m_dir.c_str())) {
+    m_fs.createDirectory(m_dir.c_str());
+  } else if (m_fs.exists(indexPath(m_dir).c_str())) {
+    throw std::runtime_error("Pack " + m_dir + " already exists");
+  }
+}
+
+PackWriter::~PackWriter()
+{
+  if (!m_closed) {
+    try {
+      cancel();
+    } catch (...) {
+      // Nothing more can be done from a destructor
+    }
+  }
+}
+
+std::string PackWriter::packPath(const std::string &dir, int pack)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/pack-%05d", pack);
+  return dir + name;
+}
+
+std::string PackWriter::indexPath(const std::string &dir)
+{
+  return dir + "/" PACK_INDEX_NAME;
+}
+
+void PackWriter::startPack()
+{
+  if (m_out) {
+    m_out->close();
+    m_out.reset();
+  }
+
+  std::unique_ptr<AlluxioCreateFileOptions> createOptions;
+  if (m_options.setWriteType) {
+    createOptions.reset(AlluxioCreateFileOptions::getCreateFileOptions());
+    createOptions->setWriteType(m_options.writeType);
+  }
+  std::string path = packPath(m_dir, m_numPacks);
+  m_out.reset(m_fs.createFile(path.c_str(), createOptions.get()));
+  m_numPacks++;
+  m_packOffset = 0;
+}
+
+/**
+   Append a member to the current pack file.
+
+   @param[in] name Member name; any byte string, unique within the pack
+   @param[in] data Member content
+   @param[in] length Number of bytes in data
+*/
+void PackWriter::add(const std::string &name, const void *data, int length)
+{
+  if (m_closed) {
+    throw std::runtime_error("add to a closed pack");
+  }
+  if (!m_names.insert(name).second) {
+    throw std::runtime_error("Duplicate member " + name + " in pack " + m_dir);
+  }
+
+  if (!m_out || (m_packOffset > 0 && m_packOffset + length > m_options.maxPackSize)) {
+    startPack();
+  }
+  m_out->write(data, length);
+
+  Entry entry;
+  entry.name = name;
+  entry.pack = m_numPacks - 1;
+  entry.checksum = crc32(0, data, length);
+  entry.offset = m_packOffset;
+  entry.length = length;
+  m_entries.push_back(entry);
+  m_packOffset += length;
+}
+
+std::string PackWriter::serializeIndex()
+{
+  std::sort(m_entries.begin(), m_entries.end(),
+            [](const Entry &a, const Entry &b) { return a.name < b.name; });
+
+  std::string index;
+  index.append(PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC));
+  putU32(index, PACK_INDEX_VERSION);
+  putU32(index, m_numPacks);
+  putU64(index, m_entries.size());
+  putU64(index, 0);
+
+  uint64_t nameOffset = 0;
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    if (nameOffset + m_entries[i].name.size() > UINT32_MAX) {
+      throw std::runtime_error("Too many member names in pack " + m_dir);
+    }
+    putU32(index, (uint32_t) nameOffset);
+    putU32(index, (uint32_t) m_entries[i].name.size());
+    putU32(index, m_entries[i].pack);
+    putU32(index, m_entries[i].checksum);
+    putU64(index, m_entries[i].offset);
+    putU64(index, m_entries[i].length);
+    nameOffset += m_entries[i].name.size();
+  }
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    index += m_entries[i].name;
+  }
+  return index;
+}
+
+/**
+   Close the pack.  The index is written last, so readers never see a pack
+   whose data is incomplete.
+*/
+void PackWriter::close()
+{
+  if (m_closed) {
+    return;
+  }
+  if (m_out) {
+    m_out->close();
+    m_out.reset();
+  }
+
+  std::string index = serializeIndex();
+  std::unique_ptr<FileOutStream> out(m_fs.createFile(indexPath(m_dir).c_str()));
+  out->write(index.data(), index.size());
+  out->close();
+
+  m_closed = true;
+  m_entries.clear();
+  m_names.clear();
+}
+
+void PackWriter::cancel()
+{
+  m_closed = true;
+  if (m_out) {
+    try {
+      m_out->cancel();
+    } catch (...) {
+      // The pack files are deleted below anyway
+    }
+    m_out.reset();
+  }
+  for (int i = 0; i < m_numPacks; i++) {
+    std::string path = packPath(m_dir, i);
+    if (m_fs.exists(path.c_str())) {
+      m_fs.deletePath(path.c_str());
+    }
+  }
+  m_numPacks = 0;
+  m_entries.clear();
+  m_names.clear();
+}
+
+//////////////////////////////////////////
+// PackReader
+//////////////////////////////////////////
+
+/**
+   Constructor
+
+   Reads the index of the pack: the only metadata operations the reader makes
+   besides opening each pack file once.
+
+   @param[in] fs File system to read from
+   @param[in] dir Directory of the pack
+*/
+PackReader::PackReader(AlluxioFileSystem &fs, const char *dir)
+    : m_fs(fs), m_dir(trimSlash(dir)), m_numEntries(0), m_names(NULL) {
+  std::string path = PackWriter::indexPath(m_dir);
+  long int size = m_fs.fileSize(path.c_str());
+  if (size < PACK_HEADER_SIZE) {
+    throw std::runtime_error("Malformed pack index " + path);
+  }
+
+  m_index.resize(size);
+  std::unique_ptr<FileInStream> in(m_fs.openFile(path.c_str()));
+  long int got = 0;
+  try {
+    while (got < size) {
+      int rdSz = in->read(m_index.data() + got, (int) std::min<long int>(size - got, 1 << 20));
+      if (rdSz <= 0) {
+        break;
+      }
+      got += rdSz;
+    }
+  } catch (...) {
+    in->close();
+    throw;
+  }
+  in->close();
+
+  const char *header = m_index.data();
+  if (got != size || memcmp(header, PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC)) != 0 ||
+      getU32(header + 8) != PACK_INDEX_VERSION) {
+    throw std::runtime_error("Malformed pack index " + path);
+  }
+  uint32_t numPacks = getU32(header + 12);
+  m_numEntries = getU64(header + 16);
+  if (m_numEntries > (uint64_t) (size - PACK_HEADER_SIZE) / PACK_ENTRY_SIZE) {
+    throw std::runtime_error("Malformed pack index " + path);
+  }
+  m_names = header + PACK_HEADER_SIZE + m_numEntries * PACK_ENTRY_SIZE;
+
+  uint64_t namesSize = size - (m_names - header);
+  for (uint64_t i = 0; i < m_numEntries; i++) {
+    const char *e = entry(i);
+    if ((uint64_t) getU32(e) + getU32(e + 4) > namesSize || getU32(e + 8) >= numPacks) {
+      throw std::runtime_error("Malformed pack index " + path);
+    }
+  }
+  m_packs.resize(numPacks);
+}
+
+PackReader::~PackReader()
+{
+  for (size_t i = 0; i < m_packs.size(); i++) {
+    if (m_packs[i]) {
+      try {
+        m_packs[i]->close();
+      } catch (...) {
+        // Read-only stream; nothing is lost
+      }
+    }
+  }
+}
+
+const char *PackReader::entry(int64_t i) const
+{
+  return m_index.data() + PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE;
+}
+
+std::string PackReader::memberName(int i) const
+{
+  if (i < 0 || (uint64_t) i >= m_numEntries) {
+    throw std::runtime_error("Pack member index out of range");
+  }
+  const char *e = entry(i);
+  return std::string(m_names + getU32(e), getU32(e + 4));
+}
+
+int64_t PackReader::find(const std::string &name) const
+{
+  int64_t lo = 0, hi = (int64_t) m_numEntries;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    const char *e = entry(mid);
+    size_t length = getU32(e + 4);
+    int cmp = memcmp(m_names + getU32(e), name.data(), std::min(length, name.size()));
+    if (cmp == 0) {
+      cmp = length < name.size() ? -1 : (length > name.size() ? 1 : 0);
+    }
+    if (cmp == 0) {
+      return mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return -1;
+}
+
+bool PackReader::contains(const std::string &name) const
+{
+  return find(name) >= 0;
+}
+
+jPackMember PackReader::openMember(const std::string &name)
+{
+  int64_t i = find(name);
+  if (i < 0) {
+    throw std::runtime_error("No member " + name + " in pack " + m_dir);
+  }
+  const char *e = entry(i);
+  return new PackMember(*this, name, getU32(e + 8), getU64(e + 16), getU64(e + 24),
+                        getU32(e + 12));
+}
+
+void PackReader::readMember(const std::string &name, std::vector<char> &out)
+{
+  std::unique_ptr<PackMember> member(openMember(name));
+  out.resize(member->length());
+  int64_t got = 0;
+  while (got < member->length()) {
+    int rdSz = member->read(out.data() + got,
+                            (int) std::min<int64_t>(member->length() - got, PACK_READ_CHUNK));
+    if (rdSz <= 0) {
+      throw std::runtime_error("Pack member " + name + " is truncated");
+    }
+    got += rdSz;
+  }
+}
+
+/**
+   Read from a pack file, opening it on first use.
+*/
+int PackReader::readPack(int pack, int64_t pos, void *buff, int length)
+{
+  if (!m_packs[pack]) {
+    std::string path = PackWriter::packPath(m_dir, pack);
+    m_packs[pack].reset(m_fs.openFile(path.c_str()));
+  }
+
+  int got = 0;
+  while (got < length) {
+    int rdSz = m_packs[pack]->positionedRead(pos + got, static_cast<char *>(buff) + got,
+                                             std::min(length - got, PACK_READ_CHUNK));
+    if (rdSz <= 0) {
+      break;
+    }
+    got += rdSz;
+  }
+  return got;
+}
+
+//////////////////////////////////////////
+// PackMember
+//////////////////////////////////////////
+
+PackMember::PackMember(PackReader &reader, const std::string &name, int pack,
+                       int64_t offset, int64_t length, uint32_t checksum)
+    : m_reader(reader), m_name(name), m_pack(pack), m_offset(offset),
+      m_length(length), m_checksum(checksum), m_pos(0), m_crc(0),
+      m_checkedPos(0) {}
+
+/**
+   Read from the current position.
+
+   @return Number of bytes read, or -1 at the end of the member
+*/
+int PackMember::read(void *buff, int length)
+{
+  int rdSz = positionedRead(m_pos, buff, length);
+  if (rdSz <= 0) {
+    return rdSz;
+  }
+
+  if (m_checkedPos == m_pos) {
+    m_crc = crc32(m_crc, buff, rdSz);
+    m_checkedPos += rdSz;
+    if (m_checkedPos == m_length && m_crc != m_checksum) {
+      throw std::runtime_error("Checksum mismatch in pack member " + m_name);
+    }
+  }
+  m_pos += rdSz;
+  return rdSz;
+}
+
+/**
+   Read at a position of the member, leaving the current position unchanged.
+
+   @return Number of bytes read, or -1 at or past the end of the member
+*/
+int PackMember::positionedRead(int64_t pos, void *buff, int length)
+{
+  if (pos < 0) {
+    throw std::runtime_error("negative position in pack member " + m_name);
+  }
+  if (pos >= m_length) {
+    return length == 0 ? 0 : -1;
+  }
+  int toRead = (int) std::min<int64_t>(length, m_length - pos);
+  int rdSz = m_reader.readPack(m_pack, m_offset + pos, buff, toRead);
+  if (rdSz < toRead) {
+    throw std::runtime_error("Pack file of member " + m_name + " is truncated");
+  }
+  return rdSz;
+}
+
+void PackMember::seek(int64_t pos)
+{
+  if (pos < 0 || pos > m_length) {
+    throw std::runtime_error("seek out of range of pack member " + m_name);
+  }
+  m_pos = pos;
+}
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,169 @@
+/**
+ * Pack files: many small logical files stored in a few large Alluxio files
+ *
+ * A pack directory holds
+ *
+ *     <dir>/pack-00000, pack-00001, ...   member data, back to back
+ *     <dir>/_index                        sorted index, written last
+ *
+ * so a million small members cost a handful of master metadata entries, and
+ * opening a member is a lookup in the cached index instead of an open RPC.
+ *
+ * Index format (all integers little-endian):
+ *
+ *     header   "ALXPACK\0", u32 version, u32 packs, u64 entries, u64 0
+ *     entries  u32 nameOffset, u32 nameLength, u32 pack, u32 crc32,
+ *              u64 offset, u64 length                     (sorted by name)
+ *     names    concatenated member names
+ *
+ */
+
+#ifndef __PACK_FILE_H_
+#define __PACK_FILE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+struct PackWriterOptions {
+    PackWriterOptions()
+        : maxPackSize(1LL << 30), setWriteType(false), writeType(CACHE_THROUGH) {}
+
+    /// A new pack file is started once the current one would exceed this
+    int64_t maxPackSize;
+    /// Whether writeType overrides the client default for pack files
+    bool setWriteType;
+    WriteType writeType;
+};
+
+class PackWriter {
+  public:
+    /// dir is created if missing; it must not hold a pack already
+    PackWriter(AlluxioFileSystem &fs, const char *dir,
+               const PackWriterOptions &options = PackWriterOptions());
+    /// Cancels the pack if close() was not called
+    ~PackWriter();
+
+    /// Append a member; names must be unique within the pack
+    void add(const std::string &name, const void *data, int length);
+    /// Close the last pack file and publish the index
+    void close();
+    /// Remove everything written so far
+    void cancel();
+
+    static std::string packPath(const std::string &dir, int pack);
+    static std::string indexPath(const std::string &dir);
+
+  private:
+    struct Entry {
+        std::string name;
+        uint32_t pack;
+        uint32_t checksum;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    PackWriter(PackWriter const &);
+    void operator=(PackWriter const &);
+
+    void startPack();
+    std::string serializeIndex();
+
+    AlluxioFileSystem &m_fs;
+    std::string m_dir;
+    PackWriterOptions m_options;
+    std::vector<Entry> m_entries;
+    std::unordered_set<std::string> m_names;
+    std::unique_ptr<FileOutStream> m_out;
+    int m_numPacks;
+    int64_t m_packOffset;
+    bool m_closed;
+};
+
+class PackReader;
+
+/**
+   A member of a pack, read with positioned reads into its pack file.  The
+   checksum is verified when the member is read sequentially to its end.
+*/
+class PackMember {
+  public:
+    int read(void *buff, int length);
+    int positionedRead(int64_t pos, void *buff, int length);
+    void seek(int64_t pos);
+
+    const std::string &name() const { return m_name; }
+    int64_t length() const { return m_length; }
+
+  private:
+    friend class PackReader;
+    PackMember(PackReader &reader, const std::string &name, int pack,
+               int64_t offset, int64_t length, uint32_t checksum);
+
+    PackReader &m_reader;
+    std::string m_name;
+    int m_pack;
+    int64_t m_offset;
+    int64_t m_length;
+    uint32_t m_checksum;
+    int64_t m_pos;
+    /// CRC of [0, m_checkedPos), while reads stay sequential
+    uint32_t m_crc;
+    int64_t m_checkedPos;
+};
+
+typedef PackMember* jPackMember;
+
+/**
+   Reads the members of a pack.  The index is read once and kept in memory
+   in its serialized form; lookups binary-search it in place.  Pack files
+   are opened on first use and kept open.
+
+   Not thread-safe: use one reader per thread.
+*/
+class PackReader {
+  public:
+    PackReader(AlluxioFileSystem &fs, const char *dir);
+    ~PackReader();
+
+    bool contains(const std::string &name) const;
+    /// Open a member; throws if the pack has no such member
+    jPackMember openMember(const std::string &name);
+    /// Read a whole member and verify its checksum
+    void readMember(const std::string &name, std::vector<char> &out);
+
+    /// Members in name order
+    int numMembers() const { return (int) m_numEntries; }
+    std::string memberName(int i) const;
+
+  private:
+    friend class PackMember;
+
+    PackReader(PackReader const &);
+    void operator=(PackReader const &);
+
+    /// Index of the entry for name, or -1
+    int64_t find(const std::string &name) const;
+    const char *entry(int64_t i) const;
+    int readPack(int pack, int64_t pos, void *buff, int length);
+
+    AlluxioFileSystem &m_fs;
+    std::string m_dir;
+    std::vector<char> m_index;
+    uint64_t m_numEntries;
+    const char *m_names;
+    std::vector<std::unique_ptr<FileInStream> > m_packs;
+};
+
+} // namespace alluxio
+
+#endif /* __PACK_FILE_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,60 @@
+/**
+ * Strings copied out of the JVM without an allocation per string
+ *
+ */
+
+#include "StringArena.h"
+
+using namespace alluxio;
+
+StringArena::StringArena(size_t blockSize)
+    : m_blockSize(blockSize > 0 ? blockSize : DEFAULT_ARENA_BLOCK_SIZE),
+      m_current(0), m_used(0) {}
+
+char *StringArena::allocate(size_t size)
+{
+  // Keep the next allocation aligned for whatever is stored in it
+  size_t aligned = (size + 7) & ~(size_t) 7;
+
+  while (m_current < m_blocks.size() &&
+         m_blocks[m_current].size - m_used < aligned) {
+    m_current++;
+    m_used = 0;
+  }
+  if (m_current == m_blocks.size()) {
+    Block block;
+    block.size = aligned > m_blockSize ? aligned : m_blockSize;
+    block.data.reset(new char[block.size]);
+    m_blocks.push_back(std::move(block));
+    m_used = 0;
+  }
+
+  char *p = m_blocks[m_current].data.get() + m_used;
+  m_used += aligned;
+  return p;
+}
+
+StringRef StringArena::copy(const char *data, size_t length)
+{
+  char *p = allocate(length + 1);
+  memcpy(p, data, length);
+  p[length] = '\0';
+  return StringRef(p, length);
+}
+
+void StringArena::reset()
+{
+  m_current = 0;
+  m_used = 0;
+}
+
+size_t StringArena::capacity() const
+{
+  size_t total = 0;
+  for (size_t i = 0; i < m_blocks.size(); i++) {
+    total += m_blocks[i].size;
+  }
+  return total;
+}
+
+/* vim: set ts=4 sw=4 : */
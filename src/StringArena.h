@@ -0,0 +1,91 @@
+/**
+ * Strings copied out of the JVM without an allocation per string
+ *
+ * A StringArena hands out memory from large blocks and takes it all back
+ * at once with reset(), keeping the blocks for the next round.  Strings
+ * copied into it are returned as StringRefs, which stay valid until the
+ * arena is reset or destroyed.
+ *
+ */
+
+#ifndef __STRING_ARENA_H_
+#define __STRING_ARENA_H_
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Bytes per block of a StringArena, unless a single string is larger
+#define DEFAULT_ARENA_BLOCK_SIZE  (64 * 1024)
+
+namespace alluxio {
+
+/**
+   Characters owned by someone else, usually a StringArena.  Strings copied
+   by StringArena::copy() and Env::getStringUTF() are NUL-terminated; those
+   pointing into a packed listing are not.
+*/
+struct StringRef {
+    StringRef() : data(""), length(0) {}
+    StringRef(const char *data, size_t length) : data(data), length(length) {}
+
+    std::string str() const { return std::string(data, length); }
+    bool empty() const { return length == 0; }
+
+    bool operator==(const StringRef &other) const
+    {
+      return length == other.length && memcmp(data, other.data, length) == 0;
+    }
+    bool operator!=(const StringRef &other) const { return !(*this == other); }
+    bool operator==(const std::string &other) const
+    {
+      return length == other.size() && memcmp(data, other.data(), length) == 0;
+    }
+    bool operator!=(const std::string &other) const { return !(*this == other); }
+
+    const char *data;
+    size_t length;
+};
+
+/**
+   Bump allocator for the strings of one listing or call.  Not thread-safe;
+   give each thread its own.
+*/
+class StringArena {
+  public:
+    explicit StringArena(size_t blockSize = DEFAULT_ARENA_BLOCK_SIZE);
+
+    /// Uninitialized memory, valid until reset()
+    char *allocate(size_t size);
+    /// Copy of a string, NUL-terminated
+    StringRef copy(const char *data, size_t length);
+    StringRef copy(const std::string &s) { return copy(s.data(), s.size()); }
+
+    /// Forget every allocation, keeping the blocks for reuse
+    void reset();
+    /// Bytes held in blocks, used or not
+    size_t capacity() const;
+
+  private:
+    StringArena(StringArena const &);
+    void operator=(StringArena const &);
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    /// Block allocated from, and bytes used in it
+    size_t m_current;
+    size_t m_used;
+};
+
+} // namespace alluxio
+
+#endif /* __STRING_ARENA_H_ */
+
+/* vim: set ts=4 sw=4 : */
@@ -0,0 +1,759 @@
+/**
+ * Striped logical files
+ *
+ */
+
+#include "StripedFile.h"
+#include "ConcurrencyLimit.h"
+#include "JNIHelper.h"
+#include "MetadataCache.h"
+#include "ThreadPool.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+#define STRIPED_MANIFEST_NAME    "_manifest"
+#define STRIPED_STAGING_SUFFIX   "._striping"
+#define STRIPED_MANIFEST_MAGIC   "alluxio-striped-file"
+#define STRIPED_MANIFEST_VERSION 1
+
+namespace alluxio {
+
+/**
+   The tasks on one part of a striped file, run one at a time on
+   ThreadPool::shared(), each with a permit of the shared limiter of the
+   IoClass of the thread that created the worker: the limiter, rather than
+   the number of parts, decides how many parts are busy at once.
+
+   Each worker keeps the stream of its part to itself; a task is given the
+   file system of the pool thread running it.
+   Tasks run in submission order; after the first failure the remaining tasks
+   are failed with the same error without running.
+*/
+class StripeWorker {
+  public:
+    typedef std::function<void(AlluxioFileSystem &)> Task;
+
+    StripeWorker(size_t maxQueued)
+        : pos(0), m_maxQueued(std::max<size_t>(maxQueued, 1)), m_running(false),
+          m_limiter(ConcurrencyLimiter::shared(IoScope::currentClass())) {}
+
+    ~StripeWorker() { stop(); }
+
+    std::future<void> submit(Task task)
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_notFull.wait(guard, [this] { return m_tasks.size() < m_maxQueued; });
+      if (m_error) {
+        std::rethrow_exception(m_error);
+      }
+      m_tasks.push_back(Item());
+      m_tasks.back().task = task;
+      std::future<void> done = m_tasks.back().done.get_future();
+      // One pool task at a time runs the queue, keeping the tasks in order
+      if (!m_running) {
+        m_running = true;
+        schedule();
+      }
+      return done;
+    }
+
+    /// Wait until the queued tasks have run
+    void stop()
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_idle.wait(guard, [this] { return !m_running; });
+    }
+
+    // Only touch these from inside a task.
+    std::unique_ptr<OutStream> out;
+    std::unique_ptr<InStream> in;
+    int64_t pos;
+
+  private:
+    struct Item {
+      Task task;
+      std::promise<void> done;
+    };
+
+    /// Run the next task on the pool once a permit is granted
+    void schedule()
+    {
+      m_limiter.acquireAsync([this] { ThreadPool::shared().execute([this] { run(); }); });
+    }
+
+    /// Run the next queued task with the permit granted, then ask for
+    /// another while tasks are left
+    void run()
+    {
+      ConcurrencyLimiter::Clock::time_point started = ConcurrencyLimiter::Clock::now();
+      Item item;
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        item.task = std::move(m_tasks.front().task);
+        item.done = std::move(m_tasks.front().done);
+        m_tasks.pop_front();
+        m_notFull.notify_all();
+      }
+      try {
+        item.task(ThreadPool::currentFileSystem());
+        item.done.set_value();
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_error = std::current_exception();
+        item.done.set_exception(m_error);
+      }
+      m_limiter.release(ConcurrencyLimiter::Clock::now() - started);
+
+      std::lock_guard<std::mutex> guard(m_lock);
+      // After a failure the tasks left fail without running
+      while (m_error && !m_tasks.empty()) {
+        m_tasks.front().done.set_exception(m_error);
+        m_tasks.pop_front();
+        m_notFull.notify_all();
+      }
+      if (m_tasks.empty()) {
+        m_running = false;
+        m_idle.notify_all();
+      } else {
+        schedule();
+      }
+    }
+
+    size_t m_maxQueued;
+    /// Whether a task of the pool is running the queue, or waits for a permit
+    bool m_running;
+    ConcurrencyLimiter &m_limiter;
+    std::exception_ptr m_error;
+    std::deque<Item> m_tasks;
+    std::mutex m_lock;
+    std::condition_variable m_notFull;
+    std::condition_variable m_idle;
+};
+
+} // namespace alluxio
+
+/**
+   Wait for all futures, then rethrow the first failure if any.
+*/
+static void waitAll(std::vector<std::future<void> > &futures)
+{
+  std::exception_ptr error;
+  for (size_t i = 0; i < futures.size(); i++) {
+    try {
+      futures[i].get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  futures.clear();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+//////////////////////////////////////////
+// StripedFileManifest
+//////////////////////////////////////////
+
+std::string StripedFileManifest::serialize() const
+{
+  std::ostringstream ss;
+  ss << STRIPED_MANIFEST_MAGIC << " " << STRIPED_MANIFEST_VERSION << "\n";
+  ss << "layout " << (layout == StripeLayout::ROUND_ROBIN ? "round-robin" : "contiguous")
+     << "\n";
+  ss << "stripe-size " << stripeSize << "\n";
+  ss << "length " << length << "\n";
+  ss << "parts " << partLengths.size() << "\n";
+  for (size_t i = 0; i < partLengths.size(); i++) {
+    ss << "part " << i << " " << partLengths[i] << "\n";
+  }
+  return ss.str();
+}
+
+/**
+   Parse a serialized manifest.
+
+   @param[in] data Content of a "_manifest" file
+   @param[out] out Parsed manifest
+   @return false if data is not a valid manifest
+*/
+bool StripedFileManifest::parse(const std::string &data, StripedFileManifest &out)
+{
+  std::istringstream ss(data);
+  std::string key, value;
+  int version;
+  size_t numParts;
+
+  if (!(ss >> key >> version) || key != STRIPED_MANIFEST_MAGIC ||
+      version != STRIPED_MANIFEST_VERSION) {
+    return false;
+  }
+  if (!(ss >> key >> value) || key != "layout") {
+    return false;
+  }
+  if (value == "round-robin") {
+    out.layout = StripeLayout::ROUND_ROBIN;
+  } else if (value == "contiguous") {
+    out.layout = StripeLayout::CONTIGUOUS;
+  } else {
+    return false;
+  }
+  if (!(ss >> key >> out.stripeSize) || key != "stripe-size" || out.stripeSize <= 0) {
+    return false;
+  }
+  if (!(ss >> key >> out.length) || key != "length" || out.length < 0) {
+    return false;
+  }
+  if (!(ss >> key >> numParts) || key != "parts" || numParts == 0) {
+    return false;
+  }
+
+  int64_t total = 0;
+  out.partLengths.assign(numParts, 0);
+  for (size_t i = 0; i < numParts; i++) {
+    size_t index;
+    if (!(ss >> key >> index >> out.partLengths[i]) || key != "part" || index != i) {
+      return false;
+    }
+    total += out.partLengths[i];
+  }
+  return total == out.length;
+}
+
+/// Whole content of a stream, closed once read
+static std::string readAll(FileInStream &in)
+{
+  std::string data;
+  char buf[4096];
+  int rdSz;
+  try {
+    while ((rdSz = in.read(buf, sizeof(buf))) > 0) {
+      data.append(buf, rdSz);
+    }
+  } catch (...) {
+    in.close();
+    throw;
+  }
+  in.close();
+  return data;
+}
+
+/**
+   Read the manifest of a striped file.
+
+   @param[in] fs File system to read from
+   @param[in] path Logical path of the striped file
+   @param[out] out Parsed manifest
+   @return false if path has no manifest, i.e. is not a striped file
+*/
+bool StripedFileManifest::read(AlluxioFileSystem &fs, const char *path,
+                               StripedFileManifest &out)
+{
+  std::string manifestPath = StripedFileWriter::manifestPath(path);
+  if (!fs.exists(manifestPath.c_str())) {
+    return false;
+  }
+
+  std::unique_ptr<FileInStream> in(fs.openFile(manifestPath.c_str()));
+  std::string data = readAll(*in);
+
+  if (!parse(data, out)) {
+    std::string err = "Malformed striped file manifest ";
+    err += manifestPath;
+    throw std::runtime_error(err);
+  }
+  return true;
+}
+
+/**
+   Read the manifest of a directory that may or may not be a striped file.
+
+   The manifest is looked up in the metadata cache of fs, as a status or as
+   an entry of the cached listing of path, before the master is asked
+   whether it exists.
+
+   @param[in] fs File system to read from
+   @param[in] path Directory to check
+   @param[out] out Parsed manifest
+   @return false if path holds no manifest file, or one that does not parse
+*/
+bool StripedFileManifest::readIfStriped(AlluxioFileSystem &fs, const char *path,
+                                        StripedFileManifest &out)
+{
+  std::string manifestPath = StripedFileWriter::manifestPath(path);
+  MetadataCache *cache = fs.metadataCache().get();
+  FileStatus status;
+  std::vector<FileStatus> listing;
+  if (cache != NULL && cache->getStatus(manifestPath, status)) {
+    if (status.isFolder) {
+      return false;
+    }
+  } else if (cache != NULL && cache->getListing(path, listing)) {
+    bool found = false;
+    for (size_t i = 0; i < listing.size() && !found; i++) {
+      const std::string &entry = listing[i].path;
+      size_t slash = entry.rfind('/');
+      found = !listing[i].isFolder &&
+          entry.compare(slash + 1, std::string::npos, STRIPED_MANIFEST_NAME) == 0;
+    }
+    if (!found) {
+      return false;
+    }
+  } else if (!fs.exists(manifestPath.c_str())) {
+    return false;
+  }
+
+  std::unique_ptr<FileInStream> in;
+  try {
+    in.reset(fs.openFile(manifestPath.c_str()));
+  } catch (NativeException &e) {
+    // A directory of that name
+    e.discard();
+    return false;
+  }
+  return parse(readAll(*in), out);
+}
+
+void StripedFileManifest::locate(int64_t pos, int &part, int64_t &partOffset,
+                                 int64_t &runLength) const
+{
+  if (layout == StripeLayout::ROUND_ROBIN) {
+    int64_t numParts = partLengths.size();
+    int64_t unit = pos / stripeSize;
+    part = unit % numParts;
+    partOffset = (unit / numParts) * stripeSize + pos % stripeSize;
+    runLength = stripeSize - pos % stripeSize;
+  } else {
+    int64_t start = 0;
+    for (part = 0; part < (int) partLengths.size() - 1; part++) {
+      if (pos < start + partLengths[part]) {
+        break;
+      }
+      start += partLengths[part];
+    }
+    partOffset = pos - start;
+    runLength = partLengths[part] - partOffset;
+  }
+  runLength = std::min(runLength, length - pos);
+}
+
+//////////////////////////////////////////
+// StripedFileWriter
+//////////////////////////////////////////
+
+std::string StripedFileWriter::partPath(const std::string &path, int part)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/part-%05d", part);
+  return path + name;
+}
+
+std::string StripedFileWriter::manifestPath(const std::string &path)
+{
+  return path + "/" STRIPED_MANIFEST_NAME;
+}
+
+/**
+   Constructor
+
+   Creates the staging directory and opens one part file per StripeWorker.
+   A staging directory left behind by an earlier crashed writer is removed.
+
+   @param[in] fs File system used for the metadata operations
+   @param[in] path Logical path of the striped file to create
+   @param[in] options Striping options
+*/
+StripedFileWriter::StripedFileWriter(AlluxioFileSystem &fs, const char *path,
+                                     const StripedFileOptions &options)
+    : m_fs(fs), m_path(path), m_stagingPath(m_path + STRIPED_STAGING_SUFFIX),
+      m_options(options), m_offset(0), m_closed(false) {
+  if (options.numParts <= 0 || options.stripeSize <= 0) {
+    throw std::runtime_error("invalid striped file options");
+  }
+
+  if (m_fs.exists(m_stagingPath.c_str())) {
+    m_fs.deletePath(m_stagingPath.c_str(), true);
+  }
+  m_fs.createDirectory(m_stagingPath.c_str());
+
+  m_pending.resize(options.numParts);
+  m_partLengths.assign(options.numParts, 0);
+
+  std::vector<std::future<void> > opened;
+  for (int i = 0; i < options.numParts; i++) {
+    m_partLocks.push_back(std::unique_ptr<std::mutex>(new std::mutex()));
+    m_workers.push_back(std::unique_ptr<StripeWorker>(
+        new StripeWorker(options.maxQueuedStripes)));
+
+    StripeWorker *worker = m_workers.back().get();
+    std::string partFile = partPath(m_stagingPath, i);
+    bool setWriteType = options.setWriteType;
+    WriteType writeType = options.writeType;
+    opened.push_back(worker->submit([=](AlluxioFileSystem &wfs) {
+      std::unique_ptr<AlluxioCreateFileOptions> createOptions;
+      if (setWriteType) {
+        createOptions.reset(AlluxioCreateFileOptions::getCreateFileOptions());
+        createOptions->setWriteType(writeType);
+      }
+      worker->out.reset(wfs.createFile(partFile.c_str(), createOptions.get()));
+    }));
+  }
+
+  try {
+    waitAll(opened);
+  } catch (...) {
+    abandon();
+    throw;
+  }
+}
+
+StripedFileWriter::~StripedFileWriter()
+{
+  if (!m_closed) {
+    abandon();
+  }
+}
+
+/**
+   Hand a full (or final) chunk of a part to its StripeWorker.
+
+   Blocks when the part already has maxQueuedStripes writes outstanding.
+*/
+void StripedFileWriter::submit(int part, std::vector<char> &chunk)
+{
+  if (chunk.empty()) {
+    return;
+  }
+  std::shared_ptr<std::vector<char> > data(new std::vector<char>());
+  data->swap(chunk);
+  m_partLengths[part] += data->size();
+
+  StripeWorker *worker = m_workers[part].get();
+  worker->submit([worker, data](AlluxioFileSystem &) {
+    worker->out->write(data->data(), data->size());
+  });
+}
+
+/**
+   Append to the logical file (ROUND_ROBIN layout only).
+
+   Returns once the data is queued; errors from the part writers surface on a
+   later write() or on close().
+*/
+void StripedFileWriter::write(const void *buff, int length)
+{
+  if (m_closed) {
+    throw std::runtime_error("write to a closed striped file");
+  }
+  if (m_options.layout != StripeLayout::ROUND_ROBIN) {
+    throw std::runtime_error("write() requires the ROUND_ROBIN layout, use writePart()");
+  }
+
+  const char *data = static_cast<const char *>(buff);
+  int64_t stripeSize = m_options.stripeSize;
+  while (length > 0) {
+    int64_t unitOffset = m_offset % stripeSize;
+    int part = (m_offset / stripeSize) % m_options.numParts;
+    int n = std::min<int64_t>(length, stripeSize - unitOffset);
+
+    m_pending[part].insert(m_pending[part].end(), data, data + n);
+    m_offset += n;
+    data += n;
+    length -= n;
+    if (unitOffset + n == stripeSize) {
+      submit(part, m_pending[part]);
+    }
+  }
+}
+
+/**
+   Append to one part (CONTIGUOUS layout only).
+
+   Safe to call concurrently for different parts.
+*/
+void StripedFileWriter::writePart(int part, const void *buff, int length)
+{
+  if (m_closed) {
+    throw std::runtime_error("write to a closed striped file");
+  }
+  if (m_options.layout != StripeLayout::CONTIGUOUS) {
+    throw std::runtime_error("writePart() requires the CONTIGUOUS layout, use write()");
+  }
+  if (part < 0 || part >= m_options.numParts) {
+    throw std::runtime_error("striped file part out of range");
+  }
+
+  std::lock_guard<std::mutex> guard(*m_partLocks[part]);
+  const char *data = static_cast<const char *>(buff);
+  std::vector<char> &pending = m_pending[part];
+  while (length > 0) {
+    int n = std::min<int64_t>(length, m_options.stripeSize - pending.size());
+    pending.insert(pending.end(), data, data + n);
+    data += n;
+    length -= n;
+    if ((int64_t) pending.size() == m_options.stripeSize) {
+      submit(part, pending);
+    }
+  }
+}
+
+/**
+   Flush and close all parts, write the manifest and publish the file.
+
+   On failure the staging directory is removed and the error is rethrown.
+*/
+void StripedFileWriter::close()
+{
+  if (m_closed) {
+    return;
+  }
+
+  try {
+    std::vector<std::future<void> > closed;
+    for (int i = 0; i < m_options.numParts; i++) {
+      std::lock_guard<std::mutex> guard(*m_partLocks[i]);
+      submit(i, m_pending[i]);
+
+      StripeWorker *worker = m_workers[i].get();
+      closed.push_back(worker->submit([worker](AlluxioFileSystem &) {
+        worker->out->close();
+        worker->out.reset();
+      }));
+    }
+    waitAll(closed);
+    stopWorkers();
+
+    StripedFileManifest manifest;
+    manifest.layout = m_options.layout;
+    manifest.stripeSize = m_options.stripeSize;
+    manifest.partLengths = m_partLengths;
+    manifest.length = 0;
+    for (size_t i = 0; i < m_partLengths.size(); i++) {
+      manifest.length += m_partLengths[i];
+    }
+
+    std::string data = manifest.serialize();
+    std::string manifestFile = manifestPath(m_stagingPath);
+    std::unique_ptr<FileOutStream> out(m_fs.createFile(manifestFile.c_str()));
+    out->write(data.data(), data.size());
+    out->close();
+
+    // Publish: a single rename makes the complete file visible
+    m_fs.renameFile(m_stagingPath.c_str(), m_path.c_str());
+  } catch (...) {
+    abandon();
+    throw;
+  }
+  m_closed = true;
+}
+
+/**
+   Abandon the file: drop all queued data and remove the staging directory.
+*/
+void StripedFileWriter::cancel()
+{
+  m_closed = true;
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    StripeWorker *worker = m_workers[i].get();
+    try {
+      worker->submit([worker](AlluxioFileSystem &) {
+        if (worker->out) {
+          worker->out->cancel();
+        }
+      });
+    } catch (...) {
+      // The worker already failed; its stream is released when it stops
+    }
+  }
+  stopWorkers();
+  m_fs.deletePath(m_stagingPath.c_str(), true);
+}
+
+void StripedFileWriter::stopWorkers()
+{
+  m_workers.clear();
+}
+
+/**
+   cancel() for error paths: the original error matters more than any
+   failure to clean up after it.
+*/
+void StripedFileWriter::abandon()
+{
+  try {
+    cancel();
+  } catch (...) {
+    m_closed = true;
+  }
+}
+
+//////////////////////////////////////////
+// StripedFileInStream
+//////////////////////////////////////////
+
+/**
+   Constructor
+
+   @param[in] fs File system used to read the manifest
+   @param[in] path Logical path of the striped file
+*/
+StripedFileInStream::StripedFileInStream(AlluxioFileSystem &fs, const char *path)
+    : m_path(path), m_pos(0) {
+  if (!StripedFileManifest::read(fs, path, m_manifest)) {
+    std::string err = "Not a striped file: ";
+    err += path;
+    throw std::runtime_error(err);
+  }
+
+  std::vector<std::future<void> > opened;
+  for (size_t i = 0; i < m_manifest.partLengths.size(); i++) {
+    m_workers.push_back(std::unique_ptr<StripeWorker>(new StripeWorker(1)));
+
+    StripeWorker *worker = m_workers.back().get();
+    std::string partFile = StripedFileWriter::partPath(m_path, i);
+    opened.push_back(worker->submit([worker, partFile](AlluxioFileSystem &wfs) {
+      worker->in.reset(wfs.openFile(partFile.c_str()));
+      worker->pos = 0;
+    }));
+  }
+  waitAll(opened);
+}
+
+StripedFileInStream::~StripedFileInStream()
+{
+  try {
+    close();
+  } catch (...) {
+    // Nothing sensible to do with errors while tearing down
+  }
+}
+
+/**
+   Read length bytes starting at logical offset pos, without moving the
+   stream position.  Pieces that live in different parts are fetched
+   concurrently.
+
+   @return Number of bytes read, or -1 if pos is at or past the end
+*/
+int StripedFileInStream::positionedRead(int64_t pos, void *buff, int length)
+{
+  struct Segment {
+    int64_t partOffset;
+    char *dest;
+    int length;
+  };
+
+  if (m_workers.empty()) {
+    throw std::runtime_error("read from a closed striped file");
+  }
+  if (pos >= m_manifest.length) {
+    return -1;
+  }
+  length = std::min<int64_t>(length, m_manifest.length - pos);
+
+  std::vector<std::shared_ptr<std::vector<Segment> > > segments(m_workers.size());
+  char *dest = static_cast<char *>(buff);
+  int64_t end = pos + length;
+  while (pos < end) {
+    int part;
+    int64_t partOffset, runLength;
+    m_manifest.locate(pos, part, partOffset, runLength);
+    int n = std::min(runLength, end - pos);
+    if (!segments[part]) {
+      segments[part].reset(new std::vector<Segment>());
+    }
+    Segment segment = { partOffset, dest, n };
+    segments[part]->push_back(segment);
+    dest += n;
+    pos += n;
+  }
+
+  std::vector<std::future<void> > reads;
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (!segments[i]) {
+      continue;
+    }
+    StripeWorker *worker = m_workers[i].get();
+    std::shared_ptr<std::vector<Segment> > work = segments[i];
+    reads.push_back(worker->submit([worker, work](AlluxioFileSystem &) {
+      for (size_t s = 0; s < work->size(); s++) {
+        const Segment &segment = (*work)[s];
+        if (worker->pos != segment.partOffset) {
+          worker->in->seek(segment.partOffset);
+          worker->pos = segment.partOffset;
+        }
+        int done = 0;
+        while (done < segment.length) {
+          int rdSz = worker->in->read(segment.dest + done, segment.length - done);
+          if (rdSz <= 0) {
+            throw std::runtime_error("striped file part is shorter than its manifest");
+          }
+          done += rdSz;
+          worker->pos += rdSz;
+        }
+      }
+    }));
+  }
+  waitAll(reads);
+  return length;
+}
+
+int StripedFileInStream::read(void *buff, int length)
+{
+  int rdSz = positionedRead(m_pos, buff, length);
+  if (rdSz > 0) {
+    m_pos += rdSz;
+  }
+  return rdSz;
+}
+
+void StripedFileInStream::seek(int64_t pos)
+{
+  if (pos < 0 || pos > m_manifest.length) {
+    throw std::runtime_error("seek out of range of the striped file");
+  }
+  m_pos = pos;
+}
+
+int64_t StripedFileInStream::skip(int64_t n)
+{
+  n = std::max<int64_t>(0, std::min(n, m_manifest.length - m_pos));
+  m_pos += n;
+  return n;
+}
+
+void StripedFileInStream::close()
+{
+  std::vector<std::future<void> > closed;
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    StripeWorker *worker = m_workers[i].get();
+    closed.push_back(worker->submit([worker](AlluxioFileSystem &) {
+      if (worker->in) {
+        worker->in->close();
+        worker->in.reset();
+      }
+    }));
+  }
+  try {
+    waitAll(closed);
+  } catch (...) {
+    m_workers.clear();
+    throw;
+  }
+  m_workers.clear();
+}
+
+/* vim: set ts=4 sw=4 : */
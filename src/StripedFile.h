@@ -0,0 +1,173 @@
+/**
+ * Striped logical files
+ *
+ * A striped file is a single logical byte sequence stored as several Alluxio
+ * part files plus a small manifest, so that one large file can be written
+ * and read by several threads (and hence several workers) at once.
+ *
+ * On Alluxio the logical path is a directory:
+ *
+ *     <path>/_manifest
+ *     <path>/part-00000
+ *     <path>/part-00001
+ *     ...
+ *
+ * The writer stages everything under "<path>._striping" and renames the
+ * directory into place after the manifest is written, so the logical file
+ * only becomes visible (to exists(), fileSize(), readers) once complete.
+ *
+ * Each operation on a part holds a permit of the shared ConcurrencyLimiter
+ * of the IoClass of the thread that opened the file (see ConcurrencyLimit.h),
+ * so numParts only bounds how many parts are busy at once.
+ *
+ */
+
+#ifndef __STRIPED_FILE_H_
+#define __STRIPED_FILE_H_
+
+#include <stdint.h>
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Alluxio.h"
+
+namespace alluxio {
+
+class StripeWorker;
+
+/// How logical bytes are assigned to the part files of a striped file
+enum class StripeLayout {
+    /// Logical stripes of stripeSize bytes are dealt to the parts in turn
+    ROUND_ROBIN,
+    /// Part i holds one contiguous range; the file is the parts concatenated
+    CONTIGUOUS
+};
+
+struct StripedFileOptions {
+    StripedFileOptions()
+        : numParts(4), stripeSize(8 << 20), layout(StripeLayout::ROUND_ROBIN),
+          maxQueuedStripes(4), setWriteType(false), writeType(CACHE_THROUGH) {}
+
+    /// Number of part files, i.e. most parts written concurrently
+    int numParts;
+    /// Bytes per stripe unit (ROUND_ROBIN) and per queued write (both layouts)
+    int stripeSize;
+    StripeLayout layout;
+    /// Writes queued per part before write() blocks the producer
+    int maxQueuedStripes;
+    /// Whether writeType overrides the client default for the part files
+    bool setWriteType;
+    WriteType writeType;
+};
+
+/**
+   Content of the "_manifest" file of a striped file.
+*/
+struct StripedFileManifest {
+    StripeLayout layout;
+    int64_t stripeSize;
+    int64_t length;
+    std::vector<int64_t> partLengths;
+
+    std::string serialize() const;
+    static bool parse(const std::string &data, StripedFileManifest &out);
+
+    /// Read the manifest of the striped file at path; false if path is not one
+    static bool read(AlluxioFileSystem &fs, const char *path,
+                     StripedFileManifest &out);
+    /// Same, for a directory that may be an ordinary one: false also if its
+    /// manifest is a directory or does not parse.  Takes what the metadata
+    /// cache of fs knows of the manifest before asking the master.
+    static bool readIfStriped(AlluxioFileSystem &fs, const char *path,
+                              StripedFileManifest &out);
+
+    /// Map a logical offset to (part, offset in part, bytes until the next
+    /// part boundary)
+    void locate(int64_t pos, int &part, int64_t &partOffset,
+                int64_t &runLength) const;
+};
+
+/**
+   Writer for a striped file.
+
+   With ROUND_ROBIN, the producer calls write() sequentially and stripes are
+   written by one task of ThreadPool::shared() per part.  With CONTIGUOUS, up
+   to numParts producer threads call writePart() concurrently, each appending
+   to its own part.  Nothing is visible under path until close() returns.
+   Do not write from a task of the shared pool.
+*/
+class StripedFileWriter {
+  public:
+    StripedFileWriter(AlluxioFileSystem &fs, const char *path,
+                      const StripedFileOptions &options = StripedFileOptions());
+    ~StripedFileWriter();
+
+    void write(const void *buff, int length);
+    void writePart(int part, const void *buff, int length);
+
+    void close();
+    void cancel();
+
+    static std::string partPath(const std::string &path, int part);
+    static std::string manifestPath(const std::string &path);
+
+  private:
+    StripedFileWriter(StripedFileWriter const &);
+    void operator=(StripedFileWriter const &);
+
+    void submit(int part, std::vector<char> &chunk);
+    void stopWorkers();
+    void abandon();
+
+    AlluxioFileSystem &m_fs;
+    std::string m_path;
+    std::string m_stagingPath;
+    StripedFileOptions m_options;
+    std::vector<std::unique_ptr<StripeWorker> > m_workers;
+    std::vector<std::vector<char> > m_pending;
+    std::vector<int64_t> m_partLengths;
+    std::vector<std::unique_ptr<std::mutex> > m_partLocks;
+    int64_t m_offset;
+    bool m_closed;
+};
+
+/**
+   Input stream over a striped file.
+
+   A read() that spans several parts fetches the pieces concurrently, one
+   task of ThreadPool::shared() per part, and returns them as one byte
+   sequence.
+*/
+class StripedFileInStream {
+  public:
+    StripedFileInStream(AlluxioFileSystem &fs, const char *path);
+    ~StripedFileInStream();
+
+    int read(void *buff, int length);
+    int positionedRead(int64_t pos, void *buff, int length);
+    void seek(int64_t pos);
+    int64_t skip(int64_t n);
+    void close();
+
+    int64_t length() const { return m_manifest.length; }
+    const StripedFileManifest &manifest() const { return m_manifest; }
+
+  private:
+    StripedFileInStream(StripedFileInStream const &);
+    void operator=(StripedFileInStream const &);
+
+    std::string m_path;
+    StripedFileManifest m_manifest;
+    std::vector<std::unique_ptr<StripeWorker> > m_workers;
+    int64_t m_pos;
+};
+
+} // namespace alluxio
+
+#endif /* __STRIPED_FILE_H_ */
+
+/* vim: set ts=4 sw=4 : */
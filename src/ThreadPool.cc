@@ -0,0 +1,267 @@
+/**
+ * Pool of threads attached to the JVM
+ *
+ */
+
+#include "ThreadPool.h"
+#include "Alluxio.h"
+
+#include <stdio.h>
+
+#include <mutex>
+#include <stdexcept>
+
+using namespace alluxio;
+using namespace alluxio::jni;
+
+static thread_local AlluxioClientContext *t_poolContext = NULL;
+static thread_local AlluxioFileSystem *t_poolFileSystem = NULL;
+/// Pool and worker index of the calling thread, if a pool thread
+static thread_local ThreadPool *t_pool = NULL;
+static thread_local int t_worker = -1;
+
+ThreadPool::ThreadPool(int numThreads) : m_stop(false), m_pending(0), m_sleeping(0)
+{
+  if (numThreads <= 0) {
+    numThreads = 1;
+  }
+  for (int i = 0; i < numThreads; i++) {
+    m_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for (int i = 0; i < numThreads; i++) {
+    m_threads.push_back(std::thread(&ThreadPool::run, this, i));
+  }
+}
+
+/**
+   Destructor.
+
+   Runs the tasks that are still queued, then joins the workers.
+*/
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stop = true;
+    m_notEmpty.notify_all();
+  }
+  for (size_t i = 0; i < m_threads.size(); i++) {
+    m_threads[i].join();
+  }
+}
+
+void ThreadPool::execute(std::function<void()> task)
+{
+  // Counted first so that a worker never sees a queued task as missing
+  m_pending++;
+  if (t_pool == this) {
+    Worker &worker = *m_workers[t_worker];
+    std::lock_guard<std::mutex> guard(worker.lock);
+    worker.tasks.push_back(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_tasks.push_back(std::move(task));
+    m_notEmpty.notify_one();
+    return;
+  }
+
+  // Pairs with the check of m_pending by a worker going to sleep
+  if (m_sleeping > 0) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_notEmpty.notify_one();
+  }
+}
+
+AlluxioClientContext *ThreadPool::currentContext()
+{
+  return t_poolContext;
+}
+
+AlluxioFileSystem &ThreadPool::currentFileSystem()
+{
+  if (t_poolFileSystem == NULL) {
+    throw std::runtime_error("not on a ThreadPool thread attached to the JVM");
+  }
+  return *t_poolFileSystem;
+}
+
+static std::mutex s_sharedLock;
+static ThreadPool *s_shared = NULL;
+static int s_sharedThreads = DEFAULT_SHARED_POOL_THREADS;
+
+ThreadPool &ThreadPool::shared()
+{
+  std::lock_guard<std::mutex> guard(s_sharedLock);
+  if (s_shared == NULL) {
+    // Never destroyed: its threads stay attached until the process exits
+    s_shared = new ThreadPool(s_sharedThreads);
+  }
+  return *s_shared;
+}
+
+bool ThreadPool::configureShared(int numThreads)
+{
+  std::lock_guard<std::mutex> guard(s_sharedLock);
+  if (s_shared != NULL) {
+    return false;
+  }
+  s_sharedThreads = numThreads;
+  return true;
+}
+
+/**
+   Take the next task for a worker: its own newest task, else the oldest
+   task queued from outside, else the oldest task of another worker.
+
+   @return false if no task was found
+*/
+bool ThreadPool::take(int worker, std::function<void()> &task)
+{
+  {
+    Worker &own = *m_workers[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      m_pending--;
+      return true;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (!m_tasks.empty()) {
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+      m_pending--;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < m_workers.size(); i++) {
+    Worker &victim = *m_workers[(worker + i) % m_workers.size()];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      m_pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(int worker)
+{
+  AlluxioClientContext *context = NULL;
+  try {
+    context = &AlluxioClientContext::shared();
+  } catch (const NativeException &e) {
+    // Tasks still run; their own JNI calls will report the failure
+    fprintf(stderr, "ThreadPool: could not set up client context: %s\n", e.what());
+  }
+  std::unique_ptr<AlluxioFileSystem> fs;
+  if (context != NULL) {
+    fs.reset(new AlluxioFileSystem(*context));
+  }
+  t_poolContext = context;
+  t_poolFileSystem = fs.get();
+  t_pool = this;
+  t_worker = worker;
+
+  for (;;) {
+    std::function<void()> task;
+    if (!take(worker, task)) {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_sleeping++;
+      m_notEmpty.wait(guard, [this] { return m_stop || m_pending > 0; });
+      m_sleeping--;
+      // Tasks left are run before the pool stops
+      if (m_stop && m_pending <= 0) {
+        break;
+      }
+      // A task was queued, or taken by another worker meanwhile
+      guard.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    try {
+      task();
+    } catch (...) {
+      // submit() routes exceptions into the future; execute() drops them
+    }
+  }
+
+  t_pool = NULL;
+  t_worker = -1;
+  t_poolContext = NULL;
+  t_poolFileSystem = NULL;
+  fs.reset();
+  // Worker threads are ours: do not leave them attached when they exit
+  try {
+    Env().DetachCurrentThread();
+  } catch (...) {
+    // Never attached in the first place
+  }
+}
+
+//////////////////////////////////////////
+// BoundedExecutor
+//////////////////////////////////////////
+
+BoundedExecutor::BoundedExecutor(ThreadPool &pool, int maxRunning)
+    : m_pool(pool), m_maxRunning(maxRunning > 0 ? maxRunning : 1), m_running(0) {}
+
+BoundedExecutor::~BoundedExecutor()
+{
+  await();
+}
+
+void BoundedExecutor::execute(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_running >= m_maxRunning) {
+      m_waiting.push_back(std::move(task));
+      return;
+    }
+    m_running++;
+  }
+  start(task);
+}
+
+void BoundedExecutor::await()
+{
+  std::unique_lock<std::mutex> guard(m_lock);
+  m_idle.wait(guard, [this] { return m_running == 0; });
+}
+
+void BoundedExecutor::start(const std::function<void()> &task)
+{
+  m_pool.execute([this, task] {
+    try {
+      task();
+    } catch (...) {
+      // Dropped, as by ThreadPool::execute()
+    }
+    finished();
+  });
+}
+
+/// A task is over: start the next one waiting, if any, in its place
+void BoundedExecutor::finished()
+{
+  std::function<void()> next;
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_waiting.empty()) {
+      if (--m_running == 0) {
+        m_idle.notify_all();
+      }
+      return;
+    }
+    next = std::move(m_waiting.front());
+    m_waiting.pop_front();
+  }
+  start(next);
+}
+
+/* vim: set ts=4 sw=4 : */
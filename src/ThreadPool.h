@@ -0,0 +1,156 @@
+/**
+ * Pool of threads attached to the JVM
+ *
+ */
+
+#ifndef __THREAD_POOL_H_
+#define __THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// Threads of ThreadPool::shared(), unless configureShared() says otherwise
+#define DEFAULT_SHARED_POOL_THREADS 16
+
+namespace alluxio {
+
+class AlluxioClientContext;
+class AlluxioFileSystem;
+
+/**
+   A fixed set of worker threads, attached to the JVM for as long as the
+   pool lives and sharing AlluxioClientContext::shared().
+
+   Tasks queued from outside the pool run in FIFO order.  Tasks queued by a
+   task go to the deque of the worker running it, which takes them back
+   newest first; idle workers steal the oldest tasks of the others.  Tree
+   shaped work (see NamespaceWalker.h) thus spreads over the pool without
+   contending on one queue.
+
+   Inside a task, currentContext() gives the shared context, and
+   currentFileSystem() a file system of the worker over it.
+
+   shared() is the pool of the library: created on first use and attached
+   for the life of the process, it lets any thread, attached or not, run
+   Alluxio operations with submitOperation().  A task must not wait for
+   other tasks of its own pool, or the pool may run out of workers.
+*/
+class ThreadPool {
+  public:
+    ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    /// Queue a task; the future carries its result or exception
+    template <typename F>
+    std::future<decltype(std::declval<F &>()())> submit(F task)
+    {
+      typedef decltype(std::declval<F &>()()) R;
+      std::shared_ptr<std::packaged_task<R()> > job(
+          new std::packaged_task<R()>(task));
+      std::future<R> result = job->get_future();
+      execute([job] { (*job)(); });
+      return result;
+    }
+
+    /**
+       Queue task(fs), where fs is the AlluxioFileSystem of the worker
+       running it; the future carries its result or exception.  The file
+       system of a worker has no metadata cache.
+    */
+    template <typename F>
+    std::future<decltype(std::declval<F &>()(std::declval<AlluxioFileSystem &>()))>
+    submitOperation(F task)
+    {
+      typedef decltype(std::declval<F &>()(std::declval<AlluxioFileSystem &>())) R;
+      return submit([task]() -> R { return task(currentFileSystem()); });
+    }
+
+    /// Queue a task whose outcome is not needed; exceptions are dropped
+    void execute(std::function<void()> task);
+
+    int size() const { return (int) m_threads.size(); }
+
+    /// Context of the calling pool thread, or NULL if not on a pool thread
+    static AlluxioClientContext *currentContext();
+    /// File system of the calling pool thread; throws off a pool thread
+    static AlluxioFileSystem &currentFileSystem();
+
+    /// The pool of the library, started on first use
+    static ThreadPool &shared();
+    /**
+       Size the shared pool; only before its first use.
+
+       @return false if the shared pool is already running
+    */
+    static bool configureShared(int numThreads);
+
+  private:
+    ThreadPool(ThreadPool const &);
+    void operator=(ThreadPool const &);
+
+    /// Tasks queued by the tasks of one worker
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void run(int worker);
+    bool take(int worker, std::function<void()> &task);
+
+    bool m_stop;
+    /// Tasks queued from outside the pool
+    std::deque<std::function<void()> > m_tasks;
+    std::vector<std::unique_ptr<Worker> > m_workers;
+    /// Tasks queued in m_tasks and m_workers together
+    std::atomic<long> m_pending;
+    std::atomic<int> m_sleeping;
+    std::mutex m_lock;
+    std::condition_variable m_notEmpty;
+    std::vector<std::thread> m_threads;
+};
+
+/**
+   Runs tasks on a pool, at most maxRunning of them at once; tasks over the
+   bound wait their turn in FIFO order.  Lets a feature run on
+   ThreadPool::shared() without taking all of its workers.  Exceptions of
+   tasks are dropped, as by ThreadPool::execute().
+*/
+class BoundedExecutor {
+  public:
+    BoundedExecutor(ThreadPool &pool, int maxRunning);
+    /// Waits for the tasks given so far
+    ~BoundedExecutor();
+
+    void execute(std::function<void()> task);
+    /// Wait until every task given so far has run
+    void await();
+
+  private:
+    BoundedExecutor(BoundedExecutor const &);
+    void operator=(BoundedExecutor const &);
+
+    void start(const std::function<void()> &task);
+    void finished();
+
+    ThreadPool &m_pool;
+    int m_maxRunning;
+    /// Tasks queued or running on the pool
+    int m_running;
+    std::deque<std::function<void()> > m_waiting;
+    std::mutex m_lock;
+    std::condition_variable m_idle;
+};
+
+} // namespace alluxio
+
+#endif /* __THREAD_POOL_H_ */
+
+/* vim: set ts=4 sw=4 : */
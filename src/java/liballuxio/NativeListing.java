@@ -0,0 +1,240 @@
+/**
+ * Directory listing packed for liballuxio
+ *
+ */
+
+package liballuxio;
+
+import alluxio.AlluxioURI;
+import alluxio.client.file.FileSystem;
+import alluxio.client.file.URIStatus;
+
+import java.io.ByteArrayOutputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+import java.nio.charset.Charset;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.Comparator;
+import java.util.List;
+import java.util.PriorityQueue;
+import java.util.regex.Pattern;
+
+/**
+ * Serializes a whole listing into one byte array, so that the native side
+ * gets it in a single JNI call instead of several calls per entry.
+ *
+ * Layout (big-endian, as written by DataOutputStream):
+ *
+ *   int version, int count,
+ *   int listingFlags (1 the listing holds a commit _MANIFEST), then per entry:
+ *   byte flags (1 folder, 2 persisted, 4 pinned), long length,
+ *   long blockSizeBytes, long lastModificationTimeMs,
+ *   int inMemoryPercentage, int mode,
+ *   int pathLength, UTF-8 path, int ownerLength, UTF-8 owner
+ *
+ * Must stay in sync with decodeListing() in Alluxio.cc.
+ */
+public final class NativeListing {
+  public static final int VERSION = 2;
+
+  public static final int LISTING_HAS_MANIFEST = 1;
+  public static final String MANIFEST_NAME = "_MANIFEST";
+
+  // ListStatusFilter::EntryType and ListStatusFilter::SortKey in Alluxio.h
+  public static final int ALL = 0;
+  public static final int FILES_ONLY = 1;
+  public static final int DIRECTORIES_ONLY = 2;
+
+  public static final int UNSORTED = 0;
+  public static final int BY_NAME = 1;
+  public static final int BY_LENGTH = 2;
+  public static final int BY_MODIFICATION_TIME = 3;
+
+  private static final Charset UTF8 = Charset.forName("UTF-8");
+
+  private NativeListing() {}
+
+  public static byte[] listStatus(FileSystem fs, AlluxioURI uri) throws Exception {
+    List<URIStatus> statuses = fs.listStatus(uri);
+    return encode(statuses, 0, statuses.size(), listingFlags(statuses));
+  }
+
+  /**
+   * Serializes entries [from, from + count) of a listing, for callers that
+   * consume a large listing batch by batch.
+   */
+  public static byte[] encode(List<URIStatus> statuses, int from, int count)
+      throws IOException {
+    return encode(statuses, from, count, 0);
+  }
+
+  /**
+   * Lists a directory and serializes only the entries that pass the filter,
+   * sorted and limited as asked.  Mirrors ListStatusFilter::apply() in
+   * Alluxio.cc; empty or null name patterns and negative bounds mean no
+   * constraint, and a limit of 0 means no limit.
+   */
+  public static byte[] listStatusFiltered(FileSystem fs, AlluxioURI uri, int type,
+      String nameGlob, String nameSuffix, String nameRegex, long minLength, long maxLength,
+      long minModificationTimeMs, long maxModificationTimeMs, boolean inMemoryOnly,
+      int sortBy, boolean descending, int limit) throws Exception {
+    List<URIStatus> statuses = fs.listStatus(uri);
+    int flags = listingFlags(statuses);
+
+    Pattern glob = isEmpty(nameGlob) ? null : Pattern.compile(globToRegex(nameGlob));
+    Pattern regex = isEmpty(nameRegex) ? null : Pattern.compile(nameRegex);
+    Comparator<URIStatus> order = sortBy == UNSORTED ? null : comparator(sortBy, descending);
+
+    // With a sort and a limit only the best `limit` entries are kept: the
+    // head of `kept` is the worst of them
+    PriorityQueue<URIStatus> kept = null;
+    if (order != null && limit > 0) {
+      kept = new PriorityQueue<URIStatus>(limit + 1, Collections.reverseOrder(order));
+    }
+    List<URIStatus> matches = new ArrayList<URIStatus>();
+
+    for (URIStatus status : statuses) {
+      if (type == FILES_ONLY && status.isFolder()
+          || type == DIRECTORIES_ONLY && !status.isFolder()
+          || minLength >= 0 && status.getLength() < minLength
+          || maxLength >= 0 && status.getLength() > maxLength
+          || minModificationTimeMs >= 0
+              && status.getLastModificationTimeMs() < minModificationTimeMs
+          || maxModificationTimeMs >= 0
+              && status.getLastModificationTimeMs() > maxModificationTimeMs
+          || inMemoryOnly && status.getInMemoryPercentage() < 100) {
+        continue;
+      }
+      String name = nameOf(status.getPath());
+      if (!isEmpty(nameSuffix) && !name.endsWith(nameSuffix)
+          || glob != null && !glob.matcher(name).matches()
+          || regex != null && !regex.matcher(name).matches()) {
+        continue;
+      }
+
+      if (kept != null) {
+        kept.add(status);
+        if (kept.size() > limit) {
+          kept.poll();
+        }
+      } else {
+        matches.add(status);
+        if (order == null && limit > 0 && matches.size() == limit) {
+          break;
+        }
+      }
+    }
+
+    if (kept != null) {
+      matches.addAll(kept);
+    }
+    if (order != null) {
+      Collections.sort(matches, order);
+    }
+    return encode(matches, 0, matches.size(), flags);
+  }
+
+  private static byte[] encode(List<URIStatus> statuses, int from, int count,
+      int listingFlags) throws IOException {
+    ByteArrayOutputStream bytes = new ByteArrayOutputStream(64 + count * 96);
+    DataOutputStream out = new DataOutputStream(bytes);
+
+    out.writeInt(VERSION);
+    out.writeInt(count);
+    out.writeInt(listingFlags);
+    for (URIStatus status : statuses.subList(from, from + count)) {
+      int flags = (status.isFolder() ? 1 : 0) | (status.isPersisted() ? 2 : 0)
+          | (status.isPinned() ? 4 : 0);
+      out.writeByte(flags);
+      out.writeLong(status.getLength());
+      out.writeLong(status.getBlockSizeBytes());
+      out.writeLong(status.getLastModificationTimeMs());
+      out.writeInt(status.getInMemoryPercentage());
+      out.writeInt(status.getMode());
+      writeString(out, status.getPath());
+      writeString(out, status.getOwner());
+    }
+    out.flush();
+    return bytes.toByteArray();
+  }
+
+  /**
+   * Flags of a listing fetched without this class, such as the one a
+   * DirectoryIterator walks, so that it is not scanned entry by entry
+   * through JNI.
+   */
+  public static int listingFlags(List<URIStatus> statuses) {
+    for (URIStatus status : statuses) {
+      if (!status.isFolder() && MANIFEST_NAME.equals(nameOf(status.getPath()))) {
+        return LISTING_HAS_MANIFEST;
+      }
+    }
+    return 0;
+  }
+
+  private static Comparator<URIStatus> comparator(final int sortBy, final boolean descending) {
+    return new Comparator<URIStatus>() {
+      @Override
+      public int compare(URIStatus a, URIStatus b) {
+        int cmp;
+        switch (sortBy) {
+          case BY_LENGTH:
+            cmp = Long.compare(a.getLength(), b.getLength());
+            break;
+          case BY_MODIFICATION_TIME:
+            cmp = Long.compare(a.getLastModificationTimeMs(), b.getLastModificationTimeMs());
+            break;
+          default:
+            cmp = nameOf(a.getPath()).compareTo(nameOf(b.getPath()));
+            break;
+        }
+        if (descending) {
+          cmp = -cmp;
+        }
+        // Ties in path order, whatever the direction, as on the native side
+        return cmp != 0 ? cmp : a.getPath().compareTo(b.getPath());
+      }
+    };
+  }
+
+  /** Translates an fnmatch(3)-style glob (*, ?, [...]) to a regex. */
+  private static String globToRegex(String glob) {
+    StringBuilder regex = new StringBuilder();
+    for (int i = 0; i < glob.length(); i++) {
+      char c = glob.charAt(i);
+      if (c == '*') {
+        regex.append(".*");
+      } else if (c == '?') {
+        regex.append('.');
+      } else if (c == '[' && glob.indexOf(']', i + 2) > 0) {
+        int end = glob.indexOf(']', i + 2);
+        String set = glob.substring(i + 1, end);
+        regex.append('[');
+        if (set.charAt(0) == '!') {
+          regex.append('^');
+          set = set.substring(1);
+        }
+        regex.append(set.replace("\\", "\\\\").replace("[", "\\[")).append(']');
+        i = end;
+      } else {
+        regex.append(Pattern.quote(String.valueOf(c)));
+      }
+    }
+    return regex.toString();
+  }
+
+  private static String nameOf(String path) {
+    return path.substring(path.lastIndexOf('/') + 1);
+  }
+
+  private static boolean isEmpty(String value) {
+    return value == null || value.isEmpty();
+  }
+
+  private static void writeString(DataOutputStream out, String value) throws IOException {
+    byte[] encoded = (value == null ? "" : value).getBytes(UTF8);
+    out.writeInt(encoded.length);
+    out.write(encoded);
+  }
+}